@@ -31,7 +31,7 @@ static const uint8_t TXBWS = 0 ;
 //   - (May 29, 2019) it appears that MCP2717FD wants the CS line to deasserted as soon as possible (thanks for
 //     Nick Kirkby for having signaled me this point, see https://github.com/pierremolinaro/acan2517/issues/5);
 //     so we mask interrupts when we access the MCP2517FD, the sequence becomes:
-//           mSPI.beginTransaction (mSPISettings) ;
+//           spiBeginTransaction () ;
 //             #ifdef ARDUINO_ARCH_ESP32
 //               taskDISABLE_INTERRUPTS () ;
 //             #endif
@@ -41,8 +41,18 @@ static const uint8_t TXBWS = 0 ;
 //             #ifdef ARDUINO_ARCH_ESP32
 //               taskENABLE_INTERRUPTS () ;
 //             #endif
-//           mSPI.endTransaction () ;
+//           spiEndTransaction () ;
 //
+// With ACAN2517FD_IDF_SPI, CS is driven by the SPI peripheral and the bus is owned by the driver between
+// spiBeginTransaction and spiEndTransaction, so interrupts are not masked (queued transactions complete in the
+// SPI interrupt); the INT pin interrupt service routine only wakes myESP32Task.
+//
+//------------------------------------------------------------------------------
+
+#if defined (ARDUINO_ARCH_ESP32) && !defined (ACAN2517FD_IDF_SPI)
+  #define ACAN2517FD_MASK_TASK_INTERRUPTS
+#endif
+
 //------------------------------------------------------------------------------
 
 #ifdef ARDUINO_ARCH_ESP32
@@ -63,6 +73,8 @@ static const uint16_t CON_REGISTER      = 0x000 ;
 static const uint16_t NBTCFG_REGISTER   = 0x004 ;
 static const uint16_t DBTCFG_REGISTER   = 0x008 ;
 static const uint16_t TDC_REGISTER      = 0x00C ;
+static const uint16_t TBC_REGISTER      = 0x010 ;
+static const uint16_t TSCON_REGISTER    = 0x014 ;
 
 static const uint16_t TREC_REGISTER     = 0x034 ;
 static const uint16_t BDIAG0_REGISTER   = 0x038 ;
@@ -128,6 +140,14 @@ static uint16_t MASK_REGISTER (const uint16_t inFilterIndex) { // 0 ... 31 (DS20
 
 static const uint16_t OSC_REGISTER = 0xE00 ;
 
+//------------------------------------------------------------------------------
+//   CRC AND ECC REGISTERS
+//------------------------------------------------------------------------------
+
+static const uint16_t CRC_REGISTER     = 0xE08 ;
+static const uint16_t ECCCON_REGISTER  = 0xE0C ;
+static const uint16_t ECCSTAT_REGISTER = 0xE10 ;
+
 //------------------------------------------------------------------------------
 //   INPUT / OUPUT CONTROL REGISTER
 //------------------------------------------------------------------------------
@@ -148,7 +168,7 @@ static const uint8_t TRANSMIT_FIFO_INDEX = 2 ;
 //    BYTE BUFFER UTILITY FUNCTIONS
 //------------------------------------------------------------------------------
 
-static void enterU32InBufferAtIndex (const uint32_t inValue, uint8_t ioBuffer [], const uint8_t inIndex) {
+static void enterU32InBufferAtIndex (const uint32_t inValue, uint8_t ioBuffer [], const uint16_t inIndex) {
   ioBuffer [inIndex + 0] = (uint8_t) inValue ;
   ioBuffer [inIndex + 1] = (uint8_t) (inValue >>  8) ;
   ioBuffer [inIndex + 2] = (uint8_t) (inValue >> 16) ;
@@ -188,8 +208,23 @@ mRxInterruptEnabled (true),
 mTransmitFIFOPayload (0),
 mTXQBufferPayload (0),
 mReceiveFIFOPayload (0),
+mReceiveTimeStamp (false),
+mTransmitFIFOAddress (0),
+mTransmitFIFOObjectSize (0),
+mTransmitFIFOObjectCount (0),
 mTXBWS_RequestedMode (0),
 mHardwareReceiveBufferOverflowCount (0),
+mReceivedFrameCount (0),
+mSPIClock (0),
+mUsesSPICRC (false),
+mSPICRCBuffer (NULL),
+mSPICRCErrorCount (0),
+mSPICRCWriteErrorCount (0),
+mSPICRCFailureCount (0),
+mRAMECCCorrectedCount (0),
+mRAMECCUncorrectedCount (0),
+mRAMECCErrorAddress (0),
+mReceiveCycleCount (0),
 mDriverReceiveBuffer (),
 mDriverTransmitBuffer ()
 #ifdef ARDUINO_ARCH_ESP32
@@ -280,8 +315,11 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
       pinMode (mINT, INPUT_PULLUP) ;
     }
     initCS () ;
+    #ifdef ACAN2517FD_IDF_SPI
+      mIDFError = ESP_OK ;
+    #endif
   //----------------------------------- Set SPI clock to 800 kHz
-    mSPISettings = SPISettings (800UL * 1000, MSBFIRST, SPI_MODE0) ;
+    setSPIClock (800UL * 1000) ;
   //----------------------------------- Request configuration mode
     bool wait = true ;
     const uint32_t startTime = millis () ;
@@ -296,6 +334,14 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     }
   //----------------------------------- Reset MCP2517FD (always use a 800 kHz clock)
     reset2517FD () ;
+  //----------------------------------- CRC protected SPI instructions (the read-back tests use them)
+    mUsesSPICRC = false ;
+    if (inSettings.mSPICRCEnabled) {
+      if (mSPICRCBuffer == NULL) {
+        mSPICRCBuffer = new uint8_t [5 + 512] ; // Largest instruction: transmit FIFO burst
+      }
+      mUsesSPICRC = true ;
+    }
   }
 //----------------------------------- Check SPI connection is on (with a 800 kHz clock)
 // We write and the read back MCP2517FD RAM at address 0x400
@@ -351,25 +397,55 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     }
   }
 //----------------------------------- Set full speed clock
-  mSPISettings = SPISettings ((inSettings.sysClock () * 2) / 5, MSBFIRST, SPI_MODE0) ;
-//----------------------------------- Checking SPI connection is on (with a full speed clock)
-//    We write and read back 2517 RAM at address 0x400
-  for (uint32_t i=1 ; (i != 0) && (errorCode == 0) ; i <<= 1) {
-    writeRegister32 (0x400, i) ;
-    const uint32_t readBackValue = readRegister32 (0x400) ;
-    if (readBackValue != i) {
+//    Start with mSPIClock; while the read-back test fails (or a CRC error occurs), lower the clock by 1/5,
+//    down to SYSCLK * 2 / 5
+  const uint32_t defaultSPIClock = (inSettings.sysClock () * 2) / 5 ;
+  uint32_t spiClock = (inSettings.mSPIClock != 0) ? inSettings.mSPIClock : defaultSPIClock ;
+  bool readBackOk = false ;
+  while ((errorCode == 0) && !readBackOk) {
+    setSPIClock (spiClock) ;
+  //----------------------------------- Checking SPI connection is on (with a full speed clock)
+  //    We write and read back 2517 RAM at address 0x400
+    if (mUsesSPICRC) {
+      writeRegister8 (CRC_REGISTER + 2, 0) ; // Clear CRCERRIF / FERRIF left by a faster clock
+    }
+    const uint32_t crcErrors = mSPICRCErrorCount + mSPICRCWriteErrorCount ;
+    readBackOk = true ;
+    for (uint32_t i=1 ; (i != 0) && readBackOk ; i <<= 1) {
+      writeRegister32 (0x400, i) ;
+      const uint32_t readBackValue = readRegister32 (0x400) ;
+      readBackOk = (readBackValue == i) && ((mSPICRCErrorCount + mSPICRCWriteErrorCount) == crcErrors) ;
+    }
+    if (readBackOk) {
+      mSPIClock = spiClock ;
+    }else if (spiClock <= defaultSPIClock) {
       errorCode = kReadBackErrorWithFullSpeedSPIClock ;
+    }else{
+      spiClock = (spiClock * 4) / 5 ;
+      if (spiClock < defaultSPIClock) {
+        spiClock = defaultSPIClock ;
+      }
     }
   }
 //----------------------------------- Install interrupt, configure external interrupt
   if (errorCode == 0) {
   //----------------------------------- Configure transmit and receive buffers
-    mDriverTransmitBuffer.initWithSize (inSettings.mDriverTransmitFIFOSize) ;
-    mDriverReceiveBuffer.initWithSize (inSettings.mDriverReceiveFIFOSize) ;
+    mDriverTransmitBuffer.initWithSize (inSettings.mDriverTransmitFIFOSize,
+                                        ACAN2517FDSettings::payloadForPayloadSize (inSettings.mControllerTransmitFIFOPayload)) ;
+    mDriverReceiveBuffer.initWithSize (inSettings.mDriverReceiveFIFOSize,
+                                       ACAN2517FDSettings::payloadForPayloadSize (inSettings.mControllerReceiveFIFOPayload)) ;
   //----------------------------------- Reset RAM
+  //    With RAM ECC, ECCEN is set first: reading a word that was never written
+  //    since power-up would report an error
+    if (inSettings.mRAMECCEnabled) {
+      writeRegister8 (ECCCON_REGISTER, 1 << 0) ; // ECCEN
+    }
     for (uint16_t address = 0x400 ; address < 0xC00 ; address += 4) {
       writeRegister32 (address, 0) ;
     }
+    if (inSettings.mRAMECCEnabled) {
+      writeRegister8 (ECCSTAT_REGISTER, 0) ; // Clear SECIF, DEDIF
+    }
   //----------------------------------- Configure CLKO pin
     uint8_t data8 = 0x03 ; // Respect PM1-PM0 default values
     if (inSettings.mCLKOPin == ACAN2517FDSettings::SOF) {
@@ -407,7 +483,7 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     data8 = inSettings.mControllerTXQSize - 1 ;
     data8 |= inSettings.mControllerTXQBufferPayload << 5 ; // Payload
     writeRegister8 (TXQCON_REGISTER + 3, data8) ; // DS20005688B, page 48
-    mTXQBufferPayload = ACAN2517FDSettings::objectSizeForPayload (inSettings.mControllerTXQBufferPayload) ;
+    mTXQBufferPayload = ACAN2517FDSettings::payloadForPayloadSize (inSettings.mControllerTXQBufferPayload) ;
   //----------------------------------- Configure TXQ and TEF
   // Bit 4: Enable Transmit Queue bit ---> 1: Enable TXQ and reserves space in RAM
   // Bit 3: Store in Transmit Event FIFO bit ---> 0: Don’t save transmitted messages in TEF
@@ -421,8 +497,18 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     writeRegister8 (FIFOCON_REGISTER (RECEIVE_FIFO_INDEX) + 3, data8) ;
     data8  = 1 << 0 ; // Interrupt Enabled for FIFO not Empty (TFNRFNIE)
     data8 |= 1 << 3 ; // Interrupt Enabled for FIFO Overflow (RXOVIE)
+    mReceiveTimeStamp = inSettings.mControllerReceiveFIFOTimeStamp ;
+    if (mReceiveTimeStamp) {
+      data8 |= 1 << 5 ; // Received Message Time Stamp Enable (RXTSEN)
+    }
     writeRegister8 (FIFOCON_REGISTER (RECEIVE_FIFO_INDEX), data8) ;
-    mReceiveFIFOPayload = ACAN2517FDSettings::objectSizeForPayload (inSettings.mControllerReceiveFIFOPayload) ;
+    mReceiveFIFOPayload = ACAN2517FDSettings::payloadForPayloadSize (inSettings.mControllerReceiveFIFOPayload) ;
+  //----------------------------------- Time Base Counter: 1 µs ticks, captured at SOF (TSCON, DS20005688B, page 30)
+    if (mReceiveTimeStamp) {
+      data32 = (inSettings.sysClock () / 1000000) - 1 ; // TBCPRE
+      data32 |= 1UL << 16 ; // TBCEN
+      writeRegister32 (TSCON_REGISTER, data32) ;
+    }
   //----------------------------------- Configure TX FIFO (FIFOCON, DS20005688B, page 52)
     data8 = inSettings.mControllerTransmitFIFORetransmissionAttempts ;
     data8 <<= 5 ;
@@ -434,7 +520,9 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     data8 = 1 << 7 ; // FIFO is a Tx FIFO
     data8 |= 1 << 4 ; // TXATIE ---> 1: Enable Transmit Attempts Exhausted Interrupt
     writeRegister8 (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX), data8) ;
-    mTransmitFIFOPayload = ACAN2517FDSettings::objectSizeForPayload (inSettings.mControllerTransmitFIFOPayload) ;
+    mTransmitFIFOPayload = ACAN2517FDSettings::payloadForPayloadSize (inSettings.mControllerTransmitFIFOPayload) ;
+    mTransmitFIFOObjectSize = ACAN2517FDSettings::objectSizeForPayload (inSettings.mControllerTransmitFIFOPayload) ;
+    mTransmitFIFOObjectCount = inSettings.mControllerTransmitFIFOSize ;
   //----------------------------------- Configure receive filters
     uint8_t filterIndex = 0 ;
     ACAN2517FDFilters::Filter * filter = inFilters.mFirstFilter ;
@@ -502,10 +590,17 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
         wait = false ;
       }
     }
+  //--- Transmit FIFO is empty: its user address is the first object (FIFOUA is not valid in configuration mode)
+    mTransmitFIFOAddress = uint16_t (0x400 + readRegister32 (FIFOUA_REGISTER (TRANSMIT_FIFO_INDEX))) ;
     //use esp32 interrupt to process isr , it need test!
     // #ifdef ARDUINO_ARCH_ESP32
     //   xTaskCreate (myESP32Task, "ACAN2517Handler", 1024, this, 16, &mESP32TaskHandle) ;
     // #endif
+    #ifdef ACAN2517FD_IDF_SPI // SPI transactions cannot be performed in interrupt context
+      if ((mINT != 255) && (mESP32TaskHandle == nullptr)) {
+        xTaskCreate (myESP32Task, "ACAN2517Handler", 4096, this, 16, &mESP32TaskHandle) ;
+      }
+    #endif
 
     if (mINT != 255) { // 255 means interrupt is not used
       #ifdef ARDUINO_ARCH_ESP32
@@ -520,6 +615,12 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
     mHardwareTxFIFOFull = false ;
     mHardwareReceiveBufferOverflowCount = 0 ;
   }
+//----------------------------------- IDF SPI device could not be added to the bus
+  #ifdef ACAN2517FD_IDF_SPI
+    if (mIDFError != ESP_OK) {
+      errorCode |= kIDFSPIDeviceError ;
+    }
+  #endif
 //---
   return errorCode ;
 }
@@ -529,8 +630,8 @@ uint32_t ACAN2517FD::begin (const ACAN2517FDSettings & inSettings,
 //------------------------------------------------------------------------------
 
 bool ACAN2517FD::end (void) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
@@ -554,9 +655,8 @@ bool ACAN2517FD::end (void) {
       }
     }
   //--- Reset MCP2517FD
-    assertCS () ;
-      mSPI.transfer16 (0x00) ; // Reset instruction: 0x0000
-    deassertCS () ;
+    uint8_t resetCommand [2] = {0, 0} ; // Reset instruction: 0x0000
+    spiTransfer (resetCommand, 2) ;
   //--- ESP32: delete associated task
     #ifdef ARDUINO_ARCH_ESP32
       if (mESP32TaskHandle != nullptr) {
@@ -566,15 +666,17 @@ bool ACAN2517FD::end (void) {
     #endif
   //--- Deallocate buffers
     delete [] mCallBackFunctionArray ; mCallBackFunctionArray = nullptr ;
+    delete [] mSPICRCBuffer ; mSPICRCBuffer = nullptr ;
+    mUsesSPICRC = false ;
     mDriverReceiveBuffer.initWithSize (0) ;
     mDriverTransmitBuffer.initWithSize (0) ;
   //---
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
 //---
   return ok ;
 }
@@ -586,8 +688,8 @@ bool ACAN2517FD::end (void) {
 bool ACAN2517FD::tryToSend (const CANFDMessage & inMessage) {
   bool ok = inMessage.isValid () ;
   if (ok) {
-    mSPI.beginTransaction (mSPISettings) ;
-      #ifdef ARDUINO_ARCH_ESP32
+    spiBeginTransaction () ;
+      #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
         taskDISABLE_INTERRUPTS () ;
       #else
         noInterrupts () ;
@@ -603,27 +705,67 @@ bool ACAN2517FD::tryToSend (const CANFDMessage & inMessage) {
             ok = sendViaTXQ (inMessage) ;
           }
         }
-      #ifdef ARDUINO_ARCH_ESP32
+      #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
         taskENABLE_INTERRUPTS () ;
       #else
         interrupts () ;
       #endif
-    mSPI.endTransaction () ;
+    spiEndTransaction () ;
   }
   return ok ;
 }
 
 //------------------------------------------------------------------------------
 
+size_t ACAN2517FD::trySendBurst (const CANFDMessage * inMessages,
+                                 const size_t inCount,
+                                 const bool inDriverBufferFallback) {
+//--- Accepted messages: valid, for the transmit FIFO, fitting its payload
+  size_t count = 0 ;
+  while ((count < inCount)
+      && inMessages [count].isValid ()
+      && (inMessages [count].idx == 0)
+      && (inMessages [count].len <= mTransmitFIFOPayload)) {
+    count += 1 ;
+  }
+  size_t accepted = 0 ;
+  if (count > 0) {
+    spiBeginTransaction () ;
+      #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+        taskDISABLE_INTERRUPTS () ;
+      #else
+        noInterrupts () ;
+      #endif
+      //--- Messages already waiting in the driver buffer go first
+        if (!mHardwareTxFIFOFull) {
+          accepted = appendBurstInControllerTxFIFO (inMessages, count) ;
+        }
+      //--- Only a full controller FIFO sends the rest to the driver buffer: after a failed
+      //    object write the FIFO is not full, the "not full" interrupt is off, so the caller retries
+        while (inDriverBufferFallback && mHardwareTxFIFOFull && (accepted < count)
+            && mDriverTransmitBuffer.append (inMessages [accepted])) {
+          accepted += 1 ;
+        }
+      #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+        taskENABLE_INTERRUPTS () ;
+      #else
+        interrupts () ;
+      #endif
+    spiEndTransaction () ;
+  }
+  return accepted ;
+}
+
+//------------------------------------------------------------------------------
+
 bool ACAN2517FD::enterInTransmitBuffer (const CANFDMessage & inMessage) {
   bool result ;
   if (mHardwareTxFIFOFull) {
     result = mDriverTransmitBuffer.append (inMessage) ;
   }else{
-    result = true ;
-    appendInControllerTxFIFO (inMessage) ;
+    result = appendInControllerTxFIFO (inMessage) ;
   //--- If controller FIFO is full, enable "FIFO not full" interrupt
-    const uint8_t status = readRegister8Assume_SPI_transaction (FIFOSTA_REGISTER (TRANSMIT_FIFO_INDEX)) ;
+    const uint8_t status = result ? readRegister8Assume_SPI_transaction (FIFOSTA_REGISTER (TRANSMIT_FIFO_INDEX)) : 1 ;
     if ((status & 1) == 0) { // FIFO is full
       uint8_t data8 = 1 << 7 ;  // FIFO is a transmit FIFO
       data8 |= 1 ; // Enable "FIFO not full" interrupt
@@ -653,7 +795,11 @@ static uint32_t lengthCodeForLength (const uint8_t inLength) {
 
 //------------------------------------------------------------------------------
 
-void ACAN2517FD::appendInControllerTxFIFO (const CANFDMessage & inMessage) {
+// The object write is CRC protected when SPI CRC is enabled: if it still fails, the
+// controller has discarded it and the RAM slot holds an old object, so UINC / TXREQ
+// are not set and false is returned.
+
+bool ACAN2517FD::appendInControllerTxFIFO (const CANFDMessage & inMessage) {
   const uint16_t ramAddr = uint16_t (0x400 + readRegister32Assume_SPI_transaction (FIFOUA_REGISTER (TRANSMIT_FIFO_INDEX))) ;
 //--- Write identifier: if an extended frame is sent, identifier bits sould be reordered (see DS20005678B, page 27)
   uint32_t idf = inMessage.id ;
@@ -694,12 +840,118 @@ void ACAN2517FD::appendInControllerTxFIFO (const CANFDMessage & inMessage) {
     enterU32InBufferAtIndex (inMessage.data32 [i], buffer, 10 + 4 * i) ;
   }
 //--- SPI transfer
-  assertCS () ;
-    mSPI.transfer (buffer, 10 + 4 * wordCount) ;
-  deassertCS () ;
+  const bool ok = spiCommand (buffer, 10 + 4 * wordCount) ;
 //--- Increment FIFO, send message (see DS20005688B, page 48)
-  const uint8_t data8 = (1 << 0) | (1 << 1) ; // Set UINC bit, TXREQ bit
-  writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX) + 1, data8);
+  if (ok) {
+    const uint8_t data8 = (1 << 0) | (1 << 1) ; // Set UINC bit, TXREQ bit
+    writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX) + 1, data8);
+  }
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+// Free objects: the FIFO sends from FIFOCI and is written at FIFOUA, both are
+// read with a single access per burst. The objects are consecutive in RAM up to the end of the
+// FIFO, so each run is written with a single SPI transfer (the unused bytes of
+// short messages are written as 0), followed by one UINC / TXREQ per object.
+// If the write of a run fails its CRC check, the burst stops before that run: its
+// objects are not committed, and the returned count lets the caller retry them.
+
+size_t ACAN2517FD::appendBurstInControllerTxFIFO (const CANFDMessage * inMessages, const size_t inCount) {
+  uint32_t status ;
+  uint16_t ramAddr ;
+  readFIFOStatusAndAddressAssume_SPI_transaction (TRANSMIT_FIFO_INDEX, status, ramAddr) ;
+  const uint32_t head = (ramAddr - mTransmitFIFOAddress) / mTransmitFIFOObjectSize ;
+  const uint32_t tail = (status >> 8) & 0x1F ; // FIFOCI: next object to transmit
+  uint32_t freeCount = 0 ;
+  if ((status & 1) != 0) { // FIFO not full
+    freeCount = (tail + mTransmitFIFOObjectCount - head) % mTransmitFIFOObjectCount ;
+    if (freeCount == 0) { // Empty
+      freeCount = mTransmitFIFOObjectCount ;
+    }
+  }
+  const size_t count = (inCount < freeCount) ? inCount : freeCount ;
+  static const uint16_t kBurstBufferSize = 512 ;
+  uint8_t buffer [2 + kBurstBufferSize] ;
+  uint32_t index = head ;
+  size_t sent = 0 ;
+  while (sent < count) {
+  //--- Run: consecutive objects up to the end of the FIFO and the buffer size
+    size_t run = count - sent ;
+    if (run > mTransmitFIFOObjectCount - index) {
+      run = mTransmitFIFOObjectCount - index ;
+    }
+    if (run > kBurstBufferSize / mTransmitFIFOObjectSize) {
+      run = kBurstBufferSize / mTransmitFIFOObjectSize ;
+    }
+    const uint16_t address = mTransmitFIFOAddress + index * mTransmitFIFOObjectSize ;
+    const uint16_t writeCommand = (address & 0x0FFF) | (0b0010 << 12) ;
+    buffer [0] = writeCommand >> 8 ;
+    buffer [1] = writeCommand & 0xFF ;
+    uint16_t length = 2 ;
+    for (size_t m=0 ; m < run ; m++) {
+      const CANFDMessage & message = inMessages [sent + m] ;
+      const uint16_t objectIndex = 2 + m * mTransmitFIFOObjectSize ;
+      while (length < objectIndex) { // Padding of the previous object
+        buffer [length] = 0 ;
+        length += 1 ;
+      }
+    //--- Identifier: if an extended frame is sent, identifier bits sould be reordered (see DS20005678B, page 27)
+      uint32_t idf = message.id ;
+      if (message.ext) {
+        idf = ((message.id >> 18) & 0x7FF) | ((message.id & 0x3FFFF) << 11) ;
+      }
+    //--- DLC field, FDF, BRS, RTR, IDE bits
+      uint32_t flags = lengthCodeForLength (message.len) ;
+      if (message.ext) {
+        flags |= 1 << 4 ; // Set EXT bit
+      }
+      switch (message.type) {
+      case CANFDMessage::CAN_REMOTE :
+        flags |= 1 << 5 ; // Set RTR bit
+        break ;
+      case CANFDMessage::CAN_DATA :
+       break ;
+      case CANFDMessage::CANFD_NO_BIT_RATE_SWITCH :
+        flags |= 1 << 7 ; // Set FDF bit
+        break ;
+      case CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH :
+        flags |= 1 << 7 ; // Set FDF bit
+        flags |= 1 << 6 ; // Set BRS bit
+        break ;
+      }
+      enterU32InBufferAtIndex (idf, buffer, objectIndex) ;
+      enterU32InBufferAtIndex (flags, buffer, objectIndex + 4) ;
+      const uint32_t wordCount = (message.len + 3) / 4 ;
+      for (uint32_t i=0 ; i < wordCount ; i++) {
+        enterU32InBufferAtIndex (message.data32 [i], buffer, objectIndex + 8 + 4 * i) ;
+      }
+      length = objectIndex + 8 + 4 * wordCount ;
+    }
+  //--- SPI transfer of the whole run
+    if (!spiCommand (buffer, length)) {
+      break ;
+    }
+  //--- Increment FIFO once per object, send messages (see DS20005688B, page 48)
+    for (size_t m=0 ; m < run ; m++) {
+      const uint8_t data8 = (1 << 0) | (1 << 1) ; // Set UINC bit, TXREQ bit
+      writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX) + 1, data8);
+    }
+    sent += run ;
+    index += run ;
+    if (index == mTransmitFIFOObjectCount) {
+      index = 0 ;
+    }
+  }
+//--- If controller FIFO is full, enable "FIFO not full" interrupt
+  if ((sent > 0) && (sent == freeCount)) {
+    uint8_t data8 = 1 << 7 ;  // FIFO is a transmit FIFO
+    data8 |= 1 ; // Enable "FIFO not full" interrupt
+    data8 |= 1 << 4 ; // TXATIE ---> 1: Enable Transmit Attempts Exhausted Interrupt
+    writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX), data8) ;
+    mHardwareTxFIFOFull = true ;
+  }
+  return sent ;
 }
 
 //------------------------------------------------------------------------------
@@ -756,13 +1008,13 @@ bool ACAN2517FD::sendViaTXQ (const CANFDMessage & inMessage) {
       for (uint32_t i=0 ; i < wordCount ; i++) {
         enterU32InBufferAtIndex (inMessage.data32 [i], buffer, 10 + 4 * i) ;
       }
-    //--- SPI transfer
-      assertCS () ;
-        mSPI.transfer (buffer, 10 + 4 * wordCount) ;
-      deassertCS () ;
+    //--- SPI transfer, the object is not sent if its write failed
+      ok = spiCommand (buffer, 10 + 4 * wordCount) ;
     //--- Increment FIFO, send message (see DS20005688B, page 48)
-      const uint8_t data8 = (1 << 0) | (1 << 1) ; // Set UINC bit, TXREQ bit
-      writeRegister8Assume_SPI_transaction (TXQCON_REGISTER + 1, data8);
+      if (ok) {
+        const uint8_t data8 = (1 << 0) | (1 << 1) ; // Set UINC bit, TXREQ bit
+        writeRegister8Assume_SPI_transaction (TXQCON_REGISTER + 1, data8);
+      }
     }
   }
   return ok ;
@@ -773,19 +1025,19 @@ bool ACAN2517FD::sendViaTXQ (const CANFDMessage & inMessage) {
 //------------------------------------------------------------------------------
 
 bool ACAN2517FD::available (void) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       const bool hasReceivedMessage = mDriverReceiveBuffer.count () > 0 ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
   return hasReceivedMessage ;
 }
 
@@ -799,8 +1051,8 @@ bool ACAN2517FD::receive (CANFDMessage & outMessage) {
         isr_poll_core () ; // Perform polling
       }else if (!mRxInterruptEnabled) {
 
-        mSPI.beginTransaction (mSPISettings) ;
-          #ifdef ARDUINO_ARCH_ESP32
+        spiBeginTransaction () ;
+          #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
             taskDISABLE_INTERRUPTS () ;
           #else
             noInterrupts () ;
@@ -811,18 +1063,58 @@ bool ACAN2517FD::receive (CANFDMessage & outMessage) {
         data8 |= (1 << 1) ; // Receive FIFO Interrupt Enable
         writeRegister8Assume_SPI_transaction (INT_REGISTER + 2, data8) ;
 
-        #ifdef ARDUINO_ARCH_ESP32
+        #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
           taskENABLE_INTERRUPTS () ;
         #else
           interrupts () ;
         #endif
-      mSPI.endTransaction () ;
+      spiEndTransaction () ;
       }
   return hasReceivedMessage ;
 }
 
 //------------------------------------------------------------------------------
 
+size_t ACAN2517FD::receiveBurst (CANFDMessage * outMessages, const size_t inMaxCount,
+                                 uint32_t * outTimeStamps) {
+//--- No interrupt pin: read the controller receive FIFO once for the whole burst.
+//    When the driver buffer is full, drain it first (polling now would drop a message)
+  if ((mINT == 255) && !mDriverReceiveBuffer.isFull ()) {
+    mRxInterruptEnabled = true ;
+    isr_poll_core () ;
+  }
+  size_t count = 0 ;
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+      taskDISABLE_INTERRUPTS () ;
+    #else
+      noInterrupts () ;
+    #endif
+      uint32_t timeStamp ;
+      while ((count < inMaxCount) && mDriverReceiveBuffer.remove (outMessages [count], timeStamp)) {
+        if (outTimeStamps != NULL) {
+          outTimeStamps [count] = timeStamp ;
+        }
+        count += 1 ;
+      }
+    //--- Driver buffer has room again: if receive interrupt is disabled, enable it
+      if ((count > 0) && !mRxInterruptEnabled && (mINT != 255)) {
+        mRxInterruptEnabled = true ;
+        uint8_t data8 = readRegister8Assume_SPI_transaction (INT_REGISTER + 2) ;
+        data8 |= (1 << 1) ; // Receive FIFO Interrupt Enable
+        writeRegister8Assume_SPI_transaction (INT_REGISTER + 2, data8) ;
+      }
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+      taskENABLE_INTERRUPTS () ;
+    #else
+      interrupts () ;
+    #endif
+  spiEndTransaction () ;
+  return count ;
+}
+
+//------------------------------------------------------------------------------
+
 bool ACAN2517FD::dispatchReceivedMessage (const tFilterMatchCallBack inFilterMatchCallBack) {
   CANFDMessage receivedMessage ;
   const bool hasReceived = receive (receivedMessage) ;
@@ -877,12 +1169,13 @@ bool ACAN2517FD::dispatchReceivedMessage (const tFilterMatchCallBack inFilterMat
 
 #ifdef ARDUINO_ARCH_ESP32
   void ACAN2517FD::isr (void) {
-    // BaseType_t xHigherPriorityTaskWoken = pdFALSE ;
-    // xSemaphoreGiveFromISR (mISRSemaphore, &xHigherPriorityTaskWoken) ;
-    // portYIELD_FROM_ISR () ;
-
-    isr_poll_core () ;
-
+    #ifdef ACAN2517FD_IDF_SPI
+      BaseType_t xHigherPriorityTaskWoken = pdFALSE ;
+      xSemaphoreGiveFromISR (mISRSemaphore, &xHigherPriorityTaskWoken) ;
+      portYIELD_FROM_ISR (xHigherPriorityTaskWoken) ;
+    #else
+      isr_poll_core () ;
+    #endif
   }
 #endif
 
@@ -901,8 +1194,8 @@ bool ACAN2517FD::dispatchReceivedMessage (const tFilterMatchCallBack inFilterMat
 //------------------------------------------------------------------------------
 
 void ACAN2517FD::isr_poll_core (void) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #endif
       bool handled = true ;
@@ -924,11 +1217,13 @@ void ACAN2517FD::isr_poll_core (void) {
         if ((it & (1 << 10)) != 0) { // Transmit Attempt interrupt
         //--- Clear Pending Transmit Attempt interrupt bit
           writeRegister8Assume_SPI_transaction (FIFOSTA_REGISTER (TRANSMIT_FIFO_INDEX), ~ (1 << 4)) ;
-          transmitInterrupt () ;
-          handled = true ;
+          if (transmitInterrupt ()) {
+            handled = true ;
+          }
         }else if ((it & (1 << 0)) != 0) { // Transmit FIFO interrupt
-          transmitInterrupt () ;
-          handled = true ;
+          if (transmitInterrupt ()) { // A failed write is retried on the next interrupt
+            handled = true ;
+          }
         }
         if ((it & (1 << 2)) != 0) { // TBCIF interrupt
           writeRegister8Assume_SPI_transaction (INT_REGISTER, ~ (1 << 2)) ;
@@ -953,85 +1248,134 @@ void ACAN2517FD::isr_poll_core (void) {
 
 
       }
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
 }
 
 //------------------------------------------------------------------------------
 
-void ACAN2517FD::transmitInterrupt (void) { // Generated if hardware transmit FIFO is not full
+// Returns false if the object write failed: the message stays first in the driver
+// buffer and is retried on the next interrupt.
+
+bool ACAN2517FD::transmitInterrupt (void) { // Generated if hardware transmit FIFO is not full
+  bool ok = true ;
   CANFDMessage message ;
-  const bool hasMessage = mDriverTransmitBuffer.remove (message) ;
+  uint32_t timeStamp ;
+  const bool hasMessage = mDriverTransmitBuffer.peek (message, timeStamp) ;
   if (hasMessage) {
-    appendInControllerTxFIFO (message) ;
+    ok = appendInControllerTxFIFO (message) ;
+    if (ok) {
+      mDriverTransmitBuffer.dropFirst () ;
+    }
   }else{ // No message in transmit FIFO: disable "FIFO not full" interrupt
     uint8_t data8 = 1 << 7 ;  // FIFO is a transmit FIFO
     data8 |= 1 << 4 ; // TXATIE ---> 1: Enable Transmit Attempts Exhausted Interrupt
     writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (TRANSMIT_FIFO_INDEX), data8) ;
     mHardwareTxFIFOFull = false ;
   }
+  return ok ;
 }
 
 //------------------------------------------------------------------------------
-/**
- */
+// Reads the receive FIFO until it is empty (or the driver buffer is full).
+// FIFOSTA and FIFOUA are read with a single access, so a burst of frames needs
+// three SPI transfers per frame (FIFO status, message object, UINC), and INT is
+// read once per burst by isr_poll_core. Only the configured payload of each
+// object is read.
+// With receive time stamps, TBC is read once per burst together with micros (),
+// and the SOF time stamp of each object is converted to micros () from this
+// reference; otherwise each frame is stamped when it is read.
+
 void ACAN2517FD::receiveInterrupt (void) {
-  const uint16_t ramAddress = uint16_t (0x400 + readRegister32Assume_SPI_transaction (FIFOUA_REGISTER (RECEIVE_FIFO_INDEX))) ;
-  CANFDMessage message ;
-//--- Read word register via 6-byte buffer (speed enhancement, thanks to thomasfla)
-  uint8_t buffer [74] = {0} ;
-//--- Enter command
-  const uint16_t readCommand = (ramAddress & 0x0FFF) | (0b0011 << 12) ;
-  buffer [0] = readCommand >> 8 ;
-  buffer [1] = readCommand & 0xFF ;
-//--- SPI transfer
-  assertCS () ;
-    mSPI.transfer (buffer, 74) ;
+  #ifdef ARDUINO_ARCH_ESP32
+    const uint32_t startCycles = ESP.getCycleCount () ;
+  #endif
+  static const uint8_t kLength [16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64} ;
+  const uint16_t headerLength = mReceiveTimeStamp ? 12 : 8 ; // ID, flags, time stamp
+  uint32_t referenceTBC = 0 ;
+  uint32_t referenceMicros = 0 ;
+  uint32_t status ;
+  uint16_t ramAddress ;
+  readFIFOStatusAndAddressAssume_SPI_transaction (RECEIVE_FIFO_INDEX, status, ramAddress) ;
+  if (mReceiveTimeStamp && ((status & (1 << 0)) != 0)) {
+    referenceTBC = readRegister32Assume_SPI_transaction (TBC_REGISTER) ;
+    referenceMicros = micros () ;
+  }
+  while (mRxInterruptEnabled && ((status & (1 << 0)) != 0)) { // TFNRFNIF: receive FIFO not empty
+    CANFDMessage message ;
+  //--- Read word register via 78-byte buffer (speed enhancement, thanks to thomasfla)
+    uint8_t buffer [78] = {0} ;
+  //--- Enter command
+    const uint16_t readCommand = (ramAddress & 0x0FFF) | (0b0011 << 12) ;
+    buffer [0] = readCommand >> 8 ;
+    buffer [1] = readCommand & 0xFF ;
+  //--- SPI transfer, then increment FIFO: set UINC bit (DS20005688B, page 52)
+  //    With CRC instructions, UINC is only sent if the object was read without CRC error. If the read or the
+  //    UINC write failed, FIFOUA tells if the object was released: if not, it stays in the controller FIFO
+  //    and is read again on the next call.
+    if (!spiTransferThenWrite8 (buffer, 2 + headerLength + mReceiveFIFOPayload, FIFOCON_REGISTER (RECEIVE_FIFO_INDEX) + 1, 1 << 0)) {
+      uint32_t newStatus ;
+      uint16_t newRAMAddress ;
+      const bool released = readFIFOStatusAndAddressAssume_SPI_transaction (RECEIVE_FIFO_INDEX, newStatus, newRAMAddress)
+        && (newRAMAddress != ramAddress) ;
+      if (!released) {
+        break ;
+      }
+    }
   //--- Read identifier (see DS20005678A, page 42)
     message.id = u32FromBufferAtIndex (buffer, 2) ;
   //--- Read DLC, RTR, IDE bits, and match filter index
     const uint32_t flags = u32FromBufferAtIndex (buffer, 6) ;
-    static const uint8_t kLength [16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64} ;
     message.len = kLength [flags & 0x0F] ;
   //--- Write data (Swap data if processor is big endian)
-    const uint32_t wordCount = (message.len + 3) / 4 ;
+    uint32_t wordCount = (message.len + 3) / 4 ;
+    if (wordCount > (mReceiveFIFOPayload / 4u)) {
+      wordCount = mReceiveFIFOPayload / 4u ;
+    }
     for (uint32_t i=0 ; i < wordCount ; i++) {
-      message.data32 [i] = u32FromBufferAtIndex (buffer, 10 + 4 * i) ;
+      message.data32 [i] = u32FromBufferAtIndex (buffer, 2 + headerLength + 4 * i) ;
     }
-  deassertCS () ;
-//--- Increment FIFO
-  const uint8_t data8 = 1 << 0 ; // Set UINC bit (DS20005688B, page 52)
-  writeRegister8Assume_SPI_transaction (FIFOCON_REGISTER (RECEIVE_FIFO_INDEX) + 1, data8) ;
-  message.idx = uint8_t ((flags >> 11) & 0x1F) ;
-//--- Message type (DS20005678B, page 42)
-  if ((flags & (1 << 5)) != 0 ) { // RTR bit
-    message.type = CANFDMessage::CAN_REMOTE ;
-  }else if ((flags & (1 << 7)) == 0) { // FDF bit
-    message.type = CANFDMessage::CAN_DATA ;
-  }else if ((flags & (1 << 6)) == 0) { // BRS bit
-    message.type = CANFDMessage::CANFD_NO_BIT_RATE_SWITCH ;
-  }else{
-    message.type = CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH ;
-  }
-//--- If an extended frame is received, identifier bits should be reordered (see DS20005678B, page 42)
-  message.ext = (flags & (1 << 4)) != 0 ;
-  if (message.ext) {
-    const uint32_t tempID = message.id ;
-    message.id = ((tempID >> 11) & 0x3FFFF) | ((tempID & 0x7FF) << 18) ;
-  }
-//--- Append message to driver receive FIFO
-  mDriverReceiveBuffer.append (message) ;
-//--- If mDriverReceiveBuffer is full, disable receive interrupt (added in release 2.17)
-  if (mDriverReceiveBuffer.isFull ()) {
-    mRxInterruptEnabled = false ;
-    if (mINT != 255) {
-      uint8_t data8 = readRegister8Assume_SPI_transaction (INT_REGISTER + 2) ;
-      data8 &= ~ (1 << 1) ; // Receive FIFO Interrupt disable
-      writeRegister8Assume_SPI_transaction (INT_REGISTER + 2, data8) ;
+  //--- Time stamp: TBC counts µs, so the distance to the reference TBC is the distance to the reference micros ()
+    const uint32_t timeStamp = mReceiveTimeStamp
+      ? referenceMicros - (referenceTBC - u32FromBufferAtIndex (buffer, 10))
+      : uint32_t (micros ()) ;
+    message.idx = uint8_t ((flags >> 11) & 0x1F) ;
+  //--- Message type (DS20005678B, page 42)
+    if ((flags & (1 << 5)) != 0 ) { // RTR bit
+      message.type = CANFDMessage::CAN_REMOTE ;
+    }else if ((flags & (1 << 7)) == 0) { // FDF bit
+      message.type = CANFDMessage::CAN_DATA ;
+    }else if ((flags & (1 << 6)) == 0) { // BRS bit
+      message.type = CANFDMessage::CANFD_NO_BIT_RATE_SWITCH ;
+    }else{
+      message.type = CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH ;
+    }
+  //--- If an extended frame is received, identifier bits should be reordered (see DS20005678B, page 42)
+    message.ext = (flags & (1 << 4)) != 0 ;
+    if (message.ext) {
+      const uint32_t tempID = message.id ;
+      message.id = ((tempID >> 11) & 0x3FFFF) | ((tempID & 0x7FF) << 18) ;
+    }
+  //--- Append message to driver receive FIFO
+    mDriverReceiveBuffer.append (message, timeStamp) ;
+    mReceivedFrameCount += 1 ;
+  //--- If mDriverReceiveBuffer is full, disable receive interrupt (added in release 2.17)
+    if (mDriverReceiveBuffer.isFull ()) {
+      mRxInterruptEnabled = false ;
+      if (mINT != 255) {
+        uint8_t data8 = readRegister8Assume_SPI_transaction (INT_REGISTER + 2) ;
+        data8 &= ~ (1 << 1) ; // Receive FIFO Interrupt disable
+        writeRegister8Assume_SPI_transaction (INT_REGISTER + 2, data8) ;
+      }
+    }else{
+      readFIFOStatusAndAddressAssume_SPI_transaction (RECEIVE_FIFO_INDEX, status, ramAddress) ;
     }
   }
+  #ifdef ARDUINO_ARCH_ESP32
+    mReceiveCycleCount += ESP.getCycleCount () - startCycles ;
+  #endif
 }
 
 //------------------------------------------------------------------------------
@@ -1049,14 +1393,12 @@ void ACAN2517FD::writeRegister32Assume_SPI_transaction (const uint16_t inRegiste
 //--- Enter register value
   enterU32InBufferAtIndex (inValue, buffer, 2) ;
 //--- SPI transfer
-  assertCS () ;
-    mSPI.transfer (buffer, 6) ;
-  deassertCS () ;
+  spiCommand (buffer, 6) ;
 }
 
 //------------------------------------------------------------------------------
 
-void ACAN2517FD::writeRegister8Assume_SPI_transaction (const uint16_t inRegisterAddress,
+bool ACAN2517FD::writeRegister8Assume_SPI_transaction (const uint16_t inRegisterAddress,
                                                        const uint8_t inValue) {
 //--- Write byte register via 3-byte buffer (speed enhancement, thanks to thomasfla)
   uint8_t buffer [3] = {0} ;
@@ -1064,9 +1406,7 @@ void ACAN2517FD::writeRegister8Assume_SPI_transaction (const uint16_t inRegister
   buffer [0] = writeCommand >> 8 ;
   buffer [1] = writeCommand & 0xFF ;
   buffer [2] = inValue ;
-  assertCS () ;
-    mSPI.transfer (buffer, 3) ;
-  deassertCS () ;
+  return spiCommand (buffer, 3) ;
 }
 
 //------------------------------------------------------------------------------
@@ -1079,9 +1419,7 @@ uint32_t ACAN2517FD::readRegister32Assume_SPI_transaction (const uint16_t inRegi
   buffer [0] = readCommand >> 8 ;
   buffer [1] = readCommand & 0xFF ;
 //--- SPI transfer
-  assertCS () ;
-    mSPI.transfer (buffer, 6) ;
-  deassertCS () ;
+  spiCommand (buffer, 6) ;
 //--- Get result
   const uint32_t result = u32FromBufferAtIndex (buffer, 2) ;
 //---
@@ -1098,9 +1436,7 @@ uint16_t ACAN2517FD::readRegister16Assume_SPI_transaction (const uint16_t inRegi
   buffer [0] = readCommand >> 8 ;
   buffer [1] = readCommand & 0xFF ;
 //--- SPI transfer
-  assertCS () ;
-    mSPI.transfer (buffer, 4) ;
-  deassertCS () ;
+  spiCommand (buffer, 4) ;
 //--- Get result
   const uint16_t result = u16FromBufferAtIndex (buffer, 2) ;
 //---
@@ -1115,104 +1451,396 @@ uint8_t ACAN2517FD::readRegister8Assume_SPI_transaction (const uint16_t inRegist
   const uint16_t readCommand = (inRegisterAddress & 0x0FFF) | (0b0011 << 12) ;
   buffer [0] = readCommand >> 8;
   buffer [1] = readCommand & 0xFF;
-  assertCS () ;
-    mSPI.transfer(buffer, 3) ;
-  deassertCS () ;
+  spiCommand (buffer, 3) ;
   return buffer [2] ;
 }
 
+//------------------------------------------------------------------------------
+// FIFOSTA and FIFOUA are consecutive registers: read both via a 10-byte buffer
+
+bool ACAN2517FD::readFIFOStatusAndAddressAssume_SPI_transaction (const uint16_t inFIFOIndex,
+                                                                 uint32_t & outStatus,
+                                                                 uint16_t & outRAMAddress) {
+  uint8_t buffer [10] = {0} ;
+  const uint16_t readCommand = (FIFOSTA_REGISTER (inFIFOIndex) & 0x0FFF) | (0b0011 << 12) ;
+  buffer [0] = readCommand >> 8 ;
+  buffer [1] = readCommand & 0xFF ;
+  const bool ok = spiCommand (buffer, 10) ;
+  outStatus = u32FromBufferAtIndex (buffer, 2) ;
+  outRAMAddress = uint16_t (0x400 + u32FromBufferAtIndex (buffer, 6)) ;
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+//   SPI ACCESS
+//------------------------------------------------------------------------------
+
+void ACAN2517FD::setSPIClock (const uint32_t inClock) {
+  mSPISettings = SPISettings (inClock, MSBFIRST, SPI_MODE0) ;
+  #ifdef ACAN2517FD_IDF_SPI
+    mIDFRequestedClock = inClock ; // The device is added again by spiBeginTransaction
+  #endif
+}
+
+//------------------------------------------------------------------------------
+//   CRC PROTECTED SPI INSTRUCTIONS (DS20005688B, section 4)
+// READ_CRC / WRITE_CRC: 2-byte command, length N, data, CRC-16 (polynomial 0x8005, seed 0xFFFF, MSB first) of the
+// command, N and data bytes. N counts bytes for SFR, 32-bit words for RAM.
+//------------------------------------------------------------------------------
+
+static const uint16_t kSPICRC16Table [256] = {
+  0x0000, 0x8005, 0x800F, 0x000A, 0x801B, 0x001E, 0x0014, 0x8011,
+  0x8033, 0x0036, 0x003C, 0x8039, 0x0028, 0x802D, 0x8027, 0x0022,
+  0x8063, 0x0066, 0x006C, 0x8069, 0x0078, 0x807D, 0x8077, 0x0072,
+  0x0050, 0x8055, 0x805F, 0x005A, 0x804B, 0x004E, 0x0044, 0x8041,
+  0x80C3, 0x00C6, 0x00CC, 0x80C9, 0x00D8, 0x80DD, 0x80D7, 0x00D2,
+  0x00F0, 0x80F5, 0x80FF, 0x00FA, 0x80EB, 0x00EE, 0x00E4, 0x80E1,
+  0x00A0, 0x80A5, 0x80AF, 0x00AA, 0x80BB, 0x00BE, 0x00B4, 0x80B1,
+  0x8093, 0x0096, 0x009C, 0x8099, 0x0088, 0x808D, 0x8087, 0x0082,
+  0x8183, 0x0186, 0x018C, 0x8189, 0x0198, 0x819D, 0x8197, 0x0192,
+  0x01B0, 0x81B5, 0x81BF, 0x01BA, 0x81AB, 0x01AE, 0x01A4, 0x81A1,
+  0x01E0, 0x81E5, 0x81EF, 0x01EA, 0x81FB, 0x01FE, 0x01F4, 0x81F1,
+  0x81D3, 0x01D6, 0x01DC, 0x81D9, 0x01C8, 0x81CD, 0x81C7, 0x01C2,
+  0x0140, 0x8145, 0x814F, 0x014A, 0x815B, 0x015E, 0x0154, 0x8151,
+  0x8173, 0x0176, 0x017C, 0x8179, 0x0168, 0x816D, 0x8167, 0x0162,
+  0x8123, 0x0126, 0x012C, 0x8129, 0x0138, 0x813D, 0x8137, 0x0132,
+  0x0110, 0x8115, 0x811F, 0x011A, 0x810B, 0x010E, 0x0104, 0x8101,
+  0x8303, 0x0306, 0x030C, 0x8309, 0x0318, 0x831D, 0x8317, 0x0312,
+  0x0330, 0x8335, 0x833F, 0x033A, 0x832B, 0x032E, 0x0324, 0x8321,
+  0x0360, 0x8365, 0x836F, 0x036A, 0x837B, 0x037E, 0x0374, 0x8371,
+  0x8353, 0x0356, 0x035C, 0x8359, 0x0348, 0x834D, 0x8347, 0x0342,
+  0x03C0, 0x83C5, 0x83CF, 0x03CA, 0x83DB, 0x03DE, 0x03D4, 0x83D1,
+  0x83F3, 0x03F6, 0x03FC, 0x83F9, 0x03E8, 0x83ED, 0x83E7, 0x03E2,
+  0x83A3, 0x03A6, 0x03AC, 0x83A9, 0x03B8, 0x83BD, 0x83B7, 0x03B2,
+  0x0390, 0x8395, 0x839F, 0x039A, 0x838B, 0x038E, 0x0384, 0x8381,
+  0x0280, 0x8285, 0x828F, 0x028A, 0x829B, 0x029E, 0x0294, 0x8291,
+  0x82B3, 0x02B6, 0x02BC, 0x82B9, 0x02A8, 0x82AD, 0x82A7, 0x02A2,
+  0x82E3, 0x02E6, 0x02EC, 0x82E9, 0x02F8, 0x82FD, 0x82F7, 0x02F2,
+  0x02D0, 0x82D5, 0x82DF, 0x02DA, 0x82CB, 0x02CE, 0x02C4, 0x82C1,
+  0x8243, 0x0246, 0x024C, 0x8249, 0x0258, 0x825D, 0x8257, 0x0252,
+  0x0270, 0x8275, 0x827F, 0x027A, 0x826B, 0x026E, 0x0264, 0x8261,
+  0x0220, 0x8225, 0x822F, 0x022A, 0x823B, 0x023E, 0x0234, 0x8231,
+  0x8213, 0x0216, 0x021C, 0x8219, 0x0208, 0x820D, 0x8207, 0x0202,
+} ;
+
+//------------------------------------------------------------------------------
+
+static uint16_t spiCRC16 (uint16_t ioCRC, const uint8_t inData [], const uint16_t inLength) {
+  for (uint16_t i=0 ; i < inLength ; i++) {
+    ioCRC = uint16_t (ioCRC << 8) ^ kSPICRC16Table [uint8_t ((ioCRC >> 8) ^ inData [i])] ;
+  }
+  return ioCRC ;
+}
+
+//------------------------------------------------------------------------------
+
+static const uint8_t SPI_CRC_ATTEMPTS = 3 ;
+
+//------------------------------------------------------------------------------
+// Builds the READ_CRC / WRITE_CRC instruction of the READ / WRITE instruction in ioBuffer into mSPICRCBuffer,
+// and returns the CRC of the header (command and length)
+
+uint16_t ACAN2517FD::spiCRCHeader (const uint8_t inBuffer [], const uint16_t inLength, const bool inRead) {
+  const uint16_t dataLength = inLength - 2 ;
+  const uint16_t address = ((uint16_t (inBuffer [0]) << 8) | inBuffer [1]) & 0x0FFF ;
+  const bool ram = (address >= 0x400) && (address < 0xC00) ;
+  const uint16_t command = address | ((inRead ? 0b1011 : 0b1010) << 12) ;
+  mSPICRCBuffer [0] = command >> 8 ;
+  mSPICRCBuffer [1] = command & 0xFF ;
+  mSPICRCBuffer [2] = uint8_t (ram ? (dataLength / 4) : dataLength) ;
+  return spiCRC16 (0xFFFF, mSPICRCBuffer, 3) ;
+}
+
+//------------------------------------------------------------------------------
+
+void ACAN2517FD::spiWriteWithCRC (const uint8_t inBuffer [], const uint16_t inLength) {
+  const uint16_t dataLength = inLength - 2 ;
+  const uint16_t headerCRC = spiCRCHeader (inBuffer, inLength, false) ;
+  memcpy (mSPICRCBuffer + 3, inBuffer + 2, dataLength) ;
+  const uint16_t crc = spiCRC16 (headerCRC, inBuffer + 2, dataLength) ;
+  mSPICRCBuffer [3 + dataLength] = uint8_t (crc >> 8) ;
+  mSPICRCBuffer [4 + dataLength] = uint8_t (crc) ;
+  spiTransfer (mSPICRCBuffer, 5 + dataLength) ;
+}
+
+//------------------------------------------------------------------------------
+// Clears CRCERRIF / FERRIF and checks they read back as 0
+
+bool ACAN2517FD::clearSPICRCFlags (void) {
+  const uint16_t writeCommand = ((CRC_REGISTER + 2) & 0x0FFF) | (0b0010 << 12) ;
+  const uint8_t clear [3] = {uint8_t (writeCommand >> 8), uint8_t (writeCommand & 0xFF), 0} ;
+  const uint16_t readCommand = ((CRC_REGISTER + 2) & 0x0FFF) | (0b0011 << 12) ;
+  bool ok = false ;
+  for (uint8_t attempt = 0 ; (attempt < SPI_CRC_ATTEMPTS) && !ok ; attempt++) {
+    spiWriteWithCRC (clear, 3) ;
+    uint8_t flags [3] = {uint8_t (readCommand >> 8), uint8_t (readCommand & 0xFF), 0xFF} ;
+    ok = spiCommandWithCRC (flags, 3) && ((flags [2] & 0x03) == 0) ;
+  }
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+// Reads are retried while the CRC does not match; on failure, the data in ioBuffer is left unchanged (callers
+// pass a zeroed buffer, so a failed FIFO status read looks like an empty FIFO).
+// Writes are verified right away: the controller discards a write with a CRC or format error and sets CRCERRIF
+// or FERRIF (CRC register, byte 2). The flags are read back after each write; if one is set, it is cleared and
+// the write is sent again. If the flags cannot be read, the write is not sent again (it may have been applied).
+// Returns false if the instruction still fails after SPI_CRC_ATTEMPTS.
+
+bool ACAN2517FD::spiCommandWithCRC (uint8_t ioBuffer [], const uint16_t inLength) {
+  const uint16_t dataLength = inLength - 2 ;
+  const bool read = (ioBuffer [0] >> 4) == 0b0011 ;
+  bool ok = false ;
+  bool unknown = false ; // Write sent, but the flags could not be read: sending it again could apply it twice (UINC)
+  for (uint8_t attempt = 0 ; (attempt < SPI_CRC_ATTEMPTS) && !ok && !unknown ; attempt++) {
+    if (!read) {
+      spiWriteWithCRC (ioBuffer, inLength) ;
+    //--- Read CRCERRIF / FERRIF
+      uint8_t flags [3] = {0} ;
+      const uint16_t readCommand = ((CRC_REGISTER + 2) & 0x0FFF) | (0b0011 << 12) ;
+      flags [0] = readCommand >> 8 ;
+      flags [1] = readCommand & 0xFF ;
+      unknown = !spiCommandWithCRC (flags, 3) ;
+      ok = !unknown && ((flags [2] & 0x03) == 0) ;
+      if (!ok && !unknown) {
+        mSPICRCWriteErrorCount += 1 ;
+        unknown = !clearSPICRCFlags () ; // Stale flags would make the next write look discarded
+      }
+    }else{
+      const uint16_t headerCRC = spiCRCHeader (ioBuffer, inLength, true) ;
+      memset (mSPICRCBuffer + 3, 0, dataLength + 2) ;
+      spiTransfer (mSPICRCBuffer, 5 + dataLength) ;
+      const uint16_t crc = spiCRC16 (headerCRC, mSPICRCBuffer + 3, dataLength) ;
+      const uint16_t receivedCRC = (uint16_t (mSPICRCBuffer [3 + dataLength]) << 8) | mSPICRCBuffer [4 + dataLength] ;
+      ok = crc == receivedCRC ;
+      if (ok) {
+        memcpy (ioBuffer + 2, mSPICRCBuffer + 3, dataLength) ;
+      }else{
+        mSPICRCErrorCount += 1 ;
+      }
+    }
+  }
+  if (!ok) {
+    mSPICRCFailureCount += 1 ;
+  }
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef ACAN2517FD_IDF_SPI
+
+//--- Largest transfer: transmit FIFO burst (512 bytes) with a CRC instruction (3-byte header, 2-byte CRC)
+static const uint16_t IDF_SPI_BUFFER_SIZE = 5 + 512 ;
+
+//------------------------------------------------------------------------------
+
+bool ACAN2517FD::beginIDFSPI (const spi_host_device_t inHost,
+                              const int inSCK,
+                              const int inMISO,
+                              const int inMOSI) {
+  mIDFHost = inHost ;
+  spi_bus_config_t busConfig = {} ;
+  busConfig.mosi_io_num = inMOSI ;
+  busConfig.miso_io_num = inMISO ;
+  busConfig.sclk_io_num = inSCK ;
+  busConfig.quadwp_io_num = -1 ;
+  busConfig.quadhd_io_num = -1 ;
+  busConfig.max_transfer_sz = IDF_SPI_BUFFER_SIZE ;
+  const esp_err_t err = spi_bus_initialize (inHost, &busConfig, SPI_DMA_CH_AUTO) ;
+//--- ESP_ERR_INVALID_STATE: the bus is already initialized by another controller on the same host
+  bool ok = (err == ESP_OK) || (err == ESP_ERR_INVALID_STATE) ;
+//--- Transfers go through word aligned internal buffers, so the IDF driver never allocates a bounce buffer
+  if (ok) {
+    mIDFTxBuffer = (uint8_t *) heap_caps_malloc (IDF_SPI_BUFFER_SIZE, MALLOC_CAP_DMA) ;
+    mIDFRxBuffer = (uint8_t *) heap_caps_malloc (IDF_SPI_BUFFER_SIZE, MALLOC_CAP_DMA) ;
+    ok = (mIDFTxBuffer != NULL) && (mIDFRxBuffer != NULL) ;
+  }
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+
+void ACAN2517FD::spiBeginTransaction (void) {
+//--- Device clock is set when it is added to the bus (800 kHz for reset, then full speed)
+  if ((mIDFClock != mIDFRequestedClock) && (mIDFTxBuffer != NULL)) {
+    if (mIDFDevice != NULL) {
+      spi_bus_remove_device (mIDFDevice) ;
+      mIDFDevice = NULL ;
+    }
+    spi_device_interface_config_t deviceConfig = {} ;
+    deviceConfig.mode = 0 ;
+    deviceConfig.clock_speed_hz = int (mIDFRequestedClock) ;
+    deviceConfig.spics_io_num = mCS ;
+    deviceConfig.queue_size = 2 ; // Message object read + UINC write
+    const esp_err_t err = spi_bus_add_device (mIDFHost, &deviceConfig, &mIDFDevice) ;
+    if (err == ESP_OK) {
+      mIDFClock = mIDFRequestedClock ;
+    }else{
+      mIDFDevice = NULL ;
+      mIDFError = err ; // Reported by begin: without a device, transfers do nothing
+    }
+  }else if (mIDFTxBuffer == NULL) {
+    mIDFError = ESP_ERR_INVALID_STATE ; // beginIDFSPI was not called, or failed
+  }
+  if (mIDFDevice != NULL) {
+    spi_device_acquire_bus (mIDFDevice, portMAX_DELAY) ;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void ACAN2517FD::spiEndTransaction (void) {
+  if (mIDFDevice != NULL) {
+    spi_device_release_bus (mIDFDevice) ;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Register accesses are short: polling transactions avoid the interrupt and
+// task switch of a queued transaction
+
+void ACAN2517FD::spiTransfer (uint8_t ioBuffer [], const uint16_t inLength) {
+  if (mIDFDevice != NULL) {
+    memcpy (mIDFTxBuffer, ioBuffer, inLength) ;
+    spi_transaction_t transaction = {} ;
+    transaction.length = 8 * inLength ;
+    transaction.tx_buffer = mIDFTxBuffer ;
+    transaction.rx_buffer = mIDFRxBuffer ;
+    spi_device_polling_transmit (mIDFDevice, &transaction) ;
+    memcpy (ioBuffer, mIDFRxBuffer, inLength) ;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Both transactions are queued: the SPI interrupt starts the register write as
+// soon as the message object read completes, and the object is copied out while
+// the write is on the bus
+
+bool ACAN2517FD::spiTransferThenWrite8 (uint8_t ioBuffer [], const uint16_t inLength,
+                                        const uint16_t inRegisterAddress, const uint8_t inValue) {
+  bool ok = mIDFDevice != NULL ;
+  if (mUsesSPICRC) { // The CRC of the object is checked before UINC releases it
+    ok = spiCommandWithCRC (ioBuffer, inLength) && writeRegister8Assume_SPI_transaction (inRegisterAddress, inValue) ;
+  }else if (mIDFDevice != NULL) {
+    memcpy (mIDFTxBuffer, ioBuffer, inLength) ;
+    spi_transaction_t transfer = {} ;
+    transfer.length = 8 * inLength ;
+    transfer.tx_buffer = mIDFTxBuffer ;
+    transfer.rx_buffer = mIDFRxBuffer ;
+    spi_transaction_t write = {} ;
+    write.flags = SPI_TRANS_USE_TXDATA ;
+    write.length = 24 ;
+    const uint16_t writeCommand = (inRegisterAddress & 0x0FFF) | (0b0010 << 12) ;
+    write.tx_data [0] = writeCommand >> 8 ;
+    write.tx_data [1] = writeCommand & 0xFF ;
+    write.tx_data [2] = inValue ;
+    spi_device_queue_trans (mIDFDevice, &transfer, portMAX_DELAY) ;
+    spi_device_queue_trans (mIDFDevice, &write, portMAX_DELAY) ;
+    spi_transaction_t * done ;
+    spi_device_get_trans_result (mIDFDevice, &done, portMAX_DELAY) ;
+    memcpy (ioBuffer, mIDFRxBuffer, inLength) ;
+    spi_device_get_trans_result (mIDFDevice, &done, portMAX_DELAY) ;
+  }
+  return ok ;
+}
+
+//------------------------------------------------------------------------------
+
+#endif
+
 //------------------------------------------------------------------------------
 //   MCP2517FD REGISTER ACCESS, THIRD LEVEL FUNCTIONS (HANDLE CS AND SPI TRANSACTION)
 //------------------------------------------------------------------------------
 
 void ACAN2517FD::writeRegister8 (const uint16_t inRegisterAddress, const uint8_t inValue) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       writeRegister8Assume_SPI_transaction (inRegisterAddress, inValue) ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
 }
 
 //------------------------------------------------------------------------------
 
 uint8_t ACAN2517FD::readRegister8 (const uint16_t inRegisterAddress) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       const uint8_t result = readRegister8Assume_SPI_transaction (inRegisterAddress) ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
   return result ;
 }
 
 //------------------------------------------------------------------------------
 
 uint16_t ACAN2517FD::readRegister16 (const uint16_t inRegisterAddress) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       const uint16_t result = readRegister16Assume_SPI_transaction (inRegisterAddress) ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
   return result ;
 }
 
 //------------------------------------------------------------------------------
 
 void ACAN2517FD::writeRegister32 (const uint16_t inRegisterAddress, const uint32_t inValue) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       writeRegister32Assume_SPI_transaction (inRegisterAddress, inValue) ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
 }
 
 //------------------------------------------------------------------------------
 
 uint32_t ACAN2517FD::readRegister32 (const uint16_t inRegisterAddress) {
-  mSPI.beginTransaction (mSPISettings) ;
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
       const uint32_t result = readRegister32Assume_SPI_transaction (inRegisterAddress) ;
-    #ifdef ARDUINO_ARCH_ESP32
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
   return result ;
 }
 
@@ -1262,21 +1890,20 @@ void ACAN2517FD::setOperationMode (const ACAN2517FDSettings::OperationMode inOpe
 //------------------------------------------------------------------------------
 
 void ACAN2517FD::reset2517FD (void) {
-  mSPI.beginTransaction (mSPISettings) ; // Check RESET is performed with 800 kHz clock
-    #ifdef ARDUINO_ARCH_ESP32
+  spiBeginTransaction () ; // Check RESET is performed with 800 kHz clock
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskDISABLE_INTERRUPTS () ;
     #else
       noInterrupts () ;
     #endif
-      assertCS () ;
-        mSPI.transfer16 (0x00) ; // Reset instruction: 0x0000
-      deassertCS () ;
-    #ifdef ARDUINO_ARCH_ESP32
+      uint8_t resetCommand [2] = {0, 0} ; // Reset instruction: 0x0000
+      spiTransfer (resetCommand, 2) ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
       taskENABLE_INTERRUPTS () ;
     #else
       interrupts () ;
     #endif
-  mSPI.endTransaction () ;
+  spiEndTransaction () ;
 }
 
 //------------------------------------------------------------------------------
@@ -1313,6 +1940,45 @@ uint32_t ACAN2517FD::diagInfos (const int inIndex) { // thanks to Flole998 and t
   return readRegister32 (inIndex ? BDIAG1_REGISTER: BDIAG0_REGISTER) ;
 }
 
+//------------------------------------------------------------------------------
+//    Controller health (DS20005688B, pages 22 and 23)
+//------------------------------------------------------------------------------
+
+void ACAN2517FD::pollHealth (void) {
+  spiBeginTransaction () ;
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+      taskDISABLE_INTERRUPTS () ;
+    #else
+      noInterrupts () ;
+    #endif
+    //--- ECCSTAT: bit 1 SECIF, bit 2 DEDIF, bits 16-27 ERRADDR
+      const uint32_t ecc = readRegister32Assume_SPI_transaction (ECCSTAT_REGISTER) ;
+      if ((ecc & ((1 << 1) | (1 << 2))) != 0) {
+        if ((ecc & (1 << 1)) != 0) {
+          mRAMECCCorrectedCount += 1 ;
+        }
+        if ((ecc & (1 << 2)) != 0) {
+          mRAMECCUncorrectedCount += 1 ;
+        }
+        mRAMECCErrorAddress = uint16_t ((ecc >> 16) & 0xFFF) ;
+        writeRegister8Assume_SPI_transaction (ECCSTAT_REGISTER, 0) ;
+      }
+    //--- CRC register, byte 2: bit 0 CRCERRIF, bit 1 FERRIF
+      if (mUsesSPICRC) {
+        const uint8_t crcFlags = readRegister8Assume_SPI_transaction (CRC_REGISTER + 2) ;
+        if ((crcFlags & 0x03) != 0) {
+          mSPICRCWriteErrorCount += 1 ;
+          writeRegister8Assume_SPI_transaction (CRC_REGISTER + 2, 0) ;
+        }
+      }
+    #ifdef ACAN2517FD_MASK_TASK_INTERRUPTS
+      taskENABLE_INTERRUPTS () ;
+    #else
+      interrupts () ;
+    #endif
+  spiEndTransaction () ;
+}
+
 //------------------------------------------------------------------------------
 //    GPIO
 //------------------------------------------------------------------------------
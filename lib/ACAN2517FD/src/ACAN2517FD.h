@@ -13,6 +13,9 @@
 #include <ACAN2517FD_CANMessage.h>
 #include <ACAN2517FDFilters.h>
 #include <SPI.h>
+#ifdef ACAN2517FD_IDF_SPI
+  #include <driver/spi_master.h>
+#endif
 
 //------------------------------------------------------------------------------
 //   ACAN2517FD class
@@ -61,6 +64,7 @@ class ACAN2517FD {
   public: static const uint32_t kReadBackErrorWithFullSpeedSPIClock = uint32_t (1) << 18 ;
   public: static const uint32_t kISRNotNullAndNoIntPin              = uint32_t (1) << 19 ;
   public: static const uint32_t kInvalidTDCO                        = uint32_t (1) << 20 ;
+  public: static const uint32_t kIDFSPIDeviceError                  = uint32_t (1) << 21 ; // ACAN2517FD_IDF_SPI: see idfSPIError
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //   end method (resets the MCP2517FD, deallocate buffers, and detach interrupt pin)
@@ -75,12 +79,32 @@ class ACAN2517FD {
 
   public: bool tryToSend (const CANFDMessage & inMessage) ;
 
+//--- Send several messages through the transmit FIFO: consecutive message objects are
+//    written in a single SPI transfer, messages that do not fit go to the driver transmit
+//    buffer. Stops at the first message that cannot be accepted (invalid, idx != 0, too
+//    long, driver buffer full, or its object write into the controller failed the SPI CRC
+//    check). Returns the number of accepted messages.
+//    With inDriverBufferFallback false, only messages written into the controller transmit
+//    FIFO are accepted, so the result counts frames the controller has actually received.
+  public: size_t trySendBurst (const CANFDMessage * inMessages,
+                               const size_t inCount,
+                               const bool inDriverBufferFallback = true) ;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    Receive a message
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
   public: bool receive (CANFDMessage & outMessage) ;
   public: bool available (void) ;
+
+//--- Poll the controller once (no interrupt pin) and move up to inMaxCount messages
+//    from the driver receive buffer to outMessages within a single critical section.
+//    Returns the number of messages written. outTimeStamps (if not NULL) gets the
+//    micros () of each message: its SOF from the controller time stamp if
+//    mControllerReceiveFIFOTimeStamp is set, otherwise the time it was read from
+//    the controller.
+  public: size_t receiveBurst (CANFDMessage * outMessages, const size_t inMaxCount,
+                               uint32_t * outTimeStamps = NULL) ;
   public: typedef void (*tFilterMatchCallBack) (const uint32_t inFilterIndex) ;
   public: bool dispatchReceivedMessage (const tFilterMatchCallBack inFilterMatchCallBack = NULL) ;
 
@@ -139,8 +163,23 @@ class ACAN2517FD {
   private: uint8_t mTransmitFIFOPayload ; // in byte count
   private: uint8_t mTXQBufferPayload ; // in byte count
   private: uint8_t mReceiveFIFOPayload ; // in byte count
+  private: bool mReceiveTimeStamp ; // Receive objects carry a TBC time stamp
+  private: uint16_t mTransmitFIFOAddress ; // RAM address of the first transmit FIFO object
+  private: uint8_t mTransmitFIFOObjectSize ; // in byte count
+  private: uint8_t mTransmitFIFOObjectCount ;
   private: uint8_t mTXBWS_RequestedMode ;
   private: uint8_t mHardwareReceiveBufferOverflowCount ;
+  private: uint32_t mReceivedFrameCount ;
+  private: uint32_t mSPIClock ; // Negotiated by begin
+  private: bool mUsesSPICRC ;
+  private: uint8_t * mSPICRCBuffer ;
+  private: uint32_t mSPICRCErrorCount ;
+  private: uint32_t mSPICRCWriteErrorCount ;
+  private: uint32_t mSPICRCFailureCount ;
+  private: uint32_t mRAMECCCorrectedCount ;
+  private: uint32_t mRAMECCUncorrectedCount ;
+  private: uint16_t mRAMECCErrorAddress ;
+  private: uint64_t mReceiveCycleCount ;
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    Receive buffer
@@ -148,10 +187,19 @@ class ACAN2517FD {
 
   private: ACANFDBuffer mDriverReceiveBuffer ;
 
+  public: uint32_t driverReceiveBufferCount (void) const {
+    return mDriverReceiveBuffer.count () ;
+  }
+
   public: uint32_t driverReceiveBufferPeakCount (void) const {
     return mDriverReceiveBuffer.peakCount () ;
   }
 
+//--- Received frames longer than the receive FIFO payload, stored with len clamped to the payload
+  public: uint32_t driverReceiveBufferTruncatedCount (void) const {
+    return mDriverReceiveBuffer.truncatedCount () ;
+  }
+
   public: uint8_t hardwareReceiveBufferOverflowCount (void) const {
     return mHardwareReceiveBufferOverflowCount ;
   }
@@ -178,16 +226,87 @@ class ACAN2517FD {
     return mDriverTransmitBuffer.peakCount () ;
   }
 
+  public: uint8_t transmitFIFOPayload (void) const {
+    return mTransmitFIFOPayload ;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    Receive path cost: frames read from the controller receive FIFO, and
+  //    CPU cycles spent reading them (ESP32 only, 0 otherwise)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  public: uint32_t receivedFrameCount (void) const {
+    return mReceivedFrameCount ;
+  }
+
+  public: uint64_t receiveCycleCount (void) const {
+    return mReceiveCycleCount ;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    SPI clock negotiated by begin, CRC protected SPI instructions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  public: uint32_t spiClock (void) const {
+    return mSPIClock ;
+  }
+
+  public: bool usesSPICRC (void) const {
+    return mUsesSPICRC ;
+  }
+
+//--- Reads with a CRC mismatch (each one is retried)
+  public: uint32_t spiCRCErrorCount (void) const {
+    return mSPICRCErrorCount ;
+  }
+
+//--- Instructions that still failed after all attempts (a received object is then left in the controller FIFO)
+  public: uint32_t spiCRCFailureCount (void) const {
+    return mSPICRCFailureCount ;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    Controller health: RAM ECC and SPI CRC error flags
+  // pollHealth reads and clears the ECCSTAT and CRC flags, it should be called
+  // periodically (a few register accesses). The controller only has flags, so
+  // several errors between two calls are counted once.
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  public: void pollHealth (void) ;
+
+//--- Writes discarded by the controller (CRCERRIF or FERRIF), checked after each write and retried
+  public: uint32_t spiCRCWriteErrorCount (void) const {
+    return mSPICRCWriteErrorCount ;
+  }
+
+//--- Single bit errors corrected (SECIF)
+  public: uint32_t ramECCCorrectedCount (void) const {
+    return mRAMECCCorrectedCount ;
+  }
+
+//--- Double bit errors detected (DEDIF)
+  public: uint32_t ramECCUncorrectedCount (void) const {
+    return mRAMECCUncorrectedCount ;
+  }
+
+//--- ERRADDR of the last ECC error
+  public: uint16_t ramECCErrorAddress (void) const {
+    return mRAMECCErrorAddress ;
+  }
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    Private methods
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
   private: void writeRegister32Assume_SPI_transaction (const uint16_t inRegisterAddress, const uint32_t inValue) ;
-  private: void writeRegister8Assume_SPI_transaction (const uint16_t inRegisterAddress, const uint8_t inValue) ;
+  private: bool writeRegister8Assume_SPI_transaction (const uint16_t inRegisterAddress, const uint8_t inValue) ;
 
   private: uint32_t readRegister32Assume_SPI_transaction (const uint16_t inRegisterAddress) ;
   private: uint8_t readRegister8Assume_SPI_transaction (const uint16_t inRegisterAddress) ;
   private: uint16_t readRegister16Assume_SPI_transaction (const uint16_t inRegisterAddress) ;
+  private: bool readFIFOStatusAndAddressAssume_SPI_transaction (const uint16_t inFIFOIndex,
+                                                                 uint32_t & outStatus,
+                                                                 uint16_t & outRAMAddress) ;
 
   private: void reset2517FD (void) ;
 
@@ -200,7 +319,8 @@ class ACAN2517FD {
 
   private: bool sendViaTXQ (const CANFDMessage & inMessage) ;
   private: bool enterInTransmitBuffer (const CANFDMessage & inMessage) ;
-  private: void appendInControllerTxFIFO (const CANFDMessage & inMessage) ;
+  private: bool appendInControllerTxFIFO (const CANFDMessage & inMessage) ;
+  private: size_t appendBurstInControllerTxFIFO (const CANFDMessage * inMessages, const size_t inCount) ;
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    Polling
@@ -215,7 +335,7 @@ class ACAN2517FD {
   public: void isr (void) ;
   public: void isr_poll_core (void) ;
   private: void receiveInterrupt (void) ;
-  private: void transmitInterrupt (void) ;
+  private: bool transmitInterrupt (void) ;
   #ifdef ARDUINO_ARCH_ESP32
     public: SemaphoreHandle_t mISRSemaphore ;
   #endif
@@ -331,6 +451,75 @@ class ACAN2517FD {
     }
   #endif
 
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    SPI access
+  // By default, SPIClass transfers with software CS. With ACAN2517FD_IDF_SPI
+  // (ESP32), the driver uses the IDF spi_master driver: DMA transfers, CS
+  // driven by the SPI peripheral, and the message object read of the receive
+  // path is queued together with the UINC write. Call beginIDFSPI before begin.
+  // Several controllers can share a host: each one calls beginIDFSPI with the
+  // same pins and is added to the bus as a separate device with its own CS.
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  private: void setSPIClock (const uint32_t inClock) ;
+  private: uint16_t spiCRCHeader (const uint8_t inBuffer [], const uint16_t inLength, const bool inRead) ;
+  private: void spiWriteWithCRC (const uint8_t inBuffer [], const uint16_t inLength) ;
+  private: bool spiCommandWithCRC (uint8_t ioBuffer [], const uint16_t inLength) ;
+  private: bool clearSPICRCFlags (void) ;
+
+//--- Sends a READ / WRITE instruction built in ioBuffer (2-byte command, then data), as READ_CRC / WRITE_CRC
+//    if CRC is enabled; data read is returned from ioBuffer [2]. Returns false if the CRC check failed.
+  private: inline bool spiCommand (uint8_t ioBuffer [], const uint16_t inLength) {
+    if (mUsesSPICRC) {
+      return spiCommandWithCRC (ioBuffer, inLength) ;
+    }else{
+      spiTransfer (ioBuffer, inLength) ;
+      return true ;
+    }
+  }
+
+  #ifdef ACAN2517FD_IDF_SPI
+    public: bool beginIDFSPI (const spi_host_device_t inHost,
+                              const int inSCK,
+                              const int inMISO,
+                              const int inMOSI) ;
+
+    private: spi_host_device_t mIDFHost = SPI2_HOST ;
+    private: spi_device_handle_t mIDFDevice = NULL ;
+    private: uint32_t mIDFClock = 0 ; // Clock of mIDFDevice
+    private: uint32_t mIDFRequestedClock = 0 ;
+    private: uint8_t * mIDFTxBuffer = NULL ; // DMA capable
+    private: uint8_t * mIDFRxBuffer = NULL ; // DMA capable
+    private: esp_err_t mIDFError = ESP_OK ; // Last spi_bus_add_device error
+
+//--- spi_bus_add_device error behind kIDFSPIDeviceError (ESP_ERR_INVALID_STATE if beginIDFSPI was not called)
+    public: esp_err_t idfSPIError (void) const {
+      return mIDFError ;
+    }
+
+    private: void spiBeginTransaction (void) ;
+    private: void spiEndTransaction (void) ;
+    private: void spiTransfer (uint8_t ioBuffer [], const uint16_t inLength) ;
+    private: bool spiTransferThenWrite8 (uint8_t ioBuffer [], const uint16_t inLength,
+                                         const uint16_t inRegisterAddress, const uint8_t inValue) ;
+  #else
+    private: inline void spiBeginTransaction (void) {
+      mSPI.beginTransaction (mSPISettings) ;
+    }
+    private: inline void spiEndTransaction (void) {
+      mSPI.endTransaction () ;
+    }
+    private: inline void spiTransfer (uint8_t ioBuffer [], const uint16_t inLength) {
+      assertCS () ;
+        mSPI.transfer (ioBuffer, inLength) ;
+      deassertCS () ;
+    }
+    private: inline bool spiTransferThenWrite8 (uint8_t ioBuffer [], const uint16_t inLength,
+                                                const uint16_t inRegisterAddress, const uint8_t inValue) {
+      return spiCommand (ioBuffer, inLength) && writeRegister8Assume_SPI_transaction (inRegisterAddress, inValue) ;
+    }
+  #endif
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    GPIO
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -283,7 +283,8 @@ uint32_t ACAN2517FDSettings::ramUsage (void) const {
 //--- TXQ
   result += objectSizeForPayload (mControllerTXQBufferPayload) * mControllerTXQSize ;
 //--- Receive FIFO (FIFO #1)
-  result += objectSizeForPayload (mControllerReceiveFIFOPayload) * mControllerReceiveFIFOSize ;
+  result += (objectSizeForPayload (mControllerReceiveFIFOPayload) + (mControllerReceiveFIFOTimeStamp ? 4 : 0))
+          * mControllerReceiveFIFOSize ;
 //--- Send FIFO (FIFO #2)
   result += objectSizeForPayload (mControllerTransmitFIFOPayload) * mControllerTransmitFIFOSize ;
 //---
@@ -298,3 +299,9 @@ uint32_t ACAN2517FDSettings::objectSizeForPayload (const PayloadSize inPayload)
 }
 
 //------------------------------------------------------------------------------
+
+uint32_t ACAN2517FDSettings::payloadForPayloadSize (const PayloadSize inPayload) {
+  return objectSizeForPayload (inPayload) - 8 ; // 8 header bytes per message object
+}
+
+//------------------------------------------------------------------------------
@@ -143,6 +143,26 @@ class ACAN2517FDSettings {
 // true --> Include Stuff Bit Count in CRC Field and use Non-Zero CRC Initialization Vector according to ISO 11898-1:2015
   public: bool mISOCRCEnabled = true ;
 
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    SPI clock and CRC protected SPI instructions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Fastest SPI clock tried by begin, 0 --> SYSCLK * 2 / 5. While the full speed read-back test fails, begin lowers
+// the clock by 1/5, down to SYSCLK * 2 / 5 (the negotiated clock is returned by ACAN2517FD::spiClock)
+  public: uint32_t mSPIClock = 0 ;
+
+// true --> all register and RAM accesses use READ_CRC / WRITE_CRC: reads with a CRC mismatch are retried and
+// counted, writes with a CRC mismatch are discarded by the controller (CRCERRIF)
+  public: bool mSPICRCEnabled = false ;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  //    RAM ECC
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// true --> begin enables ECC and clears the whole RAM (a word never written since power-up would be reported as
+// an error); corrected and uncorrected errors are counted by ACAN2517FD::pollHealth
+  public: bool mRAMECCEnabled = false ;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    CLKO pin function (default value is MCP2517FD power on setting)
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -204,6 +224,10 @@ class ACAN2517FDSettings {
 //--- Controller receive FIFO size
   public: uint8_t mControllerReceiveFIFOSize = 27 ; // 1 ... 32
 
+//--- Receive FIFO time stamp: each received object carries the TBC value at SOF (1 µs ticks),
+//    which receiveBurst converts to micros (). Adds 4 bytes per receive FIFO object in RAM.
+  public: bool mControllerReceiveFIFOTimeStamp = false ;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    SYSCLOCK frequency computation
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -230,6 +254,9 @@ class ACAN2517FDSettings {
 
   public: static uint32_t objectSizeForPayload (const PayloadSize inPayload) ;
 
+//--- Data bytes of a message object
+  public: static uint32_t payloadForPayloadSize (const PayloadSize inPayload) ;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   //    Distance between actual bit rate and requested bit rate (in ppm, part-per-million)
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -14,6 +14,58 @@
 
 //------------------------------------------------------------------------------
 
+//    ACANFDSlot: one buffer entry, data sized for the FIFO payload
+//------------------------------------------------------------------------------
+// A full CANFDMessage is 72 bytes; a slot for classic CAN frames is 20 bytes,
+// so the same RAM holds 3.6 times more frames, and append / remove only copy
+// the bytes actually used by the frame.
+// A frame longer than the payload given to initWithSize (the controller truncates
+// it too) is stored with len clamped to that payload, so load never returns bytes
+// that were not received; the buffer counts these frames (truncatedCount).
+// Each slot also keeps the receive time stamp of its frame (micros ()).
+
+template <uint8_t PAYLOAD> class ACANFDSlot {
+  public: uint32_t timeStamp ;
+  public: uint32_t id ;
+  public: bool ext ;
+  public: CANFDMessage::Type type ;
+  public: uint8_t idx ;
+  public: uint8_t len ;
+  public: uint32_t data32 [(PAYLOAD + 3) / 4] ;
+
+  public: inline void store (const CANFDMessage & inMessage, const uint32_t inTimeStamp, const uint8_t inLength) {
+    timeStamp = inTimeStamp ;
+    id = inMessage.id ;
+    ext = inMessage.ext ;
+    type = inMessage.type ;
+    idx = inMessage.idx ;
+    len = inLength ; // <= PAYLOAD
+    const uint32_t wordCount = (len + 3) / 4 ;
+    for (uint32_t i=0 ; i < wordCount ; i++) {
+      data32 [i] = inMessage.data32 [i] ;
+    }
+  }
+
+  public: inline void load (CANFDMessage & outMessage, uint32_t & outTimeStamp) const {
+    outTimeStamp = timeStamp ;
+    outMessage.id = id ;
+    outMessage.ext = ext ;
+    outMessage.type = type ;
+    outMessage.idx = idx ;
+    outMessage.len = len ;
+    const uint32_t wordCount = (len + 3) / 4 ;
+    for (uint32_t i=0 ; i < wordCount ; i++) {
+      outMessage.data32 [i] = data32 [i] ;
+    }
+  }
+} ;
+
+//------------------------------------------------------------------------------
+//    ACANFDBuffer
+//------------------------------------------------------------------------------
+// The slot size is selected by initWithSize from the controller FIFO payload:
+// 8 (classic CAN), 16, or 64 bytes.
+
 class ACANFDBuffer {
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -23,9 +75,12 @@ class ACANFDBuffer {
   public: ACANFDBuffer (void)  :
   mBuffer (NULL),
   mSize (0),
+  mPayload (64),
+  mMaxLength (64),
   mReadIndex (0),
   mCount (0),
-  mPeakCount (0) {
+  mPeakCount (0),
+  mTruncatedCount (0) {
   }
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -40,11 +95,14 @@ class ACANFDBuffer {
   // Private properties
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  private: CANFDMessage * mBuffer ;
+  private: uint32_t * mBuffer ; // Word aligned slot storage
   private: uint32_t mSize ;
+  private: uint8_t mPayload ; // 8, 16 or 64
+  private: uint8_t mMaxLength ; // Payload given to initWithSize, longer frames are truncated
   private: uint32_t mReadIndex ;
   private: uint32_t mCount ;
   private: uint32_t mPeakCount ; // > mSize if overflow did occur
+  private: uint32_t mTruncatedCount ; // Frames longer than the slot payload
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Accessors
@@ -54,31 +112,74 @@ class ACANFDBuffer {
   public: inline uint32_t count (void) const { return mCount ; }
   public: inline bool isFull (void) const { return mCount == mSize ; } // Added in release 2.17 (thanks to Flole998)
   public: inline uint32_t peakCount (void) const { return mPeakCount ; }
+  public: inline uint8_t payload (void) const { return mPayload ; }
+  public: inline uint32_t truncatedCount (void) const { return mTruncatedCount ; }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Slot size for a payload (bytes)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  public: static uint32_t slotSizeForPayload (const uint32_t inPayload) {
+    if (inPayload <= 8) {
+      return sizeof (ACANFDSlot <8>) ;
+    }else if (inPayload <= 16) {
+      return sizeof (ACANFDSlot <16>) ;
+    }else{
+      return sizeof (ACANFDSlot <64>) ;
+    }
+  }
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // initWithSize
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  public: void initWithSize (const uint32_t inSize) {
-    delete [] mBuffer ; mBuffer = new CANFDMessage [inSize] ;
+  public: void initWithSize (const uint32_t inSize, const uint32_t inPayload = 64) {
+    mPayload = (inPayload <= 8) ? 8 : ((inPayload <= 16) ? 16 : 64) ;
+    mMaxLength = (inPayload < 64) ? uint8_t (inPayload) : 64 ;
+    delete [] mBuffer ;
+    mBuffer = new uint32_t [inSize * slotSizeForPayload (mPayload) / 4] ;
     mSize = inSize ;
     mReadIndex = 0 ;
     mCount = 0 ;
     mPeakCount = 0 ;
+    mTruncatedCount = 0 ;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Slot access
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  private: template <uint8_t PAYLOAD> inline ACANFDSlot <PAYLOAD> * slot (const uint32_t inIndex) const {
+    return ((ACANFDSlot <PAYLOAD> *) mBuffer) + inIndex ;
   }
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // append
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  public: bool append (const CANFDMessage & inMessage) {
+  public: bool append (const CANFDMessage & inMessage, const uint32_t inTimeStamp = 0) {
     const bool ok = mCount < mSize ;
     if (ok) {
       uint32_t writeIndex = mReadIndex + mCount ;
       if (writeIndex >= mSize) {
         writeIndex -= mSize ;
       }
-      mBuffer [writeIndex] = inMessage ;
+      uint8_t length = inMessage.len ;
+      if (length > mMaxLength) {
+        length = mMaxLength ;
+        mTruncatedCount += 1 ;
+      }
+      switch (mPayload) {
+      case 8 :
+        slot <8> (writeIndex)->store (inMessage, inTimeStamp, length) ;
+        break ;
+      case 16 :
+        slot <16> (writeIndex)->store (inMessage, inTimeStamp, length) ;
+        break ;
+      default :
+        slot <64> (writeIndex)->store (inMessage, inTimeStamp, length) ;
+        break ;
+      }
       mCount += 1 ;
       if (mPeakCount < mCount) {
         mPeakCount = mCount ;
@@ -94,16 +195,49 @@ class ACANFDBuffer {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
   public: bool remove (CANFDMessage & outMessage) {
+    uint32_t timeStamp ;
+    return remove (outMessage, timeStamp) ;
+  }
+
+  public: bool remove (CANFDMessage & outMessage, uint32_t & outTimeStamp) {
+    const bool ok = peek (outMessage, outTimeStamp) ;
+    if (ok) {
+      dropFirst () ;
+    }
+    return ok ;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Peek / dropFirst: the first message is removed only once it has been handled
+  // (the transmit interrupt keeps it if its write into the controller failed)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  public: bool peek (CANFDMessage & outMessage, uint32_t & outTimeStamp) const {
     const bool ok = mCount > 0 ;
     if (ok) {
-      outMessage = mBuffer [mReadIndex] ;
+      switch (mPayload) {
+      case 8 :
+        slot <8> (mReadIndex)->load (outMessage, outTimeStamp) ;
+        break ;
+      case 16 :
+        slot <16> (mReadIndex)->load (outMessage, outTimeStamp) ;
+        break ;
+      default :
+        slot <64> (mReadIndex)->load (outMessage, outTimeStamp) ;
+        break ;
+      }
+    }
+    return ok ;
+  }
+
+  public: void dropFirst (void) {
+    if (mCount > 0) {
       mCount -= 1 ;
       mReadIndex += 1 ;
       if (mReadIndex == mSize) {
         mReadIndex = 0 ;
       }
     }
-    return ok ;
   }
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
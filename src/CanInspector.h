@@ -1,11 +1,18 @@
+#pragma once
+
 #include <ACAN2517FD.h>
+#include "bus_config.h"
 
 extern ACAN2517FD can ;
-extern ACAN2517FDSettings settings 
+extern BusConfigService busConfig ;
+
+/**
+ * 设置mcp2518的工作模式 ACAN2517FDSettings::OperationMode
+ * 新的模式由采集任务重新初始化mcp2518后生效，并保存到flash
+ * @return 模式不合法返回false
+ */
 bool setCanWorkMode(uint8_t mode) {
 
-    //ACAN2517FDSettings settings (ACAN2517FDSettings::OSC_40MHz, 500 * 1000, DataBitRateFactor::x1) ;
-    settings.mRequestedMode = mode ;
-    
-    
-}
\ No newline at end of file
+    return busConfig.setCanMode(mode) ;
+
+}
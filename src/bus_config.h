@@ -0,0 +1,503 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <ACAN2517FD.h>
+#include "config.h"
+#include "can_filter.h"
+#include "can_channels.h"
+#include "can_twai.h"
+
+/**
+ * 总线配置服务
+ *
+ * CAN波特率、数据段倍率、工作模式以及LIN/K-Line波特率不再是编译期常量，
+ * 菜单和串口命令都通过BusConfigService修改配置：
+ * 1.设置时先校验(CAN使用ACAN2517FDSettings::CANBitSettingConsistency)，不合法直接返回false
+ * 2.合法的配置先放入pending，由采集任务(loop)调用service()时只重新初始化有修改的总线
+ * 3.生效的配置和flash(NVS)中保存的不同时才写入flash，下次开机自动加载；
+ *   开机加载和自动波特率检测后的重新初始化不会重复写flash
+ * 其他CAN通道(第二个MCP2518)使用和can相同的CAN配置，在CAN配置生效时一起重新初始化。
+ * 片上TWAI控制器是单独的一条经典CAN总线，有自己的波特率和模式。
+ *
+ * 限制：CAN配置生效时，end()/begin()(包括SPI时钟协商和模式切换的等待)在采集任务中阻塞执行，
+ * 这段时间所有MCP2518通道都不被轮询，接着其他通道也用同样的配置重新初始化，所以CAN配置修改会让
+ * 每个MCP2518通道的采集中断一次，耗时由bus命令的"reinit"给出。LIN/K-Line由UART缓冲，
+ * TWAI由自己的读取任务接收，修改CAN配置时继续采集；只修改LIN/K-Line/TWAI时不会访问MCP2518。
+ */
+
+// 需要重新初始化的总线
+static const uint8_t BUS_CONFIG_CAN   = 1 << 0;
+static const uint8_t BUS_CONFIG_LIN   = 1 << 1;
+static const uint8_t BUS_CONFIG_KLINE = 1 << 2;
+static const uint8_t BUS_CONFIG_TWAI  = 1 << 3;
+
+// 菜单中可选的配置值，与标签一一对应
+static const uint32_t bus_config_can_rates[] = {125000, 250000, 500000, 1000000};
+static const char * const bus_config_can_rate_labels[] = {"125k", "250k", "500k", "1M"};
+
+static const uint8_t bus_config_data_factors[] = {1, 2, 4, 8};
+static const char * const bus_config_data_factor_labels[] = {"x1", "x2", "x4", "x8"};
+
+static const uint8_t bus_config_can_modes[] = {
+  ACAN2517FDSettings::NormalFD,
+  ACAN2517FDSettings::Normal20B,
+  ACAN2517FDSettings::ListenOnly,
+  ACAN2517FDSettings::InternalLoopBack,
+  ACAN2517FDSettings::ExternalLoopBack
+};
+static const char * const bus_config_can_mode_labels[] = {"FD", "2.0B", "Listen", "IntLoop", "ExtLoop"};
+
+static const uint32_t bus_config_lin_bauds[] = {2400, 9600, 10417, 19200};
+static const char * const bus_config_lin_baud_labels[] = {"2400", "9600", "10417", "19200"};
+
+static const uint32_t bus_config_kline_bauds[] = {9600, 10400};
+static const char * const bus_config_kline_baud_labels[] = {"9600", "10400"};
+
+// 在数组中查找配置值，没找到返回0
+template <typename T, size_t N>
+int bus_config_index_of(const T (&table)[N], uint32_t value) {
+  for (size_t i = 0; i < N; i++) {
+    if (table[i] == value) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+typedef struct {
+  uint32_t can_bitrate;      // CAN仲裁段波特率
+  uint8_t can_data_factor;   // CAN FD数据段倍率 1...10
+  uint8_t can_mode;          // MCP2518工作模式 ACAN2517FDSettings::OperationMode
+  uint32_t lin_baud;         // LIN波特率
+  uint32_t kline_baud;       // K-Line波特率
+  uint32_t twai_bitrate;     // TWAI波特率
+  uint8_t twai_mode;         // TWAI工作模式 twai_mode_t
+} bus_config_t;
+
+class BusConfigService {
+private:
+  static const uint8_t kVersion = 2;   // 保存在flash中的配置格式版本
+
+  ACAN2517FD & mCAN;
+  HardwareSerial & mLinSerial;
+  HardwareSerial & mKLineSerial;
+  Preferences mPrefs;
+
+  bus_config_t mActive;              // 已经生效的配置
+  bus_config_t mPending;             // 等待生效的配置
+  bus_config_t mStored;              // flash中保存的配置
+  bool mStoredValid;                 // mStored是否有效(flash中没有配置时为false)
+  uint32_t mLastCanReinitUs;         // 最近一次CAN重新初始化阻塞采集任务的时间
+  volatile uint8_t mPendingMask;     // 等待重新初始化的总线
+  uint32_t mLastCanError;            // 最近一次can.begin的错误码
+  bool mCanStarted;
+  CanFilter * mFilter;               // 接收过滤器，重新初始化MCP2518时生效
+  volatile bool mAcceptAll;          // 网关有转发路由：MCP2518不使用硬件过滤器
+  CanChannels * mChannels;           // 多控制器采集，通道0是mCAN
+  CanTwai * mTwai;                   // 片上TWAI控制器，没有使用时为NULL
+  portMUX_TYPE mMux;
+
+  // 修改pending配置并标记需要重新初始化的总线
+  template <typename F>
+  void stage(uint8_t bus, F change) {
+    portENTER_CRITICAL(&mMux);
+    change(mPending);
+    mPendingMask |= bus;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+public:
+  BusConfigService(ACAN2517FD & can, HardwareSerial & linSerial, HardwareSerial & klineSerial) :
+    mCAN(can), mLinSerial(linSerial), mKLineSerial(klineSerial) {
+    mActive = defaults();
+    mPending = mActive;
+    mPendingMask = 0;
+    mStored = mActive;
+    mStoredValid = false;
+    mLastCanReinitUs = 0;
+    mLastCanError = 0;
+    mCanStarted = false;
+    mFilter = NULL;
+    mAcceptAll = false;
+    mChannels = NULL;
+    mTwai = NULL;
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+  }
+
+  void setFilter(CanFilter * filter) {
+    mFilter = filter;
+  }
+
+  void setChannels(CanChannels * channels) {
+    mChannels = channels;
+  }
+
+  void setTwai(CanTwai * twai) {
+    mTwai = twai;
+  }
+
+  /**
+   * 网关有转发路由时MCP2518接收所有帧，白名单只过滤采集，不影响转发；变化时重新初始化CAN
+   * @return 设置有变化时返回true
+   */
+  bool setAcceptAll(bool acceptAll) {
+    if (acceptAll == mAcceptAll) {
+      return false;
+    }
+    mAcceptAll = acceptAll;
+    requestCanReinit();
+    return true;
+  }
+
+  // 编译期的默认配置(config.h)
+  static bus_config_t defaults() {
+    bus_config_t cfg;
+    cfg.can_bitrate = CAN_DEFAULT_BITRATE;
+    cfg.can_data_factor = CAN_DEFAULT_DATA_FACTOR;
+    cfg.can_mode = MCP2518_DEFAULT_WORK_MODE;
+    cfg.lin_baud = LIN_DEFAULT_BAUD;
+    cfg.kline_baud = KLINE_DEFAULT_BAUD;
+    cfg.twai_bitrate = TWAI_DEFAULT_BITRATE;
+    cfg.twai_mode = TWAI_DEFAULT_MODE;
+    return cfg;
+  }
+
+  /**
+   * 检查CAN配置是否可以用于MCP2518
+   * @return 0表示合法，否则为CANBitSettingConsistency()的错误位，
+   *         或ACAN2517FD::kTooFarFromDesiredBitRate
+   */
+  static uint32_t validateCan(const bus_config_t & cfg) {
+    if (cfg.can_data_factor < 1 || cfg.can_data_factor > 10) {
+      return ACAN2517FD::kInconsistentBitRateSettings;
+    }
+    ACAN2517FDSettings s(MCP2518_OSCILLATOR, cfg.can_bitrate, DataBitRateFactor(cfg.can_data_factor));
+    if (!s.mArbitrationBitRateClosedToDesiredRate) {
+      return ACAN2517FD::kTooFarFromDesiredBitRate;
+    }
+    return s.CANBitSettingConsistency();
+  }
+
+  static bool validMode(uint8_t mode) {
+    return mode == ACAN2517FDSettings::NormalFD || mode == ACAN2517FDSettings::Normal20B
+        || mode == ACAN2517FDSettings::ListenOnly || mode == ACAN2517FDSettings::InternalLoopBack
+        || mode == ACAN2517FDSettings::ExternalLoopBack;
+  }
+
+  static bool validLinBaud(uint32_t baud) {
+    return baud >= 1000 && baud <= 20000;
+  }
+
+  static bool validKLineBaud(uint32_t baud) {
+    return baud >= 1200 && baud <= 115200;
+  }
+
+  static bool same(const bus_config_t & a, const bus_config_t & b) {
+    return a.can_bitrate == b.can_bitrate && a.can_data_factor == b.can_data_factor && a.can_mode == b.can_mode
+        && a.lin_baud == b.lin_baud && a.kline_baud == b.kline_baud
+        && a.twai_bitrate == b.twai_bitrate && a.twai_mode == b.twai_mode;
+  }
+
+  // 检查整个配置，所有总线的配置都合法时返回true
+  static bool validate(const bus_config_t & cfg) {
+    return validateCan(cfg) == 0 && validMode(cfg.can_mode)
+        && validLinBaud(cfg.lin_baud) && validKLineBaud(cfg.kline_baud)
+        && CanTwai::validBitRate(cfg.twai_bitrate) && CanTwai::validMode(cfg.twai_mode);
+  }
+
+  // 从flash加载配置，没有保存过或版本不一致时使用默认配置
+  void load() {
+    bus_config_t cfg = defaults();
+    mStoredValid = false;
+    if (mPrefs.begin("bus_config", true)) {
+      if (mPrefs.getUChar("version", 0) == kVersion
+          && mPrefs.getBytesLength("config") == sizeof(cfg)) {
+        mPrefs.getBytes("config", &cfg, sizeof(cfg));
+        mStoredValid = true;
+      }
+      mPrefs.end();
+    }
+    if (!validate(cfg)) {
+      cfg = defaults();
+      mStoredValid = false;
+    }
+    mStored = cfg;
+    portENTER_CRITICAL(&mMux);
+    mPending = cfg;
+    mPendingMask = BUS_CONFIG_CAN | BUS_CONFIG_LIN | BUS_CONFIG_KLINE | BUS_CONFIG_TWAI;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  // 保存当前生效的配置到flash
+  bool save() {
+    if (!mPrefs.begin("bus_config", false)) {
+      return false;
+    }
+    bus_config_t cfg = active();
+    mPrefs.putUChar("version", kVersion);
+    bool ok = mPrefs.putBytes("config", &cfg, sizeof(cfg)) == sizeof(cfg);
+    mPrefs.end();
+    if (ok) {
+      mStored = cfg;
+      mStoredValid = true;
+    }
+    return ok;
+  }
+
+  /**
+   * 一次修改多个配置：整个配置先作为一个整体校验，只重新初始化有变化的总线
+   * @return 配置不合法时返回false，pending配置不变
+   */
+  bool setConfig(const bus_config_t & cfg) {
+    if (!validate(cfg)) {
+      return false;
+    }
+    portENTER_CRITICAL(&mMux);
+    uint8_t mask = 0;
+    if (cfg.can_bitrate != mPending.can_bitrate || cfg.can_data_factor != mPending.can_data_factor
+        || cfg.can_mode != mPending.can_mode) {
+      mask |= BUS_CONFIG_CAN;
+    }
+    if (cfg.lin_baud != mPending.lin_baud) {
+      mask |= BUS_CONFIG_LIN;
+    }
+    if (cfg.kline_baud != mPending.kline_baud) {
+      mask |= BUS_CONFIG_KLINE;
+    }
+    if (cfg.twai_bitrate != mPending.twai_bitrate || cfg.twai_mode != mPending.twai_mode) {
+      mask |= BUS_CONFIG_TWAI;
+    }
+    mPending = cfg;
+    mPendingMask |= mask;
+    portEXIT_CRITICAL(&mMux);
+    return true;
+  }
+
+  bool setCanBitRate(uint32_t bitrate) {
+    bus_config_t cfg = pending();
+    cfg.can_bitrate = bitrate;
+    if (validateCan(cfg) != 0) {
+      return false;
+    }
+    stage(BUS_CONFIG_CAN, [bitrate](bus_config_t & p) { p.can_bitrate = bitrate; });
+    return true;
+  }
+
+  bool setCanDataFactor(uint8_t factor) {
+    bus_config_t cfg = pending();
+    cfg.can_data_factor = factor;
+    if (validateCan(cfg) != 0) {
+      return false;
+    }
+    stage(BUS_CONFIG_CAN, [factor](bus_config_t & p) { p.can_data_factor = factor; });
+    return true;
+  }
+
+  bool setCanMode(uint8_t mode) {
+    if (!validMode(mode)) {
+      return false;
+    }
+    stage(BUS_CONFIG_CAN, [mode](bus_config_t & p) { p.can_mode = mode; });
+    return true;
+  }
+
+  bool setLinBaud(uint32_t baud) {
+    if (!validLinBaud(baud)) {
+      return false;
+    }
+    stage(BUS_CONFIG_LIN, [baud](bus_config_t & p) { p.lin_baud = baud; });
+    return true;
+  }
+
+  bool setKLineBaud(uint32_t baud) {
+    if (!validKLineBaud(baud)) {
+      return false;
+    }
+    stage(BUS_CONFIG_KLINE, [baud](bus_config_t & p) { p.kline_baud = baud; });
+    return true;
+  }
+
+  bool setTwaiBitRate(uint32_t bitrate) {
+    if (!CanTwai::validBitRate(bitrate)) {
+      return false;
+    }
+    stage(BUS_CONFIG_TWAI, [bitrate](bus_config_t & p) { p.twai_bitrate = bitrate; });
+    return true;
+  }
+
+  bool setTwaiMode(uint8_t mode) {
+    if (!CanTwai::validMode(mode)) {
+      return false;
+    }
+    stage(BUS_CONFIG_TWAI, [mode](bus_config_t & p) { p.twai_mode = mode; });
+    return true;
+  }
+
+  // 不修改配置，只要求按pending配置重新初始化MCP2518(例如自动波特率检测结束后恢复工作模式)
+  void requestCanReinit() {
+    stage(BUS_CONFIG_CAN, [](bus_config_t &) {});
+  }
+
+  // 当前生效的配置
+  bus_config_t active() {
+    portENTER_CRITICAL(&mMux);
+    bus_config_t cfg = mActive;
+    portEXIT_CRITICAL(&mMux);
+    return cfg;
+  }
+
+  // 将要生效的配置(包含还没有生效的修改)
+  bus_config_t pending() {
+    portENTER_CRITICAL(&mMux);
+    bus_config_t cfg = mPending;
+    portEXIT_CRITICAL(&mMux);
+    return cfg;
+  }
+
+  bool hasPending() {
+    return mPendingMask != 0;
+  }
+
+  uint32_t lastCanError() {
+    return mLastCanError;
+  }
+
+  uint32_t lastCanReinitUs() {
+    return mLastCanReinitUs;
+  }
+
+  // 由配置生成MCP2518的初始化参数，所有CAN通道相同
+  static ACAN2517FDSettings canSettings(const bus_config_t & cfg) {
+    ACAN2517FDSettings s(MCP2518_OSCILLATOR, cfg.can_bitrate, DataBitRateFactor(cfg.can_data_factor));
+    s.mRequestedMode = ACAN2517FDSettings::OperationMode(cfg.can_mode);
+    // TXQ由周期发送使用，优先级高于发送FIFO
+    s.mControllerTXQSize = CAN_TXQ_SIZE;
+    s.mControllerReceiveFIFOSize = CAN_RX_FIFO_SIZE;
+    s.mControllerTransmitFIFOSize = CAN_TX_FIFO_SIZE;
+    s.mDriverReceiveFIFOSize = CAN_DRIVER_RX_SIZE;
+    // 每帧带控制器在SOF时的时间戳，采集任务的轮询周期不影响帧间隔
+    s.mControllerReceiveFIFOTimeStamp = true;
+    // SPI时钟由begin()从MCP2517_SPI_SPEED开始协商，CRC指令保证读写不会静默出错
+    s.mSPIClock = MCP2517_SPI_SPEED;
+    s.mSPICRCEnabled = MCP2517_SPI_CRC;
+    s.mRAMECCEnabled = MCP2517_RAM_ECC;
+    // 经典CAN只有8字节数据：控制器对象和驱动缓冲区都按8字节分配，同样的内存中可以保存更多的帧
+    if (cfg.can_mode == ACAN2517FDSettings::Normal20B) {
+      s.mControllerTXQBufferPayload = ACAN2517FDSettings::PAYLOAD_8;
+      s.mControllerTransmitFIFOPayload = ACAN2517FDSettings::PAYLOAD_8;
+      s.mControllerReceiveFIFOPayload = ACAN2517FDSettings::PAYLOAD_8;
+      s.mControllerReceiveFIFOSize = CAN_RX_FIFO_SIZE_CLASSIC;
+      s.mControllerTransmitFIFOSize = CAN_TX_FIFO_SIZE_CLASSIC;
+      s.mDriverReceiveFIFOSize = CAN_DRIVER_RX_SIZE * ACANFDBuffer::slotSizeForPayload(64) / ACANFDBuffer::slotSizeForPayload(8);
+    }
+    return s;
+  }
+
+  /**
+   * 按配置重新初始化MCP2518，不影响LIN和K-Line
+   * @param filtered - 使用接收过滤器的白名单，自动波特率检测时需要接收所有帧
+   * @return can.begin的错误码，0表示成功
+   */
+  uint32_t applyCan(const bus_config_t & cfg, bool filtered = true) {
+    ACAN2517FDSettings s = canSettings(cfg);
+    if (mCanStarted) {
+      mCAN.end();
+    }
+    ACAN2517FDFilters filters;
+    if (filtered && mFilter != NULL && mFilter->apply(filters, !mAcceptAll) > 0) {
+      mLastCanError = mCAN.begin(s, NULL, filters);
+    } else {
+      mLastCanError = mCAN.begin(s, NULL);
+    }
+    mCanStarted = true;
+    if (mChannels != NULL) {
+      mChannels->setError(0, mLastCanError);
+      mChannels->setBitRates(s.actualArbitrationBitRate(), s.actualDataBitRate());
+    }
+    return mLastCanError;
+  }
+
+  /**
+   * 按配置重新初始化通道0以外的MCP2518，使用和can相同的配置和接收过滤器
+   * 初始化失败的通道不再采集，下次CAN配置生效时重试
+   */
+  void applyChannels(const bus_config_t & cfg) {
+    if (mChannels == NULL || mChannels->count() < 2) {
+      return;
+    }
+    ACAN2517FDSettings s = canSettings(cfg);
+    ACAN2517FDFilters filters;
+    bool filtered = mFilter != NULL && mFilter->apply(filters, !mAcceptAll) > 0;
+    for (uint8_t channel = 1; channel < mChannels->count(); channel++) {
+      uint32_t error = mChannels->restart(channel, s, filtered ? &filters : NULL);
+      if (error != 0) {
+        Serial.printf("|error:can%u config failed, error code 0x%x\n", channel, error);
+      }
+    }
+  }
+
+  /**
+   * 在采集任务(loop)中调用：对有修改的总线重新初始化，并保存生效后的配置
+   * 只有拥有总线的采集任务才会访问控制器，所以不需要和接收代码互斥
+   */
+  void service() {
+    if (mPendingMask == 0) {
+      return;
+    }
+    portENTER_CRITICAL(&mMux);
+    uint8_t mask = mPendingMask;
+    bus_config_t cfg = mPending;
+    mPendingMask = 0;
+    portEXIT_CRITICAL(&mMux);
+
+    bool ok = true;
+    if (mask & BUS_CONFIG_CAN) {
+      uint32_t start = micros();
+      if (applyCan(cfg) != 0) {
+        ok = false;
+        Serial.printf("|error:can config failed, error code 0x%x\n", mLastCanError);
+      }
+      applyChannels(cfg);
+      mLastCanReinitUs = micros() - start;
+    }
+    if (mask & BUS_CONFIG_LIN) {
+      mLinSerial.updateBaudRate(cfg.lin_baud);
+    }
+    if (mask & BUS_CONFIG_KLINE) {
+      mKLineSerial.updateBaudRate(cfg.kline_baud);
+    }
+    bool twaiOk = true;
+    // 这里只校验参数，驱动由TWAI的读取任务启动，启动失败时由CanTwai::poll()输出错误
+    if ((mask & BUS_CONFIG_TWAI) && mTwai != NULL) {
+      esp_err_t err = mTwai->begin(cfg.twai_bitrate, cfg.twai_mode);
+      if (err != ESP_OK) {
+        twaiOk = false;
+        Serial.printf("|error:twai config failed, error code 0x%x\n", err);
+      }
+    }
+
+    portENTER_CRITICAL(&mMux);
+    bus_config_t previous = mActive;
+    if (ok) {
+      mActive = cfg;
+    } else {
+      // CAN初始化失败时只保留LIN/K-Line/TWAI的修改
+      mActive.lin_baud = cfg.lin_baud;
+      mActive.kline_baud = cfg.kline_baud;
+      mActive.twai_bitrate = cfg.twai_bitrate;
+      mActive.twai_mode = cfg.twai_mode;
+    }
+    if (!twaiOk) {
+      mActive.twai_bitrate = previous.twai_bitrate;
+      mActive.twai_mode = previous.twai_mode;
+    }
+    bool changed = !mStoredValid || !same(mStored, mActive);
+    portEXIT_CRITICAL(&mMux);
+
+    // 只有生效的配置和flash中的不同时才写入，减少flash的擦写
+    if (changed) {
+      save();
+    }
+  }
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+
+// #define CAN_DATA 1;
+// #define K_LINE_DATA 2;
+// #define LIN_DATA 3;
+
+
+typedef struct {
+  uint8_t data_len;
+  char * data;
+  uint8_t status;       // LIN_FRAME_xxx
+} lin_bus_data;
+
+typedef struct {
+  uint8_t data_len;
+  char * data;
+} kline_bus_data;
+
+
+
+typedef enum {
+  CAN_DATA = 1,
+  K_LINE_DATA = 2,
+  LIN_DATA = 3
+} data_type;
+
+//所有的总线数据都使用data_t结构体保存，通过type来区分数据来源
+typedef struct {
+  data_type type;
+  void * obj;
+  uint32_t timestamp;   // 采集时间(us)
+  uint8_t channel;      // CAN通道(MCP2518)，其他总线为0
+} data_t;
+
+
+/**
+ * 从串口读到的LIN原始数据中定位一帧：跳过break产生的0x00，找到SYNC(0x55)，
+ * 后面一个字节是PID(低6位为帧ID)，其余为数据场。
+ * @return 找到帧返回true，并输出帧ID、数据起始指针和数据长度(含校验字节)
+ */
+static inline bool lin_locate_frame(const uint8_t * raw, uint8_t raw_len,
+                                    uint8_t & frame_id, const uint8_t * & data, uint8_t & data_len) {
+  for (uint8_t i = 0; i + 1 < raw_len; i++) {
+    if (raw[i] == 0x55) {
+      frame_id = raw[i + 1] & 0x3F;
+      data = raw + i + 2;
+      data_len = raw_len - i - 2;
+      return true;
+    }
+  }
+  return false;
+}
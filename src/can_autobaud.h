@@ -0,0 +1,229 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "bus_config.h"
+
+/**
+ * CAN自动波特率检测
+ *
+ * MCP2518工作在ListenOnly模式下不会发送ACK和错误帧，所以检测过程不会干扰车辆总线。
+ * 检测分两步，每个候选配置监听AUTOBAUD_DWELL_MS：
+ * 1.仲裁段：依次尝试125k/250k/500k/1M(数据段x1)，按收到的有效帧数减去接收错误计数打分，
+ *   收到足够多的帧且没有错误时提前结束
+ * 2.数据段：仲裁段最佳配置下出现数据段错误(总线上有BRS的FD帧)时，再依次尝试x2/x4/x8
+ * 最差情况下约1.4秒完成，结束后把结果提交给BusConfigService，按原来的工作模式立即重新初始化并保存
+ *
+ * 检测过程是非阻塞的状态机，在采集任务(loop)中调用service()，检测期间LIN/K-Line继续采集
+ */
+
+#define AUTOBAUD_DWELL_MS      200   // 每个候选配置的监听时间
+#define AUTOBAUD_LOCK_FRAMES   20    // 收到这么多帧且没有错误时直接锁定，不再尝试其他仲裁段波特率
+
+// BDIAG1中仲裁段/数据段的错误标志
+static const uint32_t AUTOBAUD_NOMINAL_ERROR_FLAGS = 0x003F0000;  // NBIT0/NBIT1/NACK/NFORM/NSTUF/NCRC
+static const uint32_t AUTOBAUD_DATA_ERROR_FLAGS    = 0x3B000000;  // DBIT0/DBIT1/DFORM/DSTUF/DCRC
+
+class CanAutoBaud {
+private:
+  enum State { IDLE, SWEEP_ARBITRATION, SWEEP_DATA };
+
+  // 一个候选配置的监听结果
+  struct Score {
+    uint32_t frames;        // 收到的有效帧
+    uint32_t brsFrames;     // 其中带BRS的FD帧
+    uint32_t errors;        // 仲裁段接收错误
+    uint32_t dataErrors;    // 数据段接收错误
+
+    int32_t arbitration() const { return (int32_t)frames - (int32_t)errors; }
+    int32_t data() const { return (int32_t)brsFrames - (int32_t)dataErrors; }
+  };
+
+  BusConfigService & mConfig;
+  ACAN2517FD & mCAN;
+  volatile bool mRequested;       // UI任务请求开始检测
+  State mState;
+  uint8_t mCandidate;             // 当前候选配置在候选表中的序号
+  uint32_t mCandidateStart;       // 当前候选配置开始监听的时间
+  Score mCurrent;
+  Score mBest;
+  uint32_t mBestBitrate;
+  uint8_t mBestFactor;
+  bool mLastSucceeded;
+  volatile uint32_t mCompleted;   // 完成的检测次数，UI用来判断是否需要刷新菜单
+
+  // 以ListenOnly模式按候选配置重新初始化MCP2518，并清空计分
+  void beginCandidate(uint32_t bitrate, uint8_t factor, uint32_t now) {
+    bus_config_t cfg = mConfig.pending();
+    cfg.can_bitrate = bitrate;
+    cfg.can_data_factor = factor;
+    cfg.can_mode = ACAN2517FDSettings::ListenOnly;
+    mConfig.applyCan(cfg, false);
+    mCurrent = Score{0, 0, 0, 0};
+    mCandidateStart = now;
+  }
+
+  // 读取MCP2518的错误计数和错误标志，计入当前候选配置
+  void collectErrors() {
+    uint32_t bdiag0 = mCAN.diagInfos(0);
+    uint32_t bdiag1 = mCAN.diagInfos(1);
+    uint32_t rec = mCAN.errorCounters() & 0xFF;
+
+    uint32_t nominal = bdiag0 & 0xFF;              // NRERRCNT
+    uint32_t data = (bdiag0 >> 16) & 0xFF;         // DRERRCNT
+    mCurrent.errors = max(nominal, rec);
+    if (mCurrent.errors == 0 && (bdiag1 & AUTOBAUD_NOMINAL_ERROR_FLAGS)) {
+      mCurrent.errors = 1;
+    }
+    mCurrent.dataErrors = data;
+    if (mCurrent.dataErrors == 0 && (bdiag1 & AUTOBAUD_DATA_ERROR_FLAGS)) {
+      mCurrent.dataErrors = 1;
+    }
+  }
+
+  // 仲裁段候选结束
+  void finishArbitrationCandidate(uint32_t now) {
+    uint32_t bitrate = bus_config_can_rates[mCandidate];
+    if (mCurrent.frames > 0 && (mBest.frames == 0 || mCurrent.arbitration() > mBest.arbitration())) {
+      mBest = mCurrent;
+      mBestBitrate = bitrate;
+    }
+    Serial.printf("|info:autobaud %u bps: %u frames, %u errors\n", bitrate, mCurrent.frames, mCurrent.errors);
+
+    bool locked = mCurrent.frames >= AUTOBAUD_LOCK_FRAMES && mCurrent.errors == 0;
+    mCandidate++;
+    if (!locked && mCandidate < sizeof(bus_config_can_rates) / sizeof(bus_config_can_rates[0])) {
+      beginCandidate(bus_config_can_rates[mCandidate], 1, now);
+      return;
+    }
+
+    if (mBest.frames == 0) {
+      finish(false);
+    } else if (mBest.dataErrors > 0) {
+      // 仲裁段正确但数据段出错：总线上有BRS的FD帧，继续检测数据段倍率
+      mState = SWEEP_DATA;
+      mCandidate = 1;   // 跳过x1
+      beginCandidate(mBestBitrate, bus_config_data_factors[mCandidate], now);
+    } else {
+      finish(true);
+    }
+  }
+
+  // 数据段候选结束
+  void finishDataCandidate(uint32_t now) {
+    uint8_t factor = bus_config_data_factors[mCandidate];
+    if (mCurrent.brsFrames > 0 && mCurrent.data() > mBest.data()) {
+      mBest = mCurrent;
+      mBestFactor = factor;
+    }
+    Serial.printf("|info:autobaud %u bps x%u: %u fd frames, %u data errors\n",
+                  mBestBitrate, factor, mCurrent.brsFrames, mCurrent.dataErrors);
+
+    mCandidate++;
+    if (mCandidate < sizeof(bus_config_data_factors) / sizeof(bus_config_data_factors[0])) {
+      beginCandidate(mBestBitrate, bus_config_data_factors[mCandidate], now);
+    } else {
+      finish(true);
+    }
+  }
+
+  /**
+   * 提交检测结果：波特率、数据段倍率和原来的工作模式作为一个完整的配置校验并暂存，
+   * 然后立即由BusConfigService重新初始化MCP2518(finish在采集任务中调用)，初始化成功才算锁定
+   */
+  void finish(bool found) {
+    mState = IDLE;
+    mLastSucceeded = false;
+    if (found) {
+      bus_config_t cfg = mConfig.pending();
+      cfg.can_bitrate = mBestBitrate;
+      cfg.can_data_factor = mBestFactor;
+      if (!mConfig.setConfig(cfg)) {
+        Serial.printf("|error:autobaud result %u bps x%u rejected\n", mBestBitrate, mBestFactor);
+      }
+    }
+    // 配置没有变化时也要从ListenOnly的候选配置恢复
+    mConfig.requestCanReinit();
+    mConfig.service();
+    bus_config_t active = mConfig.active();
+    if (!found) {
+      Serial.println("|error:autobaud found no valid CAN traffic");
+    } else if (active.can_bitrate == mBestBitrate && active.can_data_factor == mBestFactor
+               && mConfig.lastCanError() == 0) {
+      mLastSucceeded = true;
+      Serial.printf("|info:autobaud locked %u bps, data factor x%u\n", mBestBitrate, mBestFactor);
+    } else {
+      Serial.printf("|error:autobaud %u bps x%u not applied, error code 0x%x\n", mBestBitrate, mBestFactor,
+                    mConfig.lastCanError());
+    }
+    mCompleted++;
+  }
+
+public:
+  CanAutoBaud(BusConfigService & config, ACAN2517FD & can) : mConfig(config), mCAN(can) {
+    mRequested = false;
+    mState = IDLE;
+    mCandidate = 0;
+    mCandidateStart = 0;
+    mBestBitrate = 0;
+    mBestFactor = 1;
+    mLastSucceeded = false;
+    mCompleted = 0;
+  }
+
+  // 请求开始检测，可以在任意任务中调用，实际由采集任务开始
+  void request() {
+    mRequested = true;
+  }
+
+  bool isBusy() {
+    return mState != IDLE || mRequested;
+  }
+
+  bool lastSucceeded() {
+    return mLastSucceeded;
+  }
+
+  uint32_t completedCount() {
+    return mCompleted;
+  }
+
+  /**
+   * 在采集任务(loop)中调用
+   * @return 正在检测时返回true，此时MCP2518由检测程序独占，调用者不能读取CAN数据
+   */
+  bool service(uint32_t now) {
+    if (mState == IDLE) {
+      if (!mRequested) {
+        return false;
+      }
+      mRequested = false;
+      mState = SWEEP_ARBITRATION;
+      mCandidate = 0;
+      mBest = Score{0, 0, 0, 0};
+      mBestBitrate = 0;
+      mBestFactor = 1;
+      beginCandidate(bus_config_can_rates[0], 1, now);
+      return true;
+    }
+
+    // 只计数，不把检测期间的数据放入队列
+    CANFDMessage message;
+    while (mCAN.receive(message)) {
+      mCurrent.frames++;
+      if (message.type == CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH) {
+        mCurrent.brsFrames++;
+      }
+    }
+
+    if (now - mCandidateStart >= AUTOBAUD_DWELL_MS) {
+      collectErrors();
+      if (mState == SWEEP_ARBITRATION) {
+        finishArbitrationCandidate(now);
+      } else {
+        finishDataCandidate(now);
+      }
+    }
+    return mState != IDLE;
+  }
+};
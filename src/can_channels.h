@@ -0,0 +1,391 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "config.h"
+#include "can_twai.h"
+#include "can_frame_bits.h"
+
+/**
+ * 多控制器采集：每个MCP2518和片上TWAI控制器是一个通道，采集任务(loop)按轮转顺序公平地服务所有通道
+ *
+ * 通道0是总线配置服务(busConfig)管理的can，其他通道使用和通道0相同的CAN配置，由busConfig一起重新初始化。
+ * 每个通道有自己的CS和INT引脚，可以和其他通道共用一个SPI主机，也可以在不同的SPI主机上。
+ * 驱动仍然工作在轮询模式，INT引脚只用来判断控制器是否有待处理的中断：
+ * INT为高且驱动缓冲区中没有帧时跳过这个通道，不访问SPI；没有接INT的通道每次都轮询。
+ * TWAI通道由CanTwai的读取任务放入环形缓冲区，环中有帧时才服务。
+ * 每帧都带有自己的时间戳：MCP2518的时间戳是控制器在SOF时记录的TBC(1us)换算成的micros()，
+ * TWAI的时间戳是读取任务被唤醒时的micros()。
+ * 每次服务一个通道最多取CAN_RECEIVE_BURST帧，起始通道每次轮转，满负载的通道不会让其他通道饿死。
+ *
+ * 每个通道统计帧数、每秒帧数和峰值、批次大小、队列丢弃、控制器FIFO溢出和每帧的SPI读取开销，
+ * 统计只在采集任务中写，其他任务读到的值可能差一个批次。
+ *
+ * 满负载吞吐量测量(can bench)：数据消费任务提交请求，采集任务清零测量窗口的计数，
+ * 可选地让一个通道不停地发送最低优先级的帧，保持它的发送FIFO是满的；
+ * 到时间后输出每个通道的帧率、总线负载、丢弃、FIFO溢出、每帧的CPU周期和SPI后端。
+ */
+
+#ifdef ACAN2517FD_IDF_SPI
+  #define CAN_SPI_BACKEND "idf-dma"
+#else
+  #define CAN_SPI_BACKEND "spiclass"
+#endif
+
+#define CAN_BENCH_MIN_MS 100
+#define CAN_BENCH_MAX_MS 60000
+
+// 吞吐量测量开始时的计数和测量期间收到的位数
+typedef struct {
+  uint32_t frames;
+  uint32_t dropped;
+  uint32_t overflows;          // MCP2518：控制器FIFO溢出，TWAI：驱动接收队列丢失
+  uint32_t received;           // receivedFrameCount()
+  uint64_t cycles;             // receiveCycleCount()
+  uint64_t nominalBits;
+  uint64_t dataBits;
+} can_bench_t;
+
+typedef struct {
+  ACAN2517FD * can;            // MCP2518通道
+  CanTwai * twai;              // TWAI通道，和can只有一个不是NULL
+  uint8_t intPin;              // 255表示没有接INT
+  bool started;                // 调用过begin，重新初始化前需要end
+  bool online;                 // 最近一次初始化成功
+  bool paused;                 // 被其他程序独占(自动波特率检测)，暂停采集和发送
+  uint32_t error;              // 最近一次begin的错误码
+  uint32_t frames;             // 从控制器读出的帧
+  uint32_t dropped;            // recv_queue满丢弃的帧
+  uint32_t polls;              // 访问SPI的次数
+  uint32_t bursts;             // 取到帧的次数
+  uint16_t maxBurst;
+  uint32_t secondFrames;       // 当前一秒内的帧数
+  uint32_t rate;               // 上一秒的帧数
+  uint32_t peakRate;
+  can_bench_t bench;
+} can_channel_t;
+
+class CanChannels {
+private:
+  can_channel_t mChannels[CAN_MAX_CHANNELS];
+  uint8_t mCount;
+  uint8_t mNext;               // 下一次最先服务的通道
+  uint32_t mSecondMs;
+  uint32_t mArbitrationRate;   // MCP2518通道的实际波特率，由busConfig设置
+  uint32_t mDataRate;
+
+  // 吞吐量测量：请求由数据消费任务写入，mBenchRequestMs最后写，采集任务读到非0时开始
+  volatile uint32_t mBenchRequestMs;
+  volatile uint8_t mBenchRequestTx;
+  volatile uint8_t mBenchRequestLen;
+  bool mBenchActive;
+  uint32_t mBenchStartMs;
+  uint32_t mBenchMs;
+  uint8_t mBenchTx;            // 发送负载的通道，255表示只接收
+  CANFDMessage mBenchFrame;
+  uint32_t mBenchSent;
+
+  uint32_t overflowCount(can_channel_t & c) {
+    return c.twai != NULL ? c.twai->missedCount() : c.can->hardwareReceiveBufferOverflowCount();
+  }
+
+  void startBench(uint32_t now) {
+    mBenchMs = mBenchRequestMs;
+    mBenchTx = mBenchRequestTx;
+    mBenchFrame = CANFDMessage();
+    mBenchFrame.id = CAN_BENCH_ID;
+    mBenchFrame.len = mBenchRequestLen;
+    mBenchFrame.type = mBenchFrame.len > 8 ? CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH : CANFDMessage::CAN_DATA;
+    mBenchRequestMs = 0;
+    mBenchSent = 0;
+    for (uint8_t i = 0; i < mCount; i++) {
+      can_channel_t & c = mChannels[i];
+      memset(&c.bench, 0, sizeof(c.bench));
+      c.bench.frames = c.frames;
+      c.bench.dropped = c.dropped;
+      c.bench.overflows = overflowCount(c);
+      if (c.can != NULL) {
+        c.bench.received = c.can->receivedFrameCount();
+        c.bench.cycles = c.can->receiveCycleCount();
+      }
+    }
+    mBenchStartMs = now;
+    mBenchActive = true;
+  }
+
+  // 保持发送通道的发送缓冲区是满的，每次最多放入CAN_SEND_BURST帧
+  void fillBench() {
+    for (int n = 0; n < CAN_SEND_BURST && mBenchTx != 255 && tryToSend(mBenchTx, mBenchFrame); n++) {
+      mBenchSent++;
+    }
+  }
+
+  // 输出测量结果，只在测量结束时执行一次
+  void finishBench(uint32_t now) {
+    mBenchActive = false;
+    uint32_t elapsed = max(now - mBenchStartMs, (uint32_t) 1);
+    Serial.printf("|bench:%u ms", elapsed);
+    if (mBenchTx != 255) {
+      Serial.printf(", can%u sent %u frames (%u/s) of %u bytes", mBenchTx, mBenchSent,
+                    (uint32_t) ((uint64_t) mBenchSent * 1000 / elapsed), mBenchFrame.len);
+    }
+    Serial.println();
+    for (uint8_t i = 0; i < mCount; i++) {
+      can_channel_t & c = mChannels[i];
+      uint32_t frames = c.frames - c.bench.frames;
+      uint32_t arbitrationRate = c.twai != NULL ? c.twai->bitRate() : mArbitrationRate;
+      uint32_t dataRate = c.twai != NULL ? 0 : mDataRate;
+      uint64_t busyUs = arbitrationRate ? can_bus_time_us(c.bench.nominalBits, c.bench.dataBits, arbitrationRate, dataRate) : 0;
+      uint32_t load = min((uint32_t) (busyUs * 10000 / ((uint64_t) elapsed * 1000)), (uint32_t) 10000);
+      uint32_t overflows = c.twai != NULL ? overflowCount(c) - c.bench.overflows
+                                          : (uint8_t) (overflowCount(c) - c.bench.overflows);
+      Serial.printf("|bench:can%u %u frames/s, load %u.%02u%%, %u dropped, %u fifo overflows", i,
+                    (uint32_t) ((uint64_t) frames * 1000 / elapsed), load / 100, load % 100,
+                    c.dropped - c.bench.dropped, overflows);
+      if (c.can != NULL) {
+        uint32_t received = c.can->receivedFrameCount() - c.bench.received;
+        uint64_t cycles = c.can->receiveCycleCount() - c.bench.cycles;
+        Serial.printf(", %u cycles/frame, spi %s %u kHz\n", received ? (uint32_t) (cycles / received) : 0,
+                      CAN_SPI_BACKEND, c.can->spiClock() / 1000);
+      } else {
+        Serial.println(", twai");
+      }
+    }
+  }
+
+public:
+  CanChannels() {
+    memset(mChannels, 0, sizeof(mChannels));
+    mCount = 0;
+    mNext = 0;
+    mSecondMs = 0;
+    mArbitrationRate = 0;
+    mDataRate = 0;
+    mBenchRequestMs = 0;
+    mBenchRequestTx = 255;
+    mBenchRequestLen = 8;
+    mBenchActive = false;
+    mBenchStartMs = 0;
+    mBenchMs = 0;
+    mBenchTx = 255;
+    mBenchSent = 0;
+  }
+
+  /**
+   * 注册一个控制器，在setup()中按通道号的顺序调用
+   * @param intPin - 控制器的INT引脚，255表示没有接
+   * @return 通道号，通道已满返回255
+   */
+  uint8_t add(ACAN2517FD & can, uint8_t intPin) {
+    if (mCount >= CAN_MAX_CHANNELS) {
+      return 255;
+    }
+    can_channel_t & c = mChannels[mCount];
+    c.can = &can;
+    c.intPin = intPin;
+    if (intPin != 255) {
+      pinMode(intPin, INPUT_PULLUP);
+    }
+    return mCount++;
+  }
+
+  /**
+   * 注册片上TWAI控制器，由busConfig按TWAI的配置启动
+   * @return 通道号，通道已满返回255
+   */
+  uint8_t add(CanTwai & twai) {
+    if (mCount >= CAN_MAX_CHANNELS) {
+      return 255;
+    }
+    can_channel_t & c = mChannels[mCount];
+    c.twai = &twai;
+    c.intPin = 255;
+    return mCount++;
+  }
+
+  uint8_t count() {
+    return mCount;
+  }
+
+  // 在线的MCP2518通道的驱动，用于在采集任务中读取错误计数和健康状态；TWAI、离线或暂停的通道返回NULL
+  ACAN2517FD * controller(uint8_t channel) {
+    if (channel >= mCount || !mChannels[channel].online || mChannels[channel].paused) {
+      return NULL;
+    }
+    return mChannels[channel].can;
+  }
+
+  // TWAI通道的控制器，用于在采集任务中读取错误计数和状态；MCP2518通道返回NULL
+  CanTwai * twai(uint8_t channel) {
+    return channel < mCount ? mChannels[channel].twai : NULL;
+  }
+
+  // 暂停或恢复一个通道的采集和发送，不改变它的在线状态
+  void setPaused(uint8_t channel, bool paused) {
+    if (channel < mCount) {
+      mChannels[channel].paused = paused;
+    }
+  }
+
+  // MCP2518通道的实际波特率，用于计算吞吐量测量的总线负载
+  void setBitRates(uint32_t arbitrationRate, uint32_t dataRate) {
+    mArbitrationRate = arbitrationRate;
+    mDataRate = dataRate;
+  }
+
+  /**
+   * 请求一次满负载吞吐量测量(数据消费任务中调用)，采集任务在下一次service时开始
+   * @param ms - 测量时间
+   * @param txChannel - 不停发送的通道，255表示只接收
+   * @param len - 发送帧的数据长度，大于8时发送带BRS的FD帧
+   * @return 参数无效或上一次测量还没有结束时返回false
+   */
+  bool requestBench(uint32_t ms, uint8_t txChannel, uint8_t len) {
+    CANFDMessage frame;
+    frame.len = len;
+    frame.type = len > 8 ? CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH : CANFDMessage::CAN_DATA;
+    if (ms < CAN_BENCH_MIN_MS || ms > CAN_BENCH_MAX_MS || !frame.isValid() || mBenchActive || mBenchRequestMs != 0) {
+      return false;
+    }
+    // TWAI只能发送经典帧
+    if (txChannel != 255 && (txChannel >= mCount || (mChannels[txChannel].twai != NULL && len > 8))) {
+      return false;
+    }
+    mBenchRequestTx = txChannel;
+    mBenchRequestLen = len;
+    mBenchRequestMs = ms;
+    return true;
+  }
+
+  /**
+   * 按配置重新初始化一个MCP2518通道(采集任务中调用)，初始化失败的通道不再被服务
+   * @return begin的错误码，0表示成功
+   */
+  uint32_t restart(uint8_t channel, const ACAN2517FDSettings & settings, const ACAN2517FDFilters * filters) {
+    can_channel_t & c = mChannels[channel];
+    if (c.can == NULL) {
+      return 0;              // TWAI通道按自己的配置启动
+    }
+    if (c.started) {
+      c.can->end();
+    }
+    c.started = true;
+    c.error = filters != NULL ? c.can->begin(settings, NULL, *filters) : c.can->begin(settings, NULL);
+    c.online = c.error == 0;
+    return c.error;
+  }
+
+  /**
+   * 向一个通道发送，不等待，在采集任务中调用(网关转发)
+   * @return 通道不存在、离线或发送缓冲区满时返回false
+   */
+  bool tryToSend(uint8_t channel, const CANFDMessage & msg) {
+    if (channel >= mCount) {
+      return false;
+    }
+    can_channel_t & c = mChannels[channel];
+    if (c.twai != NULL) {
+      return c.twai->tryToSend(msg);
+    }
+    return c.online && !c.paused && c.can->tryToSend(msg);
+  }
+
+  // 记录由busConfig直接初始化的通道0的错误码，初始化失败的通道不再被服务
+  void setError(uint8_t channel, uint32_t error) {
+    if (channel < mCount) {
+      mChannels[channel].error = error;
+      mChannels[channel].online = error == 0;
+    }
+  }
+
+  /**
+   * 在采集任务中调用：从起始通道开始依次服务每个有待处理帧的通道，每个通道最多取一批
+   * @param burst - 至少CAN_RECEIVE_BURST帧的缓冲区
+   * @param sink - sink(channel, frames, timestamps, count)，返回recv_queue满丢弃的帧数
+   */
+  template <typename Sink>
+  void service(uint32_t now, CANFDMessage * burst, Sink sink) {
+    if (mBenchRequestMs != 0 && !mBenchActive) {
+      startBench(now);
+    }
+    if (mBenchActive) {
+      fillBench();
+    }
+    uint32_t timestamps[CAN_RECEIVE_BURST];
+    for (uint8_t n = 0; n < mCount; n++) {
+      uint8_t channel = (mNext + n) % mCount;
+      can_channel_t & c = mChannels[channel];
+      size_t count;
+      if (c.twai != NULL) {
+        c.twai->poll(now);
+        if (!c.twai->pending()) {
+          continue;
+        }
+        c.polls++;
+        count = c.twai->receiveBurst(burst, timestamps, CAN_RECEIVE_BURST);
+      } else {
+        if (!c.online || c.paused) {
+          continue;
+        }
+        //INT为高时控制器没有新帧，驱动缓冲区中也没有上次剩下的帧，不需要访问SPI
+        if (c.intPin != 255 && digitalRead(c.intPin) == HIGH && c.can->driverReceiveBufferCount() == 0) {
+          continue;
+        }
+        c.polls++;
+        count = c.can->receiveBurst(burst, CAN_RECEIVE_BURST, timestamps);
+      }
+      if (count == 0) {
+        continue;
+      }
+      c.dropped += sink(channel, burst, timestamps, count);
+      c.bursts++;
+      c.maxBurst = max(c.maxBurst, (uint16_t) count);
+      c.frames += count;
+      c.secondFrames += count;
+      if (mBenchActive) {
+        for (size_t i = 0; i < count; i++) {
+          uint32_t nominal, data;
+          can_frame_bits(burst[i], nominal, data);
+          c.bench.nominalBits += nominal;
+          c.bench.dataBits += data;
+        }
+      }
+    }
+    if (mCount > 0) {
+      mNext = (mNext + 1) % mCount;
+    }
+
+    if (now - mSecondMs >= 1000) {
+      mSecondMs = now;
+      for (uint8_t i = 0; i < mCount; i++) {
+        can_channel_t & c = mChannels[i];
+        c.rate = c.secondFrames;
+        c.peakRate = max(c.peakRate, c.rate);
+        c.secondFrames = 0;
+      }
+    }
+
+    if (mBenchActive && now - mBenchStartMs >= mBenchMs) {
+      finishBench(now);
+    }
+  }
+
+  // 输出每个通道的状态和吞吐量，MCP2518和TWAI通道的吞吐量统计相同
+  void print() {
+    for (uint8_t i = 0; i < mCount; i++) {
+      const can_channel_t & c = mChannels[i];
+      if (c.twai != NULL) {
+        c.twai->print(i);
+      } else {
+        Serial.printf("can%u: mcp2518 %s, error 0x%x, int pin %d, spi %s %u kHz, %u fifo overflows, %u truncated\n", i,
+                      !c.online ? "offline" : c.paused ? "paused" : "online", c.error,
+                      c.intPin == 255 ? -1 : c.intPin, CAN_SPI_BACKEND, c.can->spiClock() / 1000,
+                      c.can->hardwareReceiveBufferOverflowCount(), c.can->driverReceiveBufferTruncatedCount());
+      }
+      Serial.printf("can%u: %u frames, %u/s, peak %u/s, %u dropped\n", i, c.frames, c.rate, c.peakRate, c.dropped);
+      uint32_t received = c.can != NULL ? c.can->receivedFrameCount() : 0;
+      Serial.printf("can%u: %u polls, %u bursts, max burst %u, %u cycles/frame\n", i, c.polls, c.bursts,
+                    c.maxBurst, received ? (uint32_t) (c.can->receiveCycleCount() / received) : 0);
+    }
+  }
+};
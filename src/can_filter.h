@@ -0,0 +1,442 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+
+/**
+ * CAN接收过滤：把ID白名单(单个ID或范围)编译成MCP2518的mask/filter对
+ *
+ * MCP2518只有32个过滤器，每个过滤器接收 (id & mask) == value 的帧，也就是ID空间中的一个"立方体"。
+ * 编译分两步：
+ * 1.每个范围拆成按2的幂对齐的块，这些块的并集正好是白名单
+ * 2.块数超过过滤器数时，每次合并两个块，合并后的块为包含两者的最小立方体，
+ *   选择新增误收(白名单外的ID)最少的一对，直到块数不超过过滤器数。
+ *   误收数按范围精确计算，合并的代价只和这两个块有关，所以代价矩阵只需更新新块所在的行
+ *
+ * 误收的帧由软件丢弃：标准帧查2048位的位图，扩展帧在排好序的范围表中二分查找。
+ * 命中的过滤器没有误收时直接接收，不用查表。
+ *
+ * 白名单在数据消费任务中编辑和编译，编译结果在采集任务重新初始化MCP2518时和硬件过滤器一起生效。
+ */
+
+#define CAN_FILTER_MAX_RANGES   64     // 白名单中的范围数(合并相邻的范围后)
+#define CAN_FILTER_MAX_PAIRS    32     // MCP2518的过滤器数
+#define CAN_FILTER_MAX_CUBES    128    // 拆分后参与合并的块数，超过时整个范围用一个块
+#define CAN_FILTER_NO_INDEX     255    // CANFDMessage.idx：没有经过MCP2518硬件过滤器的帧(TWAI)
+
+typedef struct {
+  uint32_t first;
+  uint32_t last;
+  bool ext;
+} can_id_range_t;
+
+typedef struct {
+  uint32_t mask;           // 按ID的位序，扩展帧为29位，不是MCP2518寄存器中的位序
+  uint32_t value;
+  bool ext;
+  bool exact;              // 这个过滤器没有误收
+} can_filter_pair_t;
+
+// 编译结果，硬件过滤器和软件过滤一起生效
+typedef struct {
+  can_filter_pair_t pairs[CAN_FILTER_MAX_PAIRS];
+  uint8_t pairCount;       // 0表示不过滤
+  uint8_t stdBitmap[256];  // 白名单中的标准帧ID
+  can_id_range_t extRanges[CAN_FILTER_MAX_RANGES];
+  uint8_t extCount;
+  uint32_t stdFalsePositives;
+  uint32_t extFalsePositives;   // 各过滤器误收数之和，过滤器有重叠时偏大
+} can_filter_set_t;
+
+static inline uint32_t can_id_space(bool ext) {
+  return ext ? 0x1FFFFFFF : 0x7FF;
+}
+
+class CanFilter {
+private:
+  portMUX_TYPE mMux;
+
+  // 数据消费任务编辑的白名单，按(标准帧, 扩展帧)和起始ID排序，没有重叠
+  can_id_range_t mRanges[CAN_FILTER_MAX_RANGES];
+  uint8_t mRangeCount;
+
+  can_filter_set_t mPending;
+  volatile bool mHasPending;
+  can_filter_set_t mActive;     // 只在采集任务中访问
+  bool mHardware;               // mActive的过滤器已经写入MCP2518，只在采集任务中访问
+  uint32_t mDropped;            // 软件丢弃的误收帧
+
+  // 满足 (x & mask) == value 且 x <= n 的x的个数
+  static uint32_t countUpTo(uint32_t n, uint32_t mask, uint32_t value, bool ext) {
+    uint32_t count = 0;
+    for (int8_t b = ext ? 28 : 10; b >= 0; b--) {
+      uint32_t bit = 1UL << b;
+      uint8_t freeBelow = __builtin_popcount(~mask & (bit - 1));
+      if (n & bit) {
+        // 这一位取0时后面的位任意(受mask约束)，都小于n
+        if (!(mask & bit) || !(value & bit)) {
+          count += 1UL << freeBelow;
+        }
+        if ((mask & bit) && !(value & bit)) {
+          return count;
+        }
+      } else if ((mask & bit) && (value & bit)) {
+        return count;
+      }
+    }
+    return count + 1;
+  }
+
+  // 立方体中在白名单内的ID数
+  uint32_t covered(const can_filter_pair_t & cube) {
+    uint32_t count = 0;
+    for (uint8_t i = 0; i < mRangeCount; i++) {
+      const can_id_range_t & r = mRanges[i];
+      if (r.ext != cube.ext) {
+        continue;
+      }
+      count += countUpTo(r.last, cube.mask, cube.value, cube.ext);
+      if (r.first > 0) {
+        count -= countUpTo(r.first - 1, cube.mask, cube.value, cube.ext);
+      }
+    }
+    return count;
+  }
+
+  static uint32_t cubeSize(const can_filter_pair_t & cube) {
+    return 1UL << __builtin_popcount(~cube.mask & can_id_space(cube.ext));
+  }
+
+  static can_filter_pair_t merge(const can_filter_pair_t & a, const can_filter_pair_t & b) {
+    can_filter_pair_t c;
+    c.ext = a.ext;
+    c.mask = a.mask & b.mask & ~(a.value ^ b.value);
+    c.value = a.value & c.mask;
+    c.exact = false;
+    return c;
+  }
+
+  static bool contains(const can_filter_pair_t & outer, const can_filter_pair_t & inner) {
+    return outer.ext == inner.ext && (outer.mask & inner.mask) == outer.mask
+        && (inner.value & outer.mask) == outer.value;
+  }
+
+  // 立方体中不在白名单内的ID数(误收数)
+  uint32_t falsePositives(const can_filter_pair_t & cube) {
+    return cubeSize(cube) - covered(cube);
+  }
+
+  /**
+   * 合并后新增的误收数：合并结果的误收数减去a和b已有的误收数(a和b相交时相交部分只算一次)，
+   * 帧格式不同的块不能合并
+   */
+  uint32_t mergeCost(const can_filter_pair_t & a, const can_filter_pair_t & b) {
+    if (a.ext != b.ext) {
+      return UINT32_MAX;
+    }
+    uint32_t existing = falsePositives(a) + falsePositives(b);
+    if (((a.value ^ b.value) & a.mask & b.mask) == 0) {
+      can_filter_pair_t both;
+      both.ext = a.ext;
+      both.mask = a.mask | b.mask;
+      both.value = a.value | b.value;
+      both.exact = false;
+      existing -= falsePositives(both);
+    }
+    return falsePositives(merge(a, b)) - existing;
+  }
+
+  // 包含[first, last]的最小立方体
+  static can_filter_pair_t boundingCube(const can_id_range_t & r) {
+    can_filter_pair_t c;
+    c.ext = r.ext;
+    uint32_t diff = r.first ^ r.last;
+    uint32_t low = diff ? (0xFFFFFFFFUL >> __builtin_clz(diff)) : 0;
+    c.mask = can_id_space(r.ext) & ~low;
+    c.value = r.first & c.mask;
+    c.exact = false;
+    return c;
+  }
+
+  // 把范围拆成按2的幂对齐的块，块数超过max时返回0
+  static uint8_t split(const can_id_range_t & r, can_filter_pair_t * out, uint8_t max) {
+    uint8_t n = 0;
+    uint32_t first = r.first;
+    while (true) {
+      uint8_t k = first ? __builtin_ctz(first) : (r.ext ? 29 : 11);
+      while (k > 0 && (uint64_t) first + (1ULL << k) - 1 > r.last) {
+        k--;
+      }
+      if (n >= max) {
+        return 0;
+      }
+      out[n].ext = r.ext;
+      out[n].mask = can_id_space(r.ext) & ~((1UL << k) - 1);
+      out[n].value = first;
+      out[n].exact = false;
+      n++;
+      uint64_t next = (uint64_t) first + (1ULL << k);
+      if (next > r.last) {
+        return n;
+      }
+      first = next;
+    }
+  }
+
+  static uint16_t pairIndex(uint8_t i, uint8_t j) {
+    // i > j，下三角矩阵
+    return (uint16_t) i * (i - 1) / 2 + j;
+  }
+
+  static bool stdAccepted(const can_filter_set_t & set, uint32_t id) {
+    return set.stdBitmap[id >> 3] & (1 << (id & 7));
+  }
+
+  static bool extAccepted(const can_filter_set_t & set, uint32_t id) {
+    int16_t lo = 0;
+    int16_t hi = set.extCount - 1;
+    while (lo <= hi) {
+      int16_t mid = (lo + hi) / 2;
+      if (id < set.extRanges[mid].first) {
+        hi = mid - 1;
+      } else if (id > set.extRanges[mid].last) {
+        lo = mid + 1;
+      } else {
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  CanFilter() {
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mRangeCount = 0;
+    memset(&mPending, 0, sizeof(mPending));
+    memset(&mActive, 0, sizeof(mActive));
+    mHardware = false;
+    mHasPending = false;
+    mDropped = 0;
+  }
+
+  // 清空白名单，compile()后接收所有帧
+  void clear() {
+    mRangeCount = 0;
+  }
+
+  /**
+   * 把[first, last]加入白名单，和已有的范围重叠或相邻时合并
+   * @return ID超出范围或白名单已满时返回false
+   */
+  bool add(bool ext, uint32_t first, uint32_t last) {
+    if (first > last || last > can_id_space(ext)) {
+      return false;
+    }
+    // 找到第一个可能重叠或相邻的范围，吸收后面所有与之重叠的范围
+    uint8_t i = 0;
+    while (i < mRangeCount && (mRanges[i].ext < ext || (mRanges[i].ext == ext && mRanges[i].last + 1 < first))) {
+      i++;
+    }
+    uint8_t j = i;
+    while (j < mRangeCount && mRanges[j].ext == ext && mRanges[j].first <= last + 1) {
+      first = min(first, mRanges[j].first);
+      last = max(last, mRanges[j].last);
+      j++;
+    }
+    if (j == i && mRangeCount >= CAN_FILTER_MAX_RANGES) {
+      return false;
+    }
+    memmove(mRanges + i + 1, mRanges + j, (mRangeCount - j) * sizeof(can_id_range_t));
+    mRangeCount = mRangeCount - (j - i) + 1;
+    mRanges[i].first = first;
+    mRanges[i].last = last;
+    mRanges[i].ext = ext;
+    return true;
+  }
+
+  uint8_t rangeCount() {
+    return mRangeCount;
+  }
+
+  /**
+   * 把白名单编译成不超过maxPairs个过滤器，结果在下一次重新初始化MCP2518时生效
+   * @return 内存不足时返回false
+   */
+  bool compile(uint8_t maxPairs = CAN_FILTER_MAX_PAIRS) {
+    can_filter_set_t * set = (can_filter_set_t *) calloc(1, sizeof(can_filter_set_t));
+    can_filter_pair_t * cubes = (can_filter_pair_t *) malloc(CAN_FILTER_MAX_CUBES * sizeof(can_filter_pair_t));
+    uint32_t * costs = (uint32_t *) malloc(CAN_FILTER_MAX_CUBES * (CAN_FILTER_MAX_CUBES - 1) / 2 * sizeof(uint32_t));
+    bool ok = set != NULL && cubes != NULL && costs != NULL;
+    if (ok && mRangeCount > 0) {
+      // 拆分后块太多时，剩下的每个范围只用一个块
+      uint8_t n = 0;
+      for (uint8_t i = 0; i < mRangeCount; i++) {
+        uint8_t left = CAN_FILTER_MAX_CUBES - n - (mRangeCount - i - 1);
+        uint8_t count = split(mRanges[i], cubes + n, left);
+        if (count == 0) {
+          cubes[n] = boundingCube(mRanges[i]);
+          count = 1;
+        }
+        n += count;
+      }
+
+      for (uint8_t i = 1; i < n; i++) {
+        for (uint8_t j = 0; j < i; j++) {
+          costs[pairIndex(i, j)] = mergeCost(cubes[i], cubes[j]);
+        }
+      }
+
+      while (n > maxPairs) {
+        uint32_t best = UINT32_MAX;
+        uint8_t bi = 1;
+        uint8_t bj = 0;
+        for (uint8_t i = 1; i < n; i++) {
+          for (uint8_t j = 0; j < i; j++) {
+            if (costs[pairIndex(i, j)] < best) {
+              best = costs[pairIndex(i, j)];
+              bi = i;
+              bj = j;
+            }
+          }
+        }
+        if (best == UINT32_MAX) {
+          // 只剩不能合并的标准帧和扩展帧各一个块时不会发生，防止死循环
+          break;
+        }
+
+        // 新块放在bj，删除bi和被新块包含的块，删除时把最后一块移过来并搬动它的代价
+        can_filter_pair_t merged = merge(cubes[bi], cubes[bj]);
+        cubes[bj] = merged;
+        for (uint8_t k = n; k-- > 0;) {
+          if (k != bj && (k == bi || contains(merged, cubes[k]))) {
+            uint8_t last = n - 1;
+            if (k != last) {
+              cubes[k] = cubes[last];
+              for (uint8_t m = 0; m < last; m++) {
+                if (m != k) {
+                  costs[m > k ? pairIndex(m, k) : pairIndex(k, m)] = costs[m > last ? pairIndex(m, last) : pairIndex(last, m)];
+                }
+              }
+              if (bj == last) {
+                bj = k;
+              }
+            }
+            n--;
+          }
+        }
+        for (uint8_t m = 0; m < n; m++) {
+          if (m != bj) {
+            costs[m > bj ? pairIndex(m, bj) : pairIndex(bj, m)] = mergeCost(cubes[m], cubes[bj]);
+          }
+        }
+      }
+
+      set->pairCount = n;
+      for (uint8_t i = 0; i < n; i++) {
+        set->pairs[i] = cubes[i];
+        uint32_t fp = falsePositives(cubes[i]);
+        set->pairs[i].exact = fp == 0;
+        if (cubes[i].ext) {
+          set->extFalsePositives += fp;
+        }
+      }
+      for (uint8_t i = 0; i < mRangeCount; i++) {
+        const can_id_range_t & r = mRanges[i];
+        if (r.ext) {
+          set->extRanges[set->extCount++] = r;
+        } else {
+          for (uint32_t id = r.first; id <= r.last; id++) {
+            set->stdBitmap[id >> 3] |= 1 << (id & 7);
+          }
+        }
+      }
+      // 标准帧的误收数按位图精确计算
+      for (uint32_t id = 0; id <= 0x7FF; id++) {
+        if (stdAccepted(*set, id)) {
+          continue;
+        }
+        for (uint8_t i = 0; i < n; i++) {
+          if (!set->pairs[i].ext && (id & set->pairs[i].mask) == set->pairs[i].value) {
+            set->stdFalsePositives++;
+            break;
+          }
+        }
+      }
+    }
+    if (ok) {
+      portENTER_CRITICAL(&mMux);
+      mPending = *set;
+      mHasPending = true;
+      portEXIT_CRITICAL(&mMux);
+    }
+    free(set);
+    free(cubes);
+    free(costs);
+    return ok;
+  }
+
+  /**
+   * 在采集任务中重新初始化MCP2518前调用：启用编译好的过滤器，加入到ACAN2517FDFilters
+   * @param hardware - false时控制器接收所有帧(网关需要转发白名单外的帧)，白名单只在accept()中检查
+   * @return 加入的过滤器数，0表示不过滤(由驱动接收所有帧)
+   */
+  uint8_t apply(ACAN2517FDFilters & filters, bool hardware = true) {
+    if (mHasPending) {
+      portENTER_CRITICAL(&mMux);
+      mActive = mPending;
+      mHasPending = false;
+      portEXIT_CRITICAL(&mMux);
+    }
+    mHardware = hardware;
+    if (!hardware) {
+      return 0;
+    }
+    for (uint8_t i = 0; i < mActive.pairCount; i++) {
+      const can_filter_pair_t & p = mActive.pairs[i];
+      filters.appendFilter(p.ext ? kExtended : kStandard, p.mask, p.value, NULL);
+    }
+    return mActive.pairCount;
+  }
+
+  bool hasPending() {
+    return mHasPending;
+  }
+
+  /**
+   * 采集任务中对每个收到的帧调用，丢弃硬件过滤器误收的帧
+   * msg.idx是命中的MCP2518过滤器序号，没有误收的过滤器直接接收。
+   * TWAI的帧没有硬件过滤器序号(CAN_FILTER_NO_INDEX)，没有写入硬件过滤器时也一样，总是按白名单检查
+   * @return 帧在白名单中，或没有启用过滤时返回true
+   */
+  bool accept(const CANFDMessage & msg) {
+    if (mActive.pairCount == 0 || (mHardware && msg.idx < mActive.pairCount && mActive.pairs[msg.idx].exact)) {
+      return true;
+    }
+    bool ok = msg.ext ? extAccepted(mActive, msg.id) : (msg.id <= 0x7FF && stdAccepted(mActive, msg.id));
+    if (!ok) {
+      mDropped++;
+    }
+    return ok;
+  }
+
+  uint32_t dropped() {
+    return mDropped;
+  }
+
+  // 输出白名单和编译结果
+  void print() {
+    Serial.printf("filter: %u ranges, %u hardware filters, %u dropped in software\n",
+                  mRangeCount, mPending.pairCount, mDropped);
+    for (uint8_t i = 0; i < mRangeCount; i++) {
+      const can_id_range_t & r = mRanges[i];
+      Serial.printf(r.ext ? "  accept %08X-%08X\n" : "  accept %03X-%03X\n", r.first, r.last);
+    }
+    for (uint8_t i = 0; i < mPending.pairCount; i++) {
+      const can_filter_pair_t & p = mPending.pairs[i];
+      Serial.printf(p.ext ? "  filter %u: mask %08X value %08X%s\n" : "  filter %u: mask %03X value %03X%s\n",
+                    i, p.mask, p.value, p.exact ? "" : " (false positives)");
+    }
+    Serial.printf("false positives: %u standard, %u extended%s\n", mPending.stdFalsePositives,
+                  mPending.extFalsePositives, mHasPending ? " (not applied yet)" : "");
+  }
+};
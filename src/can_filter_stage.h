@@ -0,0 +1,290 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+
+/**
+ * CAN软件过滤/触发：在数据消费任务中对每帧一次算出它属于哪些过滤集合
+ *
+ * 集合：记录(采集日志)、显示(monitor输出到串口)、开始记录触发、停止记录触发。
+ * 标准帧ID查2048项的表，每项的低4位是各集合是否包含这个ID，高4位表示这个ID在对应集合中有数据规则，
+ * 相当于把4个集合的2048位位图放在一起，一次查表得到所有集合的结果。
+ * 扩展帧ID放在开放寻址的哈希集合中，每项的值和标准帧的表项相同。
+ *
+ * 数据规则比较从offset开始的最多8个字节：(数据 & mask) == value，编译成一次64位比较。
+ * 一个集合中同一ID的多条规则满足任意一条即可；没有数据规则的ID只按ID判断，
+ * 任意ID的数据规则对集合中的所有帧生效。
+ * 记录和显示集合没有添加ID时接收所有ID，触发集合没有添加ID时不触发(除非有任意ID的数据规则)。
+ */
+
+#define CAN_STAGE_SETS          4
+#define CAN_STAGE_EXT_SLOTS     256    // 扩展帧哈希集合的容量，最多使用3/4
+#define CAN_STAGE_MAX_RULES     16
+#define CAN_STAGE_MAX_RANGE     256    // 一次添加的扩展帧ID范围的最大长度
+
+typedef enum : uint8_t {
+  CAN_STAGE_RECORD = 0,
+  CAN_STAGE_DISPLAY = 1,
+  CAN_STAGE_START = 2,
+  CAN_STAGE_STOP = 3,
+} can_stage_set;
+
+static const char * const can_stage_set_names[CAN_STAGE_SETS] = {"record", "display", "start", "stop"};
+
+typedef struct {
+  uint32_t id;
+  bool ext;
+  bool anyId;            // 适用于所有ID
+  uint8_t sets;          // 规则所属的集合(位)
+  uint8_t offset;        // 比较的第一个字节
+  uint8_t length;        // 比较的字节数，1 ~ 8
+  uint64_t mask;         // 小端序，第offset字节在最低8位
+  uint64_t value;
+} can_payload_rule_t;
+
+class CanFilterStage {
+private:
+  uint8_t mStd[0x800];
+  uint32_t mExtKeys[CAN_STAGE_EXT_SLOTS];
+  uint8_t mExtValues[CAN_STAGE_EXT_SLOTS];
+  uint16_t mExtCount;
+  can_payload_rule_t mRules[CAN_STAGE_MAX_RULES];
+  uint8_t mRuleCount;
+  uint16_t mIdCount[CAN_STAGE_SETS];   // 每个集合中的ID数
+  uint8_t mAllIds;                     // 接收所有ID的集合
+  uint8_t mAnyRules;                   // 有任意ID数据规则的集合
+  uint32_t mMatches[CAN_STAGE_SETS];
+
+  static uint8_t hash(uint32_t id) {
+    id *= 0x9E3779B1;
+    return id >> 24;
+  }
+
+  uint8_t * extFind(uint32_t id) {
+    for (uint16_t i = 0, slot = hash(id); i < CAN_STAGE_EXT_SLOTS; i++, slot = (slot + 1) % CAN_STAGE_EXT_SLOTS) {
+      if (mExtValues[slot] == 0) {
+        return NULL;
+      }
+      if (mExtKeys[slot] == id) {
+        return &mExtValues[slot];
+      }
+    }
+    return NULL;
+  }
+
+  // 表项中加入bits，新的扩展帧ID插入哈希集合
+  bool mark(bool ext, uint32_t id, uint8_t bits) {
+    if (!ext) {
+      mStd[id] |= bits;
+      return true;
+    }
+    uint8_t * value = extFind(id);
+    if (value != NULL) {
+      *value |= bits;
+      return true;
+    }
+    if (mExtCount >= CAN_STAGE_EXT_SLOTS * 3 / 4) {
+      return false;
+    }
+    uint16_t slot = hash(id);
+    while (mExtValues[slot] != 0) {
+      slot = (slot + 1) % CAN_STAGE_EXT_SLOTS;
+    }
+    mExtKeys[slot] = id;
+    mExtValues[slot] = bits;
+    mExtCount++;
+    return true;
+  }
+
+  void updateDefaults() {
+    mAllIds = 0;
+    for (uint8_t s = 0; s < CAN_STAGE_SETS; s++) {
+      bool trigger = s == CAN_STAGE_START || s == CAN_STAGE_STOP;
+      if (mIdCount[s] == 0 && (!trigger || (mAnyRules & (1 << s)))) {
+        mAllIds |= 1 << s;
+      }
+    }
+  }
+
+  static bool payloadMatch(const can_payload_rule_t & rule, const CANFDMessage & msg) {
+    if (msg.type == CANFDMessage::CAN_REMOTE || msg.len < rule.offset + rule.length) {
+      return false;
+    }
+    uint64_t data = 0;
+    memcpy(&data, msg.data + rule.offset, rule.length);
+    return (data & rule.mask) == rule.value;
+  }
+
+public:
+  CanFilterStage() {
+    memset(mStd, 0, sizeof(mStd));
+    memset(mExtValues, 0, sizeof(mExtValues));
+    mExtCount = 0;
+    mRuleCount = 0;
+    memset(mIdCount, 0, sizeof(mIdCount));
+    mAnyRules = 0;
+    memset(mMatches, 0, sizeof(mMatches));
+    updateDefaults();
+  }
+
+  static int8_t setIndex(const char * name) {
+    for (uint8_t s = 0; s < CAN_STAGE_SETS; s++) {
+      if (strcmp(name, can_stage_set_names[s]) == 0) {
+        return s;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * 清空集合中的ID和数据规则
+   * @param sets - 集合的位
+   */
+  void clear(uint8_t sets) {
+    for (uint16_t id = 0; id < 0x800; id++) {
+      mStd[id] &= ~(sets | (sets << 4));
+    }
+    // 哈希集合不能直接删除，把剩下的项重新插入
+    uint32_t keys[CAN_STAGE_EXT_SLOTS];
+    uint8_t values[CAN_STAGE_EXT_SLOTS];
+    memcpy(keys, mExtKeys, sizeof(keys));
+    memcpy(values, mExtValues, sizeof(values));
+    memset(mExtValues, 0, sizeof(mExtValues));
+    mExtCount = 0;
+    for (uint16_t i = 0; i < CAN_STAGE_EXT_SLOTS; i++) {
+      uint8_t value = values[i] & ~(sets | (sets << 4));
+      if (value != 0) {
+        mark(true, keys[i], value);
+      }
+    }
+
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < mRuleCount; i++) {
+      mRules[i].sets &= ~sets;
+      if (mRules[i].sets) {
+        mRules[n++] = mRules[i];
+      }
+    }
+    mRuleCount = n;
+    mAnyRules &= ~sets;
+    for (uint8_t s = 0; s < CAN_STAGE_SETS; s++) {
+      if (sets & (1 << s)) {
+        mIdCount[s] = 0;
+      }
+    }
+    updateDefaults();
+  }
+
+  /**
+   * 把ID范围加入集合
+   * @return ID超出范围、扩展帧范围太长或哈希集合已满时返回false
+   */
+  bool addIds(uint8_t set, bool ext, uint32_t first, uint32_t last) {
+    if (set >= CAN_STAGE_SETS || first > last || last > (ext ? 0x1FFFFFFFUL : 0x7FFUL)
+        || (ext && last - first >= CAN_STAGE_MAX_RANGE)) {
+      return false;
+    }
+    for (uint32_t id = first; id <= last; id++) {
+      if (!mark(ext, id, 1 << set)) {
+        return false;
+      }
+      mIdCount[set]++;
+    }
+    updateDefaults();
+    return true;
+  }
+
+  /**
+   * 添加数据规则，规则中的ID同时加入集合
+   * @param anyId - 规则适用于所有ID，此时id和ext被忽略
+   * @param value - 从offset开始的length个字节
+   * @param mask - 比较的位，和value的字节顺序相同
+   * @return 规则已满、长度不合法或哈希集合已满时返回false
+   */
+  bool addRule(uint8_t set, bool anyId, bool ext, uint32_t id, uint8_t offset,
+               const uint8_t * value, const uint8_t * mask, uint8_t length) {
+    if (set >= CAN_STAGE_SETS || mRuleCount >= CAN_STAGE_MAX_RULES || length == 0 || length > 8
+        || offset + length > 64 || (!anyId && id > (ext ? 0x1FFFFFFFUL : 0x7FFUL))) {
+      return false;
+    }
+    can_payload_rule_t & rule = mRules[mRuleCount];
+    rule.id = id;
+    rule.ext = ext;
+    rule.anyId = anyId;
+    rule.sets = 1 << set;
+    rule.offset = offset;
+    rule.length = length;
+    rule.mask = 0;
+    rule.value = 0;
+    memcpy(&rule.mask, mask, length);
+    memcpy(&rule.value, value, length);
+    rule.value &= rule.mask;
+    if (anyId) {
+      mAnyRules |= 1 << set;
+    } else {
+      if (!mark(ext, id, (1 << set) | (0x10 << set))) {
+        return false;
+      }
+      mIdCount[set]++;
+    }
+    mRuleCount++;
+    updateDefaults();
+    return true;
+  }
+
+  /**
+   * 对一帧计算所属的集合，每帧只调用一次
+   * @return 集合的位，(1 << CAN_STAGE_xxx)
+   */
+  uint8_t evaluate(const CANFDMessage & msg) {
+    uint8_t entry = 0;
+    if (!msg.ext) {
+      entry = msg.id < 0x800 ? mStd[msg.id] : 0;
+    } else if (mExtCount > 0) {
+      uint8_t * value = extFind(msg.id);
+      entry = value != NULL ? *value : 0;
+    }
+    uint8_t sets = (entry | mAllIds) & 0x0F;
+    uint8_t ruleSets = ((entry >> 4) | mAnyRules) & sets;
+    if (ruleSets) {
+      uint8_t pass = 0;
+      for (uint8_t i = 0; i < mRuleCount; i++) {
+        const can_payload_rule_t & rule = mRules[i];
+        if ((rule.sets & ruleSets) && (rule.anyId || (rule.id == msg.id && rule.ext == msg.ext))
+            && payloadMatch(rule, msg)) {
+          pass |= rule.sets;
+        }
+      }
+      sets = (sets & ~ruleSets) | (pass & ruleSets);
+    }
+    for (uint8_t s = 0; s < CAN_STAGE_SETS; s++) {
+      if (sets & (1 << s)) {
+        mMatches[s]++;
+      }
+    }
+    return sets;
+  }
+
+  // 输出每个集合的ID数、规则和匹配的帧数
+  void print() {
+    for (uint8_t s = 0; s < CAN_STAGE_SETS; s++) {
+      Serial.printf("rule %s: %s, %u matched\n", can_stage_set_names[s],
+                    (mAllIds & (1 << s)) ? "all ids" : (mIdCount[s] ? "listed ids" : "off"), mMatches[s]);
+    }
+    Serial.printf("rule ids: %u extended ids, %u payload rules\n", mExtCount, mRuleCount);
+    for (uint8_t i = 0; i < mRuleCount; i++) {
+      const can_payload_rule_t & rule = mRules[i];
+      uint8_t s = __builtin_ctz(rule.sets);
+      if (rule.anyId) {
+        Serial.printf("  %s any", can_stage_set_names[s]);
+      } else {
+        Serial.printf(rule.ext ? "  %s %08X" : "  %s %03X", can_stage_set_names[s], rule.id);
+      }
+      Serial.printf(" data[%u]", rule.offset);
+      for (uint8_t b = 0; b < rule.length; b++) {
+        Serial.printf(" %02X/%02X", (uint8_t)(rule.value >> (b * 8)), (uint8_t)(rule.mask >> (b * 8)));
+      }
+      Serial.println();
+    }
+  }
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+
+/**
+ * 计算一帧在总线上的位数(包括帧间隔和最坏情况的填充位)，总线负载统计和吞吐量测量共用
+ * @param nominal - 按仲裁段波特率传输的位数
+ * @param data - 按数据段波特率传输的位数(只有带BRS的FD帧不为0)
+ */
+inline void can_frame_bits(const CANFDMessage & msg, uint32_t & nominal, uint32_t & data) {
+  uint32_t payload = msg.type == CANFDMessage::CAN_REMOTE ? 0 : msg.len * 8;
+  if (msg.type == CANFDMessage::CAN_REMOTE || msg.type == CANFDMessage::CAN_DATA) {
+    // SOF..CRC可以填充：标准帧34位，扩展帧54位；之后是CRC分隔符、ACK、EOF和帧间隔共13位
+    uint32_t stuffable = (msg.ext ? 54 : 34) + payload;
+    nominal = stuffable + (stuffable - 1) / 4 + 13;
+    data = 0;
+    return;
+  }
+  // FD仲裁段：SOF、ID、RRS、IDE、FDF、res、BRS(扩展帧另有SRR和18位扩展ID)
+  uint32_t arbitration = msg.ext ? 36 : 17;
+  // 数据段：ESI、DLC、数据，之后是填充计数、CRC以及固定填充位
+  uint32_t dynamic = 5 + payload;
+  uint32_t crc = msg.len > 16 ? 4 + 21 + 7 : 4 + 17 + 6;
+  uint32_t dataPhase = dynamic + (dynamic - 1) / 4 + crc;
+  nominal = arbitration + (arbitration - 1) / 4 + 13;
+  if (msg.type == CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH) {
+    data = dataPhase;
+  } else {
+    nominal += dataPhase;
+    data = 0;
+  }
+}
+
+/**
+ * 按位数和波特率计算总线占用时间
+ * @return 占用时间(us)
+ */
+inline uint64_t can_bus_time_us(uint64_t nominal, uint64_t data, uint32_t arbitrationRate, uint32_t dataRate) {
+  return nominal * 1000000 / arbitrationRate + (dataRate ? data * 1000000 / dataRate : 0);
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "config.h"
+
+/**
+ * CAN网关：把一个通道收到的帧按路由表转发到另一个通道，用于台架测试和串在ECU与整车之间的中间人诊断
+ *
+ * 路由：源通道上的一段ID转发到目的通道，可以把ID平移到新的起始ID；阻断路由匹配的帧不转发。
+ * 没有路由的帧不转发，bridge命令添加两个通道之间双向转发所有ID的路由。
+ * 阻断路由优先于转发路由，其余按添加的顺序，先添加的路由优先。
+ * 改写规则：转发前把从offset开始的最多8个字节按 (数据 & ~mask) | value 改写，
+ * 可以针对一个ID或源通道上的所有ID，和CanFilterStage的数据规则一样编译成一次64位运算。
+ *
+ * 转发完全在采集任务中完成，帧从控制器读出后立即查表并写入目的控制器，不经过recv_queue：
+ * 标准帧每个源通道一张2048项的表，每项的低5位是路由序号+1，最高位表示这个ID有改写规则；
+ * 扩展帧只有少量路由，按优先顺序预先排好每个源通道的路由列表。
+ * 延迟按每帧自己的时间戳计算：MCP2518是控制器在SOF时的时间戳，TWAI是读取任务被中断唤醒的时间，
+ * 到交给目的控制器为止，每条路由一个直方图，不包括帧在目的总线上等待仲裁和发送的时间。
+ *
+ * 转发在采集白名单(CanFilter)之前完成，白名单只决定哪些帧被采集。有转发路由时MCP2518不使用硬件过滤器
+ * (BusConfigService::setAcceptAll)，否则白名单外的帧在控制器中就被丢弃，不能转发。
+ *
+ * 路由表由数据消费任务编辑，commit()后在采集任务下一次转发时生效，生效后统计重新开始。
+ * 采集任务在mMux中切换路由表和更新统计，print()在mMux中复制一份，不会读到一半的更新。
+ */
+
+#define CAN_GATEWAY_MAX_ROUTES    16
+#define CAN_GATEWAY_MAX_REWRITES  16
+#define CAN_GATEWAY_BLOCK         255      // 阻断路由的目的通道
+#define CAN_GATEWAY_BUCKETS       8
+#define CAN_GATEWAY_REWRITE_ID    0x80     // 标准帧表项：这个ID有改写规则
+
+static const uint16_t can_gateway_bucket_us[CAN_GATEWAY_BUCKETS - 1] = {50, 100, 200, 300, 500, 1000, 2000};
+
+typedef struct {
+  uint8_t src;           // 源通道
+  uint8_t dst;           // 目的通道，CAN_GATEWAY_BLOCK为阻断
+  bool ext;
+  bool translate;        // 转发时平移ID
+  uint32_t first;        // 源ID范围
+  uint32_t last;
+  uint32_t target;       // 平移后first对应的ID
+} can_route_t;
+
+typedef struct {
+  uint8_t src;
+  bool anyId;            // 适用于源通道上所有转发的帧
+  bool ext;
+  uint32_t id;
+  uint8_t offset;        // 改写的第一个字节
+  uint8_t length;        // 改写的字节数，1 ~ 8
+  uint64_t mask;         // 小端序，第offset字节在最低8位
+  uint64_t value;
+} can_rewrite_t;
+
+typedef struct {
+  uint32_t forwarded;
+  uint32_t blocked;
+  uint32_t rewritten;
+  uint32_t failed;       // 目的控制器发送缓冲区满或不支持(FD帧发往TWAI)
+  uint32_t hist[CAN_GATEWAY_BUCKETS];
+  uint32_t maxUs;
+  uint64_t sumUs;
+} can_route_stats_t;
+
+class CanGateway {
+private:
+  portMUX_TYPE mMux;
+
+  // 数据消费任务编辑的路由表
+  can_route_t mRoutes[CAN_GATEWAY_MAX_ROUTES];
+  uint8_t mRouteCount;
+  can_rewrite_t mRewrites[CAN_GATEWAY_MAX_REWRITES];
+  uint8_t mRewriteCount;
+
+  // 提交给采集任务的路由表
+  can_route_t mPendingRoutes[CAN_GATEWAY_MAX_ROUTES];
+  uint8_t mPendingRouteCount;
+  can_rewrite_t mPendingRewrites[CAN_GATEWAY_MAX_REWRITES];
+  uint8_t mPendingRewriteCount;
+  volatile bool mPending;
+  bool mForwarding;                // 已提交的路由表中有转发(不是阻断)的路由
+
+  // 正在使用的路由表和查找表，由采集任务写，mActive、mActiveCount和mStats的修改在mMux中
+  can_route_t mActive[CAN_GATEWAY_MAX_ROUTES];
+  uint8_t mActiveCount;
+  can_rewrite_t mActiveRewrites[CAN_GATEWAY_MAX_REWRITES];
+  uint8_t mActiveRewriteCount;
+  uint8_t mStd[CAN_MAX_CHANNELS][0x800];
+  uint8_t mExt[CAN_MAX_CHANNELS][CAN_GATEWAY_MAX_ROUTES];   // 按优先顺序的扩展帧路由
+  uint8_t mExtCount[CAN_MAX_CHANNELS];
+  bool mAnyRewrite[CAN_MAX_CHANNELS];                       // 源通道有所有ID的改写规则
+  can_route_stats_t mStats[CAN_GATEWAY_MAX_ROUTES];
+
+  // 阻断路由在前，其余按添加的顺序
+  void rebuild() {
+    memset(mStd, 0, sizeof(mStd));
+    memset(mExtCount, 0, sizeof(mExtCount));
+    memset(mAnyRewrite, 0, sizeof(mAnyRewrite));
+    for (uint8_t pass = 0; pass < 2; pass++) {
+      for (uint8_t i = 0; i < mActiveCount; i++) {
+        const can_route_t & r = mActive[i];
+        if ((r.dst == CAN_GATEWAY_BLOCK) != (pass == 0)) {
+          continue;
+        }
+        if (r.ext) {
+          mExt[r.src][mExtCount[r.src]++] = i;
+          continue;
+        }
+        for (uint32_t id = r.first; id <= r.last; id++) {
+          if (mStd[r.src][id] == 0) {
+            mStd[r.src][id] = i + 1;
+          }
+        }
+      }
+    }
+    for (uint8_t i = 0; i < mActiveRewriteCount; i++) {
+      const can_rewrite_t & w = mActiveRewrites[i];
+      if (w.anyId) {
+        mAnyRewrite[w.src] = true;
+      } else if (!w.ext) {
+        mStd[w.src][w.id] |= CAN_GATEWAY_REWRITE_ID;
+      }
+    }
+  }
+
+  // 查找帧的路由，没有返回-1
+  int8_t lookup(uint8_t src, const CANFDMessage & msg, bool & rewrite) {
+    if (!msg.ext) {
+      uint8_t entry = msg.id < 0x800 ? mStd[src][msg.id] : 0;
+      rewrite = (entry & CAN_GATEWAY_REWRITE_ID) || mAnyRewrite[src];
+      return (int8_t) (entry & 0x1F) - 1;
+    }
+    rewrite = mActiveRewriteCount > 0;
+    for (uint8_t n = 0; n < mExtCount[src]; n++) {
+      const can_route_t & r = mActive[mExt[src][n]];
+      if (msg.id >= r.first && msg.id <= r.last) {
+        return mExt[src][n];
+      }
+    }
+    return -1;
+  }
+
+  // 按源通道和原始ID改写数据，返回是否改写
+  bool applyRewrites(uint8_t src, uint32_t id, CANFDMessage & msg) {
+    bool changed = false;
+    for (uint8_t i = 0; i < mActiveRewriteCount; i++) {
+      const can_rewrite_t & w = mActiveRewrites[i];
+      if (w.src != src || (!w.anyId && (w.id != id || w.ext != msg.ext))
+          || msg.type == CANFDMessage::CAN_REMOTE || msg.len < w.offset + w.length) {
+        continue;
+      }
+      uint64_t data = 0;
+      memcpy(&data, msg.data + w.offset, w.length);
+      data = (data & ~w.mask) | w.value;
+      memcpy(msg.data + w.offset, &data, w.length);
+      changed = true;
+    }
+    return changed;
+  }
+
+  void record(can_route_stats_t & s, uint32_t latency) {
+    uint8_t b = 0;
+    while (b < CAN_GATEWAY_BUCKETS - 1 && latency >= can_gateway_bucket_us[b]) {
+      b++;
+    }
+    portENTER_CRITICAL(&mMux);
+    s.hist[b]++;
+    s.forwarded++;
+    s.sumUs += latency;
+    if (latency > s.maxUs) {
+      s.maxUs = latency;
+    }
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  // 采集任务中更新一个计数
+  void increment(uint32_t & counter) {
+    portENTER_CRITICAL(&mMux);
+    counter++;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+public:
+  CanGateway() {
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mRouteCount = 0;
+    mRewriteCount = 0;
+    mPendingRouteCount = 0;
+    mPendingRewriteCount = 0;
+    mPending = false;
+    mForwarding = false;
+    mActiveCount = 0;
+    mActiveRewriteCount = 0;
+    memset(mStd, 0, sizeof(mStd));
+    memset(mExtCount, 0, sizeof(mExtCount));
+    memset(mAnyRewrite, 0, sizeof(mAnyRewrite));
+    memset(mStats, 0, sizeof(mStats));
+  }
+
+  /**
+   * 添加一条路由
+   * @param dst - 目的通道，CAN_GATEWAY_BLOCK为阻断
+   * @param translate - 把first平移到target，范围内的其他ID按相同的偏移平移
+   * @return 路由已满，通道、ID范围或平移后的ID不合法时返回false
+   */
+  bool addRoute(uint8_t src, uint8_t dst, bool ext, uint32_t first, uint32_t last,
+                bool translate = false, uint32_t target = 0) {
+    uint32_t maxId = ext ? 0x1FFFFFFFUL : 0x7FFUL;
+    if (mRouteCount >= CAN_GATEWAY_MAX_ROUTES || src >= CAN_MAX_CHANNELS || src == dst
+        || (dst >= CAN_MAX_CHANNELS && dst != CAN_GATEWAY_BLOCK) || first > last || last > maxId
+        || (translate && target + (last - first) > maxId)) {
+      return false;
+    }
+    mRoutes[mRouteCount++] = {src, dst, ext, translate, first, last, target};
+    return true;
+  }
+
+  // 两个通道之间双向转发所有标准帧和扩展帧
+  bool addBridge(uint8_t a, uint8_t b) {
+    if (mRouteCount + 4 > CAN_GATEWAY_MAX_ROUTES) {
+      return false;
+    }
+    return addRoute(a, b, false, 0, 0x7FF) && addRoute(a, b, true, 0, 0x1FFFFFFF)
+        && addRoute(b, a, false, 0, 0x7FF) && addRoute(b, a, true, 0, 0x1FFFFFFF);
+  }
+
+  /**
+   * 添加改写规则
+   * @param anyId - 适用于源通道上所有转发的帧，此时id和ext被忽略
+   * @param value - 从offset开始的length个字节
+   * @param mask - 改写的位，和value的字节顺序相同
+   * @return 规则已满或参数不合法时返回false
+   */
+  bool addRewrite(uint8_t src, bool anyId, bool ext, uint32_t id, uint8_t offset,
+                  const uint8_t * value, const uint8_t * mask, uint8_t length) {
+    if (mRewriteCount >= CAN_GATEWAY_MAX_REWRITES || src >= CAN_MAX_CHANNELS || length == 0 || length > 8
+        || offset + length > 64 || (!anyId && id > (ext ? 0x1FFFFFFFUL : 0x7FFUL))) {
+      return false;
+    }
+    can_rewrite_t & w = mRewrites[mRewriteCount];
+    w.src = src;
+    w.anyId = anyId;
+    w.ext = ext;
+    w.id = anyId ? 0 : id;
+    w.offset = offset;
+    w.length = length;
+    w.mask = 0;
+    w.value = 0;
+    memcpy(&w.mask, mask, length);
+    memcpy(&w.value, value, length);
+    w.value &= w.mask;
+    mRewriteCount++;
+    return true;
+  }
+
+  void clear() {
+    mRouteCount = 0;
+    mRewriteCount = 0;
+  }
+
+  // 把编辑好的路由表提交给采集任务
+  void commit() {
+    portENTER_CRITICAL(&mMux);
+    memcpy(mPendingRoutes, mRoutes, mRouteCount * sizeof(can_route_t));
+    mPendingRouteCount = mRouteCount;
+    memcpy(mPendingRewrites, mRewrites, mRewriteCount * sizeof(can_rewrite_t));
+    mPendingRewriteCount = mRewriteCount;
+    mPending = true;
+    portEXIT_CRITICAL(&mMux);
+    mForwarding = false;
+    for (uint8_t i = 0; i < mRouteCount; i++) {
+      mForwarding |= mRoutes[i].dst != CAN_GATEWAY_BLOCK;
+    }
+  }
+
+  // 已提交的路由表中有没有转发路由，有时MCP2518需要接收所有帧
+  bool forwarding() {
+    return mForwarding;
+  }
+
+  /**
+   * 采集任务中对每个收到的帧调用，有路由时改写并写入目的控制器
+   * @param channels - 提供tryToSend(channel, msg)的控制器集合，只在采集任务中访问
+   * @param timestamp - 帧的接收时间(micros())，用于计算转发延迟
+   */
+  template <typename Channels>
+  void forward(Channels & channels, uint8_t src, const CANFDMessage & msg, uint32_t timestamp) {
+    if (mPending) {
+      portENTER_CRITICAL(&mMux);
+      memcpy(mActive, mPendingRoutes, mPendingRouteCount * sizeof(can_route_t));
+      mActiveCount = mPendingRouteCount;
+      memcpy(mActiveRewrites, mPendingRewrites, mPendingRewriteCount * sizeof(can_rewrite_t));
+      mActiveRewriteCount = mPendingRewriteCount;
+      mPending = false;
+      memset(mStats, 0, sizeof(mStats));
+      portEXIT_CRITICAL(&mMux);
+      rebuild();
+    }
+    if (mActiveCount == 0) {
+      return;
+    }
+    bool rewrite;
+    int8_t index = lookup(src, msg, rewrite);
+    if (index < 0) {
+      return;
+    }
+    const can_route_t & route = mActive[index];
+    can_route_stats_t & stats = mStats[index];
+    if (route.dst == CAN_GATEWAY_BLOCK) {
+      increment(stats.blocked);
+      return;
+    }
+    CANFDMessage out = msg;
+    out.idx = 0;
+    if (rewrite && applyRewrites(src, msg.id, out)) {
+      increment(stats.rewritten);
+    }
+    if (route.translate) {
+      out.id = route.target + (msg.id - route.first);
+    }
+    if (!channels.tryToSend(route.dst, out)) {
+      increment(stats.failed);
+      return;
+    }
+    record(stats, micros() - timestamp);
+  }
+
+  uint8_t count() {
+    return mRouteCount;
+  }
+
+  // 输出路由表、改写规则和每条路由的延迟直方图，在数据消费任务中调用
+  void print() {
+    // 已提交的路由表和统计的快照，只在数据消费任务中使用
+    static can_route_t active[CAN_GATEWAY_MAX_ROUTES];
+    static can_route_stats_t stats[CAN_GATEWAY_MAX_ROUTES];
+    portENTER_CRITICAL(&mMux);
+    uint8_t activeCount = mActiveCount;
+    memcpy(active, mActive, sizeof(active));
+    memcpy(stats, mStats, sizeof(stats));
+    portEXIT_CRITICAL(&mMux);
+
+    Serial.printf("gateway: %u routes, %u rewrites\n", mRouteCount, mRewriteCount);
+    for (uint8_t i = 0; i < mRouteCount; i++) {
+      const can_route_t & r = mRoutes[i];
+      Serial.printf(r.ext ? "route %u: can%u %08X-%08X" : "route %u: can%u %03X-%03X", i, r.src, r.first, r.last);
+      if (r.dst == CAN_GATEWAY_BLOCK) {
+        Serial.print(" blocked");
+      } else {
+        Serial.printf(" -> can%u", r.dst);
+        if (r.translate) {
+          Serial.printf(r.ext ? " as %08X" : " as %03X", r.target);
+        }
+      }
+      // 统计属于已提交的路由表，还没生效的修改没有统计
+      if (i < activeCount && memcmp(&active[i], &r, sizeof(r)) == 0) {
+        const can_route_stats_t & s = stats[i];
+        Serial.printf(", %u forwarded, %u blocked, %u rewritten, %u failed", s.forwarded, s.blocked, s.rewritten, s.failed);
+        if (s.forwarded > 0) {
+          Serial.printf(", latency avg %u max %u us\n  us:", (uint32_t) (s.sumUs / s.forwarded), s.maxUs);
+          for (uint8_t b = 0; b < CAN_GATEWAY_BUCKETS; b++) {
+            if (b < CAN_GATEWAY_BUCKETS - 1) {
+              Serial.printf(" <%u:%u", can_gateway_bucket_us[b], s.hist[b]);
+            } else {
+              Serial.printf(" >=%u:%u", can_gateway_bucket_us[b - 1], s.hist[b]);
+            }
+          }
+        }
+      }
+      Serial.println();
+    }
+    for (uint8_t i = 0; i < mRewriteCount; i++) {
+      const can_rewrite_t & w = mRewrites[i];
+      if (w.anyId) {
+        Serial.printf("rewrite can%u any", w.src);
+      } else {
+        Serial.printf(w.ext ? "rewrite can%u %08X" : "rewrite can%u %03X", w.src, w.id);
+      }
+      Serial.printf(" data[%u]", w.offset);
+      for (uint8_t b = 0; b < w.length; b++) {
+        Serial.printf(" %02X/%02X", (uint8_t)(w.value >> (b * 8)), (uint8_t)(w.mask >> (b * 8)));
+      }
+      Serial.println();
+    }
+  }
+};
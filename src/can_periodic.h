@@ -0,0 +1,362 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "config.h"
+
+/**
+ * CAN周期发送：在台架上模拟缺失的ECU，按固定周期发送消息表中的帧
+ *
+ * 调度使用1ms一格、CAN_PERIODIC_WHEEL_SLOTS格的时间轮，每格是一个消息链表。
+ * 每过1ms只处理当前格的链表：到期的消息发送后按周期插入以后的格，所以每发送一帧的调度开销是O(1)，与消息表大小无关。
+ * 周期超过一圈(256ms)的消息带有剩余圈数，每经过一圈只把圈数减1放回本格，也是O(1)，
+ * 周期为P ms的消息每次发送之间被访问P/256次(最长周期60s时234次)。
+ *
+ * 帧通过MCP2518的TXQ发送(idx = 255)，TXQ的优先级高于发送FIFO，
+ * 周期帧不会排在回放、ISO-TP等数据后面；TXQ中有多帧时控制器按ID的优先级发送。
+ * TXQ满时这一帧放入重试链表，在下一次poll()时重试，迟到的时间计入抖动统计。
+ *
+ * 每帧发送前更新滚动计数器(按DBC的Intel位序，从起始位开始的len位)和校验字节
+ * (除校验字节外所有数据的XOR或CRC8 SAE J1850)。
+ *
+ * 消息表由数据消费任务编辑，commit()后在采集任务的下一次poll()中生效，生效后统计重新开始。
+ */
+
+#define CAN_PERIODIC_WHEEL_SLOTS  256
+#define CAN_PERIODIC_TICK_US      1000
+#define CAN_PERIODIC_MAX_PERIOD   60000
+
+typedef enum : uint8_t {
+  CAN_CHECKSUM_NONE,
+  CAN_CHECKSUM_XOR,
+  CAN_CHECKSUM_CRC8,     // CRC8 SAE J1850，多项式0x1D，初值和结果异或0xFF
+} can_checksum_type;
+
+typedef struct {
+  CANFDMessage msg;
+  uint16_t period;       // ms
+  uint8_t counterBit;    // 滚动计数器的起始位
+  uint8_t counterLen;    // 滚动计数器的位数，0为没有
+  uint8_t checksumByte;  // 校验字节的位置
+  uint8_t checksumType;  // can_checksum_type
+} can_periodic_config_t;
+
+typedef struct {
+  uint32_t sent;
+  uint32_t deferred;     // TXQ满重试的次数
+  int32_t minInterval;   // 实际发送间隔与周期之差(us)
+  int32_t maxInterval;
+  uint32_t maxLate;      // 相对计划时刻的最大延迟(us)
+} can_periodic_stats_t;
+
+// CRC8 SAE J1850
+static inline uint8_t can_crc8_j1850(const uint8_t * data, uint8_t len, uint8_t skip) {
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < len; i++) {
+    if (i == skip) {
+      continue;
+    }
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x1D) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc ^ 0xFF;
+}
+
+class CanPeriodic {
+private:
+  portMUX_TYPE mMux;
+
+  // 数据消费任务编辑的消息表
+  can_periodic_config_t mConfigs[CAN_PERIODIC_MAX];
+  uint8_t mConfigCount;
+
+  // 提交给采集任务的消息表
+  can_periodic_config_t mPendingConfigs[CAN_PERIODIC_MAX];
+  uint8_t mPendingCount;
+  volatile bool mPending;
+
+  // 正在发送的消息表和时间轮，只在采集任务中访问
+  can_periodic_config_t mActive[CAN_PERIODIC_MAX];
+  uint8_t mActiveCount;
+  uint32_t mDueTick[CAN_PERIODIC_MAX];      // 计划发送的格号
+  uint16_t mRounds[CAN_PERIODIC_MAX];       // 到期前还要经过所在格的圈数
+  int8_t mNext[CAN_PERIODIC_MAX];           // 同一格(或重试链表)中的下一条消息
+  int8_t mRetry;                            // TXQ满等待重试的消息
+  uint32_t mCounter[CAN_PERIODIC_MAX];
+  uint32_t mLastUs[CAN_PERIODIC_MAX];
+  int8_t mWheel[CAN_PERIODIC_WHEEL_SLOTS];  // 每格链表的第一条消息，-1为空
+  uint32_t mTick;                           // 当前格号
+  uint32_t mTickUs;                         // 当前格开始的时间
+  can_periodic_stats_t mStats[CAN_PERIODIC_MAX];
+  uint32_t mResyncs;                        // 落后超过一圈后重新排列的次数
+
+  int8_t find(uint32_t id) {
+    for (uint8_t i = 0; i < mConfigCount; i++) {
+      if (mConfigs[i].msg.id == id) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // 插入第tick格(tick在当前格之后)：下一次经过该格是在(tick - mTick - 1) / 圈长 圈之后
+  void insert(uint8_t index, uint32_t tick) {
+    mRounds[index] = (tick - mTick - 1) / CAN_PERIODIC_WHEEL_SLOTS;
+    uint8_t slot = tick % CAN_PERIODIC_WHEEL_SLOTS;
+    mNext[index] = mWheel[slot];
+    mWheel[slot] = index;
+  }
+
+  // 从当前格开始重新排列所有消息，按序号错开相位，避免同周期的消息挤在同一格
+  void rebuild() {
+    memset(mWheel, -1, sizeof(mWheel));
+    mRetry = -1;
+    for (uint8_t i = 0; i < mActiveCount; i++) {
+      mDueTick[i] = mTick + 1 + i % mActive[i].period;
+      insert(i, mDueTick[i]);
+    }
+  }
+
+  // 发送前更新计数器和校验字节
+  void prepare(uint8_t index) {
+    can_periodic_config_t & cfg = mActive[index];
+    if (cfg.counterLen > 0) {
+      uint32_t value = mCounter[index];
+      for (uint8_t b = 0; b < cfg.counterLen; b++) {
+        uint16_t bit = cfg.counterBit + b;
+        if (value & (1UL << b)) {
+          cfg.msg.data[bit / 8] |= 1 << (bit % 8);
+        } else {
+          cfg.msg.data[bit / 8] &= ~(1 << (bit % 8));
+        }
+      }
+    }
+    if (cfg.checksumType == CAN_CHECKSUM_XOR) {
+      uint8_t x = 0;
+      for (uint8_t i = 0; i < cfg.msg.len; i++) {
+        x ^= i == cfg.checksumByte ? 0 : cfg.msg.data[i];
+      }
+      cfg.msg.data[cfg.checksumByte] = x;
+    } else if (cfg.checksumType == CAN_CHECKSUM_CRC8) {
+      cfg.msg.data[cfg.checksumByte] = can_crc8_j1850(cfg.msg.data, cfg.msg.len, cfg.checksumByte);
+    }
+  }
+
+  template <typename Controller>
+  void fire(Controller & can, uint8_t index, uint32_t now) {
+    prepare(index);
+    can_periodic_stats_t & stats = mStats[index];
+    if (!can.tryToSend(mActive[index].msg)) {
+      stats.deferred++;
+      mNext[index] = mRetry;
+      mRetry = index;
+      return;
+    }
+    // 计划时刻：第mDueTick[index]格的开始
+    uint32_t due = mTickUs - (mTick - mDueTick[index]) * CAN_PERIODIC_TICK_US;
+    uint32_t late = now - due;
+    if (late > stats.maxLate) {
+      stats.maxLate = late;
+    }
+    if (stats.sent > 0) {
+      int32_t interval = (int32_t)(now - mLastUs[index]) - mActive[index].period * CAN_PERIODIC_TICK_US;
+      if (stats.sent == 1 || interval < stats.minInterval) {
+        stats.minInterval = interval;
+      }
+      if (stats.sent == 1 || interval > stats.maxInterval) {
+        stats.maxInterval = interval;
+      }
+    }
+    stats.sent++;
+    mLastUs[index] = now;
+    mCounter[index]++;
+
+    // 下一次按计划时刻计算，不累积本次的延迟
+    uint32_t next = mDueTick[index] + mActive[index].period;
+    if ((int32_t)(next - mTick) <= 0) {
+      next = mTick + 1;
+    }
+    mDueTick[index] = next;
+    insert(index, next);
+  }
+
+public:
+  CanPeriodic() {
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mConfigCount = 0;
+    mPendingCount = 0;
+    mPending = false;
+    mActiveCount = 0;
+    memset(mWheel, -1, sizeof(mWheel));
+    mRetry = -1;
+    mTick = 0;
+    mTickUs = 0;
+    mResyncs = 0;
+  }
+
+  /**
+   * 添加或替换一条周期消息，计数器和校验设置被清除
+   * @param period - 周期(ms)，1 ~ CAN_PERIODIC_MAX_PERIOD
+   * @return 消息表满、周期或帧不合法(长度超过TXQ的64字节等)时返回false
+   */
+  bool add(const CANFDMessage & msg, uint16_t period) {
+    if (period == 0 || period > CAN_PERIODIC_MAX_PERIOD || !msg.isValid()) {
+      return false;
+    }
+    int8_t index = find(msg.id);
+    if (index < 0) {
+      if (mConfigCount >= CAN_PERIODIC_MAX) {
+        return false;
+      }
+      index = mConfigCount++;
+    }
+    can_periodic_config_t & cfg = mConfigs[index];
+    cfg = can_periodic_config_t();
+    cfg.msg = msg;
+    cfg.msg.idx = 255;
+    cfg.period = period;
+    return true;
+  }
+
+  bool remove(uint32_t id) {
+    int8_t index = find(id);
+    if (index < 0) {
+      return false;
+    }
+    memmove(mConfigs + index, mConfigs + index + 1, (mConfigCount - index - 1) * sizeof(can_periodic_config_t));
+    mConfigCount--;
+    return true;
+  }
+
+  void clear() {
+    mConfigCount = 0;
+  }
+
+  /**
+   * 设置滚动计数器，每发送一次加1，超过len位后回到0
+   * @param bit - Intel位序的起始位
+   * @return 消息不存在或计数器超出数据长度时返回false
+   */
+  bool setCounter(uint32_t id, uint8_t bit, uint8_t len) {
+    int8_t index = find(id);
+    if (index < 0 || len > 32 || bit + len > mConfigs[index].msg.len * 8) {
+      return false;
+    }
+    mConfigs[index].counterBit = bit;
+    mConfigs[index].counterLen = len;
+    return true;
+  }
+
+  /**
+   * 设置校验字节，在更新计数器之后计算
+   * @return 消息不存在或校验字节超出数据长度时返回false
+   */
+  bool setChecksum(uint32_t id, uint8_t byte, can_checksum_type type) {
+    int8_t index = find(id);
+    if (index < 0 || byte >= mConfigs[index].msg.len) {
+      return false;
+    }
+    mConfigs[index].checksumByte = byte;
+    mConfigs[index].checksumType = type;
+    return true;
+  }
+
+  // 把编辑好的消息表提交给采集任务
+  void commit() {
+    portENTER_CRITICAL(&mMux);
+    memcpy(mPendingConfigs, mConfigs, mConfigCount * sizeof(can_periodic_config_t));
+    mPendingCount = mConfigCount;
+    mPending = true;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  uint8_t count() {
+    return mConfigCount;
+  }
+
+  /**
+   * 采集任务中每次循环调用：推进时间轮并发送到期的消息
+   * @param can - 发送用的控制器，只在采集任务中访问
+   * @param now - micros()
+   */
+  template <typename Controller>
+  void poll(Controller & can, uint32_t now) {
+    if (mPending) {
+      portENTER_CRITICAL(&mMux);
+      memcpy(mActive, mPendingConfigs, mPendingCount * sizeof(can_periodic_config_t));
+      mActiveCount = mPendingCount;
+      mPending = false;
+      portEXIT_CRITICAL(&mMux);
+      memset(mCounter, 0, sizeof(mCounter));
+      memset(mStats, 0, sizeof(mStats));
+      mTickUs = now;
+      rebuild();
+    }
+    if (mActiveCount == 0) {
+      return;
+    }
+
+    // 总线重新初始化等原因落后超过一圈时不补发，从当前时间重新排列
+    if (now - mTickUs > CAN_PERIODIC_WHEEL_SLOTS * CAN_PERIODIC_TICK_US) {
+      mTickUs = now;
+      mResyncs++;
+      rebuild();
+      return;
+    }
+
+    // 先重试上次TXQ满没有发出的消息
+    int8_t retry = mRetry;
+    mRetry = -1;
+    while (retry >= 0) {
+      int8_t next = mNext[retry];
+      fire(can, retry, now);
+      retry = next;
+    }
+
+    while ((int32_t)(now - (mTickUs + CAN_PERIODIC_TICK_US)) >= 0) {
+      mTick++;
+      mTickUs += CAN_PERIODIC_TICK_US;
+
+      // 取下当前格的链表，逐条发送或放回
+      uint8_t slot = mTick % CAN_PERIODIC_WHEEL_SLOTS;
+      int8_t index = mWheel[slot];
+      mWheel[slot] = -1;
+      while (index >= 0) {
+        int8_t next = mNext[index];
+        if (mRounds[index] > 0) {
+          mRounds[index]--;
+          mNext[index] = mWheel[slot];
+          mWheel[slot] = index;
+        } else {
+          fire(can, index, now);
+        }
+        index = next;
+      }
+    }
+  }
+
+  // 输出消息表和每条消息的发送统计
+  void print() {
+    Serial.printf("tx: %u messages, %u resyncs\n", mConfigCount, mResyncs);
+    for (uint8_t i = 0; i < mConfigCount; i++) {
+      const can_periodic_config_t & cfg = mConfigs[i];
+      Serial.printf(cfg.msg.ext ? "tx %08X" : "tx %03X", cfg.msg.id);
+      Serial.printf(" [%u] %u ms", cfg.msg.len, cfg.period);
+      if (cfg.counterLen) {
+        Serial.printf(", counter %u|%u", cfg.counterBit, cfg.counterLen);
+      }
+      if (cfg.checksumType != CAN_CHECKSUM_NONE) {
+        Serial.printf(", %s byte %u", cfg.checksumType == CAN_CHECKSUM_XOR ? "xor" : "crc8", cfg.checksumByte);
+      }
+      // 统计属于已提交的消息表，还没生效的修改没有统计
+      if (i < mActiveCount && mActive[i].msg.id == cfg.msg.id) {
+        const can_periodic_stats_t & stats = mStats[i];
+        Serial.printf(", %u sent, %u deferred, jitter %d..%d us, max late %u us",
+                      stats.sent, stats.deferred, stats.minInterval, stats.maxInterval, stats.maxLate);
+      }
+      Serial.println();
+    }
+  }
+};
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include <ACAN2517FD.h>
+#include "capture_log.h"
+#include "replay_timing.h"
+
+/**
+ * CAN回放：按采集日志中记录的时间间隔把CAN帧重新发送到总线
+ *
+ * 数据消费任务(loop2)在service()中从TF卡按块预读日志，解析出CAN记录并计算每帧的发送时刻，
+ * 放入单生产者单消费者的环形队列；采集任务(loop)在poll()中取出到期的帧，用can.tryToSend发送。
+ * 读TF卡的耗时(偶尔几十ms)由队列吸收，不会影响发送时刻。
+ *
+ * 时间基准是1MHz的硬件定时器，每次回放开始时清零。mcp2518在SPI上，不能在中断中访问，
+ * 所以发送只能在采集任务中完成：报警值设为队首帧发送时刻之前CAN_REPLAY_SPIN_US，
+ * 中断中只置位标志，poll()在标志置位前只读一个变量；标志置位后poll()忙等到发送时刻再发送。
+ * 这样误差不再是一个采集循环周期，而是采集循环一次超过CAN_REPLAY_SPIN_US的部分：
+ * 一次循环不超过CAN_REPLAY_SPIN_US + CAN_REPLAY_LATE_US(100us)时误差不超过50us；
+ * SPI接收突发、重新初始化等更长的循环仍然会让帧晚发，这些帧计入"over 50 us"。
+ * 忙等每次最多CAN_REPLAY_SPIN_US，2000帧/秒时最多占用采集核心10%的时间。
+ * 主机上的回放模拟(test/test_replay_sim)按不同的循环周期验证这两个结论。
+ *
+ * 每帧的调度误差 = 实际发送时的定时器值 - 计划发送时刻，统计最大值、平均值和分布。
+ * 控制器发送FIFO满导致的重试也会计入误差。
+ * 已经到期的帧用can.trySendBurst一起发送，不需要每帧等一次采集循环。
+ * 回放只把帧写入控制器的发送FIFO，不进入驱动的发送缓冲区：发送FIFO满时下次循环重试，
+ * 所以发送数(sent)和误差都按控制器接收帧的时刻计算，不会因为帧停在驱动缓冲区中而偏小。
+ * 时间换算和误差统计在replay_timing.h中，可以在主机上测试。
+ */
+
+#define CAN_REPLAY_QUEUE_SIZE   256      // 预读的帧数，2000帧/秒时约128ms
+#define CAN_REPLAY_BURST        8        // 一次交给控制器的到期帧数
+#define CAN_REPLAY_SPIN_US      50       // 在发送时刻之前多少us开始在poll()中忙等
+
+typedef struct {
+  uint64_t due;                // 计划发送时刻(定时器us)
+  CANFDMessage msg;
+} can_replay_entry_t;
+
+typedef enum : uint8_t {
+  CAN_REPLAY_IDLE,             // 没有回放
+  CAN_REPLAY_RUNNING,          // 采集任务正在按时发送
+  CAN_REPLAY_STOPPING,         // 数据消费任务请求停止
+  CAN_REPLAY_DONE,             // 采集任务已停止发送，等待数据消费任务关闭文件
+} can_replay_state;
+
+class CanReplay {
+private:
+  fs::FS & mFS;
+  File mFile;
+  char mPath[32];
+
+  // 预读块，上一块末尾不完整的记录移到开头再接着读
+  uint8_t mBlock[CAPTURE_LOG_BLOCK_SIZE];
+  uint16_t mBlockFill;
+  uint16_t mBlockPos;
+  uint16_t mHeaderSize;        // 文件头中的记录头长度
+  volatile bool mEof;
+
+  ReplayClock mClock;          // 时间换算，只在数据消费任务中访问
+
+  // 环形队列，mHead只由数据消费任务修改，mTail只由采集任务修改
+  can_replay_entry_t * mQueue;  // CAN_REPLAY_QUEUE_SIZE项，begin()中分配
+  volatile uint16_t mHead;
+  volatile uint16_t mTail;
+  volatile can_replay_state mState;
+
+  // 定时器，只在采集任务中访问
+  hw_timer_t * mTimer;
+  bool mActive;
+  bool mArmed;
+  volatile bool mFired;
+
+  // 统计
+  uint32_t mRecords;           // 读到的CAN记录数
+  uint32_t mSkipped;           // 无法发送的记录(拆分的记录、长度非法等)
+  uint32_t mUnderruns;         // 队列被取空时文件还没读完的次数
+  uint32_t mRetries;           // 控制器发送FIFO满，下次循环重试的次数
+  uint32_t mTooLong;           // 超过控制器发送FIFO数据长度的帧(经典CAN模式下的CAN FD帧)
+  ReplayErrors mErrors;        // 每帧的调度误差，计数即控制器接收的帧数
+
+  static void IRAM_ATTR onTimer(void * arg) {
+    ((CanReplay *) arg)->mFired = true;
+  }
+
+  // 由记录头生成CAN帧
+  static bool makeMessage(const capture_record_header_t & header, const uint8_t * data, CANFDMessage & msg) {
+    msg.id = header.id;
+    msg.ext = (header.flags & CAPTURE_FLAG_EXTENDED) != 0;
+    msg.idx = 0;
+    if (header.flags & CAPTURE_FLAG_REMOTE) {
+      msg.type = CANFDMessage::CAN_REMOTE;
+    } else if (header.flags & CAPTURE_FLAG_BRS) {
+      msg.type = CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH;
+    } else if (header.flags & CAPTURE_FLAG_FD) {
+      msg.type = CANFDMessage::CANFD_NO_BIT_RATE_SWITCH;
+    } else {
+      msg.type = CANFDMessage::CAN_DATA;
+    }
+    if (header.len > sizeof(msg.data)) {
+      return false;
+    }
+    msg.len = header.len;
+    memcpy(msg.data, data, header.len);
+    return msg.isValid();
+  }
+
+  // 把上一块剩余的数据移到开头，从文件读满预读块
+  bool readBlock() {
+    uint16_t remain = mBlockFill - mBlockPos;
+    memmove(mBlock, mBlock + mBlockPos, remain);
+    mBlockPos = 0;
+    mBlockFill = remain;
+    int n = mFile.read(mBlock + remain, sizeof(mBlock) - remain);
+    if (n <= 0) {
+      mEof = true;
+      return false;
+    }
+    mBlockFill += n;
+    return true;
+  }
+
+  /**
+   * 从预读块中取出下一条CAN记录放入队列
+   * @return 队列满或文件结束时返回false
+   */
+  bool fillOne() {
+    while (true) {
+      if ((uint16_t)(mHead - mTail) >= CAN_REPLAY_QUEUE_SIZE) {
+        return false;
+      }
+      if (mBlockFill - mBlockPos < mHeaderSize) {
+        if (mEof || !readBlock()) {
+          return false;
+        }
+        continue;
+      }
+      const capture_record_header_t * header = (const capture_record_header_t *) (mBlock + mBlockPos);
+      uint16_t size = mHeaderSize + header->len;
+      if (mBlockFill - mBlockPos < size) {
+        // 文件末尾不完整的记录(记录时掉电)被丢弃
+        if (mEof || !readBlock()) {
+          return false;
+        }
+        continue;
+      }
+      mBlockPos += size;
+      if (header->type != CAPTURE_CAN) {
+        continue;
+      }
+      mRecords++;
+
+      // 跳过的记录也推进时间，后面的帧保持原来的间隔
+      uint64_t due = mClock.due(header->timestamp);
+
+      can_replay_entry_t & entry = mQueue[mHead % CAN_REPLAY_QUEUE_SIZE];
+      if ((header->flags & CAPTURE_FLAG_CONTINUED)
+          || !makeMessage(*header, (const uint8_t *) header + mHeaderSize, entry.msg)) {
+        mSkipped++;
+        continue;
+      }
+      entry.due = due;
+      // 先写完队列中的数据再移动队首
+      __sync_synchronize();
+      mHead = mHead + 1;
+      return true;
+    }
+  }
+
+  void closeFile() {
+    mFile.close();
+    mState = CAN_REPLAY_IDLE;
+  }
+
+public:
+  CanReplay(fs::FS & fs) : mFS(fs) {
+    mPath[0] = 0;
+    mQueue = NULL;
+    mBlockFill = 0;
+    mBlockPos = 0;
+    mHeaderSize = sizeof(capture_record_header_t);
+    mEof = true;
+    mHead = 0;
+    mTail = 0;
+    mState = CAN_REPLAY_IDLE;
+    mTimer = NULL;
+    mActive = false;
+    mArmed = false;
+    mFired = false;
+    mRecords = 0;
+    mSkipped = 0;
+    mUnderruns = 0;
+    mRetries = 0;
+    mTooLong = 0;
+  }
+
+  /**
+   * 设置预读队列
+   * @param queue - CAN_REPLAY_QUEUE_SIZE项
+   */
+  void begin(can_replay_entry_t * queue) {
+    mQueue = queue;
+  }
+
+  /**
+   * 开始回放，在数据消费任务中调用。预读满队列后才交给采集任务发送
+   * @param path - 采集日志文件名
+   * @param speed - 回放速度，1000为原速，2000为两倍速
+   * @return 文件不存在、格式不对或正在回放、队列没有分配时返回false，speed不能为0
+   */
+  bool start(const char * path, uint32_t speed) {
+    if (mQueue == NULL) {
+      Serial.println("|error:replay queue is not allocated");
+      return false;
+    }
+    if (mState != CAN_REPLAY_IDLE) {
+      Serial.println("|error:replay already running");
+      return false;
+    }
+    snprintf(mPath, sizeof(mPath), "%s%s", path[0] == '/' ? "" : "/", path);
+    mFile = mFS.open(mPath, FILE_READ);
+    if (!mFile) {
+      Serial.printf("|error:can not open replay file %s\n", mPath);
+      return false;
+    }
+    capture_file_header_t header;
+    if (mFile.read((uint8_t *) &header, sizeof(header)) != sizeof(header) || header.magic != CAPTURE_LOG_MAGIC
+        || header.version != CAPTURE_LOG_VERSION || header.header_size < sizeof(capture_record_header_t) || header.header_size > 64) {
+      Serial.printf("|error:%s is not a capture log\n", mPath);
+      mFile.close();
+      return false;
+    }
+
+    mClock.reset(speed);
+    mHeaderSize = header.header_size;
+    mBlockFill = 0;
+    mBlockPos = 0;
+    mEof = false;
+    mHead = 0;
+    mTail = 0;
+    mRecords = 0;
+    mSkipped = 0;
+    mUnderruns = 0;
+    mRetries = 0;
+    mTooLong = 0;
+    mErrors.reset();
+
+    while (fillOne()) {
+    }
+    __sync_synchronize();
+    mState = CAN_REPLAY_RUNNING;
+    return true;
+  }
+
+  // 停止回放，队列中剩余的帧不再发送
+  void stop() {
+    if (mState == CAN_REPLAY_RUNNING) {
+      mState = CAN_REPLAY_STOPPING;
+    }
+  }
+
+  bool isRunning() {
+    return mState != CAN_REPLAY_IDLE;
+  }
+
+  // 控制器发送FIFO接收的帧数
+  uint32_t sent() {
+    return mErrors.count();
+  }
+
+  uint32_t retries() {
+    return mRetries;
+  }
+
+  uint32_t maxError() {
+    return mErrors.maxError();
+  }
+
+  // 误差超过CAN_REPLAY_LATE_US的帧数
+  uint32_t late() {
+    return mErrors.late();
+  }
+
+  /**
+   * 数据消费任务中周期调用：补充队列，回放结束后关闭文件
+   */
+  void service() {
+    if (mState == CAN_REPLAY_DONE) {
+      closeFile();
+      Serial.printf("replay finished: %u frames sent\n", mErrors.count());
+      return;
+    }
+    if (mState != CAN_REPLAY_RUNNING) {
+      return;
+    }
+    if (mHead == mTail && !mEof) {
+      mUnderruns++;
+    }
+    while (fillOne()) {
+    }
+  }
+
+  /**
+   * 采集任务中每次循环调用：发送到期的帧
+   * @param can - 发送用的控制器，只在采集任务中访问，需要提供transmitFIFOPayload()和
+   *              trySendBurst(frames, count, driverBufferFallback)
+   */
+  template <typename Controller>
+  void poll(Controller & can) {
+    can_replay_state state = mState;
+    if (state == CAN_REPLAY_IDLE || state == CAN_REPLAY_DONE) {
+      return;
+    }
+    if (!mActive) {
+      if (state != CAN_REPLAY_RUNNING) {
+        mState = CAN_REPLAY_DONE;
+        return;
+      }
+      // 定时器只创建一次，中断注册在采集任务所在的核上
+      if (mTimer == NULL) {
+        mTimer = timerBegin(1000000);
+        timerAttachInterruptArg(mTimer, onTimer, this);
+      }
+      timerWrite(mTimer, 0);
+      mActive = true;
+      mArmed = false;
+    }
+
+    if (state == CAN_REPLAY_STOPPING || (mHead == mTail && mEof)) {
+      mActive = false;
+      mState = CAN_REPLAY_DONE;
+      return;
+    }
+    // 发送后下一帧也已经进入忙等范围时接着发送，不等下一次循环；一次最多CAN_REPLAY_BURST批
+    for (uint8_t round = 0; round < CAN_REPLAY_BURST && mHead != mTail; round++) {
+      can_replay_entry_t & entry = mQueue[mTail % CAN_REPLAY_QUEUE_SIZE];
+      if (!mArmed) {
+        mArmed = true;
+        mFired = false;
+        uint64_t alarm = entry.due > CAN_REPLAY_SPIN_US ? entry.due - CAN_REPLAY_SPIN_US : 0;
+        timerAlarm(mTimer, alarm, false, 0);
+        // 报警值已经过去时不会再触发中断
+        if (timerRead(mTimer) >= alarm) {
+          mFired = true;
+        }
+      }
+      if (!mFired) {
+        return;
+      }
+      if (entry.msg.len > can.transmitFIFOPayload()) {
+        mTooLong++;
+        mArmed = false;
+        mTail = mTail + 1;
+        continue;
+      }
+      // 距发送时刻不到CAN_REPLAY_SPIN_US，忙等到发送时刻
+      while (timerRead(mTimer) < entry.due) {
+      }
+      // 同时到期的帧(倍速回放或日志中的突发)一起交给控制器，一次SPI传输写入多个发送FIFO对象
+      CANFDMessage burst[CAN_REPLAY_BURST];
+      uint64_t now = timerRead(mTimer);
+      uint16_t head = mHead;
+      uint8_t count = 0;
+      do {
+        const can_replay_entry_t & next = mQueue[(mTail + count) % CAN_REPLAY_QUEUE_SIZE];
+        burst[count++] = next.msg;
+      } while (count < CAN_REPLAY_BURST && (uint16_t)(mTail + count) != head
+               && mQueue[(mTail + count) % CAN_REPLAY_QUEUE_SIZE].due <= now
+               && mQueue[(mTail + count) % CAN_REPLAY_QUEUE_SIZE].msg.len <= can.transmitFIFOPayload());
+      size_t sent = can.trySendBurst(burst, count, false);
+      if (sent == 0) {
+        mRetries++;
+        return;
+      }
+      uint64_t sentAt = timerRead(mTimer);
+      for (size_t i = 0; i < sent; i++) {
+        mErrors.record(mQueue[(mTail + i) % CAN_REPLAY_QUEUE_SIZE].due, sentAt);
+      }
+      mArmed = false;
+      mTail = mTail + sent;
+    }
+  }
+
+  // 输出回放状态和调度误差统计
+  void print() {
+    static const char * const states[] = {"idle", "running", "stopping", "done"};
+    uint32_t speed = mClock.speed();
+    Serial.printf("replay: %s %s speed %u.%03u, %u frames, %u skipped, %u sent to controller, %u retries, %u too long, %u underruns\n",
+                  states[mState], mPath, speed / 1000, speed % 1000, mRecords, mSkipped, mErrors.count(), mRetries,
+                  mTooLong, mUnderruns);
+    Serial.printf("replay error: mean %u us, max %u us, %u over %u us\n",
+                  mErrors.meanError(), mErrors.maxError(), mErrors.late(), CAN_REPLAY_LATE_US);
+    Serial.printf("replay histogram:");
+    for (uint8_t i = 0; i < CAN_REPLAY_HISTOGRAM - 1; i++) {
+      Serial.printf(" <%u:%u", can_replay_histogram_limits[i], mErrors.histogram(i));
+    }
+    Serial.printf(" >=%u:%u\n", can_replay_histogram_limits[CAN_REPLAY_HISTOGRAM - 2],
+                  mErrors.histogram(CAN_REPLAY_HISTOGRAM - 1));
+  }
+};
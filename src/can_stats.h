@@ -0,0 +1,642 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "bus_config.h"
+#include "can_frame_bits.h"
+
+/**
+ * CAN总线统计
+ *
+ * 1.总线负载：按帧长度和位时间计算每帧占用总线的时间。位数包含最坏情况的填充位，
+ *   CAN FD带BRS的帧分成仲裁段和数据段两部分，分别按ACAN2517FDSettings计算出的实际波特率折算
+ * 2.错误：TEC/REC的变化趋势，接收错误计数(BDIAG0)，error-warning/passive/bus-off的状态切换
+ * 3.每个ID的帧率
+ * 所有统计都使用滑动窗口(1秒)。
+ *
+ * 每帧只调用onFrame()：查表算出位数、累加到当前时间桶、更新ID的计数，都是O(1)的操作。
+ * 读取错误计数需要访问SPI，由采集任务(loop)通过CanErrorPoller周期读取，
+ * 统计本身在数据消费任务(loop2)中完成，采集任务只多了一次很短的定时判断。
+ *
+ * 每个CAN通道有自己的CanErrorPoller和CanStats。TWAI通道的错误计数和状态由CanErrorPoller
+ * 换算成MCP2518的TREC/BDIAG0格式，统计、状态切换和记录格式和MCP2518通道相同。
+ */
+
+#define CAN_STATS_BUCKETS         10     // 总线负载的滑动窗口：10个100ms的时间桶
+#define CAN_STATS_BUCKET_MS       100
+#define CAN_STATS_ID_HASH_BITS    7
+#define CAN_STATS_MAX_IDS         (1 << CAN_STATS_ID_HASH_BITS)   // 统计帧率的ID数量
+#define CAN_STATS_ID_PROBES       8      // 查找ID时最多探测的位置
+#define CAN_STATS_ID_BUCKETS      4      // 每个ID的滑动窗口：4个250ms的时间桶
+#define CAN_STATS_ID_BUCKET_MS    250
+#define CAN_STATS_ID_EXPIRE_MS    10000  // ID超过这个时间没有出现，它的位置可以被其他ID使用
+#define CAN_STATS_TREND_SAMPLES   60     // TEC/REC趋势：保存最近60秒的采样
+#define CAN_STATS_POLL_MS         100    // 读取错误计数的周期
+#define CAN_HEALTH_RECORD_MS      10000  // 控制器健康记录的周期
+
+// 按TREC寄存器判断的控制器错误状态
+typedef enum : uint8_t {
+  CAN_ERROR_ACTIVE = 0,
+  CAN_ERROR_WARNING = 1,
+  CAN_ERROR_PASSIVE = 2,
+  CAN_BUS_OFF = 3
+} can_bus_state;
+
+static const char * const can_bus_state_names[] = {"active", "warning", "passive", "bus-off"};
+
+// 每秒一条的统计记录，写入采集日志(CAPTURE_STATS)
+typedef struct __attribute__((packed)) {
+  uint16_t bus_load;          // 总线负载，单位0.01%
+  uint16_t frames_per_s;      // 帧率
+  uint16_t fd_frames_per_s;   // 其中CAN FD帧
+  uint16_t errors_per_s;      // 接收错误(BDIAG0)
+  uint8_t tec;                // 发送错误计数
+  uint8_t rec;                // 接收错误计数
+  int16_t tec_trend;          // 趋势窗口内TEC的变化
+  int16_t rec_trend;          // 趋势窗口内REC的变化
+  uint8_t state;              // can_bus_state
+  uint8_t active_ids;         // 1秒内出现过的ID数量
+  uint32_t total_frames;      // 开机以来的帧数
+  uint16_t state_changes;     // 开机以来错误状态切换次数
+  uint16_t overflows;         // 控制器接收FIFO溢出次数
+  uint16_t driver_peak;       // 驱动接收缓冲区的峰值
+} can_stats_record_t;
+
+// 控制器健康记录，写入采集日志(CAPTURE_HEALTH)：周期写入，ECC/SPI CRC错误增加时立即写入
+typedef struct __attribute__((packed)) {
+  uint32_t trec;              // errorCounters()：TREC寄存器
+  uint32_t bdiag0;            // diagInfos(0)：仲裁段/数据段的收发错误计数
+  uint32_t bdiag1;            // diagInfos(1)：错误标志和无错误帧计数
+  uint32_t ecc_corrected;     // RAM ECC纠正的单比特错误
+  uint32_t ecc_uncorrected;   // RAM ECC检测到的双比特错误
+  uint16_t ecc_address;       // 最后一次ECC错误的地址
+  uint16_t spi_khz;           // 协商的SPI时钟
+  uint32_t spi_crc_reads;     // CRC错误后重读的次数
+  uint32_t spi_crc_writes;    // 控制器因CRC错误丢弃的写入
+} can_health_record_t;
+
+/**
+ * 错误计数采集：在拥有SPI的采集任务中调用poll()，其他任务只读取保存的值
+ * poll()每次只多读几个寄存器(ECCSTAT、CRC)，不会影响接收。每个通道有自己的CanErrorPoller，
+ * TWAI通道只有TREC、BDIAG0和溢出计数，没有健康记录和SPI开销
+ */
+class CanErrorPoller {
+public:
+  volatile uint32_t trec;       // TREC寄存器
+  volatile uint32_t bdiag0;     // BDIAG0寄存器：仲裁段/数据段的收发错误计数
+  volatile uint32_t overflows;  // hardwareReceiveBufferOverflowCount()
+  volatile uint32_t peak;       // driverReceiveBufferPeakCount()
+  volatile uint32_t samples;    // 采样次数，用于判断是否有新的数据
+  volatile uint32_t rxFrames;   // receivedFrameCount()：从控制器读出的帧数
+  volatile uint64_t rxCycles;   // receiveCycleCount()：读出这些帧用的CPU周期
+  volatile uint32_t spiClock;   // begin()协商的SPI时钟
+  volatile uint32_t spiCrcErrors;  // spiCRCErrorCount()：CRC错误后重读的次数
+  volatile uint32_t spiCrcWriteErrors;  // spiCRCWriteErrorCount()
+  volatile uint32_t spiCrcFailures;     // spiCRCFailureCount()：重试后仍然失败的SPI指令
+  volatile uint32_t bdiag1;     // BDIAG1寄存器
+  volatile uint32_t eccCorrected;
+  volatile uint32_t eccUncorrected;
+  volatile uint16_t eccAddress;
+  bool twai;                    // 由poll(CanTwai &)采集
+  uint32_t lastPollMs;
+
+  // 以下由数据消费任务使用
+  uint32_t lastHealthMs;
+  uint32_t lastHealthErrors;
+
+  CanErrorPoller() {
+    trec = 0;
+    bdiag0 = 0;
+    overflows = 0;
+    peak = 0;
+    samples = 0;
+    rxFrames = 0;
+    rxCycles = 0;
+    spiClock = 0;
+    spiCrcErrors = 0;
+    spiCrcWriteErrors = 0;
+    spiCrcFailures = 0;
+    bdiag1 = 0;
+    eccCorrected = 0;
+    eccUncorrected = 0;
+    eccAddress = 0;
+    twai = false;
+    lastPollMs = 0;
+    lastHealthMs = 0;
+    lastHealthErrors = 0;
+  }
+
+  void poll(ACAN2517FD & can, uint32_t now) {
+    if (now - lastPollMs < CAN_STATS_POLL_MS) {
+      return;
+    }
+    lastPollMs = now;
+    trec = can.errorCounters();
+    bdiag0 = can.diagInfos(0);
+    bdiag1 = can.diagInfos(1);
+    can.pollHealth();
+    eccCorrected = can.ramECCCorrectedCount();
+    eccUncorrected = can.ramECCUncorrectedCount();
+    eccAddress = can.ramECCErrorAddress();
+    spiCrcWriteErrors = can.spiCRCWriteErrorCount();
+    spiCrcFailures = can.spiCRCFailureCount();
+    overflows = can.hardwareReceiveBufferOverflowCount();
+    peak = can.driverReceiveBufferPeakCount();
+    rxFrames = can.receivedFrameCount();
+    rxCycles = can.receiveCycleCount();
+    spiClock = can.spiClock();
+    spiCrcErrors = can.spiCRCErrorCount();
+    samples++;
+  }
+
+  /**
+   * TWAI的错误计数和状态，按MCP2518的寄存器格式保存：
+   * TREC为TEC/REC和EWARN/RXBP/TXBP/TXBO，BDIAG0的NRERRCNT为总线错误计数的低8位
+   */
+  void poll(CanTwai & can, uint32_t now) {
+    if (now - lastPollMs < CAN_STATS_POLL_MS) {
+      return;
+    }
+    lastPollMs = now;
+    twai_status_info_t info;
+    if (!can.status(info)) {
+      return;
+    }
+    uint32_t tec = min(info.tx_error_counter, (uint32_t) 255);
+    uint32_t rec = min(info.rx_error_counter, (uint32_t) 255);
+    uint32_t value = (tec << 8) | rec;
+    if (tec >= 96 || rec >= 96) {
+      value |= 1 << 16;        // EWARN
+    }
+    if (rec >= 128) {
+      value |= 1 << 19;        // RXBP
+    }
+    if (tec >= 128) {
+      value |= 1 << 20;        // TXBP
+    }
+    if (info.state == TWAI_STATE_BUS_OFF || info.state == TWAI_STATE_RECOVERING) {
+      value |= 1 << 21;        // TXBO
+    }
+    twai = true;
+    trec = value;
+    bdiag0 = info.bus_error_count & 0xFF;
+    overflows = info.rx_missed_count + info.rx_overrun_count;
+    samples++;
+  }
+
+  /**
+   * 在数据消费任务中调用：到了记录周期或ECC/SPI CRC错误增加时生成健康记录
+   * @return 生成了新的健康记录时返回true
+   */
+  bool health(uint32_t now, can_health_record_t & r) {
+    if (twai) {
+      return false;
+    }
+    uint32_t errors = eccCorrected + eccUncorrected + spiCrcErrors + spiCrcWriteErrors;
+    if (now - lastHealthMs < CAN_HEALTH_RECORD_MS && errors == lastHealthErrors) {
+      return false;
+    }
+    lastHealthMs = now;
+    lastHealthErrors = errors;
+    r.trec = trec;
+    r.bdiag0 = bdiag0;
+    r.bdiag1 = bdiag1;
+    r.ecc_corrected = eccCorrected;
+    r.ecc_uncorrected = eccUncorrected;
+    r.ecc_address = eccAddress;
+    r.spi_khz = spiClock / 1000;
+    r.spi_crc_reads = spiCrcErrors;
+    r.spi_crc_writes = spiCrcWriteErrors;
+    return true;
+  }
+
+  void printHealth(uint8_t channel) {
+    Serial.printf("|stats:can%u health ecc corrected %u uncorrected %u (last 0x%03X), spi crc read %u write %u failed %u, bdiag1 0x%08X\n",
+                  channel, eccCorrected, eccUncorrected, eccAddress, spiCrcErrors, spiCrcWriteErrors, spiCrcFailures, bdiag1);
+  }
+
+  // SPI时钟、CRC错误和接收路径每帧的开销，用于比较SPI后端(ACAN2517FD_IDF_SPI)和时钟的效果
+  void printReceiveCost(uint8_t channel) {
+    uint32_t frames = rxFrames;
+    uint64_t cycles = rxCycles;
+    Serial.printf("|stats:can%u spi %u kHz, %u crc errors, rx %u frames, %u cycles/frame (%u us/frame)\n",
+                  channel, spiClock / 1000, spiCrcErrors, frames,
+                  frames ? (uint32_t)(cycles / frames) : 0,
+                  frames ? (uint32_t)(cycles / frames / ESP.getCpuFreqMHz()) : 0);
+  }
+};
+
+class CanStats {
+public:
+  // 统计帧率的ID
+  struct IdEntry {
+    uint32_t key;                              // ID，bit31表示扩展帧，0xFFFFFFFF为空
+    uint32_t epoch;                            // 最后一次计数的时间桶序号
+    uint16_t counts[CAN_STATS_ID_BUCKETS];     // 每个时间桶的帧数
+    uint32_t total;                            // 开机以来的帧数
+    uint32_t lastMs;                           // 最后一次出现的时间
+  };
+
+private:
+  struct Bucket {
+    uint32_t nominalBits;   // 按仲裁段波特率传输的位数
+    uint32_t dataBits;      // 按数据段波特率传输的位数
+    uint16_t frames;
+    uint16_t fdFrames;
+  };
+
+  Bucket mBuckets[CAN_STATS_BUCKETS];
+  uint8_t mBucket;                  // 当前时间桶
+  uint32_t mBucketStart;            // 当前时间桶的开始时间
+
+  IdEntry mIds[CAN_STATS_MAX_IDS];
+  uint32_t mUntracked;              // ID表满了没有统计的帧
+
+  uint32_t mArbitrationRate;        // 实际的仲裁段波特率
+  uint32_t mDataRate;               // 实际的数据段波特率
+  bus_config_t mTiming;             // 计算波特率时使用的配置
+
+  // 错误状态
+  uint8_t mTec, mRec;
+  can_bus_state mState;
+  uint16_t mStateChanges;
+  uint32_t mStateSinceMs;
+  uint32_t mLastBdiag0;
+  uint32_t mErrorsThisSecond;
+  uint32_t mErrorsPerSecond;
+  uint32_t mPollerSamples;
+
+  // TEC/REC趋势
+  uint8_t mTecHistory[CAN_STATS_TREND_SAMPLES];
+  uint8_t mRecHistory[CAN_STATS_TREND_SAMPLES];
+  uint8_t mTrendHead;
+  uint8_t mTrendCount;
+  uint32_t mLastSecondMs;
+
+  uint32_t mTotalFrames;
+  can_stats_record_t mRecord;       // 最近一秒的统计结果
+  uint8_t mChannel;                 // 输出中的通道号
+
+  // 移动到now所在的时间桶，超过整个窗口没有更新时全部清零
+  void advance(uint32_t now) {
+    uint32_t elapsed = now - mBucketStart;
+    if (elapsed < CAN_STATS_BUCKET_MS) {
+      return;
+    }
+    uint32_t steps = elapsed / CAN_STATS_BUCKET_MS;
+    if (steps >= CAN_STATS_BUCKETS) {
+      memset(mBuckets, 0, sizeof(mBuckets));
+      mBucketStart = now - now % CAN_STATS_BUCKET_MS;
+      return;
+    }
+    for (uint32_t i = 0; i < steps; i++) {
+      mBucket = (mBucket + 1) % CAN_STATS_BUCKETS;
+      memset(&mBuckets[mBucket], 0, sizeof(Bucket));
+    }
+    mBucketStart += steps * CAN_STATS_BUCKET_MS;
+  }
+
+  // 查找ID的位置，没有时占用一个空的或者过期的位置；表满时返回NULL
+  IdEntry * lookup(uint32_t key, uint32_t now) {
+    uint32_t slot = (key * 2654435761u) >> (32 - CAN_STATS_ID_HASH_BITS);
+    IdEntry * reuse = NULL;
+    for (uint8_t i = 0; i < CAN_STATS_ID_PROBES; i++) {
+      IdEntry & e = mIds[(slot + i) & (CAN_STATS_MAX_IDS - 1)];
+      if (e.key == key) {
+        return &e;
+      }
+      if (reuse == NULL && (e.key == 0xFFFFFFFF || now - e.lastMs > CAN_STATS_ID_EXPIRE_MS)) {
+        reuse = &e;
+      }
+    }
+    if (reuse) {
+      memset(reuse, 0, sizeof(IdEntry));
+      reuse->key = key;
+      reuse->epoch = now / CAN_STATS_ID_BUCKET_MS;
+    }
+    return reuse;
+  }
+
+  /**
+   * 硬件计数的增量，计数回绕时按模2^bits相减
+   * @param bits - 计数的位数，例如NRERRCNT为8位
+   */
+  static uint32_t counterDelta(uint32_t current, uint32_t last, uint8_t bits) {
+    uint32_t mask = bits >= 32 ? 0xFFFFFFFF : (1UL << bits) - 1;
+    return (current - last) & mask;
+  }
+
+  static can_bus_state stateFromTrec(uint32_t trec) {
+    if (trec & (1 << 21)) {            // TXBO
+      return CAN_BUS_OFF;
+    }
+    if (trec & ((1 << 20) | (1 << 19))) {  // TXBP | RXBP
+      return CAN_ERROR_PASSIVE;
+    }
+    if (trec & (1 << 16)) {            // EWARN
+      return CAN_ERROR_WARNING;
+    }
+    return CAN_ERROR_ACTIVE;
+  }
+
+  // 读取CanErrorPoller的新数据，检测错误状态切换
+  void updateErrors(const CanErrorPoller & poller, uint32_t now) {
+    if (poller.samples == mPollerSamples) {
+      return;
+    }
+    mPollerSamples = poller.samples;
+
+    uint32_t trec = poller.trec;
+    uint32_t bdiag0 = poller.bdiag0;
+    mTec = (trec >> 8) & 0xFF;
+    mRec = trec & 0xFF;
+
+    // NRERRCNT和DRERRCNT是8位计数，按模256的差值累加
+    mErrorsThisSecond += counterDelta(bdiag0 & 0xFF, mLastBdiag0 & 0xFF, 8)
+                       + counterDelta((bdiag0 >> 16) & 0xFF, (mLastBdiag0 >> 16) & 0xFF, 8);
+    mLastBdiag0 = bdiag0;
+
+    can_bus_state state = stateFromTrec(trec);
+    if (state != mState) {
+      Serial.printf("|info:can%u state %s -> %s (TEC %u, REC %u) after %u ms\n", mChannel,
+                    can_bus_state_names[mState], can_bus_state_names[state], mTec, mRec,
+                    now - mStateSinceMs);
+      mState = state;
+      mStateSinceMs = now;
+      mStateChanges++;
+    }
+  }
+
+  // 每秒一次：记录TEC/REC趋势并生成统计记录
+  void closeSecond(uint32_t now) {
+    mTecHistory[mTrendHead] = mTec;
+    mRecHistory[mTrendHead] = mRec;
+    mTrendHead = (mTrendHead + 1) % CAN_STATS_TREND_SAMPLES;
+    if (mTrendCount < CAN_STATS_TREND_SAMPLES) {
+      mTrendCount++;
+    }
+    uint8_t oldest = mTrendCount < CAN_STATS_TREND_SAMPLES ? 0 : mTrendHead;
+    mErrorsPerSecond = mErrorsThisSecond;
+    mErrorsThisSecond = 0;
+
+    uint32_t frames, fdFrames;
+    mRecord.bus_load = busLoad(now, frames, fdFrames);
+    mRecord.frames_per_s = frames;
+    mRecord.fd_frames_per_s = fdFrames;
+    mRecord.errors_per_s = mErrorsPerSecond;
+    mRecord.tec = mTec;
+    mRecord.rec = mRec;
+    mRecord.tec_trend = (int16_t)mTec - mTecHistory[oldest];
+    mRecord.rec_trend = (int16_t)mRec - mRecHistory[oldest];
+    mRecord.state = mState;
+    mRecord.active_ids = activeIds(now);
+    mRecord.total_frames = mTotalFrames;
+    mRecord.state_changes = mStateChanges;
+  }
+
+public:
+  CanStats() {
+    mChannel = 0;
+    reset();
+  }
+
+  void setChannel(uint8_t channel) {
+    mChannel = channel;
+  }
+
+  void reset() {
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mBucket = 0;
+    mBucketStart = 0;
+    memset(mIds, 0xFF, sizeof(mIds));
+    mUntracked = 0;
+    mArbitrationRate = CAN_DEFAULT_BITRATE;
+    mDataRate = CAN_DEFAULT_BITRATE * CAN_DEFAULT_DATA_FACTOR;
+    memset(&mTiming, 0, sizeof(mTiming));
+    mTec = 0;
+    mRec = 0;
+    mState = CAN_ERROR_ACTIVE;
+    mStateChanges = 0;
+    mStateSinceMs = 0;
+    mLastBdiag0 = 0;
+    mErrorsThisSecond = 0;
+    mErrorsPerSecond = 0;
+    mPollerSamples = 0;
+    mTrendHead = 0;
+    mTrendCount = 0;
+    mLastSecondMs = 0;
+    mTotalFrames = 0;
+    memset(&mRecord, 0, sizeof(mRecord));
+  }
+
+  // 按总线配置更新实际的仲裁段/数据段波特率，配置没有变化时直接返回
+  void setBitTiming(const bus_config_t & cfg) {
+    if (cfg.can_bitrate == mTiming.can_bitrate && cfg.can_data_factor == mTiming.can_data_factor) {
+      return;
+    }
+    mTiming = cfg;
+    ACAN2517FDSettings s(MCP2518_OSCILLATOR, cfg.can_bitrate, DataBitRateFactor(cfg.can_data_factor));
+    mArbitrationRate = s.actualArbitrationBitRate();
+    mDataRate = s.actualDataBitRate();
+    if (mArbitrationRate == 0) {
+      mArbitrationRate = cfg.can_bitrate;
+    }
+    if (mDataRate == 0) {
+      mDataRate = mArbitrationRate;
+    }
+  }
+
+  // 不是由MCP2518配置决定波特率的通道(TWAI)直接设置波特率，经典CAN的数据段和仲裁段相同
+  void setBitRates(uint32_t arbitrationRate, uint32_t dataRate) {
+    if (arbitrationRate == 0) {
+      return;
+    }
+    mArbitrationRate = arbitrationRate;
+    mDataRate = dataRate != 0 ? dataRate : arbitrationRate;
+  }
+
+  /**
+   * 每收到一帧调用一次，O(1)
+   * @param now - 收到该帧的时间(ms)
+   */
+  void onFrame(const CANFDMessage & msg, uint32_t now) {
+    advance(now);
+    uint32_t nominal, data;
+    can_frame_bits(msg, nominal, data);
+    Bucket & b = mBuckets[mBucket];
+    b.nominalBits += nominal;
+    b.dataBits += data;
+    b.frames++;
+    if (msg.type == CANFDMessage::CANFD_NO_BIT_RATE_SWITCH || msg.type == CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH) {
+      b.fdFrames++;
+    }
+    mTotalFrames++;
+
+    IdEntry * e = lookup(msg.id | (msg.ext ? 0x80000000 : 0), now);
+    if (e == NULL) {
+      mUntracked++;
+      return;
+    }
+    uint32_t epoch = now / CAN_STATS_ID_BUCKET_MS;
+    if (epoch != e->epoch) {
+      // 清零跳过的时间桶，最多清零整个窗口
+      uint32_t gap = epoch - e->epoch;
+      if (gap > CAN_STATS_ID_BUCKETS) {
+        gap = CAN_STATS_ID_BUCKETS;
+      }
+      for (uint32_t i = 0; i < gap; i++) {
+        e->counts[(epoch - i) % CAN_STATS_ID_BUCKETS] = 0;
+      }
+      e->epoch = epoch;
+    }
+    e->counts[epoch % CAN_STATS_ID_BUCKETS]++;
+    e->total++;
+    e->lastMs = now;
+  }
+
+  /**
+   * 周期调用(建议每次循环都调用)：更新错误计数，每秒生成一条统计记录
+   * @return 生成了新的统计记录时返回true
+   */
+  bool service(const CanErrorPoller & poller, uint32_t now) {
+    advance(now);
+    updateErrors(poller, now);
+    if (now - mLastSecondMs < 1000) {
+      return false;
+    }
+    mLastSecondMs = now;
+    closeSecond(now);
+    mRecord.overflows = poller.overflows;
+    mRecord.driver_peak = poller.peak;
+    return true;
+  }
+
+  /**
+   * 滑动窗口内的总线负载
+   * @return 总线负载，单位0.01%
+   */
+  uint16_t busLoad(uint32_t now, uint32_t & frames, uint32_t & fdFrames) {
+    advance(now);
+    uint64_t nominal = 0, data = 0;
+    frames = 0;
+    fdFrames = 0;
+    for (uint8_t i = 0; i < CAN_STATS_BUCKETS; i++) {
+      nominal += mBuckets[i].nominalBits;
+      data += mBuckets[i].dataBits;
+      frames += mBuckets[i].frames;
+      fdFrames += mBuckets[i].fdFrames;
+    }
+    // 窗口 = 9个完整的时间桶 + 当前时间桶已经过去的时间
+    uint32_t windowMs = (CAN_STATS_BUCKETS - 1) * CAN_STATS_BUCKET_MS + (now - mBucketStart);
+    if (windowMs == 0) {
+      return 0;
+    }
+    // 总线占用时间(us) = 位数 / 波特率
+    uint64_t busyUs = can_bus_time_us(nominal, data, mArbitrationRate, mDataRate);
+    uint64_t load = busyUs * 10000 / ((uint64_t)windowMs * 1000);
+    frames = frames * 1000 / windowMs;
+    fdFrames = fdFrames * 1000 / windowMs;
+    return load > 10000 ? 10000 : load;
+  }
+
+  // ID在滑动窗口内的帧率(帧/秒)
+  uint32_t idRate(const IdEntry & e, uint32_t now) {
+    uint32_t epoch = now / CAN_STATS_ID_BUCKET_MS;
+    uint32_t count = 0;
+    for (uint32_t k = 0; k < CAN_STATS_ID_BUCKETS; k++) {
+      uint32_t slotEpoch = e.epoch - k;
+      if (epoch - slotEpoch < CAN_STATS_ID_BUCKETS) {
+        count += e.counts[slotEpoch % CAN_STATS_ID_BUCKETS];
+      }
+    }
+    return count * 1000 / (CAN_STATS_ID_BUCKETS * CAN_STATS_ID_BUCKET_MS);
+  }
+
+  // 滑动窗口内出现过的ID数量
+  uint8_t activeIds(uint32_t now) {
+    uint32_t count = 0;
+    for (uint16_t i = 0; i < CAN_STATS_MAX_IDS; i++) {
+      if (mIds[i].key != 0xFFFFFFFF && now - mIds[i].lastMs < 1000) {
+        count++;
+      }
+    }
+    return count > 255 ? 255 : count;
+  }
+
+  /**
+   * 找出帧率最高的ID
+   * @param out - 输出的ID(按帧率从高到低)
+   * @param rates - 对应的帧率
+   * @param max - 最多输出的数量
+   * @return 实际输出的数量
+   */
+  uint8_t topIds(uint32_t now, const IdEntry ** out, uint32_t * rates, uint8_t max) {
+    uint8_t count = 0;
+    for (uint16_t i = 0; i < CAN_STATS_MAX_IDS; i++) {
+      if (mIds[i].key == 0xFFFFFFFF) {
+        continue;
+      }
+      uint32_t rate = idRate(mIds[i], now);
+      if (rate == 0) {
+        continue;
+      }
+      // 插入排序，只保留前max个
+      int8_t pos = count < max ? count : max - 1;
+      if (count == max && rates[pos] >= rate) {
+        continue;
+      }
+      while (pos > 0 && rates[pos - 1] < rate) {
+        out[pos] = out[pos - 1];
+        rates[pos] = rates[pos - 1];
+        pos--;
+      }
+      out[pos] = &mIds[i];
+      rates[pos] = rate;
+      if (count < max) {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  // 最近一秒的统计记录
+  const can_stats_record_t & record() {
+    return mRecord;
+  }
+
+  can_bus_state state() {
+    return mState;
+  }
+
+  uint32_t untrackedFrames() {
+    return mUntracked;
+  }
+
+  uint32_t arbitrationRate() {
+    return mArbitrationRate;
+  }
+
+  uint32_t dataRate() {
+    return mDataRate;
+  }
+
+  // 把统计记录打印到串口
+  void print() {
+    const can_stats_record_t & r = mRecord;
+    Serial.printf("|stats:can%u load %u.%02u%% frames/s %u fd/s %u err/s %u TEC %u(%+d) REC %u(%+d) state %s changes %u ids %u overflow %u peak %u\n",
+                  mChannel, r.bus_load / 100, r.bus_load % 100, r.frames_per_s, r.fd_frames_per_s, r.errors_per_s,
+                  r.tec, r.tec_trend, r.rec, r.rec_trend, can_bus_state_names[r.state], r.state_changes,
+                  r.active_ids, r.overflows, r.driver_peak);
+  }
+
+  // 打印帧率最高的ID
+  void printTopIds(uint32_t now, uint8_t max) {
+    const IdEntry * ids[16];
+    uint32_t rates[16];
+    uint8_t n = topIds(now, ids, rates, max > 16 ? 16 : max);
+    for (uint8_t i = 0; i < n; i++) {
+      Serial.printf("|stats:can%u id %s%03X %u/s total %u\n", mChannel, (ids[i]->key & 0x80000000) ? "x" : "",
+                    ids[i]->key & 0x1FFFFFFF, rates[i], ids[i]->total);
+    }
+  }
+};
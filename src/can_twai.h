@@ -0,0 +1,362 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+#include "driver/twai.h"
+#include "config.h"
+#include "can_filter.h"
+
+/**
+ * ESP32-S3片上TWAI(CAN 2.0)控制器作为一个经典CAN采集通道，不占用SPI带宽
+ *
+ * IDF的TWAI驱动在中断中把帧放入驱动的接收队列，高优先级的读取任务阻塞在twai_receive上，
+ * 每收到一帧立即打时间戳并放入单生产者/单消费者环形缓冲区，采集任务(loop)从环中批量取帧，
+ * 和MCP2518的通道一样进入recv_queue。TWAI没有硬件时间戳计数器，时间戳是中断唤醒读取任务时的micros()，
+ * 误差只有中断和任务切换的延迟，不受采集任务轮询周期的影响。
+ * 读取任务和采集任务在同一个核上，环的头尾各只有一个任务写。
+ *
+ * 驱动的安装、启动、停止和卸载都由读取任务完成：begin()/end()只提交请求并通知读取任务，
+ * 读取任务最多TWAI_RECEIVE_WAIT_MS后响应，采集任务不会等待。读取任务切换驱动时持有mLock，
+ * 其他任务调用驱动前用xSemaphoreTake(mLock, 0)尝试获取，拿不到时当作驱动没有运行，同样不等待。
+ *
+ * TWAI不能接收CAN FD帧，在FD总线上正常模式会用错误帧破坏FD帧，这时应使用只听模式。
+ */
+
+#define TWAI_RING_SIZE        256      // 2的幂
+#define TWAI_RX_QUEUE_LEN     32       // IDF驱动的接收队列
+#define TWAI_TX_QUEUE_LEN     16       // IDF驱动的发送队列，网关转发使用
+#define TWAI_TASK_PRIORITY    20       // 高于采集任务，收到帧后立即运行
+#define TWAI_RECEIVE_WAIT_MS  20       // 重新配置时读取任务最多等待这么久才响应
+#define TWAI_POLL_MS          100      // 检查总线关闭并恢复的周期
+
+#define TWAI_REQUEST_NONE     0
+#define TWAI_REQUEST_START    1        // 按请求的波特率和模式(重新)启动
+#define TWAI_REQUEST_STOP     2
+
+typedef struct {
+  uint32_t timestamp;          // 读取任务被唤醒时的micros()
+  twai_message_t msg;
+} twai_slot_t;
+
+class CanTwai {
+private:
+  twai_slot_t mRing[TWAI_RING_SIZE];
+  volatile uint32_t mHead;     // 读取任务写入的位置
+  volatile uint32_t mTail;     // 采集任务读出的位置
+
+  int8_t mTxPin;
+  int8_t mRxPin;
+  TaskHandle_t mTask;
+  SemaphoreHandle_t mLock;     // 读取任务切换驱动时持有
+  portMUX_TYPE mMux;           // 保护请求
+  volatile uint8_t mRequest;   // TWAI_REQUEST_xxx，由读取任务执行
+  uint32_t mRequestBitRate;
+  uint8_t mRequestMode;
+  volatile bool mRunning;      // 驱动已经启动，读取任务可以调用twai_receive
+  volatile bool mInstalled;
+  volatile esp_err_t mError;   // 最近一次启动的错误
+  esp_err_t mReportedError;    // 采集任务已经输出过的错误
+  volatile uint32_t mBitRate;
+  volatile uint8_t mMode;
+
+  uint32_t mRingOverflows;
+  uint32_t mRecoveries;
+  uint32_t mPollMs;
+
+  static bool timing(uint32_t bitrate, twai_timing_config_t & t) {
+    switch (bitrate) {
+      case 125000: { twai_timing_config_t c = TWAI_TIMING_CONFIG_125KBITS(); t = c; return true; }
+      case 250000: { twai_timing_config_t c = TWAI_TIMING_CONFIG_250KBITS(); t = c; return true; }
+      case 500000: { twai_timing_config_t c = TWAI_TIMING_CONFIG_500KBITS(); t = c; return true; }
+      case 800000: { twai_timing_config_t c = TWAI_TIMING_CONFIG_800KBITS(); t = c; return true; }
+      case 1000000: { twai_timing_config_t c = TWAI_TIMING_CONFIG_1MBITS(); t = c; return true; }
+      default: return false;
+    }
+  }
+
+  void push(const twai_message_t & msg, uint32_t timestamp) {
+    uint32_t head = mHead;
+    if (head - mTail >= TWAI_RING_SIZE) {
+      mRingOverflows++;
+      return;
+    }
+    twai_slot_t & slot = mRing[head & (TWAI_RING_SIZE - 1)];
+    slot.timestamp = timestamp;
+    slot.msg = msg;
+    mHead = head + 1;
+  }
+
+  // 在读取任务中执行请求：卸载正在运行的驱动，需要时按请求的波特率和模式重新安装并启动
+  void apply() {
+    portENTER_CRITICAL(&mMux);
+    uint8_t request = mRequest;
+    uint32_t bitrate = mRequestBitRate;
+    uint8_t mode = mRequestMode;
+    mRequest = TWAI_REQUEST_NONE;
+    portEXIT_CRITICAL(&mMux);
+
+    xSemaphoreTake(mLock, portMAX_DELAY);
+    mRunning = false;
+    if (mInstalled) {
+      twai_stop();
+      twai_driver_uninstall();
+      mInstalled = false;
+    }
+    if (request == TWAI_REQUEST_START) {
+      mBitRate = bitrate;
+      mMode = mode;
+      mError = install(bitrate, mode);
+      mRunning = mError == ESP_OK;
+    }
+    xSemaphoreGive(mLock);
+  }
+
+  esp_err_t install(uint32_t bitrate, uint8_t mode) {
+    twai_timing_config_t t;
+    timing(bitrate, t);
+    twai_general_config_t g = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t) mTxPin, (gpio_num_t) mRxPin,
+                                                          (twai_mode_t) mode);
+    g.rx_queue_len = TWAI_RX_QUEUE_LEN;
+    g.tx_queue_len = TWAI_TX_QUEUE_LEN;
+    twai_filter_config_t f = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    esp_err_t err = twai_driver_install(&g, &t, &f);
+    if (err != ESP_OK) {
+      return err;
+    }
+    mInstalled = true;
+    err = twai_start();
+    if (err != ESP_OK) {
+      twai_driver_uninstall();
+      mInstalled = false;
+    }
+    return err;
+  }
+
+  static void readerTask(void * arg) {
+    CanTwai * self = (CanTwai *) arg;
+    while (true) {
+      if (self->mRequest != TWAI_REQUEST_NONE) {
+        self->apply();
+        continue;
+      }
+      if (!self->mRunning) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        continue;
+      }
+      twai_message_t msg;
+      if (twai_receive(&msg, pdMS_TO_TICKS(TWAI_RECEIVE_WAIT_MS)) == ESP_OK) {
+        self->push(msg, micros());
+      }
+    }
+  }
+
+  // 提交请求并唤醒读取任务，第一次请求时创建锁和读取任务
+  void post(uint8_t request, uint32_t bitrate, uint8_t mode) {
+    if (mLock == NULL) {
+      mLock = xSemaphoreCreateMutex();
+    }
+    portENTER_CRITICAL(&mMux);
+    mRequestBitRate = bitrate;
+    mRequestMode = mode;
+    mRequest = request;
+    portEXIT_CRITICAL(&mMux);
+    if (mTask == NULL) {
+      xTaskCreatePinnedToCore(readerTask, "twai", 3072, this, TWAI_TASK_PRIORITY, &mTask, xPortGetCoreID());
+    } else {
+      xTaskNotifyGive(mTask);
+    }
+  }
+
+  // 其他任务调用驱动前获取锁，读取任务正在切换驱动或驱动没有安装时返回false
+  bool lock() {
+    if (mLock == NULL || xSemaphoreTake(mLock, 0) != pdTRUE) {
+      return false;
+    }
+    if (!mInstalled) {
+      xSemaphoreGive(mLock);
+      return false;
+    }
+    return true;
+  }
+
+  void unlock() {
+    xSemaphoreGive(mLock);
+  }
+
+public:
+  CanTwai(int8_t txPin, int8_t rxPin) : mTxPin(txPin), mRxPin(rxPin) {
+    mHead = 0;
+    mTail = 0;
+    mTask = NULL;
+    mLock = NULL;
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mRequest = TWAI_REQUEST_NONE;
+    mRequestBitRate = 0;
+    mRequestMode = TWAI_MODE_LISTEN_ONLY;
+    mRunning = false;
+    mInstalled = false;
+    mError = ESP_OK;
+    mReportedError = ESP_OK;
+    mBitRate = 0;
+    mMode = TWAI_MODE_LISTEN_ONLY;
+    mRingOverflows = 0;
+    mRecoveries = 0;
+    mPollMs = 0;
+  }
+
+  static bool validBitRate(uint32_t bitrate) {
+    twai_timing_config_t t;
+    return timing(bitrate, t);
+  }
+
+  static bool validMode(uint8_t mode) {
+    return mode == TWAI_MODE_NORMAL || mode == TWAI_MODE_NO_ACK || mode == TWAI_MODE_LISTEN_ONLY;
+  }
+
+  /**
+   * 请求按波特率和模式(重新)启动TWAI，在采集任务中调用，不等待读取任务
+   * 驱动安装或启动失败时由poll()输出错误，print()显示错误码
+   * @param mode - twai_mode_t
+   * @return 参数无效时返回ESP_ERR_INVALID_ARG，否则返回ESP_OK
+   */
+  esp_err_t begin(uint32_t bitrate, uint8_t mode) {
+    if (!validBitRate(bitrate) || !validMode(mode)) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    post(TWAI_REQUEST_START, bitrate, mode);
+    return ESP_OK;
+  }
+
+  // 请求停止并卸载驱动，不等待读取任务
+  void end() {
+    if (mTask != NULL) {
+      post(TWAI_REQUEST_STOP, 0, 0);
+    }
+  }
+
+  bool isRunning() {
+    return mRunning;
+  }
+
+  uint32_t bitRate() {
+    return mBitRate;
+  }
+
+  /**
+   * 读取控制器状态和错误计数，不等待
+   * @return 驱动没有安装或读取任务正在切换驱动时返回false
+   */
+  bool status(twai_status_info_t & info) {
+    if (!lock()) {
+      return false;
+    }
+    bool ok = twai_get_status_info(&info) == ESP_OK;
+    unlock();
+    return ok;
+  }
+
+  // 控制器和驱动接收队列丢失的帧(rx missed + rx overrun)，驱动没有安装时返回0
+  uint32_t missedCount() {
+    twai_status_info_t info;
+    if (!status(info)) {
+      return 0;
+    }
+    return info.rx_missed_count + info.rx_overrun_count;
+  }
+
+  /**
+   * 把帧放入驱动的发送队列，不等待
+   * @return 没有运行、只听模式、发送队列满或CAN FD帧时返回false
+   */
+  bool tryToSend(const CANFDMessage & frame) {
+    if (!mRunning || frame.len > 8
+        || (frame.type != CANFDMessage::CAN_DATA && frame.type != CANFDMessage::CAN_REMOTE)) {
+      return false;
+    }
+    twai_message_t msg = {};
+    msg.identifier = frame.id;
+    msg.extd = frame.ext;
+    msg.rtr = frame.type == CANFDMessage::CAN_REMOTE;
+    msg.data_length_code = frame.len;
+    memcpy(msg.data, frame.data, frame.len);
+    if (!lock()) {
+      return false;
+    }
+    bool ok = twai_transmit(&msg, 0) == ESP_OK;
+    unlock();
+    return ok;
+  }
+
+  // 环中有没有读出的帧
+  bool pending() {
+    return mHead != mTail;
+  }
+
+  /**
+   * 从环中取出最多max帧，每帧带自己的时间戳，在采集任务中调用
+   * @return 取出的帧数
+   */
+  size_t receiveBurst(CANFDMessage * frames, uint32_t * timestamps, size_t max) {
+    uint32_t tail = mTail;
+    uint32_t head = mHead;
+    size_t count = 0;
+    while (count < max && tail != head) {
+      const twai_slot_t & slot = mRing[tail & (TWAI_RING_SIZE - 1)];
+      CANFDMessage & frame = frames[count];
+      frame.id = slot.msg.identifier;
+      frame.ext = slot.msg.extd;
+      frame.type = slot.msg.rtr ? CANFDMessage::CAN_REMOTE : CANFDMessage::CAN_DATA;
+      frame.idx = CAN_FILTER_NO_INDEX;     // 没有硬件过滤器，canFilter按白名单检查
+      frame.len = min(slot.msg.data_length_code, (uint8_t) 8);
+      memcpy(frame.data, slot.msg.data, frame.len);
+      timestamps[count++] = slot.timestamp;
+      tail++;
+    }
+    mTail = tail;
+    return count;
+  }
+
+  // 采集任务中周期调用：输出读取任务启动驱动的错误；总线关闭时开始恢复，恢复完成(回到停止状态)后重新启动
+  void poll(uint32_t now) {
+    if (now - mPollMs < TWAI_POLL_MS) {
+      return;
+    }
+    mPollMs = now;
+    esp_err_t error = mError;
+    if (error != mReportedError) {
+      mReportedError = error;
+      if (error != ESP_OK) {
+        Serial.printf("|error:twai config failed, error code 0x%x\n", error);
+      }
+    }
+    if (!mRunning || !lock()) {
+      return;
+    }
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) == ESP_OK) {
+      if (info.state == TWAI_STATE_BUS_OFF) {
+        twai_initiate_recovery();
+        mRecoveries++;
+      } else if (info.state == TWAI_STATE_STOPPED) {
+        twai_start();
+      }
+    }
+    unlock();
+  }
+
+  // 输出控制器状态和错误计数，格式和其他CAN通道相同
+  void print(uint8_t channel) {
+    static const char * const modes[] = {"normal", "no-ack", "listen"};
+    static const char * const states[] = {"stopped", "running", "bus-off", "recovering"};
+    twai_status_info_t info;
+    if (!status(info)) {
+      Serial.printf("can%u: twai offline, error 0x%x\n", channel, mError);
+      return;
+    }
+    Serial.printf("can%u: twai %s, %u bps %s, tec %u, rec %u\n", channel, states[info.state], mBitRate,
+                  modes[mMode], info.tx_error_counter, info.rx_error_counter);
+    Serial.printf("can%u: %u bus errors, %u arbitration lost, %u missed, %u overruns, %u ring overflows, %u recoveries\n",
+                  channel, info.bus_error_count, info.arb_lost_count, info.rx_missed_count,
+                  info.rx_overrun_count, mRingOverflows, mRecoveries);
+  }
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include <ACAN2517FD.h>
+#include "bus_data.h"
+
+/**
+ * 采集日志：把所有总线的数据以二进制记录的形式保存到TF卡
+ *
+ * 文件格式：capture_file_header_t，后面是连续的记录。
+ * 每条记录为capture_record_header_t加上len字节的数据，所有字段都是小端序。
+ * 除了总线帧，统计、健康等周期性记录也写入同一个文件，回放和PC端分析时按type区分。
+ *
+ * 写入先进入内存中的块缓冲区，缓冲区满或者到了刷新周期才写入文件，
+ * 避免每帧都访问TF卡。只在数据消费任务(loop2)中调用。
+ */
+
+#define CAPTURE_LOG_MAGIC       0x474C4943   // "CILG"
+#define CAPTURE_LOG_VERSION     1
+#define CAPTURE_LOG_BLOCK_SIZE  4096         // 块缓冲区大小
+#define CAPTURE_LOG_FLUSH_MS    1000         // 缓冲区中的数据最多停留的时间
+
+// 记录类型，总线帧与data_type一致
+typedef enum : uint8_t {
+  CAPTURE_CAN   = CAN_DATA,
+  CAPTURE_KLINE = K_LINE_DATA,
+  CAPTURE_LIN   = LIN_DATA,
+  CAPTURE_STATS = 0x10,    // CAN统计记录 can_stats_record_t
+  CAPTURE_ISOTP = 0x11,    // 重组完成的ISO-TP PDU，id为发送方CAN ID
+  CAPTURE_HEALTH = 0x12,   // 控制器健康记录 can_health_record_t
+} capture_record_type;
+
+// CAN记录的flags
+static const uint8_t CAPTURE_FLAG_EXTENDED = 1 << 0;  // 扩展帧
+static const uint8_t CAPTURE_FLAG_FD       = 1 << 1;  // CAN FD帧
+static const uint8_t CAPTURE_FLAG_BRS      = 1 << 2;  // 数据段切换波特率
+static const uint8_t CAPTURE_FLAG_REMOTE   = 1 << 3;  // 远程帧
+// 数据超过255字节的记录拆成多条，除最后一条外都带这个标志，读取时按顺序拼接
+static const uint8_t CAPTURE_FLAG_CONTINUED = 1 << 7;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;          // CAPTURE_LOG_MAGIC
+  uint16_t version;        // CAPTURE_LOG_VERSION
+  uint16_t header_size;    // sizeof(capture_record_header_t)，用于兼容以后扩展的记录头
+  uint32_t start_ms;       // 开始记录时的millis()
+} capture_file_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t timestamp;      // 采集时间(us)
+  uint32_t id;             // CAN ID / LIN帧ID
+  uint8_t type;            // capture_record_type
+  uint8_t channel;         // 通道号
+  uint8_t flags;           // CAPTURE_FLAG_xxx
+  uint8_t len;             // 后面数据的长度
+} capture_record_header_t;
+
+// CAN帧的记录flags
+static inline uint8_t capture_can_flags(const CANFDMessage & msg) {
+  uint8_t flags = msg.ext ? CAPTURE_FLAG_EXTENDED : 0;
+  switch (msg.type) {
+    case CANFDMessage::CAN_REMOTE:
+      flags |= CAPTURE_FLAG_REMOTE;
+      break;
+    case CANFDMessage::CANFD_NO_BIT_RATE_SWITCH:
+      flags |= CAPTURE_FLAG_FD;
+      break;
+    case CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH:
+      flags |= CAPTURE_FLAG_FD | CAPTURE_FLAG_BRS;
+      break;
+    default:
+      break;
+  }
+  return flags;
+}
+
+class CaptureLog {
+private:
+  fs::FS & mFS;
+  File mFile;
+  bool mOpen;
+  uint8_t mBuffer[CAPTURE_LOG_BLOCK_SIZE];
+  uint16_t mFill;              // 缓冲区中的字节数
+  uint32_t mLastFlushMs;
+  uint32_t mRecords;           // 已记录的条数
+  uint32_t mBytes;             // 已写入文件的字节数
+  uint32_t mWriteErrors;       // 写文件失败的次数
+  char mPath[32];
+
+  // 把缓冲区写入文件
+  void flushBuffer() {
+    if (mFill == 0) {
+      return;
+    }
+    size_t written = mFile.write(mBuffer, mFill);
+    if (written != mFill) {
+      mWriteErrors++;
+    }
+    mBytes += written;
+    mFill = 0;
+  }
+
+public:
+  CaptureLog(fs::FS & fs) : mFS(fs) {
+    mOpen = false;
+    mFill = 0;
+    mLastFlushMs = 0;
+    mRecords = 0;
+    mBytes = 0;
+    mWriteErrors = 0;
+    mPath[0] = 0;
+  }
+
+  /**
+   * 开始记录
+   * @param path - 文件名，为NULL时自动使用/cap_0000.bin开始第一个不存在的文件
+   * @return 打开文件失败返回false
+   */
+  bool start(const char * path = NULL) {
+    if (mOpen) {
+      stop();
+    }
+    if (path != NULL && path[0]) {
+      snprintf(mPath, sizeof(mPath), "%s%s", path[0] == '/' ? "" : "/", path);
+    } else {
+      for (uint16_t i = 0; i < 10000; i++) {
+        snprintf(mPath, sizeof(mPath), "/cap_%04u.bin", i);
+        if (!mFS.exists(mPath)) {
+          break;
+        }
+      }
+    }
+
+    mFile = mFS.open(mPath, FILE_WRITE);
+    if (!mFile) {
+      Serial.printf("|error:can not open capture log %s\n", mPath);
+      return false;
+    }
+
+    capture_file_header_t header;
+    header.magic = CAPTURE_LOG_MAGIC;
+    header.version = CAPTURE_LOG_VERSION;
+    header.header_size = sizeof(capture_record_header_t);
+    header.start_ms = millis();
+    mFile.write((const uint8_t *) &header, sizeof(header));
+
+    mOpen = true;
+    mFill = 0;
+    mRecords = 0;
+    mBytes = sizeof(header);
+    mWriteErrors = 0;
+    mLastFlushMs = millis();
+    return true;
+  }
+
+  // 停止记录，写入缓冲区中剩余的数据并关闭文件
+  void stop() {
+    if (!mOpen) {
+      return;
+    }
+    flushBuffer();
+    mFile.close();
+    mOpen = false;
+  }
+
+  bool isOpen() {
+    return mOpen;
+  }
+
+  const char * path() {
+    return mPath;
+  }
+
+  uint32_t records() {
+    return mRecords;
+  }
+
+  uint32_t bytes() {
+    return mBytes + mFill;
+  }
+
+  uint32_t writeErrors() {
+    return mWriteErrors;
+  }
+
+  /**
+   * 写入一条记录
+   * @return 没有在记录时返回false
+   */
+  bool write(uint8_t type, uint8_t channel, uint32_t id, uint8_t flags, uint32_t timestamp,
+             const void * data, uint8_t len) {
+    if (!mOpen) {
+      return false;
+    }
+    if (mFill + sizeof(capture_record_header_t) + len > sizeof(mBuffer)) {
+      flushBuffer();
+    }
+    capture_record_header_t * header = (capture_record_header_t *) (mBuffer + mFill);
+    header->timestamp = timestamp;
+    header->id = id;
+    header->type = type;
+    header->channel = channel;
+    header->flags = flags;
+    header->len = len;
+    memcpy(mBuffer + mFill + sizeof(capture_record_header_t), data, len);
+    mFill += sizeof(capture_record_header_t) + len;
+    mRecords++;
+    return true;
+  }
+
+  /**
+   * 写入超过255字节的数据，拆成多条记录，除最后一条外flags都带CAPTURE_FLAG_CONTINUED
+   * @return 没有在记录时返回false
+   */
+  bool writeBlock(uint8_t type, uint8_t channel, uint32_t id, uint8_t flags, uint32_t timestamp,
+                  const uint8_t * data, uint16_t len) {
+    do {
+      uint8_t n = len > 255 ? 255 : len;
+      len -= n;
+      if (!write(type, channel, id, len ? (flags | CAPTURE_FLAG_CONTINUED) : flags, timestamp, data, n)) {
+        return false;
+      }
+      data += n;
+    } while (len > 0);
+    return true;
+  }
+
+  bool writeCan(const CANFDMessage & msg, uint32_t timestamp, uint8_t channel = 0) {
+    uint8_t len = msg.type == CANFDMessage::CAN_REMOTE ? 0 : msg.len;
+    return write(CAPTURE_CAN, channel, msg.id, capture_can_flags(msg), timestamp, msg.data, len);
+  }
+
+  // 周期调用：缓冲区中的数据超过CAPTURE_LOG_FLUSH_MS没有写入时写入文件
+  void service(uint32_t now) {
+    if (!mOpen || now - mLastFlushMs < CAPTURE_LOG_FLUSH_MS) {
+      return;
+    }
+    flushBuffer();
+    mFile.flush();
+    mLastFlushMs = now;
+  }
+};
@@ -2,8 +2,87 @@
 
 #include "Arduino.h"
 #include "config.h"
+#include "mem_policy.h"
+#include "bus_config.h"
+#include "can_autobaud.h"
+#include "can_stats.h"
+#include "can_channels.h"
+#include "can_gateway.h"
+#include "capture_log.h"
+#include "dbc_decoder.h"
+#include "ldf_decoder.h"
+#include "lin_scheduler.h"
+#include "isotp.h"
+#include "uds_client.h"
+#include "obd2_scan.h"
+#include "can_replay.h"
+#include "can_periodic.h"
+#include "can_filter_stage.h"
+#include "trigger_capture.h"
 
 extern TfCard tf;
+extern MemPolicy memPolicy;
+extern BusConfigService busConfig;
+extern CanFilter canFilter;
+extern CanFilterStage canStage;
+extern TriggerCapture triggerCapture;
+extern CanAutoBaud canAutoBaud;
+extern CanStats canStats[CAN_MAX_CHANNELS];
+extern CanErrorPoller canErrorPollers[CAN_MAX_CHANNELS];
+extern CanChannels canChannels;
+extern CanGateway gateway;
+extern CaptureLog captureLog;
+extern DbcDecoder dbc;
+extern LdfDatabase ldf;
+extern LinFrameParser linParser;
+extern LinScheduler linScheduler;
+extern IsoTp isotp;
+extern UdsClient uds;
+extern Obd2Scanner obd2;
+extern CanReplay replay;
+extern CanPeriodic periodic;
+
+bool loadLdf(const char * path);
+
+// 打印LDF中的调度表
+void printLdf() {
+  Serial.printf("ldf: %u frames, %u signals, %u skipped, %u bps\n",
+                ldf.frameCount(), ldf.signalCount(), ldf.skipped(), ldf.baud());
+  for (uint16_t i = 0; i < ldf.scheduleCount(); i++) {
+    const LdfSchedule * schedule = ldf.schedule(i);
+    Serial.printf("schedule %s: %u slots\n", schedule->name, schedule->entryCount);
+  }
+  Serial.printf("lin: %u frames, %u checksum errors, schedule %s, %u headers\n", linParser.frames(),
+                linParser.checksumErrors(), linScheduler.isRunning() ? "running" : "off", linScheduler.headers());
+}
+
+// 打印当前生效的总线配置
+void printBusConfig() {
+  bus_config_t cfg = busConfig.active();
+  Serial.printf("CAN: %u bps, data factor x%u, mode %u, last error 0x%x, reinit %u us\n",
+                cfg.can_bitrate, cfg.can_data_factor, cfg.can_mode, busConfig.lastCanError(), busConfig.lastCanReinitUs());
+  Serial.printf("TWAI: %u bps, mode %u\n", cfg.twai_bitrate, cfg.twai_mode);
+  Serial.printf("LIN: %u bps | K-Line: %u bps%s\n", cfg.lin_baud, cfg.kline_baud,
+                busConfig.hasPending() ? " (pending changes)" : "");
+}
+
+// 解析can mode命令的模式名称
+bool parseCanMode(const String & name, uint8_t & mode) {
+  if (name.equals("fd")) {
+    mode = ACAN2517FDSettings::NormalFD;
+  } else if (name.equals("normal")) {
+    mode = ACAN2517FDSettings::Normal20B;
+  } else if (name.equals("listen")) {
+    mode = ACAN2517FDSettings::ListenOnly;
+  } else if (name.equals("loopback")) {
+    mode = ACAN2517FDSettings::InternalLoopBack;
+  } else if (name.equals("extloop")) {
+    mode = ACAN2517FDSettings::ExternalLoopBack;
+  } else {
+    return false;
+  }
+  return true;
+}
 
 void processSerialCommand(){
 
@@ -30,7 +109,7 @@ void processSerialCommand(){
       Serial.printf("command:%s\n" , cmd.c_str());
 
       if(cmd.equals("help")) {
-        Serial.println("Available Command: help , ls , download filename , del filename, status, selftest [on|off] , debug [on|off]");
+        Serial.println("Available Command: help , ls , download filename , del filename, status, mem, selftest [on|off] , debug [on|off] , bus , can rate bps , can fd factor , can mode [fd|normal|listen|loopback|extloop] , can autobaud , can channels , can bench ms [txch] [len] , gateway [bridge a b|route src dst first[-last] [to id] [ext]|block src first[-last] [ext]|rewrite src id|any offset hexvalue [hexmask] [ext]|clear] , filter [add id|first-last [ext]|clear|apply] , rule [record|display|start|stop id id|first-last [ext]|data id|any offset hexvalue [hexmask] [ext]|clear] , trigger [arm [pre_s] [post_s]|now|off] , stats [on|off] , monitor [on|off] , dbc [load filename] , log [start [filename]|stop] , ldf [load filename] , lin schedule [name|off] , isotp [range first last [ext]|reset] , uds [add tx rx [ext]|session ecu n|dtc ecu [mask]|clear ecu|read ecu did..|poll ecu did len ms|poll off] , obd [scan [ext]|stop] , replay [start filename [speed]|stop] , tx [add id ms hexdata [ext] [fd]|counter id bit len|checksum id byte xor|crc8|del id|clear] , twai rate bps , twai mode [normal|listen|noack] , lin baud bps , kline baud bps");
         continue;
       }
       else if(cmd.startsWith("download")) {
@@ -88,6 +167,466 @@ void processSerialCommand(){
         Serial.println("Free Disk:"+String(tf.freeBytes()/1024.0)+"KB");
         Serial.println("Self-test status:"+ String(self_test_mode?"enable":"disable")+" |  Debug Mode:"+String(debug_mode?"enable":"disable"));
         //Serial.println("CAN_Transceiver Mode:"+String( (can_work_mode==1)?"Silent":"HighSpeed" ));
+        printBusConfig();
+        continue;
+      }else if(cmd.equals("mem")) {
+        memPolicy.print();
+        continue;
+      }else if(cmd.equals("stats")) {
+        for (uint8_t channel = 0; channel < canChannels.count(); channel++) {
+          canStats[channel].print();
+          canStats[channel].printTopIds(millis(), 10);
+          if (canErrorPollers[channel].samples > 0 && !canErrorPollers[channel].twai) {
+            canErrorPollers[channel].printReceiveCost(channel);
+            canErrorPollers[channel].printHealth(channel);
+          }
+        }
+        canChannels.print();
+        continue;
+      }else if(cmd.equals("can channels")) {
+        //每个MCP2518的状态和吞吐量
+        canChannels.print();
+        continue;
+      }else if(cmd.startsWith("can bench ")) {
+        //满负载吞吐量测量: can bench ms [txch] [len]，txch不停发送最低优先级的帧，结束时输出每个通道的结果
+        unsigned int ms, tx = 255, len = 8;
+        int n = sscanf(cmd.substring(10).c_str(), "%u %u %u", &ms, &tx, &len);
+        bool ok = n >= 1 && tx <= 255 && len <= 64 && canChannels.requestBench(ms, tx, len);
+        Serial.println(ok ? "can bench started" : "can bench usage: can bench ms(100-60000) [txch] [len]");
+        continue;
+      }else if(cmd.equals("stats on")) {
+        //每秒输出一次CAN统计
+        print_bus_stats = true;
+        continue;
+      }else if(cmd.equals("trigger")) {
+        triggerCapture.print();
+        continue;
+      }else if(cmd.startsWith("trigger arm")) {
+        //在PSRAM中保存最近的总线记录，触发时把触发前pre_s秒和触发后post_s秒的记录写入tf卡
+        float pre = TRIGGER_PRE_MS / 1000.0f;
+        float post = TRIGGER_POST_MS / 1000.0f;
+        sscanf(cmd.c_str(), "trigger arm %f %f", &pre, &post);
+        if (pre < 0 || post < 0 || pre > 600 || post > 600) {
+          Serial.println("trigger usage: trigger arm [pre_s] [post_s], 0 ~ 600 s");
+        } else if (triggerCapture.arm((uint32_t)(pre * 1000), (uint32_t)(post * 1000))) {
+          triggerCapture.print();
+        } else {
+          Serial.println("|error:trigger capture is busy or has no buffer");
+        }
+        continue;
+      }else if(cmd.equals("trigger now")) {
+        if (!triggerCapture.isArmed()) {
+          Serial.println("trigger capture is not armed");
+        }
+        triggerCapture.trigger("command");
+        continue;
+      }else if(cmd.equals("trigger off")) {
+        triggerCapture.disarm();
+        triggerCapture.print();
+        continue;
+      }else if(cmd.equals("stats off")) {
+        print_bus_stats = false;
+        continue;
+      }else if(cmd.startsWith("log start")) {
+        //开始记录所有总线数据到tf卡，不指定文件名时自动生成
+        String name = cmd.substring(9);
+        name.trim();
+        if (captureLog.start(name.length() ? name.c_str() : NULL)) {
+          Serial.printf("capture log started: %s\n", captureLog.path());
+        }
+        continue;
+      }else if(cmd.equals("log stop")) {
+        captureLog.stop();
+        Serial.printf("capture log stopped: %s, %u records, %u bytes\n", captureLog.path(), captureLog.records(), captureLog.bytes());
+        continue;
+      }else if(cmd.equals("monitor on")) {
+        //输出所有总线数据，CAN帧按DBC解码
+        print_bus_message = true;
+        continue;
+      }else if(cmd.equals("monitor off")) {
+        print_bus_message = false;
+        continue;
+      }else if(cmd.startsWith("dbc load ")) {
+        String name = cmd.substring(9);
+        name.trim();
+        String path = name.startsWith("/") ? name : ("/" + name);
+        if (dbc.load(tf.mFS, path.c_str())) {
+          Serial.printf("dbc loaded: %u messages, %u signals, %u skipped, %u long lines, %u bytes\n",
+                        dbc.messageCount(), dbc.signalCount(), dbc.skippedSignals(), dbc.longLines(), dbc.memoryUsage());
+        } else {
+          Serial.printf("failed to load dbc %s\n", path.c_str());
+        }
+        continue;
+      }else if(cmd.equals("dbc")) {
+        Serial.printf("dbc: %u messages, %u signals, %u skipped, %u bytes\n",
+                      dbc.messageCount(), dbc.signalCount(), dbc.skippedSignals(), dbc.memoryUsage());
+        continue;
+      }else if(cmd.startsWith("ldf load ")) {
+        String name = cmd.substring(9);
+        name.trim();
+        String path = name.startsWith("/") ? name : ("/" + name);
+        if (loadLdf(path.c_str())) {
+          printLdf();
+        } else {
+          Serial.printf("failed to load ldf %s\n", path.c_str());
+        }
+        continue;
+      }else if(cmd.equals("ldf")) {
+        printLdf();
+        continue;
+      }else if(cmd.equals("lin schedule off")) {
+        linScheduler.stop();
+        Serial.println("LIN schedule stopped");
+        continue;
+      }else if(cmd.startsWith("lin schedule ")) {
+        //只发送从节点发布帧的帧头，主节点发布的时隙不发送数据
+        String name = cmd.substring(13);
+        name.trim();
+        const LdfSchedule * schedule = ldf.schedule(name.c_str());
+        if (schedule != NULL && linScheduler.start(ldf.entries(*schedule), schedule->entryCount)) {
+          Serial.printf("LIN schedule %s started\n", schedule->name);
+        } else {
+          Serial.printf("invalid LIN schedule %s\n", name.c_str());
+        }
+        continue;
+      }else if(cmd.equals("isotp")) {
+        Serial.printf("isotp: %u pdus, %u active, %u sequence errors, %u timeouts, %u overflows, %u frames sent\n",
+                      isotp.pdus(), isotp.activeSessions(), isotp.sequenceErrors(), isotp.timeouts(),
+                      isotp.overflows(), isotp.framesSent());
+        continue;
+      }else if(cmd.startsWith("isotp range ")) {
+        //增加被动重组的ID范围: isotp range first last [ext]
+        char ext[4] = "";
+        unsigned long first, last;
+        int n = sscanf(cmd.substring(12).c_str(), "%lx %lx %3s", &first, &last, ext);
+        bool ok = n >= 2 && isotp.addRange(first, last, strcmp(ext, "ext") == 0);
+        Serial.println(ok ? "isotp range added" : "isotp range usage: isotp range first last [ext] (hex)");
+        continue;
+      }else if(cmd.equals("isotp reset")) {
+        isotp.resetRanges();
+        Serial.println("isotp ranges reset");
+        continue;
+      }else if(cmd.equals("uds")) {
+        uds.print();
+        continue;
+      }else if(cmd.startsWith("uds add ")) {
+        //增加ECU: uds add txid rxid [ext] (hex)
+        char ext[4] = "";
+        unsigned long tx, rx;
+        int n = sscanf(cmd.substring(8).c_str(), "%lx %lx %3s", &tx, &rx, ext);
+        int8_t ecu = n >= 2 ? uds.addEcu(tx, rx, strcmp(ext, "ext") == 0) : -1;
+        if (ecu >= 0) {
+          Serial.printf("uds ecu %d\n", ecu);
+        } else {
+          Serial.println("uds add usage: uds add txid rxid [ext] (hex)");
+        }
+        continue;
+      }else if(cmd.startsWith("uds session ")) {
+        int ecu, session;
+        bool ok = sscanf(cmd.substring(12).c_str(), "%d %x", &ecu, &session) == 2 && uds.sessionControl(ecu, session);
+        Serial.println(ok ? "uds session requested" : "uds session usage: uds session ecu session(hex)");
+        continue;
+      }else if(cmd.startsWith("uds dtc ")) {
+        int ecu;
+        unsigned mask = 0xFF;
+        bool ok = sscanf(cmd.substring(8).c_str(), "%d %x", &ecu, &mask) >= 1 && uds.readDtc(ecu, mask);
+        Serial.println(ok ? "uds read dtc requested" : "uds dtc usage: uds dtc ecu [mask(hex)]");
+        continue;
+      }else if(cmd.startsWith("uds clear ")) {
+        bool ok = uds.clearDtc(cmd.substring(10).toInt());
+        Serial.println(ok ? "uds clear dtc requested" : "uds clear usage: uds clear ecu");
+        continue;
+      }else if(cmd.startsWith("uds read ")) {
+        //一次读取多个DID: uds read ecu did [did...] (hex)
+        uint16_t dids[UDS_MAX_BATCH];
+        uint8_t count = 0;
+        char buffer[128];
+        strncpy(buffer, cmd.substring(9).c_str(), sizeof(buffer) - 1);
+        buffer[sizeof(buffer) - 1] = 0;
+        char * token = strtok(buffer, " ");
+        int ecu = token ? atoi(token) : -1;
+        while ((token = strtok(NULL, " ")) != NULL && count < UDS_MAX_BATCH) {
+          dids[count++] = strtoul(token, NULL, 16);
+        }
+        bool ok = uds.isEcu(ecu) && uds.readDids(ecu, dids, count);
+        Serial.println(ok ? "uds read did requested" : "uds read usage: uds read ecu did [did...] (hex)");
+        continue;
+      }else if(cmd.equals("uds poll off")) {
+        uds.clearPolls();
+        Serial.println("uds polling stopped");
+        continue;
+      }else if(cmd.startsWith("uds poll ")) {
+        //轮询DID: uds poll ecu did len period_ms，结果在monitor on时输出
+        int ecu, len, period;
+        unsigned did;
+        bool ok = sscanf(cmd.substring(9).c_str(), "%d %x %d %d", &ecu, &did, &len, &period) == 4
+                  && uds.addPoll(ecu, did, len, period);
+        Serial.println(ok ? "uds poll added" : "uds poll usage: uds poll ecu did(hex) len period_ms");
+        continue;
+      }else if(cmd.equals("obd")) {
+        obd2.print();
+        continue;
+      }else if(cmd.equals("obd scan") || cmd.equals("obd scan ext")) {
+        //发现支持的PID后循环扫描，monitor on时输出每个值
+        obd2.start(cmd.endsWith("ext"));
+        Serial.println("obd2 scan started");
+        continue;
+      }else if(cmd.equals("obd stop")) {
+        obd2.stop();
+        Serial.println("obd2 scan stopped");
+        continue;
+      }else if(cmd.equals("replay")) {
+        replay.print();
+        continue;
+      }else if(cmd.startsWith("replay start ")) {
+        //按记录的时间回放采集日志中的CAN帧: replay start filename [speed]，speed为倍速，默认1
+        char name[32];
+        float speed = 1;
+        int n = sscanf(cmd.substring(13).c_str(), "%31s %f", name, &speed);
+        if (n < 1 || speed < 0.01f || speed > 100) {
+          Serial.println("replay usage: replay start filename [speed]");
+        } else if (replay.start(name, (uint32_t)(speed * 1000 + 0.5f))) {
+          Serial.printf("replay started: %s\n", name);
+        }
+        continue;
+      }else if(cmd.equals("replay stop")) {
+        replay.stop();
+        Serial.println("replay stopped");
+        continue;
+      }else if(cmd.equals("tx")) {
+        periodic.print();
+        continue;
+      }else if(cmd.startsWith("tx add ")) {
+        //周期发送: tx add id(hex) period_ms hexdata [ext] [fd]，数据超过8字节时自动使用CAN FD
+        unsigned id, period;
+        char hex[130];
+        CANFDMessage msg;
+        bool ok = sscanf(cmd.substring(7).c_str(), "%x %u %129s", &id, &period, hex) == 3 && strlen(hex) % 2 == 0;
+        msg.len = strlen(hex) / 2;
+        for (uint8_t i = 0; ok && i < msg.len; i++) {
+          unsigned b;
+          ok = sscanf(hex + i * 2, "%2x", &b) == 1;
+          msg.data[i] = b;
+        }
+        msg.id = id;
+        msg.ext = cmd.indexOf(" ext") > 0;
+        if (msg.len > 8 || cmd.endsWith(" fd")) {
+          msg.type = CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH;
+        }
+        if (ok && periodic.add(msg, period)) {
+          periodic.commit();
+          Serial.printf("tx added: %X every %u ms\n", id, period);
+        } else {
+          Serial.println("tx usage: tx add id(hex) period_ms hexdata [ext] [fd]");
+        }
+        continue;
+      }else if(cmd.startsWith("tx counter ")) {
+        unsigned id;
+        int bit, len;
+        if (sscanf(cmd.substring(11).c_str(), "%x %d %d", &id, &bit, &len) == 3 && bit >= 0 && len >= 0
+            && periodic.setCounter(id, bit, len)) {
+          periodic.commit();
+          Serial.println("tx counter set");
+        } else {
+          Serial.println("tx usage: tx counter id(hex) start_bit bits");
+        }
+        continue;
+      }else if(cmd.startsWith("tx checksum ")) {
+        unsigned id;
+        int byte;
+        char type[8];
+        bool ok = sscanf(cmd.substring(12).c_str(), "%x %d %7s", &id, &byte, type) == 3 && byte >= 0
+                  && (strcmp(type, "xor") == 0 || strcmp(type, "crc8") == 0)
+                  && periodic.setChecksum(id, byte, strcmp(type, "xor") == 0 ? CAN_CHECKSUM_XOR : CAN_CHECKSUM_CRC8);
+        if (ok) {
+          periodic.commit();
+          Serial.println("tx checksum set");
+        } else {
+          Serial.println("tx usage: tx checksum id(hex) byte xor|crc8");
+        }
+        continue;
+      }else if(cmd.startsWith("tx del ")) {
+        if (periodic.remove(strtoul(cmd.substring(7).c_str(), NULL, 16))) {
+          periodic.commit();
+          Serial.println("tx removed");
+        } else {
+          Serial.println("tx message not found");
+        }
+        continue;
+      }else if(cmd.equals("tx clear")) {
+        periodic.clear();
+        periodic.commit();
+        Serial.println("tx cleared");
+        continue;
+      }else if(cmd.equals("bus")) {
+        printBusConfig();
+        continue;
+      }else if(cmd.equals("filter")) {
+        canFilter.print();
+        continue;
+      }else if(cmd.startsWith("filter add ")) {
+        //接收白名单: filter add id 或 filter add first-last，扩展帧加ext，filter apply后生效
+        unsigned first, last;
+        int n = sscanf(cmd.substring(11).c_str(), "%x-%x", &first, &last);
+        if (n == 1) {
+          last = first;
+        }
+        if (n >= 1 && canFilter.add(cmd.endsWith(" ext"), first, last)) {
+          Serial.printf("filter: %u ranges\n", canFilter.rangeCount());
+        } else {
+          Serial.println("filter usage: filter add id(hex)|first-last [ext]");
+        }
+        continue;
+      }else if(cmd.equals("filter clear")) {
+        canFilter.clear();
+        Serial.println("filter cleared, filter apply to accept all frames");
+        continue;
+      }else if(cmd.equals("filter apply")) {
+        //编译成硬件过滤器，MCP2518重新初始化后生效
+        if (canFilter.compile()) {
+          busConfig.requestCanReinit();
+          canFilter.print();
+        } else {
+          Serial.println("|error:not enough memory to compile filters");
+        }
+        continue;
+      }else if(cmd.equals("rule")) {
+        canStage.print();
+        continue;
+      }else if(cmd.startsWith("rule ")) {
+        //软件过滤集合: rule <record|display|start|stop> id first[-last] [ext]
+        //              rule <set> data <id|any> offset hexvalue [hexmask] [ext]
+        //              rule <set> clear
+        char name[8], target[12], hex[20], maskHex[20];
+        unsigned first, last, offset;
+        int n = sscanf(cmd.c_str(), "rule %7s", name);
+        int8_t set = n == 1 ? CanFilterStage::setIndex(name) : -1;
+        String rest = cmd.substring(6 + strlen(name));
+        bool ext = cmd.endsWith(" ext");
+        bool ok = false;
+        if (set >= 0 && rest.equals("clear")) {
+          canStage.clear(1 << set);
+          ok = true;
+        } else if (set >= 0 && rest.startsWith("id ")) {
+          n = sscanf(rest.c_str(), "id %x-%x", &first, &last);
+          ok = n >= 1 && canStage.addIds(set, ext, first, n == 2 ? last : first);
+        } else if (set >= 0 && rest.startsWith("data ")) {
+          n = sscanf(rest.c_str(), "data %11s %u %19s %19s", target, &offset, hex, maskHex);
+          bool any = strcmp(target, "any") == 0;
+          bool hasMask = n == 4 && strcmp(maskHex, "ext") != 0;
+          uint8_t len = strlen(hex) / 2;
+          ok = n >= 3 && (any || sscanf(target, "%x", &first) == 1) && strlen(hex) % 2 == 0 && len >= 1 && len <= 8
+               && (!hasMask || strlen(maskHex) == strlen(hex));
+          uint8_t value[8], mask[8];
+          for (uint8_t i = 0; ok && i < len; i++) {
+            unsigned v, m = 0xFF;
+            ok = sscanf(hex + i * 2, "%2x", &v) == 1 && (!hasMask || sscanf(maskHex + i * 2, "%2x", &m) == 1);
+            value[i] = v;
+            mask[i] = m;
+          }
+          ok = ok && canStage.addRule(set, any, ext, any ? 0 : first, offset, value, mask, len);
+        }
+        if (ok) {
+          canStage.print();
+        } else {
+          Serial.println("rule usage: rule <record|display|start|stop> id first[-last] [ext] | data <id|any> offset hexvalue [hexmask] [ext] | clear");
+        }
+        continue;
+      }else if(cmd.equals("gateway")) {
+        gateway.print();
+        continue;
+      }else if(cmd.startsWith("gateway ")) {
+        //网关: gateway bridge a b
+        //      gateway route src dst first[-last] [to id] [ext]
+        //      gateway block src first[-last] [ext]
+        //      gateway rewrite src <id|any> offset hexvalue [hexmask] [ext]
+        //      gateway clear
+        String rest = cmd.substring(8);
+        bool ext = cmd.indexOf(" ext") > 0;
+        unsigned src, dst, first, last, target, offset;
+        char id[12], hex[20], maskHex[20];
+        bool ok = false;
+        int n;
+        if (rest.equals("clear")) {
+          gateway.clear();
+          ok = true;
+        } else if (rest.startsWith("bridge ")) {
+          ok = sscanf(rest.c_str(), "bridge %u %u", &src, &dst) == 2 && gateway.addBridge(src, dst);
+        } else if (rest.startsWith("route ")) {
+          n = sscanf(rest.c_str(), "route %u %u %x-%x", &src, &dst, &first, &last);
+          int to = rest.indexOf(" to ");
+          bool translate = to > 0 && sscanf(rest.c_str() + to, " to %x", &target) == 1;
+          ok = n >= 3 && (to < 0 || translate)
+               && gateway.addRoute(src, dst, ext, first, n == 4 ? last : first, translate, translate ? target : 0);
+        } else if (rest.startsWith("block ")) {
+          n = sscanf(rest.c_str(), "block %u %x-%x", &src, &first, &last);
+          ok = n >= 2 && gateway.addRoute(src, CAN_GATEWAY_BLOCK, ext, first, n == 3 ? last : first);
+        } else if (rest.startsWith("rewrite ")) {
+          n = sscanf(rest.c_str(), "rewrite %u %11s %u %19s %19s", &src, id, &offset, hex, maskHex);
+          bool any = strcmp(id, "any") == 0;
+          bool hasMask = n == 5 && strcmp(maskHex, "ext") != 0;
+          uint8_t len = strlen(hex) / 2;
+          ok = n >= 4 && (any || sscanf(id, "%x", &first) == 1) && strlen(hex) % 2 == 0 && len >= 1 && len <= 8
+               && (!hasMask || strlen(maskHex) == strlen(hex));
+          uint8_t value[8], mask[8];
+          for (uint8_t i = 0; ok && i < len; i++) {
+            unsigned v, m = 0xFF;
+            ok = sscanf(hex + i * 2, "%2x", &v) == 1 && (!hasMask || sscanf(maskHex + i * 2, "%2x", &m) == 1);
+            value[i] = v;
+            mask[i] = m;
+          }
+          ok = ok && gateway.addRewrite(src, any, ext, any ? 0 : first, offset, value, mask, len);
+        }
+        if (ok) {
+          gateway.commit();
+          //有转发路由时MCP2518接收所有帧，白名单外的帧也能转发
+          if (busConfig.setAcceptAll(gateway.forwarding())) {
+            Serial.println(gateway.forwarding() ? "gateway: hardware filters off while forwarding"
+                                                : "gateway: hardware filters restored");
+          }
+          gateway.print();
+        } else {
+          Serial.println("gateway usage: gateway bridge a b | route src dst first[-last] [to id] [ext] | block src first[-last] [ext] | rewrite src <id|any> offset hexvalue [hexmask] [ext] | clear");
+        }
+        continue;
+      }else if(cmd.equals("can autobaud")) {
+        //ListenOnly模式下扫描候选波特率，不会向总线发送任何数据，结果自动保存
+        canAutoBaud.request();
+        Serial.println("CAN autobaud started");
+        continue;
+      }else if(cmd.startsWith("can rate ")) {
+        //修改的配置由采集任务重新初始化mcp2518后生效，并保存到flash
+        uint32_t bitrate = cmd.substring(9).toInt();
+        Serial.println(busConfig.setCanBitRate(bitrate) ? "CAN bit rate accepted" : "invalid CAN bit rate");
+        continue;
+      }else if(cmd.startsWith("can fd ")) {
+        uint8_t factor = cmd.substring(7).toInt();
+        Serial.println(busConfig.setCanDataFactor(factor) ? "CAN data factor accepted" : "invalid CAN data factor");
+        continue;
+      }else if(cmd.startsWith("can mode ")) {
+        uint8_t mode;
+        bool ok = parseCanMode(cmd.substring(9), mode) && busConfig.setCanMode(mode);
+        Serial.println(ok ? "CAN mode accepted" : "can mode usage: can mode [fd|normal|listen|loopback|extloop]");
+        continue;
+      }else if(cmd.startsWith("twai rate ")) {
+        //片上TWAI控制器的波特率：125k, 250k, 500k, 800k, 1M
+        uint32_t bitrate = cmd.substring(10).toInt();
+        Serial.println(busConfig.setTwaiBitRate(bitrate) ? "TWAI bit rate accepted" : "invalid TWAI bit rate");
+        continue;
+      }else if(cmd.startsWith("twai mode ")) {
+        String name = cmd.substring(10);
+        uint8_t mode = name.equals("normal") ? TWAI_MODE_NORMAL : name.equals("noack") ? TWAI_MODE_NO_ACK
+                     : name.equals("listen") ? TWAI_MODE_LISTEN_ONLY : 0xFF;
+        bool ok = mode != 0xFF && busConfig.setTwaiMode(mode);
+        Serial.println(ok ? "TWAI mode accepted" : "twai mode usage: twai mode [normal|listen|noack]");
+        continue;
+      }else if(cmd.startsWith("lin baud ")) {
+        uint32_t baud = cmd.substring(9).toInt();
+        Serial.println(busConfig.setLinBaud(baud) ? "LIN baud accepted" : "invalid LIN baud");
+        continue;
+      }else if(cmd.startsWith("kline baud ")) {
+        uint32_t baud = cmd.substring(11).toInt();
+        Serial.println(busConfig.setKLineBaud(baud) ? "K-Line baud accepted" : "invalid K-Line baud");
         continue;
       }else if(cmd.equals("debug on")){
         debug_mode = true;
@@ -106,7 +645,7 @@ void processSerialCommand(){
       }
       else {
         
-        Serial.println("Available Command: help , ls , download filename , del filename, status, selftest [on|off] , debug [on|off]");
+        Serial.println("Available Command: help , ls , download filename , del filename, status, mem, selftest [on|off] , debug [on|off] , bus , can rate bps , can fd factor , can mode [fd|normal|listen|loopback|extloop] , can autobaud , can channels , can bench ms [txch] [len] , gateway [bridge a b|route src dst first[-last] [to id] [ext]|block src first[-last] [ext]|rewrite src id|any offset hexvalue [hexmask] [ext]|clear] , filter [add id|first-last [ext]|clear|apply] , rule [record|display|start|stop id id|first-last [ext]|data id|any offset hexvalue [hexmask] [ext]|clear] , trigger [arm [pre_s] [post_s]|now|off] , stats [on|off] , monitor [on|off] , dbc [load filename] , log [start [filename]|stop] , ldf [load filename] , lin schedule [name|off] , isotp [range first last [ext]|reset] , uds [add tx rx [ext]|session ecu n|dtc ecu [mask]|clear ecu|read ecu did..|poll ecu did len ms|poll off] , obd [scan [ext]|stop] , replay [start filename [speed]|stop] , tx [add id ms hexdata [ext] [fd]|counter id bit len|checksum id byte xor|crc8|del id|clear] , twai rate bps , twai mode [normal|listen|noack] , lin baud bps , kline baud bps");
         continue;
       }
 
@@ -7,8 +7,33 @@ static const int MCP2517_MOSI = 11 ; // SDI input of MCP2517FD
 static const int MCP2517_MISO = 13 ; // SDO output of MCP2517FD
 static const int MCP2517_CS  = 10 ; // CS input of MCP2517FD
 static const int MCP2517_INT = 9 ;
+// Set to true only on boards that route the controller INT pin to MCP2517_INT: channel 0 is polled otherwise
+static const bool MCP2517_INT_WIRED = false;
 static const int MCP2517_RESET = 8 ;
-static const int MCP2517_SPI_SPEED = 10000000;
+// Fastest SPI clock tried by can.begin(): it steps down by 1/5 (down to 16 MHz) until the read-back test passes
+// without CRC errors. The datasheet limit is 0.85 * SYSCLK / 2, 17 MHz with the 40 MHz oscillator.
+static const int MCP2517_SPI_SPEED = 17000000;
+static const bool MCP2517_SPI_CRC = true;
+// Enable RAM ECC: corrected/uncorrected errors are counted and logged as health records
+static const bool MCP2517_RAM_ECC = true;
+
+//Second MCP2518 (CAN channel 1): same SPI bus and pins as the first one, own CS and INT.
+//The other SPI host drives the TFT. Unused by default: set MCP2518_1_CS (e.g. 14) on boards with a second
+//controller, MCP2518_1_INT (e.g. 17) to -1 to poll it
+static const int MCP2518_1_CS = -1;
+static const int MCP2518_1_INT = -1;
+
+//On-chip TWAI controller (classic CAN only) as CAN channel 2, needs an external transceiver.
+//Unused by default: set TWAI_TX/TWAI_RX (e.g. 1/2) on boards with a transceiver. Listen-only by default: in
+//normal mode TWAI destroys CAN FD frames with error frames. Bit rate and mode can be changed at runtime
+//(twai rate / twai mode)
+static const int TWAI_TX = -1;
+static const int TWAI_RX = -1;
+static const uint32_t TWAI_DEFAULT_BITRATE = 500 * 1000;
+#define TWAI_DEFAULT_MODE TWAI_MODE_LISTEN_ONLY
+
+//CAN controllers serviced by the capture task (can_channels.h): two MCP2518 and TWAI
+static const uint8_t CAN_MAX_CHANNELS = 3;
 
 
 //need change User_Setup.h file to set following params
@@ -32,6 +57,48 @@ static const int MAIN_BTN = 38;
 
 
 #define MCP2518_DEFAULT_WORK_MODE ACAN2517FDSettings::InternalLoopBack
+#define MCP2518_OSCILLATOR ACAN2517FDSettings::OSC_40MHz
+
+//default CAN bit rate, could be changed at runtime by menu or serial command (saved in flash)
+static const uint32_t CAN_DEFAULT_BITRATE = 500 * 1000;
+static const uint8_t CAN_DEFAULT_DATA_FACTOR = 1;
+
+//frames waiting in send_queue for loop() to transmit with can.tryToSend
+static const int CAN_SEND_QUEUE_SIZE = 64;
+
+//frames loop() takes from the driver per can.receiveBurst call
+static const int CAN_RECEIVE_BURST = 8;
+
+//frames loop() takes from send_queue per can.trySendBurst call
+static const int CAN_SEND_BURST = 8;
+
+//identifier of the frames sent by the full-load throughput measurement (can bench), lowest priority
+static const uint32_t CAN_BENCH_ID = 0x7FF;
+
+//MCP2518 RAM (2048 bytes) split with 64 byte payloads: TXQ for cyclic frames (highest priority),
+//receive FIFO and the driver's transmit FIFO (written in bursts by trySendBurst). Receive objects carry
+//a 4 byte SOF time stamp, (4 + 4) * 72 + 19 * 76 = 2020 bytes
+static const uint8_t CAN_TXQ_SIZE = 4;
+static const uint8_t CAN_RX_FIFO_SIZE = 19;
+static const uint8_t CAN_TX_FIFO_SIZE = 4;
+
+//2.0B mode (classic CAN only): 8 byte payloads, 16 byte objects (20 with the receive time stamp),
+//receive and transmit FIFOs at their maximum size, (4 + 32) * 16 + 32 * 20 = 1216 bytes
+static const uint8_t CAN_RX_FIFO_SIZE_CLASSIC = 32;
+static const uint8_t CAN_TX_FIFO_SIZE_CLASSIC = 32;
+
+//driver receive ring in frames; with 8 byte payloads the ring keeps the same RAM and holds 3.6x the frames
+static const uint16_t CAN_DRIVER_RX_SIZE = 32;
+
+//cyclic transmit table size (tx add ...)
+static const int CAN_PERIODIC_MAX = 32;
+
+//pre/post-trigger capture: history ring in PSRAM (power of two, at most half of the free PSRAM,
+//TRIGGER_BUFFER_MIN in internal RAM without PSRAM) and default windows (trigger arm ...)
+static const uint32_t TRIGGER_BUFFER_SIZE = 4 * 1024 * 1024;
+static const uint32_t TRIGGER_BUFFER_MIN = 32 * 1024;
+static const uint32_t TRIGGER_PRE_MS = 10000;
+static const uint32_t TRIGGER_POST_MS = 5000;
 
 //ata6535 STBY = LOW is normal mode, STBY  = 1 STAND BY mode
 //this chip could replace with tja1051t/3 or sit1051t/3 ,these chip have silent mode with this pin
@@ -41,6 +108,7 @@ static const int ATA6363_STBY = 4;
 //LIN BUS
 static const int TJA2019T_SLP = 21;
 static const int LIN_BAUDRATE = 10940;
+static const int LIN_DEFAULT_BAUD = 19200;
 
 
 //SDIO configuration
@@ -48,12 +116,19 @@ static const int SDIO_CLK = 40;
 static const int SDIO_CMD = 41;
 static const int SDIO_D0 = 42;
 
+//DBC file loaded from tf card at boot, used to decode CAN frames
+static const char * const DBC_DEFAULT_FILE = "/vehicle.dbc";
+
+//LDF file loaded from tf card at boot, used to decode LIN frames and poll LIN slaves
+static const char * const LDF_DEFAULT_FILE = "/vehicle.ldf";
+
 //K-Line configuration
 //if K-line did not send any data to K-Line bus , check LSF0102DCUR chip ,does it have any data send from 5 pin
 //test LSF0102DCUR pin8(EN) to GND voltage,it should 5v
 static const int K_LINE_TX = 7;
 static const int K_LINE_RX = 6;
 static const int KLINE_BAUDRATE = 50000;
+static const int KLINE_DEFAULT_BAUD = 10400;
 
 
 //LIN-Bus configuration
@@ -79,5 +154,8 @@ bool debug_mode = false;
 //print all bus data 
 bool print_bus_message = false;
 
+//print CAN bus statistics every second
+bool print_bus_stats = false;
+
 bool print_debug_info = false;
 bool print_debug_error = false;
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include <ACAN2517FD.h>
+
+/**
+ * DBC信号解码
+ *
+ * 从TF卡加载DBC文件(只解析BO_和SG_)，加载时把每个信号编译成提取计划：
+ * 起始字节、移位、位长度、字节序、符号、比例/偏移以及多路复用值。
+ * 解码时按ID在哈希表中找到报文，然后对每个信号执行固定的几条位运算：
+ *   Intel:    raw = (load_le64(data + byte) >> shift) & mask
+ *   Motorola: raw = (load_be64(data + byte) << shift) >> (64 - length)
+ * 信号跨越9个字节时(移位+长度超过64位)再补上第9个字节，支持64字节的CAN FD数据。
+ *
+ * 加载在数据消费任务中进行，解码也只在该任务中调用，所以不需要加锁。
+ */
+
+#define DBC_MAX_LINE        256     // 解析的行长度，超出部分(通常是SG_的接收节点列表)被跳过
+#define DBC_NAME_LEN        48      // 报文名、信号名的最大长度
+#define DBC_UNIT_LEN        16      // 单位的最大长度
+#define DBC_NO_MUX          -1      // 信号不受多路复用控制
+
+// 信号标志
+static const uint8_t DBC_SIGNAL_MOTOROLA    = 1 << 0;  // 大端(Motorola)字节序
+static const uint8_t DBC_SIGNAL_SIGNED      = 1 << 1;  // 有符号
+static const uint8_t DBC_SIGNAL_MULTIPLEXOR = 1 << 2;  // 多路复用选择信号
+static const uint8_t DBC_SIGNAL_WIDE        = 1 << 3;  // 需要读取第9个字节
+
+// 一个信号的提取计划
+struct DbcSignalPlan {
+  const char * name;
+  const char * unit;
+  float factor;
+  float offset;
+  uint64_t mask;          // Intel格式的掩码
+  int16_t muxValue;       // 多路复用值，DBC_NO_MUX表示总是存在
+  uint8_t byte;           // 开始读取的字节
+  uint8_t shift;          // Intel: 右移位数; Motorola: 左移位数(信号最高位在64位中的位置)
+  uint8_t length;         // 位长度 1...64
+  uint8_t minLen;         // 帧数据至少需要的长度
+  uint8_t flags;          // DBC_SIGNAL_xxx
+};
+
+// 一个报文的解码计划
+struct DbcMessagePlan {
+  uint32_t id;            // DBC中的ID，扩展帧bit31为1
+  const char * name;
+  uint16_t firstSignal;   // 在信号表中的开始位置
+  uint16_t signalCount;
+  int16_t multiplexor;    // 多路复用选择信号在该报文中的序号，-1表示没有
+  uint8_t dlc;            // DBC中定义的数据长度
+  bool padded;            // 读取会超过64字节，需要先复制到补零的缓冲区
+};
+
+class DbcDecoder {
+private:
+  DbcMessagePlan * mMessages;
+  DbcSignalPlan * mSignals;
+  char * mStrings;              // 所有名称和单位
+  uint16_t * mTable;            // ID哈希表，保存报文序号，0xFFFF为空
+  uint16_t mMessageCount;
+  uint16_t mSignalCount;
+  uint16_t mTableMask;
+  uint32_t mStringSize;
+  uint32_t mStringUsed;
+  uint32_t mSkippedSignals;     // 格式错误或超出64字节的信号
+  uint32_t mLongLines;          // 超过DBC_MAX_LINE被截断的行
+
+  static uint32_t hash(uint32_t id) {
+    return id * 2654435761u;
+  }
+
+  // 复制字符串到字符串池，统计阶段只计算长度
+  const char * store(const char * text) {
+    size_t len = strlen(text) + 1;
+    if (mStrings == NULL) {
+      mStringSize += len;
+      return NULL;
+    }
+    if (mStringUsed + len > mStringSize) {
+      return "";
+    }
+    char * p = mStrings + mStringUsed;
+    memcpy(p, text, len);
+    mStringUsed += len;
+    return p;
+  }
+
+  // 解析 "BO_ id name: dlc transmitter"
+  bool parseMessage(const char * line) {
+    unsigned long id;
+    unsigned dlc;
+    char name[DBC_NAME_LEN];
+    if (sscanf(line, "BO_ %lu %47[^: ] : %u", &id, name, &dlc) != 3) {
+      return false;
+    }
+    if (strcmp(name, "VECTOR__INDEPENDENT_SIG_MSG") == 0) {
+      return false;
+    }
+    const char * stored = store(name);
+    if (mMessages) {
+      DbcMessagePlan & m = mMessages[mMessageCount];
+      m.id = id;
+      m.name = stored;
+      m.firstSignal = mSignalCount;
+      m.signalCount = 0;
+      m.multiplexor = -1;
+      m.dlc = dlc;
+      m.padded = false;
+    }
+    mMessageCount++;
+    return true;
+  }
+
+  // 解析 "SG_ name [M|mN] : start|length@order sign (factor,offset) [min|max] "unit" receivers"
+  void parseSignal(const char * line) {
+    const char * colon = strchr(line, ':');
+    if (colon == NULL) {
+      mSkippedSignals++;
+      return;
+    }
+    char name[DBC_NAME_LEN];
+    char mux[8] = "";
+    char head[DBC_NAME_LEN + 16];
+    size_t headLen = min((size_t)(colon - line), sizeof(head) - 1);
+    memcpy(head, line, headLen);
+    head[headLen] = 0;
+    if (sscanf(head, " SG_ %47s %7s", name, mux) < 1) {
+      mSkippedSignals++;
+      return;
+    }
+
+    unsigned start, length;
+    char order, sign;
+    float factor, offset, minimum, maximum;
+    char unit[DBC_UNIT_LEN] = "";
+    int n = sscanf(colon + 1, " %u|%u@%c%c (%f,%f) [%f|%f] \"%15[^\"]\"",
+                   &start, &length, &order, &sign, &factor, &offset, &minimum, &maximum, unit);
+    if (n < 6) {
+      mSkippedSignals++;
+      return;
+    }
+
+    DbcSignalPlan plan;
+    if (!compile(plan, start, length, order == '0', sign == '-')) {
+      mSkippedSignals++;
+      return;
+    }
+    plan.factor = factor;
+    plan.offset = offset;
+    plan.muxValue = DBC_NO_MUX;
+    if (mux[0] == 'M') {
+      plan.flags |= DBC_SIGNAL_MULTIPLEXOR;
+    } else if (mux[0] == 'm') {
+      plan.muxValue = atoi(mux + 1);
+    }
+    plan.name = store(name);
+    plan.unit = store(unit);
+
+    if (mMessages && mMessageCount > 0) {
+      DbcMessagePlan & m = mMessages[mMessageCount - 1];
+      if (plan.flags & DBC_SIGNAL_MULTIPLEXOR) {
+        m.multiplexor = m.signalCount;
+      }
+      uint16_t readEnd = plan.byte + 8 + ((plan.flags & DBC_SIGNAL_WIDE) ? 1 : 0);
+      if (readEnd > 64) {
+        m.padded = true;
+      }
+      mSignals[mSignalCount] = plan;
+      m.signalCount++;
+    }
+    mSignalCount++;
+  }
+
+  // 逐行解析文件；mMessages为NULL时只统计数量和字符串长度
+  void parseFile(File & file) {
+    char line[DBC_MAX_LINE];
+    bool inMessage = false;
+    while (file.available()) {
+      size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+      line[len] = 0;
+      if (len == sizeof(line) - 1) {
+        // 行太长：丢弃到行尾，否则剩下的部分会被当作下一行，结束当前报文而丢掉后面的信号。
+        // SG_的定义字段都在行首，截断的只是接收节点列表；截断到定义字段时按格式错误跳过该信号
+        uint32_t extra = 0;
+        while (file.available() && file.read() != '\n') {
+          extra++;
+        }
+        if (extra > 0) {
+          mLongLines++;
+        }
+      }
+      const char * p = line;
+      while (*p == ' ' || *p == '\t') {
+        p++;
+      }
+      if (strncmp(p, "BO_ ", 4) == 0) {
+        inMessage = parseMessage(p);
+      } else if (strncmp(p, "SG_ ", 4) == 0) {
+        if (inMessage) {
+          parseSignal(p);
+        }
+      } else if (*p != '\r' && *p != 0) {
+        inMessage = false;
+      }
+    }
+  }
+
+  void buildTable() {
+    uint32_t size = 16;
+    while (size < (uint32_t)mMessageCount * 2) {
+      size <<= 1;
+    }
+    mTable = new uint16_t[size];
+    memset(mTable, 0xFF, size * sizeof(uint16_t));
+    mTableMask = size - 1;
+    for (uint16_t i = 0; i < mMessageCount; i++) {
+      uint32_t slot = hash(mMessages[i].id) & mTableMask;
+      while (mTable[slot] != 0xFFFF) {
+        slot = (slot + 1) & mTableMask;
+      }
+      mTable[slot] = i;
+    }
+  }
+
+public:
+  /**
+   * 把信号定义编译成提取计划(LDF的LIN信号也使用)
+   * @return 信号超出64字节时返回false
+   */
+  static bool compile(DbcSignalPlan & plan, uint16_t startBit, uint8_t length, bool motorola, bool isSigned) {
+    if (length == 0 || length > 64) {
+      return false;
+    }
+    uint16_t lastBit;
+    plan.flags = (motorola ? DBC_SIGNAL_MOTOROLA : 0) | (isSigned ? DBC_SIGNAL_SIGNED : 0);
+    plan.length = length;
+    plan.byte = startBit / 8;
+    if (motorola) {
+      // 把最高位换算成从数据最高位开始的线性位序号
+      plan.shift = 7 - (startBit % 8);
+      lastBit = plan.byte * 8 + plan.shift + length - 1;
+    } else {
+      plan.shift = startBit % 8;
+      lastBit = startBit + length - 1;
+    }
+    if (lastBit >= 64 * 8) {
+      return false;
+    }
+    plan.minLen = lastBit / 8 + 1;
+    if (plan.shift + length > 64) {
+      plan.flags |= DBC_SIGNAL_WIDE;
+    }
+    plan.mask = length == 64 ? ~0ULL : ((1ULL << length) - 1);
+    return true;
+  }
+
+  DbcDecoder() {
+    mMessages = NULL;
+    mSignals = NULL;
+    mStrings = NULL;
+    mTable = NULL;
+    clear();
+  }
+
+  ~DbcDecoder() {
+    clear();
+  }
+
+  // 释放已加载的DBC
+  void clear() {
+    delete [] mMessages;
+    delete [] mSignals;
+    delete [] mStrings;
+    delete [] mTable;
+    mMessages = NULL;
+    mSignals = NULL;
+    mStrings = NULL;
+    mTable = NULL;
+    mMessageCount = 0;
+    mSignalCount = 0;
+    mTableMask = 0;
+    mStringSize = 0;
+    mStringUsed = 0;
+    mSkippedSignals = 0;
+    mLongLines = 0;
+  }
+
+  /**
+   * 从文件系统加载DBC文件并编译所有报文
+   * 先扫描一遍统计报文、信号数量和字符串长度，一次性分配后再扫描一遍填充
+   * @return 打开文件失败或没有报文时返回false
+   */
+  bool load(fs::FS & fs, const char * path) {
+    clear();
+    File file = fs.open(path);
+    if (!file) {
+      return false;
+    }
+    parseFile(file);
+    uint16_t messages = mMessageCount;
+    uint16_t signals = mSignalCount;
+    if (messages == 0) {
+      file.close();
+      return false;
+    }
+
+    mMessages = new DbcMessagePlan[messages];
+    mSignals = new DbcSignalPlan[signals > 0 ? signals : 1];
+    mStrings = new char[mStringSize];
+    mMessageCount = 0;
+    mSignalCount = 0;
+    mSkippedSignals = 0;
+    mLongLines = 0;
+    file.seek(0);
+    parseFile(file);
+    file.close();
+
+    buildTable();
+    return true;
+  }
+
+  bool isLoaded() {
+    return mMessageCount > 0;
+  }
+
+  uint16_t messageCount() {
+    return mMessageCount;
+  }
+
+  uint16_t signalCount() {
+    return mSignalCount;
+  }
+
+  uint32_t skippedSignals() {
+    return mSkippedSignals;
+  }
+
+  uint32_t longLines() {
+    return mLongLines;
+  }
+
+  uint32_t memoryUsage() {
+    return mMessageCount * sizeof(DbcMessagePlan) + mSignalCount * sizeof(DbcSignalPlan)
+         + mStringSize + (mTable ? (mTableMask + 1) * sizeof(uint16_t) : 0);
+  }
+
+  // 按ID查找报文，没有定义时返回NULL
+  const DbcMessagePlan * find(uint32_t id, bool ext) {
+    if (mTable == NULL) {
+      return NULL;
+    }
+    uint32_t key = ext ? (id | 0x80000000) : id;
+    uint32_t slot = hash(key) & mTableMask;
+    while (mTable[slot] != 0xFFFF) {
+      const DbcMessagePlan & m = mMessages[mTable[slot]];
+      if (m.id == key) {
+        return &m;
+      }
+      slot = (slot + 1) & mTableMask;
+    }
+    return NULL;
+  }
+
+  const DbcSignalPlan & signal(const DbcMessagePlan & message, uint16_t index) {
+    return mSignals[message.firstSignal + index];
+  }
+
+  /**
+   * 按提取计划取出原始值(已做符号扩展)
+   * @param data - 帧数据，从plan.byte开始必须能读取8个字节(WIDE信号9个字节)
+   */
+  static int64_t extract(const DbcSignalPlan & plan, const uint8_t * data) {
+    uint64_t word;
+    uint64_t raw;
+    memcpy(&word, data + plan.byte, sizeof(word));
+    if (plan.flags & DBC_SIGNAL_MOTOROLA) {
+      word = __builtin_bswap64(word);
+      raw = word << plan.shift;
+      if (plan.flags & DBC_SIGNAL_WIDE) {
+        raw |= data[plan.byte + 8] >> (8 - plan.shift);
+      }
+      raw >>= 64 - plan.length;
+    } else {
+      raw = word >> plan.shift;
+      if (plan.flags & DBC_SIGNAL_WIDE) {
+        raw |= (uint64_t)data[plan.byte + 8] << (64 - plan.shift);
+      }
+      raw &= plan.mask;
+    }
+    if ((plan.flags & DBC_SIGNAL_SIGNED) && plan.length < 64) {
+      uint8_t unused = 64 - plan.length;
+      return (int64_t)(raw << unused) >> unused;
+    }
+    return (int64_t)raw;
+  }
+
+  static float physical(const DbcSignalPlan & plan, int64_t raw) {
+    float value = (plan.flags & DBC_SIGNAL_SIGNED) ? (float)raw : (float)(uint64_t)raw;
+    return value * plan.factor + plan.offset;
+  }
+
+  /**
+   * 解码一帧，对每个存在的信号调用callback(const DbcSignalPlan &, float value)
+   * 帧数据不够长的信号和多路复用值不匹配的信号会被跳过
+   * @return 没有该报文的定义时返回NULL
+   */
+  template <typename F>
+  const DbcMessagePlan * decode(const CANFDMessage & msg, F callback) {
+    const DbcMessagePlan * message = find(msg.id, msg.ext);
+    if (message == NULL) {
+      return NULL;
+    }
+
+    const uint8_t * data = msg.data;
+    uint8_t padded[64 + 9];
+    if (message->padded) {
+      memcpy(padded, msg.data, 64);
+      memset(padded + 64, 0, 9);
+      data = padded;
+    }
+
+    const DbcSignalPlan * signals = mSignals + message->firstSignal;
+    int64_t muxValue = DBC_NO_MUX;
+    if (message->multiplexor >= 0) {
+      const DbcSignalPlan & mux = signals[message->multiplexor];
+      if (mux.minLen <= msg.len) {
+        muxValue = extract(mux, data);
+      }
+    }
+
+    for (uint16_t i = 0; i < message->signalCount; i++) {
+      const DbcSignalPlan & plan = signals[i];
+      if (plan.minLen > msg.len) {
+        continue;
+      }
+      if (plan.muxValue != DBC_NO_MUX && plan.muxValue != muxValue) {
+        continue;
+      }
+      callback(plan, physical(plan, extract(plan, data)));
+    }
+    return message;
+  }
+};
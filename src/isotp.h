@@ -0,0 +1,593 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ACAN2517FD.h>
+
+/**
+ * ISO-TP(ISO 15765-2)传输层
+ *
+ * 被动重组：对诊断ID范围内(默认0x7DF-0x7EF和29位的0x18DAxxxx/0x18DBxxxx)的帧，
+ * 把首帧(FF)和连续帧(CF)重组成完整的PDU，单帧(SF)直接输出。
+ * 支持CAN FD的转义长度(SF长度为0时第2字节为长度，FF长度为0时后4字节为长度)和64字节的帧。
+ * 多个ID对可以同时传输，每个发送方ID占用固定缓冲池中的一个会话，超时的会话自动释放。
+ * 转义的首帧只用于超过4095字节的PDU，这样的传输由一个单独的长会话重组(ISOTP_LONG_PDU字节，
+ * 有PSRAM时才分配)，同一时间只能有一个；长会话忙、没有缓冲区或超过ISOTP_LONG_PDU时丢弃并计入overflows。
+ *
+ * 主动收发：通过open()打开一个链路(请求ID/应答ID)，send()发送请求，超过单帧时先发首帧，
+ * 收到流控帧(FC)后按BS/STmin发送连续帧；应答ID上收到首帧时自动回复流控帧。
+ * 发送通过构造时传入的函数完成(放入发送队列，由采集任务调用tryToSend)。
+ *
+ * 所有缓冲区都是固定分配的，运行时不申请内存。只在数据消费任务(loop2)中调用。
+ */
+
+#define ISOTP_SESSIONS        16      // 同时重组的会话数
+#define ISOTP_MAX_PDU         4095    // 普通会话重组的最大PDU长度(不转义的首帧的最大长度)
+#define ISOTP_LONG_PDU        65535   // 长会话重组的最大PDU长度，超过的传输被丢弃
+#define ISOTP_LINKS           8       // 主动收发的链路数
+#define ISOTP_TX_BUFFER       256     // 每个链路发送PDU的最大长度
+#define ISOTP_RANGES          8       // 被动重组的ID范围数
+#define ISOTP_TIMEOUT_MS      1000    // N_Cr/N_Bs：等待连续帧或流控帧的超时
+#define ISOTP_PADDING         0xCC    // 发送帧的填充字节
+
+// PCI类型(第1字节高4位)
+static const uint8_t ISOTP_SINGLE      = 0;
+static const uint8_t ISOTP_FIRST       = 1;
+static const uint8_t ISOTP_CONSECUTIVE = 2;
+static const uint8_t ISOTP_FLOW        = 3;
+
+// 流控状态
+static const uint8_t ISOTP_FLOW_CTS      = 0;
+static const uint8_t ISOTP_FLOW_WAIT     = 1;
+static const uint8_t ISOTP_FLOW_OVERFLOW = 2;
+
+// 链路状态
+typedef enum : uint8_t {
+  ISOTP_LINK_IDLE,        // 空闲，可以发送
+  ISOTP_LINK_WAIT_FC,     // 已发送首帧或一个块，等待流控帧
+  ISOTP_LINK_SENDING,     // 正在发送连续帧
+  ISOTP_LINK_ERROR,       // 对方拒绝或超时，下一次send()时清除
+} isotp_link_state;
+
+// 重组完成的PDU，data在下一次调用onFrame()之前有效
+struct IsoTpPdu {
+  uint32_t id;            // 发送方CAN ID
+  bool ext;
+  bool fd;                // 由CAN FD帧传输
+  int8_t link;            // 属于哪个主动链路的应答，-1表示被动重组
+  uint16_t len;
+  const uint8_t * data;
+};
+
+// 发送一帧CAN数据，发送队列满时返回false
+typedef bool (*isotp_transmit_t)(const CANFDMessage & msg);
+
+// CAN FD帧的数据长度只能是0-8,12,16,20,24,32,48,64
+static inline uint8_t isotp_fd_length(uint8_t len) {
+  static const uint8_t lengths[] = {8, 12, 16, 20, 24, 32, 48, 64};
+  for (uint8_t i = 0; i < sizeof(lengths); i++) {
+    if (len <= lengths[i]) {
+      return lengths[i];
+    }
+  }
+  return 64;
+}
+
+class IsoTp {
+private:
+  struct Session {
+    uint32_t key;         // 发送方ID，扩展帧bit31为1
+    uint32_t lastMs;
+    uint16_t total;
+    uint16_t received;
+    uint8_t nextSn;
+    bool active;
+    bool fd;
+    uint8_t * data;       // ISOTP_MAX_PDU字节(长会话ISOTP_LONG_PDU字节)，begin()中分配
+  };
+
+  struct Range {
+    uint32_t first;       // 扩展帧bit31为1
+    uint32_t last;
+  };
+
+  struct Link {
+    uint32_t txKey;       // 请求ID
+    uint32_t rxKey;       // 应答ID
+    uint32_t lastMs;      // 等待流控帧的开始时间
+    uint32_t nextMs;      // 下一个连续帧的发送时间
+    uint16_t len;
+    uint16_t offset;
+    uint8_t sn;
+    uint8_t blockSize;
+    uint8_t blockLeft;
+    uint8_t stMinMs;
+    isotp_link_state state;
+    bool open;
+    bool fd;
+    uint8_t data[ISOTP_TX_BUFFER];
+  };
+
+  isotp_transmit_t mTransmit;
+  Session mSessions[ISOTP_SESSIONS];
+  Session mLong;              // 转义首帧(超过ISOTP_MAX_PDU)的长会话
+  Link mLinks[ISOTP_LINKS];
+  Range mRanges[ISOTP_RANGES];
+  uint8_t mRangeCount;
+  IsoTpPdu mPdu;
+
+  uint32_t mPdus;             // 输出的PDU数
+  uint32_t mSequenceErrors;   // 连续帧序号错误或格式错误
+  uint32_t mTimeouts;         // 会话或链路超时
+  uint32_t mOverflows;        // PDU太长或没有空闲会话
+  uint32_t mFramesSent;
+
+  static uint32_t keyOf(uint32_t id, bool ext) {
+    return ext ? (id | 0x80000000) : id;
+  }
+
+  bool inRange(uint32_t key) {
+    for (uint8_t i = 0; i < mRangeCount; i++) {
+      if (key >= mRanges[i].first && key <= mRanges[i].last) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int8_t findLink(uint32_t rxKey) {
+    for (uint8_t i = 0; i < ISOTP_LINKS; i++) {
+      if (mLinks[i].open && mLinks[i].rxKey == rxKey) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  Session * findSession(uint32_t key) {
+    for (uint8_t i = 0; i < ISOTP_SESSIONS; i++) {
+      if (mSessions[i].active && mSessions[i].key == key) {
+        return &mSessions[i];
+      }
+    }
+    if (mLong.active && mLong.key == key) {
+      return &mLong;
+    }
+    return NULL;
+  }
+
+  // 分配普通会话：使用空闲的，都没有时替换最久没有数据的
+  Session * allocSession() {
+    Session * oldest = &mSessions[0];
+    for (uint8_t i = 0; i < ISOTP_SESSIONS; i++) {
+      if (!mSessions[i].active) {
+        return &mSessions[i];
+      }
+      if ((int32_t)(mSessions[i].lastMs - oldest->lastMs) < 0) {
+        oldest = &mSessions[i];
+      }
+    }
+    mOverflows++;
+    return oldest;
+  }
+
+  // 准备一帧，payload之后用ISOTP_PADDING填充到合法的长度
+  static void makeFrame(uint32_t txKey, bool fd, CANFDMessage & msg, uint8_t len) {
+    msg.id = txKey & 0x1FFFFFFF;
+    msg.ext = txKey & 0x80000000;
+    if (fd) {
+      msg.type = CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH;
+      msg.len = isotp_fd_length(len);
+    } else {
+      msg.type = CANFDMessage::CAN_DATA;
+      msg.len = 8;
+    }
+    memset(msg.data + len, ISOTP_PADDING, msg.len - len);
+  }
+
+  static void makeFrame(const Link & link, CANFDMessage & msg, uint8_t len) {
+    makeFrame(link.txKey, link.fd, msg, len);
+  }
+
+  bool transmit(const CANFDMessage & msg) {
+    if (mTransmit == NULL || !mTransmit(msg)) {
+      return false;
+    }
+    mFramesSent++;
+    return true;
+  }
+
+  // 回复流控帧：BS=0，STmin=0，对方可以连续发送所有连续帧
+  void sendFlow(Link & link, uint8_t status) {
+    CANFDMessage msg;
+    msg.data[0] = (ISOTP_FLOW << 4) | status;
+    msg.data[1] = 0;
+    msg.data[2] = 0;
+    makeFrame(link, msg, 3);
+    transmit(msg);
+  }
+
+  void onFlow(Link & link, const uint8_t * data, uint32_t now) {
+    if (link.state != ISOTP_LINK_WAIT_FC) {
+      return;
+    }
+    switch (data[0] & 0x0F) {
+      case ISOTP_FLOW_CTS:
+        link.blockSize = data[1];
+        link.blockLeft = data[1];
+        // STmin 0xF1-0xF9是100-900us，按1ms处理；保留值按最大的127ms处理
+        if (data[2] <= 0x7F) {
+          link.stMinMs = data[2];
+        } else if (data[2] >= 0xF1 && data[2] <= 0xF9) {
+          link.stMinMs = 1;
+        } else {
+          link.stMinMs = 0x7F;
+        }
+        link.state = ISOTP_LINK_SENDING;
+        link.nextMs = now;
+        pump(link, now);
+        break;
+      case ISOTP_FLOW_WAIT:
+        link.lastMs = now;
+        break;
+      default:
+        link.state = ISOTP_LINK_ERROR;
+        mOverflows++;
+        break;
+    }
+  }
+
+  // 按STmin和BS发送到期的连续帧，发送队列满时下一次service()再发
+  void pump(Link & link, uint32_t now) {
+    uint8_t payload = link.fd ? 63 : 7;
+    while (link.state == ISOTP_LINK_SENDING && (int32_t)(now - link.nextMs) >= 0) {
+      uint8_t n = min((uint16_t) payload, (uint16_t)(link.len - link.offset));
+      CANFDMessage msg;
+      msg.data[0] = (ISOTP_CONSECUTIVE << 4) | link.sn;
+      memcpy(msg.data + 1, link.data + link.offset, n);
+      makeFrame(link, msg, n + 1);
+      if (!transmit(msg)) {
+        return;
+      }
+      link.offset += n;
+      link.sn = (link.sn + 1) & 0x0F;
+      if (link.offset >= link.len) {
+        link.state = ISOTP_LINK_IDLE;
+      } else if (link.blockSize && --link.blockLeft == 0) {
+        link.state = ISOTP_LINK_WAIT_FC;
+        link.lastMs = now;
+      } else if (link.stMinMs) {
+        link.nextMs = now + link.stMinMs;
+      }
+    }
+  }
+
+  const IsoTpPdu * output(uint32_t key, bool fd, int8_t link, const uint8_t * data, uint16_t len) {
+    mPdu.id = key & 0x1FFFFFFF;
+    mPdu.ext = key & 0x80000000;
+    mPdu.fd = fd;
+    mPdu.link = link;
+    mPdu.len = len;
+    mPdu.data = data;
+    mPdus++;
+    return &mPdu;
+  }
+
+public:
+  IsoTp(isotp_transmit_t transmit) : mTransmit(transmit) {
+    memset(mSessions, 0, sizeof(mSessions));
+    memset(&mLong, 0, sizeof(mLong));
+    memset(mLinks, 0, sizeof(mLinks));
+    mRangeCount = 0;
+    mPdus = 0;
+    mSequenceErrors = 0;
+    mTimeouts = 0;
+    mOverflows = 0;
+    mFramesSent = 0;
+    resetRanges();
+  }
+
+  /**
+   * 设置会话的重组缓冲区，没有设置时多帧传输被丢弃
+   * @param buffer - ISOTP_SESSIONS * ISOTP_MAX_PDU字节
+   * @param longBuffer - 长会话的ISOTP_LONG_PDU字节，为NULL时丢弃转义首帧的传输
+   */
+  void begin(uint8_t * buffer, uint8_t * longBuffer) {
+    for (uint8_t i = 0; i < ISOTP_SESSIONS; i++) {
+      mSessions[i].data = buffer != NULL ? buffer + i * ISOTP_MAX_PDU : NULL;
+    }
+    mLong.data = longBuffer;
+  }
+
+  // 恢复默认的诊断ID范围
+  void resetRanges() {
+    mRangeCount = 0;
+    addRange(0x7DF, 0x7EF, false);
+    addRange(0x18DA0000, 0x18DBFFFF, true);
+  }
+
+  // 增加一个被动重组的ID范围
+  bool addRange(uint32_t first, uint32_t last, bool ext) {
+    if (mRangeCount >= ISOTP_RANGES || first > last) {
+      return false;
+    }
+    mRanges[mRangeCount].first = keyOf(first, ext);
+    mRanges[mRangeCount].last = keyOf(last, ext);
+    mRangeCount++;
+    return true;
+  }
+
+  /**
+   * 打开一个主动收发链路，应答ID上的帧总会被重组
+   * @param txId - 请求ID(物理寻址或功能寻址)
+   * @param rxId - 应答ID
+   * @param fd - 使用CAN FD帧发送
+   * @return 链路序号，没有空闲链路时返回-1
+   */
+  int8_t open(uint32_t txId, uint32_t rxId, bool ext, bool fd = false) {
+    uint32_t rxKey = keyOf(rxId, ext);
+    int8_t index = findLink(rxKey);
+    for (uint8_t i = 0; index < 0 && i < ISOTP_LINKS; i++) {
+      if (!mLinks[i].open) {
+        index = i;
+      }
+    }
+    if (index < 0) {
+      return -1;
+    }
+    Link & link = mLinks[index];
+    link.txKey = keyOf(txId, ext);
+    link.rxKey = rxKey;
+    link.fd = fd;
+    link.state = ISOTP_LINK_IDLE;
+    link.open = true;
+    return index;
+  }
+
+  void close(int8_t index) {
+    if (index >= 0 && index < ISOTP_LINKS) {
+      mLinks[index].open = false;
+    }
+  }
+
+  isotp_link_state linkState(int8_t index) {
+    return mLinks[index].state;
+  }
+
+  /**
+   * 在链路上发送一个PDU
+   * 单帧直接发送；多帧时发送首帧后等待流控帧，连续帧在onFrame()/service()中发送
+   * @return 链路正在发送、PDU太长或发送队列满时返回false
+   */
+  bool send(int8_t index, const uint8_t * data, uint16_t len, uint32_t now) {
+    if (index < 0 || index >= ISOTP_LINKS || !mLinks[index].open) {
+      return false;
+    }
+    Link & link = mLinks[index];
+    if (link.state == ISOTP_LINK_WAIT_FC || link.state == ISOTP_LINK_SENDING
+        || len == 0 || len > ISOTP_TX_BUFFER) {
+      return false;
+    }
+
+    CANFDMessage msg;
+    if (len <= 7) {
+      msg.data[0] = (ISOTP_SINGLE << 4) | len;
+      memcpy(msg.data + 1, data, len);
+      makeFrame(link, msg, len + 1);
+      if (!transmit(msg)) {
+        return false;
+      }
+      link.state = ISOTP_LINK_IDLE;
+      return true;
+    }
+    if (link.fd && len <= 62) {
+      msg.data[0] = ISOTP_SINGLE << 4;
+      msg.data[1] = len;
+      memcpy(msg.data + 2, data, len);
+      makeFrame(link, msg, len + 2);
+      if (!transmit(msg)) {
+        return false;
+      }
+      link.state = ISOTP_LINK_IDLE;
+      return true;
+    }
+
+    uint8_t first = link.fd ? 62 : 6;
+    msg.data[0] = (ISOTP_FIRST << 4) | (len >> 8);
+    msg.data[1] = len & 0xFF;
+    memcpy(msg.data + 2, data, first);
+    makeFrame(link, msg, first + 2);
+    if (!transmit(msg)) {
+      return false;
+    }
+    memcpy(link.data, data, len);
+    link.len = len;
+    link.offset = first;
+    link.sn = 1;
+    link.state = ISOTP_LINK_WAIT_FC;
+    link.lastMs = now;
+    return true;
+  }
+
+  /**
+   * 不经过链路直接发送一个单帧，用于功能寻址的请求(例如OBD的0x7DF)
+   * @return PDU超过单帧长度或发送队列满时返回false
+   */
+  bool sendSingle(uint32_t id, bool ext, const uint8_t * data, uint8_t len) {
+    if (len == 0 || len > 7) {
+      return false;
+    }
+    CANFDMessage msg;
+    msg.data[0] = (ISOTP_SINGLE << 4) | len;
+    memcpy(msg.data + 1, data, len);
+    makeFrame(keyOf(id, ext), false, msg, len + 1);
+    return transmit(msg);
+  }
+
+  /**
+   * 处理收到的一帧CAN数据
+   * @return 完成一个PDU时返回该PDU，否则返回NULL
+   */
+  const IsoTpPdu * onFrame(const CANFDMessage & msg, uint32_t now) {
+    if (msg.type == CANFDMessage::CAN_REMOTE || msg.len == 0) {
+      return NULL;
+    }
+    uint32_t key = keyOf(msg.id, msg.ext);
+    int8_t linkIndex = findLink(key);
+    if (linkIndex < 0 && !inRange(key)) {
+      return NULL;
+    }
+    const uint8_t * data = msg.data;
+    bool fd = msg.type == CANFDMessage::CANFD_NO_BIT_RATE_SWITCH
+           || msg.type == CANFDMessage::CANFD_WITH_BIT_RATE_SWITCH;
+
+    switch (data[0] >> 4) {
+      case ISOTP_SINGLE: {
+        uint16_t len = data[0] & 0x0F;
+        uint8_t head = 1;
+        if (len == 0 && msg.len > 8) {
+          len = data[1];
+          head = 2;
+        }
+        if (len == 0 || head + len > msg.len) {
+          mSequenceErrors++;
+          return NULL;
+        }
+        return output(key, fd, linkIndex, data + head, len);
+      }
+
+      case ISOTP_FIRST: {
+        if (msg.len < 8) {
+          mSequenceErrors++;
+          return NULL;
+        }
+        uint32_t total = ((data[0] & 0x0F) << 8) | data[1];
+        uint8_t head = 2;
+        if (total == 0) {
+          total = ((uint32_t) data[2] << 24) | ((uint32_t) data[3] << 16) | ((uint32_t) data[4] << 8) | data[5];
+          head = 6;
+        }
+        // ISO 15765-2：能用单帧发送的长度(经典帧<=7，FD帧<=TX_DL-2)和不需要转义的长度不能用首帧，忽略这样的首帧
+        uint32_t minimum = msg.len > 8 ? msg.len - 1 : 8;
+        if (total < minimum || (head == 6 && total <= 0xFFF)) {
+          mSequenceErrors++;
+          return NULL;
+        }
+        // 转义的首帧由长会话重组，长会话正在接收其他发送方的传输时丢弃
+        bool escaped = total > ISOTP_MAX_PDU;
+        bool tooLong = escaped
+                     ? total > ISOTP_LONG_PDU || mLong.data == NULL || (mLong.active && mLong.key != key)
+                     : mSessions[0].data == NULL;
+        if (linkIndex >= 0) {
+          sendFlow(mLinks[linkIndex], tooLong ? ISOTP_FLOW_OVERFLOW : ISOTP_FLOW_CTS);
+        }
+        if (tooLong) {
+          mOverflows++;
+          return NULL;
+        }
+        Session * session = findSession(key);
+        if (session != NULL) {
+          // 同一发送方重新开始传输
+          session->active = false;
+          mSequenceErrors++;
+        }
+        session = escaped ? &mLong : allocSession();
+        uint16_t n = min((uint32_t)(msg.len - head), total);
+        memcpy(session->data, data + head, n);
+        session->key = key;
+        session->total = total;
+        session->received = n;
+        session->nextSn = 1;
+        session->fd = fd;
+        session->lastMs = now;
+        session->active = true;
+        return NULL;
+      }
+
+      case ISOTP_CONSECUTIVE: {
+        Session * session = findSession(key);
+        if (session == NULL) {
+          return NULL;
+        }
+        if ((data[0] & 0x0F) != session->nextSn) {
+          session->active = false;
+          mSequenceErrors++;
+          return NULL;
+        }
+        uint16_t n = min((uint16_t)(msg.len - 1), (uint16_t)(session->total - session->received));
+        memcpy(session->data + session->received, data + 1, n);
+        session->received += n;
+        session->nextSn = (session->nextSn + 1) & 0x0F;
+        session->lastMs = now;
+        if (session->received < session->total) {
+          return NULL;
+        }
+        session->active = false;
+        return output(key, session->fd, linkIndex, session->data, session->total);
+      }
+
+      case ISOTP_FLOW:
+        if (linkIndex >= 0) {
+          onFlow(mLinks[linkIndex], data, now);
+        }
+        return NULL;
+
+      default:
+        return NULL;
+    }
+  }
+
+  // 周期调用：释放超时的会话，发送到期的连续帧，检查流控帧超时
+  void service(uint32_t now) {
+    for (uint8_t i = 0; i < ISOTP_SESSIONS; i++) {
+      Session & session = mSessions[i];
+      if (session.active && now - session.lastMs > ISOTP_TIMEOUT_MS) {
+        session.active = false;
+        mTimeouts++;
+      }
+    }
+    if (mLong.active && now - mLong.lastMs > ISOTP_TIMEOUT_MS) {
+      mLong.active = false;
+      mTimeouts++;
+    }
+    for (uint8_t i = 0; i < ISOTP_LINKS; i++) {
+      Link & link = mLinks[i];
+      if (!link.open) {
+        continue;
+      }
+      if (link.state == ISOTP_LINK_SENDING) {
+        pump(link, now);
+      } else if (link.state == ISOTP_LINK_WAIT_FC && now - link.lastMs > ISOTP_TIMEOUT_MS) {
+        link.state = ISOTP_LINK_ERROR;
+        mTimeouts++;
+      }
+    }
+  }
+
+  uint8_t activeSessions() {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < ISOTP_SESSIONS; i++) {
+      n += mSessions[i].active;
+    }
+    return n + mLong.active;
+  }
+
+  uint32_t pdus() {
+    return mPdus;
+  }
+
+  uint32_t sequenceErrors() {
+    return mSequenceErrors;
+  }
+
+  uint32_t timeouts() {
+    return mTimeouts;
+  }
+
+  uint32_t overflows() {
+    return mOverflows;
+  }
+
+  uint32_t framesSent() {
+    return mFramesSent;
+  }
+};
@@ -0,0 +1,689 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include "dbc_decoder.h"
+#include "lin_frame.h"
+
+/**
+ * LDF(LIN描述文件)解析和LIN信号解码
+ *
+ * 从TF卡加载LDF文件，取出帧ID、长度、发布节点、校验和模型、信号布局、编码(比例/偏移/单位)和调度表。
+ * LIN信号都是Intel位序，加载时用DbcDecoder::compile编译成与DBC相同的提取计划，
+ * 解码时直接使用DbcDecoder::extract/physical。
+ *
+ * 帧长度和校验和模型提供给LinFrameParser，调度表提供给LinScheduler。
+ * 加载和解码都在数据消费任务中进行。
+ */
+
+#define LDF_MAX_FILE_SIZE   (256 * 1024)   // 超过这个大小的文件不加载
+#define LDF_TOKEN_LEN       64
+#define LDF_MAX_VALUES      6              // 一条语句最多读取的值
+#define LDF_NO_FRAME        0xFF
+
+// 一个LIN帧
+struct LdfFrame {
+  const char * name;
+  uint16_t firstSignal;   // 在信号表中的开始位置
+  uint8_t signalCount;
+  uint8_t id;             // 帧ID 0...63
+  uint8_t length;         // 数据长度
+  uint8_t checksum;       // LIN_CHECKSUM_CLASSIC / LIN_CHECKSUM_ENHANCED
+  bool fromMaster;        // 由主节点发布
+};
+
+// 调度表中的一个时隙
+struct LdfScheduleEntry {
+  uint16_t delayMs;       // 时隙长度
+  uint8_t id;             // 帧ID
+  bool fromMaster;        // 由主节点发布(帧头之后需要主节点发送数据)
+};
+
+struct LdfSchedule {
+  const char * name;
+  uint16_t firstEntry;
+  uint16_t entryCount;
+};
+
+class LdfDatabase {
+private:
+  // 信号定义(Signals段)，编码在Signal_representation段中指定
+  struct SignalDef {
+    const char * name;
+    uint8_t size;
+    int16_t encoding;
+  };
+
+  struct Encoding {
+    const char * name;
+    const char * unit;
+    float factor;
+    float offset;
+  };
+
+  // 解析状态
+  const char * mText;
+  size_t mTextLen;
+  size_t mPos;
+  char mToken[LDF_TOKEN_LEN];
+  bool mQuoted;                 // 当前token是字符串
+  char mMaster[LDF_TOKEN_LEN];  // 主节点名称
+  bool mEnhanced;               // LIN 2.x使用增强校验和
+
+  SignalDef * mDefs;
+  Encoding * mEncodings;
+  LdfFrame * mFrames;
+  DbcSignalPlan * mSignals;
+  LdfSchedule * mSchedules;
+  LdfScheduleEntry * mEntries;
+  char * mStrings;
+  uint16_t mDefCount;
+  uint16_t mEncodingCount;
+  uint16_t mFrameCount;
+  uint16_t mSignalCount;
+  uint16_t mScheduleCount;
+  uint16_t mEntryCount;
+  uint32_t mStringSize;
+  uint32_t mStringUsed;
+  uint32_t mSkipped;            // 无法解析的信号或调度时隙
+  uint32_t mBaud;
+  uint8_t mIndex[LIN_FRAME_IDS];   // 帧ID -> 帧序号
+
+  // 复制字符串到字符串池，统计阶段只计算长度
+  const char * store(const char * text) {
+    size_t len = strlen(text) + 1;
+    if (mStrings == NULL) {
+      mStringSize += len;
+      return NULL;
+    }
+    if (mStringUsed + len > mStringSize) {
+      return "";
+    }
+    char * p = mStrings + mStringUsed;
+    memcpy(p, text, len);
+    mStringUsed += len;
+    return p;
+  }
+
+  static bool isPunct(char c) {
+    return c == '{' || c == '}' || c == ':' || c == ';' || c == ',' || c == '=';
+  }
+
+  // 读取下一个token，跳过注释；标点符号单独作为一个token
+  bool next() {
+    mQuoted = false;
+    while (mPos < mTextLen) {
+      char c = mText[mPos];
+      if (c == '/' && mPos + 1 < mTextLen && mText[mPos + 1] == '/') {
+        while (mPos < mTextLen && mText[mPos] != '\n') {
+          mPos++;
+        }
+      } else if (c == '/' && mPos + 1 < mTextLen && mText[mPos + 1] == '*') {
+        mPos += 2;
+        while (mPos + 1 < mTextLen && !(mText[mPos] == '*' && mText[mPos + 1] == '/')) {
+          mPos++;
+        }
+        mPos += 2;
+      } else if (isspace((unsigned char) c)) {
+        mPos++;
+      } else {
+        break;
+      }
+    }
+    if (mPos >= mTextLen) {
+      mToken[0] = 0;
+      return false;
+    }
+
+    size_t n = 0;
+    char c = mText[mPos];
+    if (isPunct(c)) {
+      mToken[n++] = c;
+      mPos++;
+    } else if (c == '"') {
+      mQuoted = true;
+      mPos++;
+      while (mPos < mTextLen && mText[mPos] != '"') {
+        if (n + 1 < sizeof(mToken)) {
+          mToken[n++] = mText[mPos];
+        }
+        mPos++;
+      }
+      mPos++;
+    } else {
+      while (mPos < mTextLen && !isspace((unsigned char) mText[mPos]) && !isPunct(mText[mPos])
+             && mText[mPos] != '"') {
+        if (n + 1 < sizeof(mToken)) {
+          mToken[n++] = mText[mPos];
+        }
+        mPos++;
+      }
+    }
+    mToken[n] = 0;
+    return true;
+  }
+
+  bool is(char c) {
+    return !mQuoted && mToken[0] == c && mToken[1] == 0;
+  }
+
+  bool expect(char c) {
+    return next() && is(c);
+  }
+
+  // '{'已经读取，跳过到对应的'}'
+  void skipBlock() {
+    int depth = 1;
+    while (depth > 0 && next()) {
+      if (is('{')) {
+        depth++;
+      } else if (is('}')) {
+        depth--;
+      }
+    }
+  }
+
+  /**
+   * 读取到';'为止的所有值，忽略','和'{}'(信号的数组初值)
+   * @return 值的数量，超过LDF_MAX_VALUES的部分只计数
+   */
+  uint8_t readValues(char values[][LDF_TOKEN_LEN]) {
+    uint8_t n = 0;
+    while (next() && !is(';')) {
+      if (!mQuoted && (is(',') || is('{') || is('}'))) {
+        continue;
+      }
+      if (n < LDF_MAX_VALUES) {
+        strcpy(values[n], mToken);
+      }
+      n++;
+    }
+    return n;
+  }
+
+  // "Master: name, 5 ms, 0.1 ms; Slaves: ...;"
+  void parseNodes() {
+    while (next() && !is('}')) {
+      bool master = strcmp(mToken, "Master") == 0;
+      if (!expect(':')) {
+        return;
+      }
+      char values[LDF_MAX_VALUES][LDF_TOKEN_LEN];
+      uint8_t n = readValues(values);
+      if (master && n > 0) {
+        strcpy(mMaster, values[0]);
+      }
+    }
+  }
+
+  // "name: size, init, publisher, subscribers;"
+  void parseSignals() {
+    while (next() && !is('}')) {
+      const char * name = store(mToken);
+      if (!expect(':')) {
+        return;
+      }
+      char values[LDF_MAX_VALUES][LDF_TOKEN_LEN];
+      if (readValues(values) == 0) {
+        continue;
+      }
+      if (mDefs) {
+        SignalDef & def = mDefs[mDefCount];
+        def.name = name;
+        def.size = atoi(values[0]);
+        def.encoding = -1;
+      }
+      mDefCount++;
+    }
+  }
+
+  SignalDef * findDef(const char * name) {
+    for (uint16_t i = 0; mDefs && i < mDefCount; i++) {
+      if (strcmp(mDefs[i].name, name) == 0) {
+        return &mDefs[i];
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * Frames段:            "name: id, publisher, length { signal, offset; ... }"
+   * Diagnostic_frames段: "name: id { signal, offset; ... }"
+   */
+  void parseFrames(bool diagnostic) {
+    while (next() && !is('}')) {
+      const char * name = store(mToken);
+      if (!expect(':') || !next()) {
+        return;
+      }
+      uint8_t id = strtoul(mToken, NULL, 0) & 0x3F;
+      bool fromMaster = id == 0x3C;
+      uint8_t length = 8;
+      if (!diagnostic) {
+        char publisher[LDF_TOKEN_LEN];
+        if (!expect(',') || !next()) {
+          return;
+        }
+        strcpy(publisher, mToken);
+        fromMaster = strcmp(publisher, mMaster) == 0;
+        if (!expect(',') || !next()) {
+          return;
+        }
+        length = atoi(mToken);
+      }
+      if (!expect('{')) {
+        return;
+      }
+
+      LdfFrame * frame = mFrames ? &mFrames[mFrameCount] : NULL;
+      if (frame) {
+        frame->name = name;
+        frame->id = id;
+        frame->length = min(length, (uint8_t) LIN_MAX_DATA);
+        // 诊断帧总是使用经典校验和
+        frame->checksum = (mEnhanced && id < 0x3C) ? LIN_CHECKSUM_ENHANCED : LIN_CHECKSUM_CLASSIC;
+        frame->fromMaster = fromMaster;
+        frame->firstSignal = mSignalCount;
+        frame->signalCount = 0;
+      }
+
+      while (next() && !is('}')) {
+        char signal[LDF_TOKEN_LEN];
+        strcpy(signal, mToken);
+        if (!expect(',') || !next()) {
+          return;
+        }
+        uint16_t offset = atoi(mToken);
+        if (!expect(';')) {
+          return;
+        }
+        if (frame == NULL) {
+          mSignalCount++;
+          continue;
+        }
+        SignalDef * def = findDef(signal);
+        DbcSignalPlan plan;
+        if (def == NULL || offset + def->size > LIN_MAX_DATA * 8
+            || !DbcDecoder::compile(plan, offset, def->size, false, false)) {
+          mSkipped++;
+          continue;
+        }
+        plan.name = def->name;
+        plan.unit = "";
+        plan.factor = 1;
+        plan.offset = 0;
+        plan.muxValue = DBC_NO_MUX;
+        mSignals[mSignalCount++] = plan;
+        frame->signalCount++;
+      }
+      mFrameCount++;
+    }
+  }
+
+  // "name { logical_value, ...; physical_value, min, max, scale, offset, "unit"; }"
+  void parseEncodings() {
+    while (next() && !is('}')) {
+      const char * name = store(mToken);
+      if (!expect('{')) {
+        return;
+      }
+      Encoding encoding = { name, NULL, 1, 0 };
+      bool physical = false;
+      while (next() && !is('}')) {
+        bool isPhysical = strcmp(mToken, "physical_value") == 0;
+        char values[LDF_MAX_VALUES][LDF_TOKEN_LEN];
+        uint8_t n = readValues(values);
+        // 只使用第一个物理值范围
+        if (isPhysical && !physical && n >= 4) {
+          physical = true;
+          encoding.factor = atof(values[2]);
+          encoding.offset = atof(values[3]);
+          encoding.unit = store(n >= 5 ? values[4] : "");
+        }
+      }
+      if (encoding.unit == NULL) {
+        encoding.unit = store("");
+      }
+      if (mEncodings) {
+        mEncodings[mEncodingCount] = encoding;
+      }
+      mEncodingCount++;
+    }
+  }
+
+  // "encoding: signal, signal, ...;"
+  void parseRepresentation() {
+    while (next() && !is('}')) {
+      int16_t encoding = -1;
+      for (uint16_t i = 0; mEncodings && i < mEncodingCount; i++) {
+        if (strcmp(mEncodings[i].name, mToken) == 0) {
+          encoding = i;
+          break;
+        }
+      }
+      if (!expect(':')) {
+        return;
+      }
+      while (next() && !is(';')) {
+        if (is(',')) {
+          continue;
+        }
+        SignalDef * def = findDef(mToken);
+        if (def) {
+          def->encoding = encoding;
+        }
+      }
+    }
+  }
+
+  const LdfFrame * findFrame(const char * name) {
+    for (uint16_t i = 0; mFrames && i < mFrameCount; i++) {
+      if (strcmp(mFrames[i].name, name) == 0) {
+        return &mFrames[i];
+      }
+    }
+    return NULL;
+  }
+
+  // "name { frame delay 10 ms; command { ... } delay 10 ms; }"
+  void parseSchedules() {
+    while (next() && !is('}')) {
+      const char * name = store(mToken);
+      if (!expect('{')) {
+        return;
+      }
+      if (mSchedules) {
+        LdfSchedule & schedule = mSchedules[mScheduleCount];
+        schedule.name = name;
+        schedule.firstEntry = mEntryCount;
+        schedule.entryCount = 0;
+      }
+
+      while (next() && !is('}')) {
+        char command[LDF_TOKEN_LEN];
+        strcpy(command, mToken);
+        if (!next()) {
+          return;
+        }
+        // 诊断命令(AssignNAD等)带参数块
+        bool isCommand = is('{');
+        if (isCommand) {
+          skipBlock();
+          next();
+        }
+        if (strcmp(mToken, "delay") != 0 || !next()) {
+          while (!is(';') && next()) {
+          }
+          continue;
+        }
+        uint16_t delay = atof(mToken);
+        while (next() && !is(';')) {
+        }
+        if (mSchedules == NULL) {
+          mEntryCount++;
+          continue;
+        }
+        const LdfFrame * frame = isCommand ? NULL : findFrame(command);
+        if (frame == NULL) {
+          mSkipped++;
+          continue;
+        }
+        LdfScheduleEntry & entry = mEntries[mEntryCount++];
+        entry.id = frame->id;
+        entry.delayMs = delay;
+        entry.fromMaster = frame->fromMaster;
+        mSchedules[mScheduleCount].entryCount++;
+      }
+      mScheduleCount++;
+    }
+  }
+
+  // 解析整个文件；数组为NULL时只统计数量和字符串长度
+  void parse() {
+    mPos = 0;
+    mMaster[0] = 0;
+    mEnhanced = true;
+    while (next()) {
+      char key[LDF_TOKEN_LEN];
+      strcpy(key, mToken);
+      if (!next()) {
+        break;
+      }
+      if (is('=')) {
+        char values[LDF_MAX_VALUES][LDF_TOKEN_LEN];
+        if (readValues(values) == 0) {
+          continue;
+        }
+        if (strcmp(key, "LIN_protocol_version") == 0) {
+          mEnhanced = values[0][0] != '1';
+        } else if (strcmp(key, "LIN_speed") == 0) {
+          mBaud = atof(values[0]) * 1000;
+        }
+      } else if (is('{')) {
+        if (strcmp(key, "Nodes") == 0) {
+          parseNodes();
+        } else if (strcmp(key, "Signals") == 0 || strcmp(key, "Diagnostic_signals") == 0) {
+          parseSignals();
+        } else if (strcmp(key, "Frames") == 0) {
+          parseFrames(false);
+        } else if (strcmp(key, "Diagnostic_frames") == 0) {
+          parseFrames(true);
+        } else if (strcmp(key, "Schedule_tables") == 0) {
+          parseSchedules();
+        } else if (strcmp(key, "Signal_encoding_types") == 0) {
+          parseEncodings();
+        } else if (strcmp(key, "Signal_representation") == 0) {
+          parseRepresentation();
+        } else {
+          skipBlock();
+        }
+      }
+    }
+  }
+
+  // 把编码的比例/偏移/单位填入信号的提取计划，建立帧ID索引
+  void link() {
+    for (uint16_t i = 0; i < mSignalCount; i++) {
+      SignalDef * def = findDef(mSignals[i].name);
+      if (def && def->encoding >= 0) {
+        const Encoding & encoding = mEncodings[def->encoding];
+        mSignals[i].factor = encoding.factor;
+        mSignals[i].offset = encoding.offset;
+        mSignals[i].unit = encoding.unit;
+      }
+    }
+    memset(mIndex, LDF_NO_FRAME, sizeof(mIndex));
+    for (uint16_t i = 0; i < mFrameCount && i < LDF_NO_FRAME; i++) {
+      if (mIndex[mFrames[i].id] == LDF_NO_FRAME) {
+        mIndex[mFrames[i].id] = i;
+      }
+    }
+  }
+
+public:
+  LdfDatabase() {
+    mDefs = NULL;
+    mEncodings = NULL;
+    mFrames = NULL;
+    mSignals = NULL;
+    mSchedules = NULL;
+    mEntries = NULL;
+    mStrings = NULL;
+    clear();
+  }
+
+  ~LdfDatabase() {
+    clear();
+  }
+
+  // 释放已加载的LDF
+  void clear() {
+    delete [] mDefs;
+    delete [] mEncodings;
+    delete [] mFrames;
+    delete [] mSignals;
+    delete [] mSchedules;
+    delete [] mEntries;
+    delete [] mStrings;
+    mDefs = NULL;
+    mEncodings = NULL;
+    mFrames = NULL;
+    mSignals = NULL;
+    mSchedules = NULL;
+    mEntries = NULL;
+    mStrings = NULL;
+    mText = NULL;
+    mTextLen = 0;
+    mDefCount = 0;
+    mEncodingCount = 0;
+    mFrameCount = 0;
+    mSignalCount = 0;
+    mScheduleCount = 0;
+    mEntryCount = 0;
+    mStringSize = 0;
+    mStringUsed = 0;
+    mSkipped = 0;
+    mBaud = 0;
+    memset(mIndex, LDF_NO_FRAME, sizeof(mIndex));
+  }
+
+  /**
+   * 从文件系统加载LDF文件
+   * 文件整个读入内存，先解析一遍统计数量和字符串长度，一次性分配后再解析一遍填充
+   * @return 打开文件失败、文件太大或没有帧定义时返回false
+   */
+  bool load(fs::FS & fs, const char * path) {
+    clear();
+    File file = fs.open(path);
+    if (!file) {
+      return false;
+    }
+    size_t size = file.size();
+    if (size == 0 || size > LDF_MAX_FILE_SIZE) {
+      file.close();
+      return false;
+    }
+    char * text = new char[size];
+    size = file.read((uint8_t *) text, size);
+    file.close();
+    mText = text;
+    mTextLen = size;
+
+    parse();
+    if (mFrameCount == 0) {
+      delete [] text;
+      clear();
+      return false;
+    }
+    mDefs = new SignalDef[mDefCount > 0 ? mDefCount : 1];
+    mEncodings = new Encoding[mEncodingCount > 0 ? mEncodingCount : 1];
+    mFrames = new LdfFrame[mFrameCount];
+    mSignals = new DbcSignalPlan[mSignalCount > 0 ? mSignalCount : 1];
+    mSchedules = new LdfSchedule[mScheduleCount > 0 ? mScheduleCount : 1];
+    mEntries = new LdfScheduleEntry[mEntryCount > 0 ? mEntryCount : 1];
+    mStrings = new char[mStringSize];
+    mDefCount = 0;
+    mEncodingCount = 0;
+    mFrameCount = 0;
+    mSignalCount = 0;
+    mScheduleCount = 0;
+    mEntryCount = 0;
+    mSkipped = 0;
+    parse();
+
+    delete [] text;
+    mText = NULL;
+    mTextLen = 0;
+    link();
+    return true;
+  }
+
+  bool isLoaded() {
+    return mFrameCount > 0;
+  }
+
+  uint16_t frameCount() {
+    return mFrameCount;
+  }
+
+  uint16_t signalCount() {
+    return mSignalCount;
+  }
+
+  uint16_t scheduleCount() {
+    return mScheduleCount;
+  }
+
+  uint32_t skipped() {
+    return mSkipped;
+  }
+
+  // LDF中的LIN_speed，没有定义时为0
+  uint32_t baud() {
+    return mBaud;
+  }
+
+  // 按帧ID查找，没有定义时返回NULL
+  const LdfFrame * find(uint8_t id) {
+    uint8_t index = mIndex[id & 0x3F];
+    return index == LDF_NO_FRAME ? NULL : &mFrames[index];
+  }
+
+  /**
+   * 输出每个帧ID的数据长度和校验和模型，用于LinFrameParser::setFrameTable
+   * 没有定义的ID长度为0
+   */
+  void frameTable(uint8_t lengths[LIN_FRAME_IDS], uint8_t checksums[LIN_FRAME_IDS]) {
+    for (uint8_t id = 0; id < LIN_FRAME_IDS; id++) {
+      const LdfFrame * frame = find(id);
+      lengths[id] = frame ? frame->length : 0;
+      checksums[id] = frame ? frame->checksum : LIN_CHECKSUM_UNKNOWN;
+    }
+  }
+
+  const LdfSchedule * schedule(uint16_t index) {
+    return index < mScheduleCount ? &mSchedules[index] : NULL;
+  }
+
+  // 按名称查找调度表
+  const LdfSchedule * schedule(const char * name) {
+    for (uint16_t i = 0; i < mScheduleCount; i++) {
+      if (strcmp(mSchedules[i].name, name) == 0) {
+        return &mSchedules[i];
+      }
+    }
+    return NULL;
+  }
+
+  const LdfScheduleEntry * entries(const LdfSchedule & schedule) {
+    return mEntries + schedule.firstEntry;
+  }
+
+  /**
+   * 解码一帧LIN数据，对每个信号调用callback(const DbcSignalPlan &, float value)
+   * 数据不够长的信号会被跳过
+   * @return 没有该帧的定义时返回NULL
+   */
+  template <typename F>
+  const LdfFrame * decode(uint8_t id, const uint8_t * data, uint8_t len, F callback) {
+    const LdfFrame * frame = find(id);
+    if (frame == NULL) {
+      return NULL;
+    }
+    // 提取计划总是读取8(9)个字节，复制到补零的缓冲区
+    uint8_t padded[LIN_MAX_DATA + 9];
+    len = min(len, (uint8_t) LIN_MAX_DATA);
+    memcpy(padded, data, len);
+    memset(padded + len, 0, sizeof(padded) - len);
+
+    const DbcSignalPlan * signals = mSignals + frame->firstSignal;
+    for (uint8_t i = 0; i < frame->signalCount; i++) {
+      const DbcSignalPlan & plan = signals[i];
+      if (plan.minLen > len) {
+        continue;
+      }
+      callback(plan, DbcDecoder::physical(plan, DbcDecoder::extract(plan, padded)));
+    }
+    return frame;
+  }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * LIN帧解析
+ *
+ * 以前采集任务每次从串口读8个字节作为一帧，帧边界完全靠运气。
+ * LinFrameParser按字节解析：break(串口收到0x00)、SYNC(0x55)、PID、数据、校验和。
+ * 帧长度和校验和模型来自LDF(LinFrameParser::setFrameTable)，没有LDF的帧按字节间隔超时结束，
+ * 校验和同时尝试经典和增强两种模型。
+ *
+ * 输出的帧格式与lin_locate_frame()兼容：[0x55, PID, 数据..., 校验和]
+ */
+
+#define LIN_MAX_DATA        8
+#define LIN_FRAME_IDS       64
+#define LIN_RAW_MAX         (2 + LIN_MAX_DATA + 1)
+
+// 校验和模型
+static const uint8_t LIN_CHECKSUM_UNKNOWN  = 0;
+static const uint8_t LIN_CHECKSUM_CLASSIC  = 1;   // LIN 1.x以及诊断帧：只计算数据
+static const uint8_t LIN_CHECKSUM_ENHANCED = 2;   // LIN 2.x：数据和PID一起计算
+
+// 帧状态
+static const uint8_t LIN_FRAME_PARITY_OK   = 1 << 0;
+static const uint8_t LIN_FRAME_CHECKSUM_OK = 1 << 1;
+static const uint8_t LIN_FRAME_ENHANCED    = 1 << 2;  // 校验和为增强模型
+static const uint8_t LIN_FRAME_TIMEOUT     = 1 << 3;  // 长度未知，按超时结束
+
+struct LinFrame {
+  uint8_t raw[LIN_RAW_MAX];   // [0x55, PID, 数据..., 校验和]
+  uint8_t rawLen;
+  uint8_t id;                 // 帧ID 0...63
+  uint8_t status;             // LIN_FRAME_xxx
+};
+
+// 由6位帧ID计算带奇偶校验位的PID
+static inline uint8_t lin_pid(uint8_t id) {
+  id &= 0x3F;
+  uint8_t p0 = ((id >> 0) ^ (id >> 1) ^ (id >> 2) ^ (id >> 4)) & 1;
+  uint8_t p1 = ~((id >> 1) ^ (id >> 3) ^ (id >> 4) ^ (id >> 5)) & 1;
+  return id | (p0 << 6) | (p1 << 7);
+}
+
+/**
+ * 计算LIN校验和：带进位的8位累加后取反
+ * @param pid - 增强模型时参与计算的PID，经典模型传0
+ */
+static inline uint8_t lin_checksum(uint8_t pid, const uint8_t * data, uint8_t len) {
+  uint16_t sum = pid;
+  for (uint8_t i = 0; i < len; i++) {
+    sum += data[i];
+    if (sum > 0xFF) {
+      sum -= 0xFF;
+    }
+  }
+  return ~sum & 0xFF;
+}
+
+class LinFrameParser {
+private:
+  enum State { WAIT_SYNC, WAIT_PID, DATA };
+
+  uint8_t mLength[LIN_FRAME_IDS];     // 每个ID的数据长度，0为未知
+  uint8_t mChecksum[LIN_FRAME_IDS];   // 每个ID的校验和模型
+  uint8_t mPendingLength[LIN_FRAME_IDS];
+  uint8_t mPendingChecksum[LIN_FRAME_IDS];
+  volatile bool mPending;             // 数据消费任务提交了新的帧表
+  portMUX_TYPE mMux;
+
+  State mState;
+  LinFrame mFrame;
+  uint8_t mExpected;                  // 期望的数据长度，0为未知
+  uint32_t mLastByteUs;
+  uint32_t mTimeoutUs;                // 字节间隔超过这个时间认为帧结束
+  uint32_t mFrames;
+  uint32_t mErrors;
+
+  // 在帧开始时应用新的帧表，不会打断正在解析的帧
+  void applyPending() {
+    if (!mPending) {
+      return;
+    }
+    portENTER_CRITICAL(&mMux);
+    memcpy(mLength, mPendingLength, sizeof(mLength));
+    memcpy(mChecksum, mPendingChecksum, sizeof(mChecksum));
+    mPending = false;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  // 校验收到的帧并输出，数据为空的帧(只有帧头，没有应答)不输出
+  bool finish(LinFrame & out, bool timeout) {
+    mState = WAIT_SYNC;
+    uint8_t dataLen = mFrame.rawLen - 3;   // 去掉SYNC、PID和校验和
+    if (mFrame.rawLen < 4) {
+      return false;
+    }
+    const uint8_t * data = mFrame.raw + 2;
+    uint8_t checksum = mFrame.raw[mFrame.rawLen - 1];
+    uint8_t pid = mFrame.raw[1];
+    uint8_t model = mChecksum[mFrame.id];
+
+    mFrame.status &= LIN_FRAME_PARITY_OK;
+    if (timeout) {
+      mFrame.status |= LIN_FRAME_TIMEOUT;
+    }
+    if (model != LIN_CHECKSUM_CLASSIC && lin_checksum(pid, data, dataLen) == checksum) {
+      mFrame.status |= LIN_FRAME_CHECKSUM_OK | LIN_FRAME_ENHANCED;
+    } else if (model != LIN_CHECKSUM_ENHANCED && lin_checksum(0, data, dataLen) == checksum) {
+      mFrame.status |= LIN_FRAME_CHECKSUM_OK;
+    } else {
+      mErrors++;
+    }
+    mFrames++;
+    out = mFrame;
+    return true;
+  }
+
+public:
+  LinFrameParser() {
+    memset(mLength, 0, sizeof(mLength));
+    memset(mChecksum, 0, sizeof(mChecksum));
+    mPending = false;
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mState = WAIT_SYNC;
+    mExpected = 0;
+    mLastByteUs = 0;
+    mFrames = 0;
+    mErrors = 0;
+    setBaud(LIN_DEFAULT_BAUD);
+  }
+
+  // 按波特率设置帧结束的超时：3个字节的时间
+  void setBaud(uint32_t baud) {
+    mTimeoutUs = baud ? 3 * 10 * 1000000UL / baud : 3000;
+  }
+
+  /**
+   * 提交帧长度和校验和模型表(通常来自LDF)，可以在其他任务中调用
+   * 采集任务在下一帧开始时使用新的表
+   */
+  void setFrameTable(const uint8_t * lengths, const uint8_t * checksums) {
+    portENTER_CRITICAL(&mMux);
+    memcpy(mPendingLength, lengths, sizeof(mPendingLength));
+    memcpy(mPendingChecksum, checksums, sizeof(mPendingChecksum));
+    mPending = true;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  /**
+   * 输入一个串口字节
+   * @return 解析出完整的一帧时返回true
+   */
+  bool feed(uint8_t value, uint32_t nowUs, LinFrame & out) {
+    bool done = false;
+    // 数据段中出现长时间间隔，之前的数据已经是一个完整的帧(长度未知)
+    if (mState == DATA && nowUs - mLastByteUs > mTimeoutUs) {
+      done = finish(out, true);
+    }
+    mLastByteUs = nowUs;
+
+    switch (mState) {
+      case WAIT_SYNC:
+        // break在串口上表现为0x00，直接等待SYNC
+        if (value == 0x55) {
+          applyPending();
+          mFrame.raw[0] = value;
+          mFrame.rawLen = 1;
+          mState = WAIT_PID;
+        }
+        break;
+
+      case WAIT_PID:
+        mFrame.raw[1] = value;
+        mFrame.rawLen = 2;
+        mFrame.id = value & 0x3F;
+        mFrame.status = lin_pid(mFrame.id) == value ? LIN_FRAME_PARITY_OK : 0;
+        if (!(mFrame.status & LIN_FRAME_PARITY_OK)) {
+          // 不是合法的PID，可能是数据中的0x55，重新等待同步
+          mState = value == 0x55 ? WAIT_PID : WAIT_SYNC;
+          if (value == 0x55) {
+            mFrame.rawLen = 1;
+          }
+          break;
+        }
+        mExpected = mLength[mFrame.id];
+        mState = DATA;
+        break;
+
+      case DATA:
+        mFrame.raw[mFrame.rawLen++] = value;
+        if ((mExpected && mFrame.rawLen == 2 + mExpected + 1) || mFrame.rawLen == LIN_RAW_MAX) {
+          done = finish(out, false) || done;
+        }
+        break;
+    }
+    return done;
+  }
+
+  /**
+   * 周期调用：长度未知的帧在超时后结束
+   * @return 解析出完整的一帧时返回true
+   */
+  bool poll(uint32_t nowUs, LinFrame & out) {
+    if (mState == DATA && nowUs - mLastByteUs > mTimeoutUs) {
+      return finish(out, true);
+    }
+    return false;
+  }
+
+  uint32_t frames() {
+    return mFrames;
+  }
+
+  uint32_t checksumErrors() {
+    return mErrors;
+  }
+};
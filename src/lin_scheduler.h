@@ -0,0 +1,162 @@
+#pragma once
+
+#include <Arduino.h>
+#include "ldf_decoder.h"
+
+/**
+ * LIN主节点调度
+ *
+ * 按LDF中的调度表依次在每个时隙发送帧头(break + SYNC + PID)，从节点收到帧头后发送应答，
+ * 应答和帧头一起被LinFrameParser接收。
+ * 由主节点发布的时隙只等待不发送：主节点数据需要真正的控制逻辑，在车上盲目发送可能影响车辆，
+ * 所以调度器只用来轮询从节点的数据。
+ *
+ * 调度表由数据消费任务提交(start/stop)，在采集任务(loop)中调用service()发送。
+ * 发送帧头不阻塞采集任务：break字节写入串口后记下时间，之后的service()中按break字节的传输时间
+ * 判断它已经发完，再恢复波特率发送SYNC和PID。采集任务的一次循环比break长时，break后的间隔(delimiter)
+ * 会相应变长，帧头仍然可以被从节点识别。
+ */
+
+#define LIN_SCHEDULE_MAX_ENTRIES  64
+
+class LinScheduler {
+private:
+  HardwareSerial & mSerial;
+  portMUX_TYPE mMux;
+
+  // 正在运行的调度表，只在采集任务中访问
+  LdfScheduleEntry mEntries[LIN_SCHEDULE_MAX_ENTRIES];
+  uint8_t mCount;
+  uint8_t mSlot;
+  uint32_t mBaud;
+  uint32_t mNextMs;
+  bool mRunning;
+  uint32_t mHeaders;            // 已发送的帧头数
+  bool mInBreak;                // break字节正在发送
+  uint8_t mBreakId;             // break之后要发送的帧ID
+  uint32_t mBreakUs;            // 开始发送break的时间
+
+  // 数据消费任务提交的调度表
+  LdfScheduleEntry mPendingEntries[LIN_SCHEDULE_MAX_ENTRIES];
+  uint8_t mPendingCount;
+  volatile bool mPending;
+
+  /**
+   * 开始发送帧头
+   * break：把波特率降到一半后发送0x00，低电平持续18位(标准波特率下)，满足至少13位的要求
+   */
+  void startHeader(uint8_t id) {
+    mSerial.updateBaudRate(mBaud / 2);
+    mSerial.write((uint8_t) 0x00);
+    mInBreak = true;
+    mBreakId = id;
+    mBreakUs = micros();
+  }
+
+  /**
+   * break字节(包括停止位，半速下共20个标准位，再留1位余量)发完后恢复波特率，发送SYNC和PID
+   * @return break还没有发完时返回false
+   */
+  bool finishHeader() {
+    uint32_t breakUs = 21000000UL / mBaud + 1;
+    if (micros() - mBreakUs < breakUs) {
+      return false;
+    }
+    mSerial.updateBaudRate(mBaud);
+    mSerial.write((uint8_t) 0x55);
+    mSerial.write(lin_pid(mBreakId));
+    mInBreak = false;
+    mHeaders++;
+    return true;
+  }
+
+public:
+  LinScheduler(HardwareSerial & serial) : mSerial(serial) {
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+    mCount = 0;
+    mSlot = 0;
+    mBaud = LIN_DEFAULT_BAUD;
+    mNextMs = 0;
+    mRunning = false;
+    mHeaders = 0;
+    mInBreak = false;
+    mBreakId = 0;
+    mBreakUs = 0;
+    mPendingCount = 0;
+    mPending = false;
+  }
+
+  /**
+   * 提交调度表，采集任务在下一次service()时开始调度
+   * @return 调度表为空、太长或没有从节点发布的帧时返回false
+   */
+  bool start(const LdfScheduleEntry * entries, uint16_t count) {
+    if (count == 0 || count > LIN_SCHEDULE_MAX_ENTRIES) {
+      return false;
+    }
+    bool polling = false;
+    for (uint16_t i = 0; i < count; i++) {
+      polling |= !entries[i].fromMaster;
+    }
+    if (!polling) {
+      return false;
+    }
+    portENTER_CRITICAL(&mMux);
+    memcpy(mPendingEntries, entries, count * sizeof(LdfScheduleEntry));
+    mPendingCount = count;
+    mPending = true;
+    portEXIT_CRITICAL(&mMux);
+    return true;
+  }
+
+  // 停止调度
+  void stop() {
+    portENTER_CRITICAL(&mMux);
+    mPendingCount = 0;
+    mPending = true;
+    portEXIT_CRITICAL(&mMux);
+  }
+
+  bool isRunning() {
+    return mRunning;
+  }
+
+  uint32_t headers() {
+    return mHeaders;
+  }
+
+  /**
+   * 采集任务中周期调用，到了时隙的开始时发送帧头，不等待串口发送完成
+   * @param baud - 当前的LIN波特率，发送break后恢复到这个波特率
+   */
+  void service(uint32_t now, uint32_t baud) {
+    if (mInBreak && !finishHeader()) {
+      return;
+    }
+    mBaud = baud;
+    if (mPending) {
+      portENTER_CRITICAL(&mMux);
+      memcpy(mEntries, mPendingEntries, mPendingCount * sizeof(LdfScheduleEntry));
+      mCount = mPendingCount;
+      mPending = false;
+      portEXIT_CRITICAL(&mMux);
+      mSlot = 0;
+      mNextMs = now;
+      mRunning = mCount > 0;
+    }
+    if (!mRunning || (int32_t)(now - mNextMs) < 0) {
+      return;
+    }
+
+    const LdfScheduleEntry & entry = mEntries[mSlot];
+    if (!entry.fromMaster) {
+      startHeader(entry.id);
+    }
+    mNextMs += entry.delayMs;
+    // 落后超过一个时隙时(例如总线重新初始化)，从当前时间重新开始计时
+    if ((int32_t)(now - mNextMs) > (int32_t) entry.delayMs) {
+      mNextMs = now;
+    }
+    mSlot = (mSlot + 1) % mCount;
+  }
+};
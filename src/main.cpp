@@ -33,6 +33,14 @@
 #include <Arduino.h>
 #include <TFT_eSPI.h>
 #include "menu.h"
+#include "strip_chart.h"
+#include "bus_config.h"
+#include "can_channels.h"
+#include "can_twai.h"
+#include "can_gateway.h"
+#include "can_autobaud.h"
+#include "can_stats.h"
+#include "stats_screen.h"
 
 // 声明全局变量用于可编辑项目
 bool engine_enabled = true;
@@ -45,14 +53,89 @@ char vehicle_name[20] = "My Car";
 void displayVehicleInfo();
 void startDiagnostics();
 void resetSystem();
+void saveSettings();
+void applyBusConfigFromMenu();
+void requestAutoBaudFromMenu();
+void syncBusConfigMenu();
+void showBusStats();
+void processSerialCommand();
 
 // 创建TFT对象
 TFT_eSPI tft = TFT_eSPI();
 
-// 声明菜单对象
-Menu* mainMenu;
-Menu* settingsMenu;
-Menu* advancedSettingsMenu;
+// 曲线显示：订阅的信号定义，ID和位位置需要根据实际车型修改
+const SignalDef plot_signals[] = {
+  // name     bus       id     start len  motorola signed scale   offset min  max
+  {"RPM",    CAN_DATA, 0x0C9, 16,   16,  false,   false, 0.25f,  0,     0,   8000},
+  {"Pedal",  CAN_DATA, 0x0F1, 8,    8,   false,   false, 0.392f, 0,     0,   100},
+  {"Speed",  CAN_DATA, 0x3E9, 0,    16,  false,   false, 0.01f,  0,     0,   250},
+  {"Switch", LIN_DATA, 0x21,  0,    1,   false,   false, 1,      0,     0,   1},
+};
+StripChart signalPlot(tft);
+void showSignalPlot();
+
+// CAN总线统计：错误计数由采集任务读取，统计在数据消费任务中完成
+CanErrorPoller canErrorPollers[CAN_MAX_CHANNELS];  // 每个通道一个
+CanStats canStats[CAN_MAX_CHANNELS];
+StatsScreen statsScreen(tft, canStats[0]);
+
+// 总线配置菜单：保存各选项在选项数组中的序号，开机时从flash中的配置同步
+int bus_can_rate_index = 0;
+int bus_can_factor_index = 0;
+int bus_can_mode_index = 0;
+int bus_lin_baud_index = 0;
+int bus_kline_baud_index = 0;
+
+// 菜单定义：菜单项以constexpr表的形式放在flash中，子菜单需要先于父菜单定义
+// 高级设置菜单项目
+constexpr MenuItem advancedSettingsItems[] = {
+  menuNumber("PID Kp", &brightness_level, 0, 200), // 使用示例变量
+  menuNumber("PID Ki", &volume_level, 0, 200), // 使用示例变量
+  menuAction("保存设置", saveSettings),
+  menuBack("返回"),
+};
+constexpr MenuPage advancedSettingsMenu = menuPage("Advance Setting", advancedSettingsItems);
+
+// 总线配置菜单项目，修改后点击"应用"由采集任务重新初始化对应的总线
+constexpr MenuItem busConfigItems[] = {
+  menuChoice("CAN Rate", &bus_can_rate_index, bus_config_can_rate_labels),
+  menuChoice("FD Factor", &bus_can_factor_index, bus_config_data_factor_labels),
+  menuChoice("CAN Mode", &bus_can_mode_index, bus_config_can_mode_labels),
+  menuChoice("LIN Baud", &bus_lin_baud_index, bus_config_lin_baud_labels),
+  menuChoice("K-Line Baud", &bus_kline_baud_index, bus_config_kline_baud_labels),
+  menuAction("应用", applyBusConfigFromMenu),
+  menuAction("Auto Detect", requestAutoBaudFromMenu),
+  menuBack("返回"),
+};
+constexpr MenuPage busConfigMenu = menuPage("Bus Config", busConfigItems);
+
+// 设置菜单项目
+constexpr MenuItem settingsItems[] = {
+  menuBool("test1", &engine_enabled),
+  menuBool("test2", &abs_enabled),
+  menuNumber("test3", &brightness_level, 0, 100),
+  menuNumber("test4", &volume_level, 0, 100),
+  menuText("Carname", vehicle_name),
+  menuSubmenu("Advance Setting", &advancedSettingsMenu),
+  menuSubmenu("Bus Config", &busConfigMenu),
+  menuBack("返回"),
+};
+constexpr MenuPage settingsMenu = menuPage("Setting", settingsItems);
+
+// 主菜单项目
+constexpr MenuItem mainItems[] = {
+  menuSubmenu("Car Information", nullptr), // 暂时设为nullptr，后续再处理
+  menuSubmenu("Diagnoise", nullptr), // 暂时设为nullptr，后续再处理
+  menuSubmenu("Setting", &settingsMenu),
+  menuAction("Signal Plot", showSignalPlot),
+  menuAction("Bus Stats", showBusStats),
+  menuAction("Debug", startDiagnostics),
+  menuAction("Reset System", resetSystem),
+};
+constexpr MenuPage mainMenu = menuPage("Main", mainItems);
+
+// 菜单控制器，所有菜单共用一个Sprite
+MenuController menu(tft);
 
 // EC11旋钮引脚定义 - 请根据实际硬件连接调整这些引脚
 #define EC11_PIN_A 39  // 旋钮A相连接的GPIO引脚
@@ -99,9 +182,6 @@ void IRAM_ATTR handleButton() {
   }
 }
 
-// 当前活动菜单指针
-Menu* currentMenu = nullptr;
-
 void menu_setup() {
   Serial.begin(115200);
   
@@ -120,94 +200,61 @@ void menu_setup() {
   attachInterrupt(digitalPinToInterrupt(EC11_PIN_B), handleEncoder, CHANGE);
   attachInterrupt(digitalPinToInterrupt(EC11_PIN_SW), handleButton, FALLING);
 
-  // 创建各个菜单
-  mainMenu = new Menu(tft);
-  settingsMenu = new Menu(tft);
-  advancedSettingsMenu = new Menu(tft);
-
-  // 设置菜单ID
-  mainMenu->setId(0);
-  settingsMenu->setId(1);
-  advancedSettingsMenu->setId(2);
-
-  // 设置菜单层级关系
-  settingsMenu->setParent(mainMenu);
-  advancedSettingsMenu->setParent(settingsMenu);
-
-  // 主菜单项目
-  mainMenu->addSubmenuItem("Car Information", nullptr); // 暂时设为nullptr，后续再处理
-  mainMenu->addSubmenuItem("Diagnoise", nullptr); // 暂时设为nullptr，后续再处理
-  mainMenu->addSubmenuItem("Setting", settingsMenu);
-  mainMenu->addActionItem("Debug", startDiagnostics);
-  mainMenu->addActionItem("Reset System", resetSystem);
-
-  // 设置菜单项目
-  settingsMenu->addEditableBoolItem("test1", &engine_enabled);
-  settingsMenu->addEditableBoolItem("test2", &abs_enabled);
-  settingsMenu->addEditableNumberItem("test3", &brightness_level, 0, 100);
-  settingsMenu->addEditableNumberItem("test4", &volume_level, 0, 100);
-  settingsMenu->addEditableTextItem("Carname", vehicle_name);
-  settingsMenu->addSubmenuItem("Advance Setting", advancedSettingsMenu);
-
-  // 高级设置菜单项目
-  advancedSettingsMenu->addEditableNumberItem("PID Kp", &brightness_level, 0, 200); // 使用示例变量
-  advancedSettingsMenu->addEditableNumberItem("PID Ki", &volume_level, 0, 200); // 使用示例变量
-  advancedSettingsMenu->addActionItem("保存设置", []() { 
-    Serial.println("Setting saved"); 
-  });
-  advancedSettingsMenu->addActionItem("返回", []() { 
-    Serial.println("back to main menu"); 
-  });
+  // 初始化菜单，根菜单为主菜单
+  menu.init(&mainMenu);
 
-  // 初始化菜单
-  mainMenu->init();
-  settingsMenu->init();
-  advancedSettingsMenu->init();
+  // 曲线显示订阅的信号，每列100ms，整屏约32秒
+  const uint16_t plot_colors[] = {TFT_GREEN, TFT_YELLOW, TFT_CYAN, TFT_MAGENTA};
+  for (size_t i = 0; i < sizeof(plot_signals) / sizeof(plot_signals[0]); i++) {
+    signalPlot.subscribe(&plot_signals[i], plot_colors[i % 4]);
+  }
+  signalPlot.setBucketPeriod(100);
 
-  // 设置当前活动菜单为默认主菜单
-  currentMenu = mainMenu;
-  currentMenu->show();
+  // 显示主菜单
+  menu.show();
 }
 
 // 菜单导航处理函数
 void handleMenuNavigation() {
+  // 曲线显示界面：旋钮不起作用，按键退出回到菜单
+  if (signalPlot.isActive()) {
+    encoderPos = 0;
+    if (buttonPressed) {
+      buttonPressed = false;
+      signalPlot.end();
+      tft.fillScreen(TFT_BLACK);
+      menu.show();
+    }
+    return;
+  }
+
+  // 统计显示界面：按键退出回到菜单
+  if (statsScreen.isActive()) {
+    encoderPos = 0;
+    if (buttonPressed) {
+      buttonPressed = false;
+      statsScreen.end();
+      tft.fillScreen(TFT_BLACK);
+      menu.show();
+    }
+    return;
+  }
+
   // 处理旋钮旋转
   if (encoderPos > 0) {
     // 顺时针旋转 - 向下选择
-    currentMenu->navigateDown();
+    menu.navigateDown();
     encoderPos = 0;
   } else if (encoderPos < 0) {
     // 逆时针旋转 - 向上选择
-    currentMenu->navigateUp();
+    menu.navigateUp();
     encoderPos = 0;
   }
 
-  // 处理按键按下
+  // 处理按键按下：进入子菜单、返回上级菜单都由菜单控制器的菜单栈处理
   if (buttonPressed) {
     buttonPressed = false;  // 清除按键标志
-    
-    // 根据当前选中项执行相应操作
-    int result = currentMenu->selectCurrent();
-    
-    if (result != -1) {
-      // 如果返回的是子菜单ID，则切换到对应子菜单
-      if (result == settingsMenu->getId()) {
-        currentMenu = settingsMenu;
-        currentMenu->show();
-      } else if (result == advancedSettingsMenu->getId()) {
-        currentMenu = advancedSettingsMenu;
-        currentMenu->show();
-      }
-    } else {
-      // 如果是返回操作，切换回父菜单
-      if (strcmp(currentMenu->getCurrentSelectionLabel().c_str(), "返回") == 0) {
-        Menu* parent = currentMenu->getParent();
-        if (parent != nullptr) {
-          currentMenu = parent;
-          currentMenu->show();
-        }
-      }
-    }
+    menu.selectCurrent();
   }
 }
 
@@ -227,6 +274,37 @@ void resetSystem() {
   // 实现系统重置的逻辑
 }
 
+void saveSettings() {
+  Serial.println("Setting saved");
+}
+
+void showSignalPlot() {
+  signalPlot.begin(millis());
+}
+
+void showBusStats() {
+  statsScreen.begin(millis());
+}
+
+// 自动波特率检测完成后刷新菜单中的总线配置
+extern CanAutoBaud canAutoBaud;
+uint32_t autobaud_seen = 0;
+
+// 屏幕相关的处理：旋钮/按键导航，曲线显示的增量刷新，串口命令
+void ui_loop() {
+  processSerialCommand();
+  if (canAutoBaud.completedCount() != autobaud_seen) {
+    autobaud_seen = canAutoBaud.completedCount();
+    syncBusConfigMenu();
+    if (!signalPlot.isActive() && !statsScreen.isActive()) {
+      menu.show();
+    }
+  }
+  handleMenuNavigation();
+  signalPlot.render(millis());
+  statsScreen.render(millis());
+}
+
 #include "HardwareSerial.h"
 
 // #include <esp32-hal-bt.h>
@@ -258,52 +336,51 @@ void resetSystem() {
 // AltSoftSerial Alt_Serial;   // Create an alternative serial object (commented out)
 
 // ---------------- Create an OBD2_KLine object for communication.
-OBD2_KLine KLine(Serial2, 10400, K_LINE_RX, K_LINE_TX);  // Uses Hardware Serial (Serial1) at 10400 baud, with RX on pin 10 and TX on pin 11.
+OBD2_KLine KLine(Serial2, KLINE_DEFAULT_BAUD, K_LINE_RX, K_LINE_TX);  // Uses Hardware Serial (Serial1) at 10400 baud, with RX on pin 10 and TX on pin 11.
 // OBD2_KLine KLine(Alt_Serial, 10400, 8, 9); // Uses AltSoftSerial at 10400 baud, with RX on pin 8 and TX on pin 9.
 
 
 
 #include "tfcard.h"
 
-#include "commandProccessor.h"
+#include "capture_log.h"
 
+#include "dbc_decoder.h"
 
+#include "ldf_decoder.h"
 
-/**  当晶振不能正常启振，采用gpio输出一个20Mhz 50%占空比的方波来驱动mcp2518 **/
-//#define EMU20Mhz_OSC 1
+#include "lin_scheduler.h"
 
-#ifdef EMU20Mhz_OSC
-#include "osc_emu.h"
-#endif 
+#include "isotp.h"
+
+#include "uds_client.h"
+
+#include "obd2_scan.h"
 
-// #define CAN_DATA 1;
-// #define K_LINE_DATA 2;
-// #define LIN_DATA 3;
+#include "can_replay.h"
 
+#include "can_periodic.h"
 
-typedef struct {
-  uint8_t data_len;
-  char * data;
-} lin_bus_data;
+#include "can_filter_stage.h"
 
-typedef struct {
-  uint8_t data_len;
-  char * data;
-} kline_bus_data;
+#include "trigger_capture.h"
 
+#include "mem_policy.h"
 
+#include "commandProccessor.h"
+
+#include "CanInspector.h"
+
+
+
+/**  当晶振不能正常启振，采用gpio输出一个20Mhz 50%占空比的方波来驱动mcp2518 **/
+//#define EMU20Mhz_OSC 1
 
-typedef enum {
-  CAN_DATA = 1,
-  K_LINE_DATA = 2,
-  LIN_DATA = 3
-} data_type;
+#ifdef EMU20Mhz_OSC
+#include "osc_emu.h"
+#endif 
 
-//所有的总线数据都使用data_t结构体保存，通过type来区分数据来源
-typedef struct {
-  data_type type;
-  void * obj;
-} data_t;
+#include "bus_data.h"
 
 
 void debug_info(String str){
@@ -318,8 +395,98 @@ void print_lin_data(String str) {
   Serial.println("|data-lin:"+str);
 }
 
-void print_can_data(String str) {
-  Serial.println("|data-can:"+str);
+void print_can_data(String str, uint8_t channel = 0) {
+  Serial.println((channel ? "|data-can" + String(channel) + ":" : String("|data-can:")) + str);
+}
+
+//DBC解码，加载后CAN帧输出解码后的信号
+DbcDecoder dbc;
+
+// 输出一帧CAN数据：DBC中有该报文时输出信号的物理值，否则输出原始数据
+// DBC描述的是通道0的总线，其他通道只输出原始数据
+void print_can_message(const CANFDMessage & msg, uint8_t channel = 0) {
+  char line[512];
+  size_t n = snprintf(line, sizeof(line), msg.ext ? "%08X" : "%03X", (unsigned) msg.id);
+  const DbcMessagePlan * plan = NULL;
+  if (channel == 0) {
+    plan = dbc.decode(msg, [&](const DbcSignalPlan & signal, float value) {
+      if (n < sizeof(line)) {
+        n += snprintf(line + n, sizeof(line) - n, " %s=%g%s", signal.name, value, signal.unit);
+      }
+    });
+  }
+  if (plan != NULL) {
+    if (n < sizeof(line)) {
+      snprintf(line + n, sizeof(line) - n, " (%s)", plan->name);
+    }
+  } else {
+    for (uint8_t i = 0; i < msg.len && n + 3 < sizeof(line); i++) {
+      n += snprintf(line + n, sizeof(line) - n, " %02X", msg.data[i]);
+    }
+  }
+  print_can_data(line, channel);
+}
+
+//LDF解码，加载后LIN帧输出解码后的信号，并提供帧长度、校验和模型和调度表
+LdfDatabase ldf;
+
+//LIN帧解析，采集任务中逐字节输入串口数据
+LinFrameParser linParser;
+
+//LIN主节点调度，按LDF的调度表轮询从节点
+LinScheduler linScheduler(Serial1);
+
+// 输出一帧LIN数据：LDF中有该帧时输出信号的物理值，否则输出原始数据
+void print_lin_message(const uint8_t * raw, uint8_t raw_len, uint8_t id, uint8_t status) {
+  char line[256];
+  size_t n = snprintf(line, sizeof(line), "%02X", id);
+  const uint8_t * data = raw + 2;
+  uint8_t data_len = raw_len > 3 ? raw_len - 3 : 0;
+  const LdfFrame * frame = ldf.decode(id, data, data_len, [&](const DbcSignalPlan & signal, float value) {
+    if (n < sizeof(line)) {
+      n += snprintf(line + n, sizeof(line) - n, " %s=%g%s", signal.name, value, signal.unit);
+    }
+  });
+  if (frame != NULL) {
+    if (n < sizeof(line)) {
+      n += snprintf(line + n, sizeof(line) - n, " (%s)", frame->name);
+    }
+  } else {
+    for (uint8_t i = 0; i < data_len && n + 3 < sizeof(line); i++) {
+      n += snprintf(line + n, sizeof(line) - n, " %02X", data[i]);
+    }
+  }
+  if (!(status & LIN_FRAME_CHECKSUM_OK) && n < sizeof(line)) {
+    snprintf(line + n, sizeof(line) - n, " checksum error");
+  }
+  print_lin_data(line);
+}
+
+// 加载LDF文件，把帧长度和校验和模型交给LIN帧解析，LDF中定义了波特率时同时修改LIN波特率
+bool loadLdf(const char * path) {
+  linScheduler.stop();
+  if (!ldf.load(SD_MMC, path)) {
+    return false;
+  }
+  uint8_t lengths[LIN_FRAME_IDS];
+  uint8_t checksums[LIN_FRAME_IDS];
+  ldf.frameTable(lengths, checksums);
+  linParser.setFrameTable(lengths, checksums);
+  if (ldf.baud() != 0 && ldf.baud() != busConfig.pending().lin_baud) {
+    busConfig.setLinBaud(ldf.baud());
+  }
+  return true;
+}
+
+// 输出一个重组完成的ISO-TP PDU，太长时只输出前面的部分
+void print_isotp_pdu(const IsoTpPdu & pdu) {
+  char line[256];
+  size_t n = snprintf(line, sizeof(line), pdu.ext ? "isotp %08X [%u]" : "isotp %03X [%u]",
+                      (unsigned) pdu.id, pdu.len);
+  for (uint16_t i = 0; i < pdu.len && n + 3 < sizeof(line); i++) {
+    n += snprintf(line + n, sizeof(line) - n, " %02X", pdu.data[i]);
+  }
+  print_can_data(line);
 }
 
 void print_kline_data(String str) {
@@ -332,19 +499,251 @@ SPIClass tftspi(1);
 
 SPIClass SPI2(FSPI);
 ACAN2517FD can (MCP2517_CS, SPI2, 255) ; // Last argument is 255 -> no interrupt pin
-ACAN2517FDSettings settings (ACAN2517FDSettings::OSC_40MHz, 500 * 1000, DataBitRateFactor::x1) ;
+//第二个MCP2518(CAN通道1)，和can共用SPI2，INT引脚由canChannels读取
+ACAN2517FD can1 (MCP2518_1_CS, SPI2, 255) ;
+
+//片上TWAI控制器(CAN通道2)，只需要外接一个收发器
+CanTwai canTwai(TWAI_TX, TWAI_RX);
+
+//多控制器采集，loop()按轮转顺序公平地服务所有CAN通道
+CanChannels canChannels;
+
+//CAN网关，在loop()中把收到的帧按路由表转发到其他通道
+CanGateway gateway;
 //LIN bus  use Serial1 gpio:15,16
 
 //HardwareSerial LIN(1);
 //HardwareSerial KLINE(2);
 
-const int LIN_BAUD = 19200;
-LINBus_stack LinBus(Serial1,LIN_BAUD);
+LINBus_stack LinBus(Serial1,LIN_DEFAULT_BAUD);
+
+//CAN接收过滤器，白名单编译成MCP2518的硬件过滤器，误收的帧在loop()中丢弃
+CanFilter canFilter;
+
+//CAN/LIN/K-Line的运行时配置，菜单和串口命令修改后由loop()重新初始化对应的总线
+BusConfigService busConfig(can, Serial1, Serial2);
+
+//CAN自动波特率检测，ListenOnly模式下扫描候选波特率
+CanAutoBaud canAutoBaud(busConfig, can);
 
 QueueHandle_t recv_queue;
+//要发送的CAN帧(按值保存)，由loop()调用can.tryToSend发送
+QueueHandle_t send_queue;
 TaskHandle_t task;
 TfCard tf;
 
+// 把一帧CAN数据放入发送队列，队列满时返回false
+bool queue_can_send(const CANFDMessage & msg) {
+  return send_queue != NULL && xQueueSend(send_queue, &msg, 0) == pdTRUE;
+}
+
+//ISO-TP重组和主动收发，完成的PDU写入采集日志
+IsoTp isotp(queue_can_send);
+
+//UDS诊断客户端，请求通过isotp的主动链路发送
+UdsClient uds(isotp);
+
+// 输出UDS请求的结果，读故障码的应答按故障码逐条输出
+void print_uds_response(uint8_t ecu, uint8_t sid, const uint8_t * data, uint16_t len, uint8_t nrc) {
+  if (nrc == UDS_NRC_TIMEOUT) {
+    Serial.printf("uds ecu %u service %02X: no response\n", ecu, sid);
+    return;
+  }
+  if (nrc != 0) {
+    Serial.printf("uds ecu %u service %02X: negative response %02X\n", ecu, sid, nrc);
+    return;
+  }
+  if (sid == UDS_READ_DTC) {
+    uint16_t count = 0;
+    UdsClient::forEachDtc(data, len, [&](uint32_t dtc, uint8_t status) {
+      Serial.printf("uds ecu %u dtc %06X status %02X\n", ecu, dtc, status);
+      count++;
+    });
+    Serial.printf("uds ecu %u: %u dtc\n", ecu, count);
+  } else if (sid != UDS_READ_DID) {
+    Serial.printf("uds ecu %u service %02X: ok\n", ecu, sid);
+  }
+}
+
+//OBD-II Mode 01扫描，请求发送到功能地址
+Obd2Scanner obd2(isotp);
+
+// 输出OBD-II PID的值，标准PID输出换算后的值，其他输出原始数据
+void print_obd2_value(uint32_t ecu, uint8_t pid, const Obd2PidInfo * info, float value,
+                      const uint8_t * data, uint8_t len) {
+  if (!print_bus_message) {
+    return;
+  }
+  char line[96];
+  if (info != NULL) {
+    snprintf(line, sizeof(line), "obd2 %X %02X %s=%g%s", (unsigned) ecu, pid, info->name, value, info->unit);
+  } else {
+    size_t n = snprintf(line, sizeof(line), "obd2 %X %02X:", (unsigned) ecu, pid);
+    for (uint8_t i = 0; i < len && n + 3 < sizeof(line); i++) {
+      n += snprintf(line + n, sizeof(line) - n, " %02X", data[i]);
+    }
+  }
+  print_can_data(line);
+}
+
+// 输出读取到的DID
+void print_uds_did(uint8_t ecu, uint16_t did, const uint8_t * data, uint16_t len) {
+  if (!print_bus_message) {
+    return;
+  }
+  char line[160];
+  size_t n = snprintf(line, sizeof(line), "uds ecu %u did %04X:", ecu, did);
+  for (uint16_t i = 0; i < len && n + 3 < sizeof(line); i++) {
+    n += snprintf(line + n, sizeof(line) - n, " %02X", data[i]);
+  }
+  print_can_data(line);
+}
+
+//采集日志，保存所有总线数据和统计记录
+CaptureLog captureLog(SD_MMC);
+
+//CAN帧的软件过滤：决定每帧是否记录、显示，以及是否触发开始/停止记录
+CanFilterStage canStage;
+
+//触发记录，PSRAM中保存触发前的历史，触发后把前后的记录写入tf卡
+TriggerCapture triggerCapture(SD_MMC);
+
+volatile bool mainButtonPressed = false; // 主按键按下标志，手动触发
+volatile long lastMainButtonMS = 0;
+
+// 中断服务程序 - 处理主按键
+void IRAM_ATTR handleMainButton() {
+  int MS = millis();
+  if (MS - lastMainButtonMS > EC11_BTN_DEBOUNCE) {
+    mainButtonPressed = true;
+    lastMainButtonMS = MS;
+  }
+}
+
+// 任意一个通道BDIAG0中的错误计数增加时返回true
+bool can_error_increased() {
+  static uint32_t lastSamples[CAN_MAX_CHANNELS] = {0};
+  static uint32_t lastDiag[CAN_MAX_CHANNELS] = {0};
+  bool increased = false;
+  for (uint8_t channel = 0; channel < canChannels.count(); channel++) {
+    if (canErrorPollers[channel].samples == lastSamples[channel]) {
+      continue;
+    }
+    lastSamples[channel] = canErrorPollers[channel].samples;
+    uint32_t diag = canErrorPollers[channel].bdiag0;
+    for (uint8_t shift = 0; shift < 32; shift += 8) {
+      increased |= ((diag >> shift) & 0xFF) > ((lastDiag[channel] >> shift) & 0xFF);
+    }
+    lastDiag[channel] = diag;
+  }
+  return increased;
+}
+
+//CAN回放，按采集日志中的时间重新发送CAN帧
+CanReplay replay(SD_MMC);
+
+//周期发送表，模拟台架上缺失的ECU
+CanPeriodic periodic;
+
+//缓冲区的内存分配，开机时输出内存分布
+MemPolicy memPolicy;
+
+// 按板上的内存分配批量缓冲区：触发历史最多使用PSRAM的一半，没有PSRAM时用内部SRAM中的小缓冲区
+void memory_setup() {
+  size_t historySize = memPolicy.bulkSize(TRIGGER_BUFFER_SIZE, TRIGGER_BUFFER_MIN, 2);
+  triggerCapture.begin((uint8_t *) memPolicy.alloc("trigger history", historySize, MEM_BULK), historySize);
+  // 转义首帧的长会话只在有PSRAM时分配，没有时这样的传输被丢弃
+  isotp.begin((uint8_t *) memPolicy.alloc("isotp sessions", ISOTP_SESSIONS * ISOTP_MAX_PDU, MEM_BULK),
+              memPolicy.hasPsram() ? (uint8_t *) memPolicy.alloc("isotp long pdu", ISOTP_LONG_PDU, MEM_BULK) : NULL);
+  replay.begin((can_replay_entry_t *) memPolicy.alloc("replay queue",
+               CAN_REPLAY_QUEUE_SIZE * sizeof(can_replay_entry_t), MEM_BULK));
+
+  memPolicy.note("can stats", sizeof(canStats));
+  memPolicy.note("can filter", sizeof(canFilter));
+  memPolicy.note("can rules", sizeof(canStage));
+  memPolicy.note("tx table", sizeof(periodic));
+  memPolicy.note("isotp", sizeof(isotp));
+  memPolicy.note("twai ring", sizeof(canTwai));
+  memPolicy.note("gateway", sizeof(gateway));
+  memPolicy.note("capture log", sizeof(captureLog));
+  memPolicy.note("replay", sizeof(replay));
+  memPolicy.print();
+}
+
+// 把菜单的选项序号同步为当前的总线配置
+void syncBusConfigMenu() {
+  bus_config_t cfg = busConfig.pending();
+  bus_can_rate_index = bus_config_index_of(bus_config_can_rates, cfg.can_bitrate);
+  bus_can_factor_index = bus_config_index_of(bus_config_data_factors, cfg.can_data_factor);
+  bus_can_mode_index = bus_config_index_of(bus_config_can_modes, cfg.can_mode);
+  bus_lin_baud_index = bus_config_index_of(bus_config_lin_bauds, cfg.lin_baud);
+  bus_kline_baud_index = bus_config_index_of(bus_config_kline_bauds, cfg.kline_baud);
+}
+
+// 菜单中的"应用"：校验并提交总线配置，只有值改变的总线才会被重新初始化
+void applyBusConfigFromMenu() {
+  // 菜单中的所有选项组成一个完整的配置，一起校验，不会只生效其中一部分
+  bus_config_t cfg = busConfig.pending();
+  cfg.can_bitrate = bus_config_can_rates[bus_can_rate_index];
+  cfg.can_data_factor = bus_config_data_factors[bus_can_factor_index];
+  cfg.can_mode = bus_config_can_modes[bus_can_mode_index];
+  cfg.lin_baud = bus_config_lin_bauds[bus_lin_baud_index];
+  cfg.kline_baud = bus_config_kline_bauds[bus_kline_baud_index];
+  if (busConfig.setConfig(cfg)) {
+    debug_info("bus config accepted");
+  } else {
+    debug_err("invalid bus config");
+    syncBusConfigMenu();
+  }
+  menu.show();
+}
+
+// 菜单中的"Auto Detect"：由采集任务以ListenOnly模式检测CAN波特率
+void requestAutoBaudFromMenu() {
+  canAutoBaud.request();
+  debug_info("can autobaud started");
+}
+
+// 数据消费任务中的周期处理：每秒生成CAN统计记录，刷新采集日志
+void service_loop() {
+  uint32_t now = millis();
+  //每个通道的统计记录和MCP2518的健康记录，记录头中的通道号区分控制器
+  for (uint8_t channel = 0; channel < canChannels.count(); channel++) {
+    CanStats & stats = canStats[channel];
+    if (stats.service(canErrorPollers[channel], now)) {
+      bus_config_t cfg = busConfig.active();
+      if (canChannels.twai(channel) != NULL) {
+        stats.setBitRates(cfg.twai_bitrate, 0);
+      } else {
+        stats.setBitTiming(cfg);
+      }
+      if (print_bus_stats) {
+        stats.print();
+      }
+      captureLog.write(CAPTURE_STATS, channel, 0, 0, micros(), &stats.record(), sizeof(can_stats_record_t));
+      triggerCapture.write(CAPTURE_STATS, channel, 0, 0, micros(), &stats.record(), sizeof(can_stats_record_t));
+    }
+    can_health_record_t health;
+    if (canErrorPollers[channel].samples > 0 && canErrorPollers[channel].health(now, health)) {
+      captureLog.write(CAPTURE_HEALTH, channel, 0, 0, micros(), &health, sizeof(health));
+      triggerCapture.write(CAPTURE_HEALTH, channel, 0, 0, micros(), &health, sizeof(health));
+    }
+  }
+  if (can_error_increased()) {
+    triggerCapture.trigger("error frame");
+  }
+  if (mainButtonPressed) {
+    mainButtonPressed = false;
+    triggerCapture.trigger("button");
+  }
+  uds.service(now);
+  obd2.service(now);
+  isotp.service(now);
+  replay.service();
+  captureLog.service(now);
+  triggerCapture.service();
+}
+
 void loop2(void *);
 void setup() {
   // put your setup code here, to run once:
@@ -368,6 +767,8 @@ void setup() {
   
   menu_setup();
 
+  memory_setup();
+
   //LIN.begin(115200 , SERIAL_8N1);
   
   //LIN总线一般工作的速率：低速2400bps，中速9600bps，高速19200bps
@@ -396,6 +797,9 @@ void setup() {
 
 
   recv_queue = xQueueCreate(1000 , sizeof(data_t *));
+  send_queue = xQueueCreate(CAN_SEND_QUEUE_SIZE , sizeof(CANFDMessage));
+  uds.setCallbacks(print_uds_response, print_uds_did);
+  obd2.setCallback(print_obd2_value);
   
   //   // Create Task 2 on another Core
   xTaskCreatePinnedToCore(
@@ -408,6 +812,11 @@ void setup() {
     xPortGetCoreID()?0:1);            // Core 0
 
   pinMode(MCP2517_CS, OUTPUT);
+  //共用SPI总线的第二个MCP2518在初始化之前也不能被选中
+  if (MCP2518_1_CS >= 0) {
+    pinMode(MCP2518_1_CS, OUTPUT);
+    digitalWrite(MCP2518_1_CS, HIGH);
+  }
 
   #ifdef EMU20Mhz_OSC
     output20Mhz_osc1();
@@ -418,13 +827,58 @@ void setup() {
   // wait for OSC to stabilize,the OSC need 5ms to stable
   delay(10);
 
-  SPI2.begin (MCP2517_SCK, MCP2517_MISO, MCP2517_MOSI);
+  #ifdef ACAN2517FD_IDF_SPI
+    //mcp2518驱动直接使用IDF spi_master：DMA传输，CS由SPI外设控制
+    if (!can.beginIDFSPI(SPI2_HOST, MCP2517_SCK, MCP2517_MISO, MCP2517_MOSI)) {
+      Serial.println("|error:spi bus init failed");
+    }
+  #else
+    SPI2.begin (MCP2517_SCK, MCP2517_MISO, MCP2517_MOSI);
+  #endif
+
+  //通道0是can，通道1是共用SPI总线的第二个MCP2518，busConfig生效CAN配置时一起初始化
+  canChannels.add(can, MCP2517_INT_WIRED ? MCP2517_INT : 255);
+  if (MCP2518_1_CS >= 0) {
+    #ifdef ACAN2517FD_IDF_SPI
+      if (!can1.beginIDFSPI(SPI2_HOST, MCP2517_SCK, MCP2517_MISO, MCP2517_MOSI)) {
+        Serial.println("|error:spi bus init failed for can1");
+      }
+    #endif
+    canChannels.add(can1, MCP2518_1_INT < 0 ? 255 : MCP2518_1_INT);
+  }
+  if (TWAI_TX >= 0) {
+    canChannels.add(canTwai);
+    busConfig.setTwai(&canTwai);
+  }
+  busConfig.setChannels(&canChannels);
+  for (uint8_t channel = 0; channel < CAN_MAX_CHANNELS; channel++) {
+    canStats[channel].setChannel(channel);
+  }
+
+  //加载flash中保存的总线配置并初始化mcp2518,LIN,K-Line
+  busConfig.setFilter(&canFilter);
+  pinMode(MAIN_BTN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(MAIN_BTN), handleMainButton, FALLING);
+  busConfig.load();
+  syncBusConfigMenu();
+  busConfig.service();
 
 
   
   //clear all data on LIN bus
   Serial1.flush();
 
+  //加载tf卡中的DBC文件
+  if (dbc.load(SD_MMC, DBC_DEFAULT_FILE)) {
+    debug_info("dbc loaded: " + String(dbc.messageCount()) + " messages, " + String(dbc.signalCount()) + " signals");
+  }
+
+  //加载tf卡中的LDF文件
+  if (loadLdf(LDF_DEFAULT_FILE)) {
+    debug_info("ldf loaded: " + String(ldf.frameCount()) + " frames, " + String(ldf.signalCount()) + " signals, "
+               + String(ldf.scheduleCount()) + " schedules");
+  }
+
 }
 
 /**
@@ -437,21 +891,60 @@ void setup() {
  * 
  */
 void loop() {
-  
-  //read can bus data and put it to queue
-  if(can.available()) {
-    CANFDMessage message;
-    can.receive(message);
-    CANFDMessage * msg = new CANFDMessage;
-    *msg = message;
-    data_t * can_data = new data_t{
-      .type = CAN_DATA,
-      .obj = (void *) msg,
-    };
 
-    xQueueSend(recv_queue , &can_data , 1);
-    
+  //自动波特率检测期间mcp2518由检测程序独占，检测结束后才处理配置修改和接收
+  bool can_autobaud = canAutoBaud.service(millis());
+
+  //菜单或串口命令修改了总线配置时，重新初始化对应的总线
+  if(!can_autobaud) {
+    busConfig.service();
+
+  }
+
+  //每100ms读取一次每个通道的错误计数和健康状态，统计在loop2中完成；自动波特率检测期间不访问通道0
+  for (uint8_t channel = can_autobaud ? 1 : 0; channel < canChannels.count(); channel++) {
+    ACAN2517FD * controller = canChannels.controller(channel);
+    CanTwai * twai = canChannels.twai(channel);
+    if (controller != NULL) {
+      canErrorPollers[channel].poll(*controller, millis());
+    } else if (twai != NULL) {
+      canErrorPollers[channel].poll(*twai, millis());
+    }
   }
+  
+  //read can bus data and put it to queue
+  //依次轮询每个mcp2518，每个通道一次取出最多CAN_RECEIVE_BURST帧，SPI事务和关中断的开销每批只有一次
+  //自动波特率检测只占用通道0，其他通道继续采集
+  canChannels.setPaused(0, can_autobaud);
+  static CANFDMessage burst[CAN_RECEIVE_BURST];
+  canChannels.service(millis(), burst, [](uint8_t channel, const CANFDMessage * frames, const uint32_t * timestamps, size_t count) {
+    //网关先转发整批帧，再把它们放入队列：转发不受采集白名单的影响，
+    //也不会因为队列满而等待数据消费任务(队列满时不等待，直接计为丢弃)
+    for (size_t i = 0; i < count; i++) {
+      gateway.forward(canChannels, channel, frames[i], timestamps[i]);
+    }
+    size_t dropped = 0;
+    for (size_t i = 0; i < count; i++) {
+      //白名单外的帧(硬件过滤器误收，或网关转发时控制器接收所有帧)不进入队列
+      if (!canFilter.accept(frames[i])) {
+        continue;
+      }
+      CANFDMessage * msg = new CANFDMessage;
+      *msg = frames[i];
+      data_t * can_data = new data_t{
+        .type = CAN_DATA,
+        .obj = (void *) msg,
+        .timestamp = timestamps[i],
+        .channel = channel,
+      };
+      if (xQueueSend(recv_queue , &can_data , 0) != pdTRUE) {
+        delete msg;
+        delete can_data;
+        dropped++;
+      }
+    }
+    return dropped;
+  });
 
  
 
@@ -461,45 +954,39 @@ void loop() {
    * 这里需要注意LIN总线的同步 前13位为显性电平(13个低电平,紧接一个高电平)，然后的SYNC场(始终为0x55),
     紧接着时pid场，pid的范围 0-59 (十进制，因为pid只占用5位，低两位为p1,p0), ||  60,61 为诊断请求使用。 0x3c代表休眠请求。
     pid后面就是数据场，这个数据大小应该是固定的，但需要测量，测试时候可以直接使用串口读取来观察数据的长度，一般最多8个字节
+    LinFrameParser逐字节解析，加载LDF后按LDF中的长度分帧，否则按字节间隔超时分帧
   **/
-  if (Serial1.available())
-  {
-    
-    //unsigned long timeout = 1;
-    size_t read_bytes = 0;
-    //Serial1.setTimeout(timeout);
-    int read_length = 8;
-    char * buffer = new char[read_length];
-    
-    memset(buffer,0x0,8);
-    read_bytes = Serial1.readBytes(buffer , read_length);
-    
-    lin_bus_data * data = new lin_bus_data{.data_len=8,.data=buffer};
+  //LIN调度表运行时在时隙开始发送帧头
+  uint32_t lin_baud = busConfig.active().lin_baud;
+  linScheduler.service(millis(), lin_baud);
+  linParser.setBaud(lin_baud);
+
+  LinFrame lin_frame;
+  bool lin_done = false;
+  while (Serial1.available() && !lin_done) {
+    lin_done = linParser.feed(Serial1.read(), micros(), lin_frame);
+  }
+  if (!lin_done) {
+    lin_done = linParser.poll(micros(), lin_frame);
+  }
+  if (lin_done) {
+    char * buffer = new char[lin_frame.rawLen];
+    memcpy(buffer, lin_frame.raw, lin_frame.rawLen);
+
+    lin_bus_data * data = new lin_bus_data{.data_len=lin_frame.rawLen,.data=buffer,.status=lin_frame.status};
     
     data_t * lin_data = new data_t{
       .type = LIN_DATA,
       .obj = (void *) data,
+      .timestamp = (uint32_t) micros(),
     };
     
-    xQueueSend(recv_queue , &lin_data , 1);
-
-
-    if(print_bus_message) {
-
-      String debug_str = "";
-
-      for(int i=0;i<read_bytes;i++) {
-        debug_str += String(buffer[i],16)+" ";
-      }
-
-      print_lin_data(debug_str);
-    
+    //队列满时不等待，避免阻塞采集任务和网关转发
+    if (xQueueSend(recv_queue , &lin_data , 0) != pdTRUE) {
+      delete [] buffer;
+      delete data;
+      delete lin_data;
     }
-    
-    //真正读取的数据大小,使用LinBus来读取时候会自动进行效验
-    //size_t ret_read = 0;
-    //LinBus.read((byte *)buffer , 8 , &ret_read);
-
   }
   
 
@@ -509,7 +996,30 @@ void loop() {
 
 
    //process all bus sending data queue
-   //这里需要处理所有总线要发送的数据队列逻辑，数据将从send_queue队列中读取，处理之后需要释放数据所占的内存
+   //这里需要处理所有总线要发送的数据队列逻辑，数据将从send_queue队列中读取
+   //CAN帧按值保存在队列中，控制器的发送FIFO满时留在队列中下次再发
+  //周期帧和回放的帧有计划发送时刻，先于send_queue发送
+  if (!can_autobaud) {
+    periodic.poll(can, micros());
+    replay.poll(can);
+  }
+  //按批取出send_queue中的帧，can.trySendBurst一次SPI传输写入多个发送FIFO对象，没有发出的留到下次，保持顺序
+  static CANFDMessage send_burst[CAN_SEND_BURST];
+  static size_t send_count = 0;
+  if (!can_autobaud) {
+    while (send_count < CAN_SEND_BURST && xQueueReceive(send_queue, &send_burst[send_count], 0) == pdTRUE) {
+      send_count++;
+    }
+    size_t sent = can.trySendBurst(send_burst, send_count);
+    //TXQ的帧(idx 255)不经过发送FIFO，单独发送
+    if (sent == 0 && send_count > 0 && can.tryToSend(send_burst[0])) {
+      sent = 1;
+    }
+    for (size_t i = sent; i < send_count; i++) {
+      send_burst[i - sent] = send_burst[i];
+    }
+    send_count -= sent;
+  }
 
 
 
@@ -550,14 +1060,74 @@ void loop2(void *pvParameters) {
      * 处理完message对象，需要对该对象的内存区域释放，也要释放对象里的.obj元素
      */
     data_t * message;
-    xQueueReceive( recv_queue , &message, 1);
+    if (xQueueReceive( recv_queue , &message, 1) != pdTRUE) {
+      service_loop();
+      ui_loop();
+      continue;
+    }
     
     if(message->type == CAN_DATA) { 
       CANFDMessage msg = *(CANFDMessage *)message->obj;
+      //每个通道有自己的总线负载统计；信号曲线和诊断只对应通道0的总线，所有通道的帧都经过过滤规则并记录
+      uint8_t channel = message->channel;
+      if (channel < CAN_MAX_CHANNELS) {
+        canStats[channel].onFrame(msg, millis());
+      }
+      uint8_t sets = canStage.evaluate(msg);
+      if (sets & (1 << CAN_STAGE_RECORD)) {
+        triggerCapture.writeCan(msg, message->timestamp, channel);
+      }
+      //布防时开始触发写入触发记录，否则开始采集日志
+      if (sets & (1 << CAN_STAGE_START)) {
+        if (triggerCapture.isArmed()) {
+          triggerCapture.trigger("id match");
+        } else if (!captureLog.isOpen() && captureLog.start()) {
+          Serial.printf("capture log triggered: %s\n", captureLog.path());
+        }
+      }
+      if (sets & (1 << CAN_STAGE_RECORD)) {
+        captureLog.writeCan(msg, message->timestamp, channel);
+      }
+      //停止触发帧本身也被记录
+      if ((sets & (1 << CAN_STAGE_STOP)) && captureLog.isOpen()) {
+        captureLog.stop();
+        Serial.printf("capture log stopped by trigger: %s\n", captureLog.path());
+      }
+      if (print_bus_message && (sets & (1 << CAN_STAGE_DISPLAY))) {
+        print_can_message(msg, channel);
+      }
+      if (channel == 0) {
+        signalPlot.feed(CAN_DATA, msg.id, msg.data, msg.len);
+
+        const IsoTpPdu * pdu = isotp.onFrame(msg, millis());
+        if (pdu != NULL) {
+          uint8_t flags = (pdu->ext ? CAPTURE_FLAG_EXTENDED : 0) | (pdu->fd ? CAPTURE_FLAG_FD : 0);
+          captureLog.writeBlock(CAPTURE_ISOTP, 0, pdu->id, flags, message->timestamp, pdu->data, pdu->len);
+          if (print_bus_message) {
+            print_isotp_pdu(*pdu);
+          }
+          uds.onPdu(*pdu, millis());
+          obd2.onPdu(*pdu, millis());
+        }
+      }
     }
 
     else if (message->type == LIN_DATA) {
-      
+      lin_bus_data * lin = (lin_bus_data *) message->obj;
+      uint8_t frame_id;
+      const uint8_t * frame_data;
+      uint8_t frame_len;
+      if (lin_locate_frame((const uint8_t *) lin->data, lin->data_len, frame_id, frame_data, frame_len)) {
+        signalPlot.feed(LIN_DATA, frame_id, frame_data, frame_len);
+      } else {
+        frame_id = 0xFF;
+      }
+      //LIN保存解析出的整帧[0x55, PID, 数据, 校验和]，flags为LIN_FRAME_xxx
+      captureLog.write(CAPTURE_LIN, 0, frame_id, lin->status, message->timestamp, lin->data, lin->data_len);
+      triggerCapture.write(CAPTURE_LIN, 0, frame_id, lin->status, message->timestamp, lin->data, lin->data_len);
+      if (print_bus_message) {
+        print_lin_message((const uint8_t *) lin->data, lin->data_len, frame_id, lin->status);
+      }
     }
 
     else if(message->type == K_LINE_DATA) {
@@ -573,11 +1143,16 @@ void loop2(void *pvParameters) {
       lin_bus_data * ptr =  (lin_bus_data *) message->obj;
       delete ptr->data;
       delete ptr;
+    }else if(message->type == CAN_DATA) {
+      delete (CANFDMessage *) message->obj;
     }
 
     //delete message->obj;
     delete message;
 
+    service_loop();
+    ui_loop();
+
     delayMicroseconds(1);
 
   }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+
+/**
+ * 内存分配策略：大的批量缓冲区放在PSRAM，小而频繁访问的结构留在内部SRAM
+ *
+ * MEM_BULK：触发历史、ISO-TP重组缓冲区、回放队列等按块顺序访问的大缓冲区，优先分配在PSRAM，
+ *           没有PSRAM(或PSRAM不足)时退回内部SRAM。
+ * MEM_HOT：每帧都访问的小表，只分配在内部SRAM。
+ * 驱动的收发缓冲区、recv_queue和每帧的data_t仍在内部SRAM，不经过这里。
+ *
+ * 所有缓冲区在setup()中按板上的内存一次分配，不再释放，避免运行中出现碎片；
+ * 分配的区域和静态对象的大小记录下来，开机时输出内存分布，用于按部署调整缓冲区大小。
+ */
+
+#define MEM_MAX_REGIONS   16
+
+typedef enum : uint8_t {
+  MEM_HOT,
+  MEM_BULK,
+} mem_class;
+
+typedef struct {
+  const char * name;
+  void * ptr;                  // 静态对象为NULL
+  size_t size;
+  bool psram;
+} mem_region_t;
+
+class MemPolicy {
+private:
+  mem_region_t mRegions[MEM_MAX_REGIONS];
+  uint8_t mCount;
+  uint32_t mFailures;
+
+  void record(const char * name, void * ptr, size_t size, bool psram) {
+    if (mCount < MEM_MAX_REGIONS) {
+      mRegions[mCount++] = {name, ptr, size, psram};
+    }
+  }
+
+  static void printHeap(const char * name, uint32_t caps) {
+    Serial.printf("mem %-8s total %7u, free %7u, largest %7u, min free %7u\n", name,
+                  heap_caps_get_total_size(caps), heap_caps_get_free_size(caps),
+                  heap_caps_get_largest_free_block(caps), heap_caps_get_minimum_free_size(caps));
+  }
+
+public:
+  MemPolicy() {
+    mCount = 0;
+    mFailures = 0;
+  }
+
+  bool hasPsram() {
+    return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+  }
+
+  /**
+   * 按类别分配缓冲区并记录
+   * @param name - 内存分布中显示的名称，字符串常量
+   * @return 分配失败返回NULL
+   */
+  void * alloc(const char * name, size_t size, mem_class cls) {
+    void * ptr = NULL;
+    bool psram = false;
+    if (cls == MEM_BULK) {
+      ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      psram = ptr != NULL;
+    }
+    if (ptr == NULL) {
+      ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ptr == NULL) {
+      mFailures++;
+      Serial.printf("|error:can not allocate %u bytes for %s\n", size, name);
+      return NULL;
+    }
+    record(name, ptr, size, psram);
+    return ptr;
+  }
+
+  /**
+   * 计算批量缓冲区的大小：不超过wanted和可用PSRAM的1/share的最大2的幂
+   * 没有PSRAM时返回minimum，由内部SRAM分配
+   */
+  size_t bulkSize(size_t wanted, size_t minimum, uint8_t share) {
+    size_t avail = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / share;
+    size_t size = 1;
+    while (size * 2 <= wanted && size * 2 <= avail) {
+      size *= 2;
+    }
+    return size < minimum ? minimum : size;
+  }
+
+  // 记录内部SRAM中静态对象的大小
+  void note(const char * name, size_t size) {
+    record(name, NULL, size, false);
+  }
+
+  // 输出内部SRAM和PSRAM的使用情况和所有记录的区域
+  void print() {
+    printHeap("internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    printHeap("psram", MALLOC_CAP_SPIRAM);
+    size_t internal = 0;
+    size_t psram = 0;
+    for (uint8_t i = 0; i < mCount; i++) {
+      const mem_region_t & r = mRegions[i];
+      Serial.printf("mem   %-16s %7u %s\n", r.name, r.size,
+                    r.psram ? "psram" : (r.ptr != NULL ? "internal" : "static"));
+      (r.psram ? psram : internal) += r.size;
+    }
+    Serial.printf("mem regions: %u bytes internal, %u bytes psram, %u failed allocations\n",
+                  internal, psram, mFailures);
+  }
+};
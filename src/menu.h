@@ -3,6 +3,9 @@
 
 #include <TFT_eSPI.h>
 
+// 菜单最大嵌套层数
+#define MENU_MAX_DEPTH 8
+
 // 定义菜单项类型枚举
 enum MenuItemType {
     MENU_TYPE_NORMAL,        // 普通菜单项
@@ -10,130 +13,157 @@ enum MenuItemType {
     MENU_TYPE_EDITABLE_BOOL, // 可编辑布尔值项
     MENU_TYPE_EDITABLE_TEXT, // 可编辑文本项
     MENU_TYPE_EDITABLE_NUMBER, // 可编辑数字项
-    MENU_TYPE_ACTION         // 动作项
+    MENU_TYPE_ACTION,        // 动作项
+    MENU_TYPE_BACK,          // 返回上级菜单项
+    MENU_TYPE_EDITABLE_CHOICE // 可编辑选项项（在一组选项中选择一个）
 };
 
-// 数字范围结构体，用于限制可编辑数字项的取值范围
-struct NumberRange {
-    int* value;      // 指向实际整数值的指针
-    int minValue;    // 最小值
-    int maxValue;    // 最大值
-};
+struct MenuPage;
 
-// 菜单项结构体定义
+/**
+ * 菜单项结构体定义
+ * 菜单项不再单独在堆上创建，而是以constexpr数组的形式定义在flash中，
+ * 使用下面的menuXxx()辅助函数构造
+ */
 struct MenuItem {
-    String label;              // 菜单项标签
-    int id;                   // 菜单项ID
-    bool enabled;             // 是否可用
+    const char* label;        // 菜单项标签（字符串常量，位于flash）
     MenuItemType type;        // 菜单项类型
     void* value;              // 存储可编辑值的指针（根据类型决定实际指向的内容）
-    struct Menu* submenu;     // 子菜单指针
+    int minValue;             // 可编辑数字项的最小值
+    int maxValue;             // 可编辑数字项的最大值
+    const MenuPage* submenu;  // 子菜单指针
     void (*action)();         // 动作函数指针
-    
-    // 构造函数：创建一个新的菜单项
-    MenuItem(String l, int i, bool e = true) : label(l), id(i), enabled(e) {
-        type = MENU_TYPE_NORMAL;
-        value = nullptr;
-        submenu = nullptr;
-        action = nullptr;
-    }
+    const char* const* options; // 选项项的选项名称数组
 };
 
 /**
- * Menu类 - 用于创建和管理多级菜单系统
- * 支持多种菜单项类型：普通项、子菜单、可编辑项（布尔、文本、数字）、动作项
- * 使用TFT_eSPI库进行显示，并通过Sprite优化绘图性能
+ * 菜单页定义：标题和一个连续的菜单项数组
+ */
+struct MenuPage {
+    const char* title;        // 菜单标题
+    const MenuItem* items;    // 菜单项数组
+    uint8_t itemCount;        // 菜单项数量
+};
+
+// 构造子菜单项
+constexpr MenuItem menuSubmenu(const char* label, const MenuPage* submenu) {
+    return MenuItem{label, MENU_TYPE_SUBMENU, nullptr, 0, 0, submenu, nullptr, nullptr};
+}
+
+// 构造布尔型可编辑项（如开关：开/关）
+constexpr MenuItem menuBool(const char* label, bool* value) {
+    return MenuItem{label, MENU_TYPE_EDITABLE_BOOL, value, 0, 1, nullptr, nullptr, nullptr};
+}
+
+// 构造文本型可编辑项
+constexpr MenuItem menuText(const char* label, char* value) {
+    return MenuItem{label, MENU_TYPE_EDITABLE_TEXT, value, 0, 0, nullptr, nullptr, nullptr};
+}
+
+// 构造数字型可编辑项（带范围限制的数字输入）
+constexpr MenuItem menuNumber(const char* label, int* value, int minValue, int maxValue) {
+    return MenuItem{label, MENU_TYPE_EDITABLE_NUMBER, value, minValue, maxValue, nullptr, nullptr, nullptr};
+}
+
+// 构造动作项（点击后执行特定函数的菜单项）
+constexpr MenuItem menuAction(const char* label, void (*action)()) {
+    return MenuItem{label, MENU_TYPE_ACTION, nullptr, 0, 0, nullptr, action, nullptr};
+}
+
+// 构造选项型可编辑项，value为当前选中的选项序号，options为选项名称数组
+template <size_t N>
+constexpr MenuItem menuChoice(const char* label, int* value, const char* const (&options)[N]) {
+    return MenuItem{label, MENU_TYPE_EDITABLE_CHOICE, value, 0, (int)N - 1, nullptr, nullptr, options};
+}
+
+// 构造返回项（点击后回到上一级菜单）
+constexpr MenuItem menuBack(const char* label) {
+    return MenuItem{label, MENU_TYPE_BACK, nullptr, 0, 0, nullptr, nullptr, nullptr};
+}
+
+// 根据菜单项数组构造菜单页
+template <size_t N>
+constexpr MenuPage menuPage(const char* title, const MenuItem (&items)[N]) {
+    return MenuPage{title, items, (uint8_t)N};
+}
+
+/**
+ * MenuController类 - 多级菜单的导航与显示
+ * 菜单结构由constexpr的MenuPage表描述，控制器只保存一个菜单栈（每层记录当前页、选中项和滚动位置），
+ * 所有菜单共用同一个Sprite进行绘制
  */
-class Menu {
+class MenuController {
 private:
+    // 菜单栈中的一层
+    struct Level {
+        const MenuPage* page;  // 当前菜单页
+        int selected;          // 当前选中的菜单项索引
+        int topItem;           // 显示的第一个菜单项索引（用于滚动）
+    };
+
     TFT_eSPI& tft;           // 引用TFT显示屏对象
-    MenuItem** items;        // 菜单项数组指针
-    int itemCount;           // 当前菜单项总数
-    int selected;            // 当前选中的菜单项索引
-    int topItem;             // 显示的第一个菜单项索引（用于滚动）
+    TFT_eSprite* sprite;     // 所有菜单共用的Sprite对象
+    Level stack[MENU_MAX_DEPTH]; // 菜单栈
+    int depth;               // 菜单栈深度，stack[depth - 1]为当前菜单
     int maxVisibleItems;     // 屏幕上可显示的最大菜单项数
     int itemHeight;          // 每个菜单项的高度
     int itemWidth;           // 菜单项宽度
-    TFT_eSprite* sprite;     // 用于绘制的Sprite对象，提高绘图效率
     bool editingMode;        // 编辑模式标志（true表示正在编辑可编辑项）
-    int menuId;              // 菜单唯一标识符
-    Menu* parentMenu;        // 父菜单指针（用于返回上级菜单）
-    
+
+    // 当前菜单层
+    Level& current();
+
     // 绘制单个菜单项
     void drawMenuItem(int index, bool isSelected);
-    
+
     // 清除菜单显示区域
     void clearMenuArea();
-    
+
+    // 编辑模式下修改当前项的值，delta为+1或-1
+    void editCurrent(int delta);
+
 public:
-    // 构造函数：初始化菜单对象
-    Menu(TFT_eSPI& display);
-    
-    // 析构函数：释放分配的内存资源
-    ~Menu();
-    
-    // 添加菜单项到当前菜单
-    void addItem(MenuItem* item);
-    
-    // 初始化菜单（创建Sprite、设置显示参数等）
-    void init();
-    
+    // 构造函数：初始化菜单控制器
+    MenuController(TFT_eSPI& display);
+
+    // 析构函数：释放Sprite
+    ~MenuController();
+
+    // 初始化菜单（创建共用Sprite，设置根菜单）
+    void init(const MenuPage* root);
+
     // 显示菜单（绘制并推送到屏幕）
     void show();
-    
+
     // 处理菜单导航 - 向上移动选择
     void navigateUp();
-    
+
     // 处理菜单导航 - 向下移动选择
     void navigateDown();
-    
-    // 选择当前高亮的菜单项（执行相应操作）
-    int selectCurrent();
-    
-    // 获取当前选中的菜单项ID
+
+    // 选择当前高亮的菜单项（进入子菜单、返回、切换编辑模式或执行动作）
+    void selectCurrent();
+
+    // 返回上一级菜单，已经在根菜单时返回false
+    bool back();
+
+    // 获取当前选中的菜单项索引
     int getCurrentSelection();
-    
-    // 更新菜单显示
-    void updateDisplay();
-    
+
+    // 获取当前菜单页
+    const MenuPage* currentPage();
+
     // 设置屏幕尺寸参数
     void setDimensions(int width, int height);
-    
-    // 添加子菜单项（带有子菜单的菜单项）
-    void addSubmenuItem(const char* label, Menu* submenu);
-    
-    // 添加布尔型可编辑项（如开关：开/关）
-    void addEditableBoolItem(const char* label, bool* value);
-    
-    // 添加文本型可编辑项（如字符串输入）
-    void addEditableTextItem(const char* label, char* value);
-    
-    // 添加数字型可编辑项（带范围限制的数字输入）
-    void addEditableNumberItem(const char* label, int* value, int minValue, int maxValue);
-    
-    // 添加动作项（点击后执行特定函数的菜单项）
-    void addActionItem(const char* label, void (*action)());
-    
+
     // 退出编辑模式
     void exitEditingMode();
-    
+
     // 检查是否处于编辑模式
     bool isInEditingMode();
-    
-    // 设置父菜单（用于菜单层级导航）
-    void setParent(Menu* parent);
-    
-    // 获取父菜单
-    Menu* getParent();
-    
-    // 获取菜单ID
-    int getId();
-    
-    // 设置菜单ID
-    void setId(int id);
-    
+
     // 获取当前选中项的标签
-    String getCurrentSelectionLabel();
+    const char* getCurrentSelectionLabel();
 };
 
-#endif
\ No newline at end of file
+#endif
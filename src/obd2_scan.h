@@ -0,0 +1,404 @@
+#pragma once
+
+#include <Arduino.h>
+#include "isotp.h"
+
+/**
+ * CAN上的OBD-II Mode 01实时数据扫描(SAE J1979 / ISO 15765-4)
+ *
+ * 1.发现：向功能地址(0x7DF或0x18DB33F1)依次请求位图PID 0x00、0x20...，
+ *   记录应答的ECU和所有ECU支持的PID
+ * 2.扫描：把支持的PID按每个请求最多6个分组，循环发送多PID请求，
+ *   所有已知ECU都应答后立即发送下一个请求，不等待固定的应答窗口
+ * 多PID应答按标准PID的数据长度拆分，长度未知的PID单独请求。
+ * 应答超过单帧时需要流控帧，所以为每个应答的ECU打开一个IsoTp物理寻址链路(0x7E0+n / 0x18DAxxF1)。
+ *
+ * 在数据消费任务中调用：onPdu()处理IsoTp输出的PDU，service()发送请求。
+ */
+
+#define OBD2_ECUS               8
+#define OBD2_PIDS_PER_REQUEST   6
+#define OBD2_RESPONSE_MS        100     // 等待所有ECU应答的时间(J1979 P2最大50ms)
+#define OBD2_RATE_MS            1000    // 统计刷新率的周期
+
+// 标准PID的换算：value = raw * scale + offset，raw为A或256A+B
+struct Obd2PidInfo {
+  uint8_t pid;
+  uint8_t bytes;          // 参与换算的字节数 1或2
+  const char * name;
+  const char * unit;
+  float scale;
+  float offset;
+};
+
+static const Obd2PidInfo obd2_pid_info[] = {
+  {0x04, 1, "Load",         "%",    100.0f / 255, 0},
+  {0x05, 1, "Coolant",      "C",    1,           -40},
+  {0x06, 1, "STFT1",        "%",    100.0f / 128, -100},
+  {0x07, 1, "LTFT1",        "%",    100.0f / 128, -100},
+  {0x08, 1, "STFT2",        "%",    100.0f / 128, -100},
+  {0x09, 1, "LTFT2",        "%",    100.0f / 128, -100},
+  {0x0A, 1, "FuelPress",    "kPa",  3,            0},
+  {0x0B, 1, "MAP",          "kPa",  1,            0},
+  {0x0C, 2, "RPM",          "rpm",  0.25f,        0},
+  {0x0D, 1, "Speed",        "km/h", 1,            0},
+  {0x0E, 1, "Timing",       "deg",  0.5f,        -64},
+  {0x0F, 1, "IAT",          "C",    1,           -40},
+  {0x10, 2, "MAF",          "g/s",  0.01f,        0},
+  {0x11, 1, "Throttle",     "%",    100.0f / 255, 0},
+  {0x1F, 2, "RunTime",      "s",    1,            0},
+  {0x21, 2, "MILDist",      "km",   1,            0},
+  {0x22, 2, "RailPress",    "kPa",  0.079f,       0},
+  {0x23, 2, "RailPressD",   "kPa",  10,           0},
+  {0x2C, 1, "EGR",          "%",    100.0f / 255, 0},
+  {0x2F, 1, "FuelLevel",    "%",    100.0f / 255, 0},
+  {0x30, 1, "Warmups",      "",     1,            0},
+  {0x31, 2, "ClearDist",    "km",   1,            0},
+  {0x33, 1, "Baro",         "kPa",  1,            0},
+  {0x3C, 2, "CatTemp11",    "C",    0.1f,        -40},
+  {0x3D, 2, "CatTemp21",    "C",    0.1f,        -40},
+  {0x3E, 2, "CatTemp12",    "C",    0.1f,        -40},
+  {0x3F, 2, "CatTemp22",    "C",    0.1f,        -40},
+  {0x42, 2, "ModuleVolt",   "V",    0.001f,       0},
+  {0x43, 2, "AbsLoad",      "%",    100.0f / 255, 0},
+  {0x44, 2, "Lambda",       "",     2.0f / 65536, 0},
+  {0x45, 1, "RelThrottle",  "%",    100.0f / 255, 0},
+  {0x46, 1, "Ambient",      "C",    1,           -40},
+  {0x47, 1, "ThrottleB",    "%",    100.0f / 255, 0},
+  {0x49, 1, "PedalD",       "%",    100.0f / 255, 0},
+  {0x4A, 1, "PedalE",       "%",    100.0f / 255, 0},
+  {0x4C, 1, "ThrottleCmd",  "%",    100.0f / 255, 0},
+  {0x4D, 2, "MILTime",      "min",  1,            0},
+  {0x4E, 2, "ClearTime",    "min",  1,            0},
+  {0x52, 1, "Ethanol",      "%",    100.0f / 255, 0},
+  {0x5C, 1, "OilTemp",      "C",    1,           -40},
+  {0x5E, 2, "FuelRate",     "L/h",  0.05f,        0},
+};
+
+// PID 0x00-0x5F应答数据的字节数，0表示未知(这样的PID单独请求)
+static const uint8_t obd2_pid_lengths[0x60] = {
+  4, 4, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1,   // 0x00
+  2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2,   // 0x10
+  4, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1,   // 0x20
+  1, 2, 2, 1, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2,   // 0x30
+  4, 4, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 4,   // 0x40
+  4, 1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1,   // 0x50
+};
+
+static inline uint8_t obd2_pid_length(uint8_t pid) {
+  if ((pid & 0x1F) == 0) {
+    return 4;   // 支持PID的位图
+  }
+  return pid < sizeof(obd2_pid_lengths) ? obd2_pid_lengths[pid] : 0;
+}
+
+static inline const Obd2PidInfo * obd2_find_pid(uint8_t pid) {
+  for (uint8_t i = 0; i < sizeof(obd2_pid_info) / sizeof(obd2_pid_info[0]); i++) {
+    if (obd2_pid_info[i].pid == pid) {
+      return &obd2_pid_info[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * 收到一个PID的值
+ * @param info - 标准PID的换算，没有时为NULL，value无效，只能使用原始数据
+ */
+typedef void (*obd2_value_t)(uint32_t ecu, uint8_t pid, const Obd2PidInfo * info, float value,
+                             const uint8_t * data, uint8_t len);
+
+class Obd2Scanner {
+private:
+  enum State { IDLE, DISCOVER, SCAN };
+
+  IsoTp & mIsoTp;
+  obd2_value_t mOnValue;
+  State mState;
+  bool mExt;
+
+  uint32_t mEcus[OBD2_ECUS];        // 应答ECU的ID
+  uint8_t mEcuCount;
+  bool mLinks;                      // 所有ECU都有流控链路，应答可以是多帧
+  uint8_t mSupported[32];           // 所有ECU支持的PID位图的并集
+
+  uint8_t mPids[0x100];             // 扫描的PID列表
+  uint8_t mPidCount;
+  uint8_t mCursor;
+
+  uint8_t mResponded;               // 已应答的ECU位图
+  uint32_t mSentMs;
+  bool mWaiting;
+  uint8_t mDiscoverStep;
+
+  uint32_t mSamples[0x100];         // 每个PID收到的值的数量
+  uint32_t mLastSamples[0x100];
+  uint16_t mRates[0x100];           // 每秒的值的数量
+  uint32_t mRequests;
+  uint32_t mLastRequests;
+  uint16_t mRequestRate;
+  uint32_t mRateMs;
+
+  uint32_t functionalId() {
+    return mExt ? 0x18DB33F1 : 0x7DF;
+  }
+
+  // 应答ID是否在OBD的范围内
+  bool isResponse(const IsoTpPdu & pdu) {
+    if (pdu.ext != mExt) {
+      return false;
+    }
+    return mExt ? ((pdu.id & 0xFFFFFF00) == 0x18DAF100) : (pdu.id >= 0x7E8 && pdu.id <= 0x7EF);
+  }
+
+  // 记录应答的ECU，并打开物理寻址的链路用于回复流控帧
+  int8_t ecuIndex(uint32_t id) {
+    for (uint8_t i = 0; i < mEcuCount; i++) {
+      if (mEcus[i] == id) {
+        return i;
+      }
+    }
+    if (mEcuCount >= OBD2_ECUS) {
+      return -1;
+    }
+    uint32_t tx = mExt ? (0x18DA00F1 | ((id & 0xFF) << 8)) : id - 8;
+    if (mIsoTp.open(tx, id, mExt) < 0) {
+      mLinks = false;
+    }
+    mEcus[mEcuCount] = id;
+    return mEcuCount++;
+  }
+
+  bool isSupported(uint8_t pid) {
+    return mSupported[pid >> 3] & (0x80 >> (pid & 7));
+  }
+
+  // 记录位图PID的应答：bit7 of A对应PID+1
+  void addBitmap(uint8_t base, const uint8_t * data) {
+    for (uint8_t i = 0; i < 32 && base + 1 + i < 0x100; i++) {
+      if (data[i >> 3] & (0x80 >> (i & 7))) {
+        uint8_t pid = base + 1 + i;
+        mSupported[pid >> 3] |= 0x80 >> (pid & 7);
+      }
+    }
+  }
+
+  bool sendRequest(const uint8_t * pids, uint8_t count, uint32_t now) {
+    uint8_t data[1 + OBD2_PIDS_PER_REQUEST];
+    data[0] = 0x01;
+    memcpy(data + 1, pids, count);
+    if (!mIsoTp.sendSingle(functionalId(), mExt, data, count + 1)) {
+      return false;
+    }
+    mResponded = 0;
+    mSentMs = now;
+    mWaiting = true;
+    mRequests++;
+    return true;
+  }
+
+  /**
+   * 发送下一个发现请求，全部完成时返回false
+   * 位图PID逐个请求：0x00总是请求，之后的位图只在前一个位图标明支持时请求。
+   * 单个位图的应答是单帧，收到时才知道有哪些ECU，还没有打开流控链路
+   */
+  bool discover(uint32_t now) {
+    if (mDiscoverStep >= 8) {
+      return false;
+    }
+    uint8_t base = mDiscoverStep * 0x20;
+    if (base != 0 && !isSupported(base)) {
+      return false;
+    }
+    if (sendRequest(&base, 1, now)) {
+      mDiscoverStep++;
+    }
+    return true;
+  }
+
+  // 发现完成，建立扫描列表
+  void startScan() {
+    mPidCount = 0;
+    for (uint16_t pid = 1; pid < 0x100; pid++) {
+      if ((pid & 0x1F) != 0 && isSupported(pid)) {
+        mPids[mPidCount++] = pid;
+      }
+    }
+    mCursor = 0;
+    mState = mPidCount > 0 ? SCAN : IDLE;
+  }
+
+  /**
+   * 从扫描列表中取下一组PID
+   * 长度未知的PID单独一组；没有流控链路时整个应答必须放在一个单帧中(7字节)
+   */
+  uint8_t nextGroup(uint8_t * pids) {
+    uint8_t count = 0;
+    uint16_t response = 1;
+    uint16_t maxResponse = mLinks ? ISOTP_MAX_PDU : 7;
+    while (count < OBD2_PIDS_PER_REQUEST) {
+      uint8_t pid = mPids[mCursor];
+      uint8_t len = obd2_pid_length(pid);
+      if (count > 0 && (len == 0 || response + 1 + len > maxResponse)) {
+        break;
+      }
+      pids[count++] = pid;
+      response += 1 + len;
+      mCursor = (mCursor + 1) % mPidCount;
+      if (len == 0 || mCursor == 0) {
+        break;
+      }
+    }
+    return count;
+  }
+
+  // 拆分多PID应答 41 pid data pid data ...
+  void parseResponse(uint32_t ecu, const uint8_t * data, uint16_t len) {
+    uint16_t pos = 1;
+    while (pos < len) {
+      uint8_t pid = data[pos++];
+      uint8_t pidLen = obd2_pid_length(pid);
+      if (pidLen == 0) {
+        // 长度未知的PID是单独请求的，剩余的数据都属于它
+        pidLen = len - pos;
+      }
+      if (pos + pidLen > len) {
+        return;
+      }
+      const uint8_t * value = data + pos;
+      pos += pidLen;
+      if ((pid & 0x1F) == 0) {
+        addBitmap(pid, value);
+        continue;
+      }
+      mSamples[pid]++;
+      if (mOnValue) {
+        const Obd2PidInfo * info = obd2_find_pid(pid);
+        float physical = 0;
+        if (info != NULL) {
+          uint16_t raw = info->bytes == 2 ? ((value[0] << 8) | value[1]) : value[0];
+          physical = raw * info->scale + info->offset;
+        }
+        mOnValue(ecu, pid, info, physical, value, pidLen);
+      }
+    }
+  }
+
+  void updateRates(uint32_t now) {
+    if (now - mRateMs < OBD2_RATE_MS) {
+      return;
+    }
+    for (uint16_t pid = 0; pid < 0x100; pid++) {
+      mRates[pid] = mSamples[pid] - mLastSamples[pid];
+      mLastSamples[pid] = mSamples[pid];
+    }
+    mRequestRate = mRequests - mLastRequests;
+    mLastRequests = mRequests;
+    mRateMs = now;
+  }
+
+public:
+  Obd2Scanner(IsoTp & isotp) : mIsoTp(isotp) {
+    mOnValue = NULL;
+    mState = IDLE;
+    mExt = false;
+    stop();
+  }
+
+  void setCallback(obd2_value_t onValue) {
+    mOnValue = onValue;
+  }
+
+  /**
+   * 开始发现和扫描
+   * @param ext - 使用29位ID(0x18DB33F1)
+   */
+  void start(bool ext) {
+    stop();
+    mExt = ext;
+    mState = DISCOVER;
+  }
+
+  void stop() {
+    mState = IDLE;
+    mEcuCount = 0;
+    mLinks = true;
+    mPidCount = 0;
+    mCursor = 0;
+    mWaiting = false;
+    mDiscoverStep = 0;
+    mRequests = 0;
+    mLastRequests = 0;
+    mRequestRate = 0;
+    mRateMs = millis();
+    memset(mSupported, 0, sizeof(mSupported));
+    memset(mSamples, 0, sizeof(mSamples));
+    memset(mLastSamples, 0, sizeof(mLastSamples));
+    memset(mRates, 0, sizeof(mRates));
+  }
+
+  bool isRunning() {
+    return mState != IDLE;
+  }
+
+  /**
+   * 处理IsoTp输出的PDU
+   * @return PDU是Mode 01应答时返回true
+   */
+  bool onPdu(const IsoTpPdu & pdu, uint32_t now) {
+    if (mState == IDLE || pdu.len < 2 || pdu.data[0] != 0x41 || !isResponse(pdu)) {
+      return false;
+    }
+    int8_t ecu = ecuIndex(pdu.id);
+    parseResponse(pdu.id, pdu.data, pdu.len);
+    if (ecu >= 0 && mWaiting) {
+      mResponded |= 1 << ecu;
+      // 扫描时所有已知ECU都应答了就立即发送下一个请求
+      if (mState == SCAN && mResponded == (1 << mEcuCount) - 1) {
+        mWaiting = false;
+      }
+    }
+    return true;
+  }
+
+  // 周期调用：应答完成或超时后发送下一个请求
+  void service(uint32_t now) {
+    if (mState == IDLE) {
+      return;
+    }
+    updateRates(now);
+    if (mWaiting && now - mSentMs < OBD2_RESPONSE_MS) {
+      return;
+    }
+    mWaiting = false;
+
+    if (mState == DISCOVER) {
+      if (discover(now)) {
+        return;
+      }
+      startScan();
+      if (mState == IDLE) {
+        Serial.println("|error:obd2 no supported pid");
+        return;
+      }
+    }
+    uint8_t pids[OBD2_PIDS_PER_REQUEST];
+    uint8_t cursor = mCursor;
+    uint8_t count = nextGroup(pids);
+    if (!sendRequest(pids, count, now)) {
+      mCursor = cursor;
+    }
+  }
+
+  // 输出每个PID达到的刷新率
+  void print() {
+    Serial.printf("obd2: %s, %u ecus, %u pids, %u requests/s%s\n",
+                  mState == SCAN ? "scanning" : (mState == DISCOVER ? "discovering" : "stopped"),
+                  mEcuCount, mPidCount, mRequestRate, mLinks ? "" : ", single frame only");
+    for (uint16_t i = 0; i < mPidCount; i++) {
+      uint8_t pid = mPids[i];
+      const Obd2PidInfo * info = obd2_find_pid(pid);
+      Serial.printf("pid %02X %-12s %u/s\n", pid, info ? info->name : "", mRates[pid]);
+    }
+  }
+};
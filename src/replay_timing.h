@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * CAN回放的调度计时：记录时间到计划发送时刻的换算，以及调度误差的统计
+ *
+ * 只用到整数运算，不依赖Arduino和定时器，主机测试(test/test_replay_timing)直接包含这个文件。
+ * CanReplay在数据消费任务中用ReplayClock计算每帧的计划发送时刻，在采集任务中用ReplayErrors记录误差。
+ */
+
+#define CAN_REPLAY_START_US     10000    // 开始回放后第一帧的发送时刻
+#define CAN_REPLAY_LATE_US      50       // 超过这个误差的帧单独计数
+#define CAN_REPLAY_HISTOGRAM    6
+
+// 误差分布的区间上限(us)，最后一个区间为1000us以上
+static const uint16_t can_replay_histogram_limits[CAN_REPLAY_HISTOGRAM - 1] = {10, 25, 50, 100, 1000};
+
+/**
+ * 把日志中每帧的记录时间换算成回放定时器上的计划发送时刻
+ * 记录时间是32位的micros()，相邻两帧相减可以跨过回绕；累计时间是64位的，长时间的日志也不会溢出
+ */
+class ReplayClock {
+private:
+  uint32_t mSpeed;             // 回放速度，1000为原速
+  bool mFirst;
+  uint32_t mLastTimestamp;
+  uint64_t mElapsed;           // 距第一帧的记录时间(us)
+
+public:
+  ReplayClock() {
+    reset(1000);
+  }
+
+  /**
+   * 开始新的回放
+   * @param speed - 回放速度，1000为原速，2000为两倍速，不能为0
+   */
+  void reset(uint32_t speed) {
+    mSpeed = speed;
+    mFirst = true;
+    mLastTimestamp = 0;
+    mElapsed = 0;
+  }
+
+  uint32_t speed() {
+    return mSpeed;
+  }
+
+  /**
+   * 按顺序对每条CAN记录调用一次，包括不能发送而被跳过的记录，后面的帧保持原来的间隔
+   * @param timestamp - 记录头中的采集时间(us)
+   * @return 计划发送时刻(定时器us)，第一帧为CAN_REPLAY_START_US
+   */
+  uint64_t due(uint32_t timestamp) {
+    if (mFirst) {
+      mFirst = false;
+    } else {
+      mElapsed += (uint32_t)(timestamp - mLastTimestamp);
+    }
+    mLastTimestamp = timestamp;
+    return CAN_REPLAY_START_US + mElapsed * 1000 / mSpeed;
+  }
+};
+
+/**
+ * 调度误差 = 实际发送时的定时器值 - 计划发送时刻，统计最大值、平均值和分布
+ */
+class ReplayErrors {
+private:
+  uint32_t mCount;
+  uint32_t mLate;              // 误差超过CAN_REPLAY_LATE_US的帧数
+  uint32_t mMax;
+  uint64_t mSum;
+  uint32_t mHistogram[CAN_REPLAY_HISTOGRAM];
+
+public:
+  ReplayErrors() {
+    reset();
+  }
+
+  void reset() {
+    mCount = 0;
+    mLate = 0;
+    mMax = 0;
+    mSum = 0;
+    memset(mHistogram, 0, sizeof(mHistogram));
+  }
+
+  /**
+   * 记录一帧的误差
+   * @param due - 计划发送时刻
+   * @param sentAt - 帧交给控制器时的定时器值，早于计划时刻时误差为0
+   */
+  void record(uint64_t due, uint64_t sentAt) {
+    uint64_t late = sentAt > due ? sentAt - due : 0;
+    uint32_t error = late > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) late;
+    mCount++;
+    mSum += error;
+    if (error > mMax) {
+      mMax = error;
+    }
+    if (error > CAN_REPLAY_LATE_US) {
+      mLate++;
+    }
+    uint8_t bucket = 0;
+    while (bucket < CAN_REPLAY_HISTOGRAM - 1 && error >= can_replay_histogram_limits[bucket]) {
+      bucket++;
+    }
+    mHistogram[bucket]++;
+  }
+
+  uint32_t count() {
+    return mCount;
+  }
+
+  uint32_t late() {
+    return mLate;
+  }
+
+  uint32_t maxError() {
+    return mMax;
+  }
+
+  uint32_t meanError() {
+    return mCount ? (uint32_t)(mSum / mCount) : 0;
+  }
+
+  uint32_t histogram(uint8_t bucket) {
+    return mHistogram[bucket];
+  }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <TFT_eSPI.h>
+#include "can_stats.h"
+
+#define STATS_SCREEN_REFRESH_MS  500
+#define STATS_SCREEN_TOP_IDS     8
+
+/**
+ * StatsScreen类 - 在TFT上显示CAN总线统计
+ * 上半部分是负载、帧率、错误计数和总线状态，下半部分是帧率最高的几个ID。
+ * 每500ms在Sprite中重画一次再推送，避免闪烁。
+ */
+class StatsScreen {
+private:
+    TFT_eSPI& tft;
+    CanStats& stats;
+    TFT_eSprite* sprite;
+    uint32_t lastDrawMs;
+    bool active;
+
+    static uint16_t stateColor(uint8_t state) {
+        switch (state) {
+            case CAN_ERROR_ACTIVE:  return TFT_GREEN;
+            case CAN_ERROR_WARNING: return TFT_YELLOW;
+            case CAN_ERROR_PASSIVE: return TFT_ORANGE;
+            default:                return TFT_RED;
+        }
+    }
+
+    void draw(uint32_t now) {
+        const can_stats_record_t& r = stats.record();
+        char line[64];
+        int y = 0;
+
+        sprite->fillSprite(TFT_BLACK);
+        sprite->setTextColor(TFT_WHITE, TFT_BLACK);
+
+        snprintf(line, sizeof(line), "CAN %lu/%lu kbps", (unsigned long)stats.arbitrationRate() / 1000,
+                 (unsigned long)stats.dataRate() / 1000);
+        sprite->drawString(line, 2, y, 2);
+        y += 18;
+
+        // 负载条
+        int barWidth = (sprite->width() - 4) * r.bus_load / 10000;
+        uint16_t loadColor = r.bus_load > 7000 ? TFT_RED : (r.bus_load > 4000 ? TFT_YELLOW : TFT_GREEN);
+        sprite->drawRect(2, y, sprite->width() - 4, 12, TFT_DARKGREY);
+        sprite->fillRect(2, y, barWidth, 12, loadColor);
+        y += 14;
+
+        snprintf(line, sizeof(line), "Load %u.%02u%%  %u fps  FD %u  Err %u/s",
+                 r.bus_load / 100, r.bus_load % 100, r.frames_per_s, r.fd_frames_per_s, r.errors_per_s);
+        sprite->drawString(line, 2, y, 2);
+        y += 18;
+
+        snprintf(line, sizeof(line), "TEC %u (%+d)  REC %u (%+d)  IDs %u",
+                 r.tec, r.tec_trend, r.rec, r.rec_trend, r.active_ids);
+        sprite->drawString(line, 2, y, 2);
+        y += 18;
+
+        sprite->setTextColor(stateColor(r.state), TFT_BLACK);
+        snprintf(line, sizeof(line), "State %s  changes %u  ovf %u",
+                 can_bus_state_names[r.state], r.state_changes, r.overflows);
+        sprite->drawString(line, 2, y, 2);
+        y += 22;
+
+        // 帧率最高的ID
+        const CanStats::IdEntry* ids[STATS_SCREEN_TOP_IDS];
+        uint32_t rates[STATS_SCREEN_TOP_IDS];
+        uint8_t n = stats.topIds(now, ids, rates, STATS_SCREEN_TOP_IDS);
+        sprite->setTextColor(TFT_CYAN, TFT_BLACK);
+        for (uint8_t i = 0; i < n && y + 16 <= sprite->height(); i++) {
+            bool ext = ids[i]->key & 0x80000000;
+            snprintf(line, sizeof(line), ext ? "%08lX  %lu/s" : "%03lX  %lu/s",
+                     (unsigned long)(ids[i]->key & 0x1FFFFFFF), (unsigned long)rates[i]);
+            sprite->drawString(line, 2 + (i % 2) * (sprite->width() / 2), y, 2);
+            if (i % 2) {
+                y += 16;
+            }
+        }
+
+        sprite->pushSprite(0, 0);
+    }
+
+public:
+    StatsScreen(TFT_eSPI& display, CanStats& canStats) : tft(display), stats(canStats) {
+        sprite = nullptr;
+        lastDrawMs = 0;
+        active = false;
+    }
+
+    ~StatsScreen() {
+        end();
+    }
+
+    // 进入统计显示
+    void begin(uint32_t now) {
+        if (active) {
+            return;
+        }
+        sprite = new TFT_eSprite(&tft);
+        sprite->setColorDepth(8);
+        sprite->createSprite(tft.width(), tft.height());
+        active = true;
+        draw(now);
+        lastDrawMs = now;
+    }
+
+    // 退出统计显示，释放Sprite
+    void end() {
+        if (sprite) {
+            sprite->deleteSprite();
+            delete sprite;
+            sprite = nullptr;
+        }
+        active = false;
+    }
+
+    bool isActive() {
+        return active;
+    }
+
+    // 周期调用，正在显示时每STATS_SCREEN_REFRESH_MS刷新一次
+    void render(uint32_t now) {
+        if (!active || now - lastDrawMs < STATS_SCREEN_REFRESH_MS) {
+            return;
+        }
+        draw(now);
+        lastDrawMs = now;
+    }
+};
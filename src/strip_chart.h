@@ -0,0 +1,296 @@
+#pragma once
+
+#include <TFT_eSPI.h>
+#include "strip_signal.h"
+#include "dbc_decoder.h"
+
+#define STRIP_CHART_MAX_SIGNALS 4
+#define STRIP_CHART_MAX_WIDTH   320
+#define STRIP_CHART_HEADER      20       // 顶部标题栏高度，显示信号名和当前值
+#define STRIP_CHART_LEVELS      254      // 环形缓冲中数值量化的级数
+#define STRIP_CHART_NO_DATA     0xFF     // 该列没有采样
+
+/**
+ * StripChart类 - 在TFT上实时滚动显示解码后的信号曲线
+ *
+ * 每个订阅的信号对应一个环形缓冲区，每一列(一个像素宽)保存一个时间桶内的最小/最大值，
+ * 因此无论信号的刷新率多高，绘图开销只和列数有关。
+ * 绘图采用增量方式：时间桶结束后把Sprite左移，只画新出现的列，然后推送到屏幕。
+ *
+ * 订阅时把信号定义编译成DBC解码使用的提取计划(DbcDecoder::compile)，两者的位编号和提取结果一致。
+ * feed()在数据消费任务中调用，每帧只做ID比较和位提取；render()在同一任务中周期调用，
+ * 不会给采集核心(loop)增加任何负担。
+ */
+class StripChart {
+private:
+    struct Channel {
+        const SignalDef* def;                    // 订阅的信号
+        DbcSignalPlan plan;                      // 编译后的提取计划
+        uint16_t color;                          // 曲线颜色
+        uint8_t high[STRIP_CHART_MAX_WIDTH];     // 环形缓冲：每列最大值(按显示范围量化)
+        uint8_t low[STRIP_CHART_MAX_WIDTH];      // 环形缓冲：每列最小值(按显示范围量化)
+        float bucketMin;                         // 当前时间桶的最小值
+        float bucketMax;                         // 当前时间桶的最大值
+        bool bucketValid;                        // 当前时间桶是否有采样
+        float lastValue;                         // 最近一次的物理值
+        bool hasValue;                           // 是否收到过该信号
+    };
+
+    TFT_eSPI& tft;
+    TFT_eSprite* sprite;
+    Channel channels[STRIP_CHART_MAX_SIGNALS];
+    int channelCount;
+    int width;                 // 曲线区域宽度，即显示的列数
+    int height;                // 曲线区域高度
+    int head;                  // 环形缓冲中最新一列的下一个位置
+    uint32_t columnCount;      // 已经产生的总列数
+    uint16_t bucketMs;         // 每列代表的时间(ms)
+    uint32_t bucketStart;      // 当前时间桶的起始时间
+    uint32_t lastHeaderMs;     // 上次刷新标题栏的时间
+    bool active;               // 是否正在显示
+
+    // 把物理值按显示范围量化为0...STRIP_CHART_LEVELS
+    uint8_t quantize(const SignalDef* def, float value) {
+        float range = def->max_value - def->min_value;
+        float ratio = range > 0 ? (value - def->min_value) / range : 0;
+        if (ratio < 0) ratio = 0;
+        if (ratio > 1) ratio = 1;
+        return (uint8_t)(ratio * STRIP_CHART_LEVELS);
+    }
+
+    // 把量化值换算为曲线区域内的像素行
+    int levelToY(uint8_t level) {
+        return (height - 1) - (int)level * (height - 1) / STRIP_CHART_LEVELS;
+    }
+
+    // 关闭当前时间桶，把最小/最大值写入环形缓冲
+    void closeBucket() {
+        for (int c = 0; c < channelCount; c++) {
+            Channel& ch = channels[c];
+            if (ch.bucketValid) {
+                ch.high[head] = quantize(ch.def, ch.bucketMax);
+                ch.low[head] = quantize(ch.def, ch.bucketMin);
+            } else {
+                ch.high[head] = STRIP_CHART_NO_DATA;
+                ch.low[head] = STRIP_CHART_NO_DATA;
+            }
+            ch.bucketValid = false;
+        }
+        head = (head + 1) % STRIP_CHART_MAX_WIDTH;
+        columnCount++;
+    }
+
+    // 在Sprite的x列画出环形缓冲中slot位置的数据，column为该列的序号(用于画网格)
+    void drawColumn(int x, int slot, uint32_t column) {
+        int prev = (slot + STRIP_CHART_MAX_WIDTH - 1) % STRIP_CHART_MAX_WIDTH;
+
+        // 网格线
+        if (column % 8 == 0) {
+            for (int y = 0; y < height; y += 4) {
+                sprite->drawPixel(x, y, TFT_DARKGREY);
+            }
+        }
+        sprite->drawPixel(x, height / 2, TFT_DARKGREY);
+
+        for (int c = 0; c < channelCount; c++) {
+            Channel& ch = channels[c];
+            if (ch.high[slot] == STRIP_CHART_NO_DATA) {
+                continue;
+            }
+            int top = levelToY(ch.high[slot]);
+            int bottom = levelToY(ch.low[slot]);
+            // 与前一列连接，避免信号跳变时曲线断开
+            if (ch.high[prev] != STRIP_CHART_NO_DATA) {
+                int prevTop = levelToY(ch.high[prev]);
+                int prevBottom = levelToY(ch.low[prev]);
+                if (prevBottom < top) top = prevBottom;
+                if (prevTop > bottom) bottom = prevTop;
+            }
+            sprite->drawFastVLine(x, top, bottom - top + 1, ch.color);
+        }
+    }
+
+    // 刷新标题栏：信号名称和当前值
+    void drawHeader() {
+        int slotWidth = width / (channelCount > 0 ? channelCount : 1);
+        tft.fillRect(0, 0, width, STRIP_CHART_HEADER, TFT_BLACK);
+        for (int c = 0; c < channelCount; c++) {
+            Channel& ch = channels[c];
+            String text = String(ch.def->name) + ":" + (ch.hasValue ? String(ch.lastValue, 1) : String("--"));
+            tft.setTextColor(ch.color, TFT_BLACK);
+            tft.drawString(text, c * slotWidth + 2, 2, 2);
+        }
+    }
+
+public:
+    StripChart(TFT_eSPI& display) : tft(display) {
+        sprite = nullptr;
+        channelCount = 0;
+        width = STRIP_CHART_MAX_WIDTH;
+        height = 0;
+        head = 0;
+        columnCount = 0;
+        bucketMs = 100;
+        bucketStart = 0;
+        lastHeaderMs = 0;
+        active = false;
+    }
+
+    ~StripChart() {
+        end();
+    }
+
+    /**
+     * 订阅一个信号
+     * @param def - 信号定义，必须在整个显示期间有效
+     * @param color - 曲线颜色
+     * @return 订阅数量已满或信号超出64字节返回false
+     */
+    bool subscribe(const SignalDef* def, uint16_t color) {
+        if (channelCount >= STRIP_CHART_MAX_SIGNALS || def == nullptr) {
+            return false;
+        }
+        Channel& ch = channels[channelCount];
+        if (!DbcDecoder::compile(ch.plan, def->start_bit, def->length, def->big_endian, def->is_signed)) {
+            return false;
+        }
+        ch.plan.factor = def->scale;
+        ch.plan.offset = def->offset;
+        ch.def = def;
+        ch.color = color;
+        memset(ch.high, STRIP_CHART_NO_DATA, sizeof(ch.high));
+        memset(ch.low, STRIP_CHART_NO_DATA, sizeof(ch.low));
+        ch.bucketValid = false;
+        ch.hasValue = false;
+        channelCount++;
+        return true;
+    }
+
+    // 取消所有订阅
+    void clearSubscriptions() {
+        channelCount = 0;
+    }
+
+    // 设置每列代表的时间(ms)，决定整屏显示的时间跨度
+    void setBucketPeriod(uint16_t ms) {
+        bucketMs = ms > 0 ? ms : 1;
+    }
+
+    /**
+     * 输入一帧总线数据，提取所有订阅的信号并更新当前时间桶
+     * 每帧的开销为订阅数量次ID比较，命中时做一次位提取
+     * 提取计划从plan.byte开始读取8个字节，LIN等短帧的缓冲区可能不够，命中时先复制到补零的缓冲区
+     */
+    void feed(data_type bus, uint32_t id, const uint8_t* data, uint8_t len) {
+        uint8_t padded[64 + 9];
+        bool copied = false;
+        for (int c = 0; c < channelCount; c++) {
+            Channel& ch = channels[c];
+            if (ch.def->bus != bus || ch.def->id != id || ch.plan.minLen > len) {
+                continue;
+            }
+            if (!copied) {
+                uint8_t n = len > 64 ? 64 : len;
+                memcpy(padded, data, n);
+                memset(padded + n, 0, sizeof(padded) - n);
+                copied = true;
+            }
+            float value = DbcDecoder::physical(ch.plan, DbcDecoder::extract(ch.plan, padded));
+            if (!ch.bucketValid) {
+                ch.bucketMin = value;
+                ch.bucketMax = value;
+                ch.bucketValid = true;
+            } else {
+                if (value < ch.bucketMin) ch.bucketMin = value;
+                if (value > ch.bucketMax) ch.bucketMax = value;
+            }
+            ch.lastValue = value;
+            ch.hasValue = true;
+        }
+    }
+
+    /**
+     * 进入曲线显示：创建Sprite并根据环形缓冲重画整个曲线区域
+     */
+    void begin(uint32_t now) {
+        if (active) {
+            return;
+        }
+        width = min((int)tft.width(), STRIP_CHART_MAX_WIDTH);
+        height = tft.height() - STRIP_CHART_HEADER;
+
+        // 8位色深，整屏Sprite只占用一半内存
+        sprite = new TFT_eSprite(&tft);
+        sprite->setColorDepth(8);
+        sprite->createSprite(width, height);
+        sprite->fillSprite(TFT_BLACK);
+        sprite->setScrollRect(0, 0, width, height, TFT_BLACK);
+
+        for (int x = 0; x < width; x++) {
+            int slot = (head + STRIP_CHART_MAX_WIDTH - width + x) % STRIP_CHART_MAX_WIDTH;
+            drawColumn(x, slot, columnCount - width + x);
+        }
+
+        tft.fillScreen(TFT_BLACK);
+        drawHeader();
+        sprite->pushSprite(0, STRIP_CHART_HEADER);
+
+        if (bucketStart == 0) {
+            bucketStart = now;
+        }
+        lastHeaderMs = now;
+        active = true;
+    }
+
+    // 退出曲线显示，释放Sprite；环形缓冲保留，下次进入时继续显示历史曲线
+    void end() {
+        if (sprite) {
+            sprite->deleteSprite();
+            delete sprite;
+            sprite = nullptr;
+        }
+        active = false;
+    }
+
+    bool isActive() {
+        return active;
+    }
+
+    /**
+     * 周期调用：关闭到期的时间桶；正在显示时把Sprite左移并只画新的列
+     */
+    void render(uint32_t now) {
+        if (bucketStart == 0) {
+            bucketStart = now;
+            return;
+        }
+
+        int newColumns = 0;
+        while (now - bucketStart >= bucketMs) {
+            closeBucket();
+            bucketStart += bucketMs;
+            newColumns++;
+        }
+
+        if (!active) {
+            return;
+        }
+
+        if (newColumns > 0) {
+            if (newColumns > width) {
+                newColumns = width;
+            }
+            sprite->scroll(-newColumns, 0);
+            for (int i = 0; i < newColumns; i++) {
+                int slot = (head + STRIP_CHART_MAX_WIDTH - newColumns + i) % STRIP_CHART_MAX_WIDTH;
+                drawColumn(width - newColumns + i, slot, columnCount - newColumns + i);
+            }
+            sprite->pushSprite(0, STRIP_CHART_HEADER);
+        }
+
+        if (now - lastHeaderMs >= 500) {
+            drawHeader();
+            lastHeaderMs = now;
+        }
+    }
+};
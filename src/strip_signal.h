@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+#include "bus_data.h"
+
+/**
+ * 信号定义：描述如何从某条总线的某个帧中取出一个物理量
+ * 位编号与DBC一致：Intel格式start_bit为最低位，Motorola格式start_bit为最高位
+ * 物理值 = 原始值 * scale + offset
+ * StripChart订阅时用DbcDecoder::compile把它编译成提取计划，和DBC解码使用同一套位提取
+ */
+struct SignalDef {
+  const char * name;      // 信号名称，显示在曲线图标题栏
+  data_type bus;          // 信号所在的总线
+  uint32_t id;            // CAN帧ID或LIN帧ID
+  uint16_t start_bit;     // 起始位
+  uint8_t length;         // 位长度 1...64
+  bool big_endian;        // true: Motorola字节序, false: Intel字节序
+  bool is_signed;         // 原始值是否为有符号数
+  float scale;            // 比例因子
+  float offset;           // 偏移量
+  float min_value;        // 显示范围下限
+  float max_value;        // 显示范围上限
+};
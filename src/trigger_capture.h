@@ -0,0 +1,281 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+#include "capture_log.h"
+
+/**
+ * 触发记录：在PSRAM中循环保存最近一段时间所有总线的记录，触发后把触发前后的记录写入TF卡
+ *
+ * 记录的格式和采集日志相同，写出的文件可以直接回放和分析。
+ * 缓冲区是2的幂大小的字节环，位置用不断增加的32位绝对位置表示，记录可以跨过缓冲区的末尾。
+ *
+ * 1.布防(ARMED)：新记录写入mHead，比最新记录早pre窗口以上或空间不够时从mTail丢弃最旧的记录
+ * 2.触发(POST)：从mTail(触发前窗口的第一条)开始写文件，继续记录post窗口
+ * 3.post窗口结束(FLUSH)：文件写到触发结束时的mHead为止，之后的记录作为下一次触发的历史
+ * 写完后自动重新布防，触发期间的新触发被忽略。
+ *
+ * 还没写入文件的记录不会被覆盖，TF卡太慢导致缓冲区满时丢弃新记录并计数。
+ * 只在数据消费任务(loop2)中访问，写文件每次service()最多写CAPTURE_LOG_BLOCK_SIZE * 2字节，
+ * 不会长时间阻塞数据处理，采集任务不受影响。
+ */
+
+#define TRIGGER_FLUSH_BYTES  (CAPTURE_LOG_BLOCK_SIZE * 2)
+
+typedef enum : uint8_t {
+  TRIGGER_OFF,
+  TRIGGER_ARMED,
+  TRIGGER_POST,
+  TRIGGER_FLUSH,
+} trigger_state;
+
+class TriggerCapture {
+private:
+  fs::FS & mFS;
+  File mFile;
+  char mPath[32];
+
+  uint8_t * mBuffer;
+  uint32_t mSize;              // 2的幂
+  uint32_t mHead;              // 下一条记录写入的位置
+  uint32_t mTail;              // 最旧记录的位置
+  uint32_t mFlush;             // 下一个写入文件的字节
+  uint32_t mFlushEnd;          // 触发结束时的mHead
+
+  trigger_state mState;
+  uint32_t mPreUs;
+  uint32_t mPostUs;
+  uint32_t mTriggerUs;
+  const char * mReason;
+
+  uint32_t mTriggers;
+  uint32_t mIgnored;           // 触发期间被忽略的触发
+  uint32_t mLost;              // 缓冲区满丢弃的新记录
+  uint32_t mWriteErrors;
+
+  void copyIn(uint32_t pos, const void * data, uint32_t len) {
+    uint32_t offset = pos & (mSize - 1);
+    uint32_t first = min(len, mSize - offset);
+    memcpy(mBuffer + offset, data, first);
+    memcpy(mBuffer, (const uint8_t *) data + first, len - first);
+  }
+
+  void copyOut(uint32_t pos, void * data, uint32_t len) {
+    uint32_t offset = pos & (mSize - 1);
+    uint32_t first = min(len, mSize - offset);
+    memcpy(data, mBuffer + offset, first);
+    memcpy((uint8_t *) data + first, mBuffer, len - first);
+  }
+
+  // 最旧的记录已经写入文件(或没有在写文件)时才能丢弃，位置是回绕的32位计数，按差值比较
+  bool canDrop() {
+    return mTail != mHead && (mState == TRIGGER_ARMED || (int32_t) (mFlush - mTail) > 0);
+  }
+
+  void dropOldest() {
+    capture_record_header_t header;
+    copyOut(mTail, &header, sizeof(header));
+    mTail += sizeof(header) + header.len;
+  }
+
+  bool openFile() {
+    for (uint16_t i = 0; i < 10000; i++) {
+      snprintf(mPath, sizeof(mPath), "/trg_%04u.bin", i);
+      if (!mFS.exists(mPath)) {
+        break;
+      }
+    }
+    mFile = mFS.open(mPath, FILE_WRITE);
+    if (!mFile) {
+      Serial.printf("|error:can not open trigger capture %s\n", mPath);
+      return false;
+    }
+    capture_file_header_t header;
+    header.magic = CAPTURE_LOG_MAGIC;
+    header.version = CAPTURE_LOG_VERSION;
+    header.header_size = sizeof(capture_record_header_t);
+    header.start_ms = millis();
+    mFile.write((const uint8_t *) &header, sizeof(header));
+    return true;
+  }
+
+  // 从mFlush开始最多写入TRIGGER_FLUSH_BYTES字节，不超过end
+  void flushChunk(uint32_t end) {
+    uint32_t len = min(end - mFlush, (uint32_t) TRIGGER_FLUSH_BYTES);
+    uint32_t offset = mFlush & (mSize - 1);
+    uint32_t first = min(len, mSize - offset);
+    size_t written = mFile.write(mBuffer + offset, first);
+    if (len > first) {
+      written += mFile.write(mBuffer, len - first);
+    }
+    if (written != len) {
+      mWriteErrors++;
+    }
+    mFlush += len;
+  }
+
+public:
+  TriggerCapture(fs::FS & fs) : mFS(fs) {
+    mPath[0] = 0;
+    mBuffer = NULL;
+    mSize = 0;
+    mHead = 0;
+    mTail = 0;
+    mFlush = 0;
+    mFlushEnd = 0;
+    mState = TRIGGER_OFF;
+    mPreUs = 0;
+    mPostUs = 0;
+    mTriggerUs = 0;
+    mReason = "";
+    mTriggers = 0;
+    mIgnored = 0;
+    mLost = 0;
+    mWriteErrors = 0;
+  }
+
+  /**
+   * 设置历史缓冲区
+   * @param buffer - 缓冲区，一般在PSRAM中
+   * @param size - 缓冲区大小，必须是2的幂
+   */
+  void begin(uint8_t * buffer, uint32_t size) {
+    if (buffer != NULL && (size & (size - 1)) == 0) {
+      mBuffer = buffer;
+      mSize = size;
+    }
+  }
+
+  /**
+   * 布防
+   * @param preMs - 触发前保留的时间
+   * @param postMs - 触发后继续记录的时间
+   * @return 缓冲区没有分配或正在写触发记录时返回false
+   */
+  bool arm(uint32_t preMs, uint32_t postMs) {
+    if (mBuffer == NULL || mState == TRIGGER_POST || mState == TRIGGER_FLUSH) {
+      return false;
+    }
+    mPreUs = preMs * 1000;
+    mPostUs = postMs * 1000;
+    mHead = 0;
+    mTail = 0;
+    mFlush = 0;
+    mLost = 0;
+    mState = TRIGGER_ARMED;
+    return true;
+  }
+
+  // 撤防，正在写的触发记录写完后关闭
+  void disarm() {
+    if (mState == TRIGGER_ARMED) {
+      mState = TRIGGER_OFF;
+    } else if (mState == TRIGGER_POST) {
+      mFlushEnd = mHead;
+      mState = TRIGGER_FLUSH;
+      mPostUs = 0;
+    }
+    mPreUs = 0;
+  }
+
+  bool isArmed() {
+    return mState != TRIGGER_OFF;
+  }
+
+  /**
+   * 触发，布防状态以外的触发被忽略
+   * @param reason - 触发原因，字符串常量
+   */
+  void trigger(const char * reason) {
+    if (mState != TRIGGER_ARMED) {
+      if (mState != TRIGGER_OFF) {
+        mIgnored++;
+      }
+      return;
+    }
+    if (!openFile()) {
+      return;
+    }
+    mTriggers++;
+    mReason = reason;
+    mTriggerUs = micros();
+    mFlush = mTail;
+    mState = TRIGGER_POST;
+    Serial.printf("trigger (%s): writing %s\n", reason, mPath);
+  }
+
+  /**
+   * 写入一条记录，参数和CaptureLog::write相同
+   * @return 没有布防或缓冲区满时返回false
+   */
+  bool write(uint8_t type, uint8_t channel, uint32_t id, uint8_t flags, uint32_t timestamp,
+             const void * data, uint8_t len) {
+    if (mState == TRIGGER_OFF) {
+      return false;
+    }
+    // 丢弃早于触发前窗口的记录
+    capture_record_header_t header;
+    while (canDrop()) {
+      copyOut(mTail, &header, sizeof(header));
+      if (timestamp - header.timestamp <= mPreUs) {
+        break;
+      }
+      mTail += sizeof(header) + header.len;
+    }
+    uint32_t need = sizeof(header) + len;
+    while (mHead + need - mTail > mSize) {
+      if (!canDrop()) {
+        mLost++;
+        return false;
+      }
+      dropOldest();
+    }
+    header.timestamp = timestamp;
+    header.id = id;
+    header.type = type;
+    header.channel = channel;
+    header.flags = flags;
+    header.len = len;
+    copyIn(mHead, &header, sizeof(header));
+    copyIn(mHead + sizeof(header), data, len);
+    mHead += need;
+    return true;
+  }
+
+  bool writeCan(const CANFDMessage & msg, uint32_t timestamp, uint8_t channel = 0) {
+    uint8_t len = msg.type == CANFDMessage::CAN_REMOTE ? 0 : msg.len;
+    return write(CAPTURE_CAN, channel, msg.id, capture_can_flags(msg), timestamp, msg.data, len);
+  }
+
+  /**
+   * 数据消费任务中周期调用：结束post窗口，把触发记录分块写入文件
+   */
+  void service() {
+    if (mState == TRIGGER_POST) {
+      if (micros() - mTriggerUs >= mPostUs) {
+        mFlushEnd = mHead;
+        mState = TRIGGER_FLUSH;
+      } else {
+        flushChunk(mHead);
+        return;
+      }
+    }
+    if (mState != TRIGGER_FLUSH) {
+      return;
+    }
+    flushChunk(mFlushEnd);
+    if (mFlush == mFlushEnd) {
+      mFile.close();
+      Serial.printf("trigger capture saved: %s, %u lost records\n", mPath, mLost);
+      mState = mPreUs > 0 ? TRIGGER_ARMED : TRIGGER_OFF;
+    }
+  }
+
+  void print() {
+    static const char * const states[] = {"off", "armed", "post-trigger", "flushing"};
+    Serial.printf("trigger: %s, pre %u ms, post %u ms, buffer %u/%u bytes\n", states[mState],
+                  mPreUs / 1000, mPostUs / 1000, mHead - mTail, mSize);
+    Serial.printf("trigger: %u triggers, %u ignored, %u lost records, %u write errors, last %s %s\n",
+                  mTriggers, mIgnored, mLost, mWriteErrors, mReason, mPath);
+  }
+};
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <Arduino.h>
+#include "isotp.h"
+
+/**
+ * UDS(ISO 14229)诊断客户端
+ *
+ * 每个ECU使用IsoTp的一个主动链路(请求ID/应答ID)，每个ECU同时只有一个未完成的请求，
+ * 不同ECU的请求同时进行，扫描多个ECU时总时间取决于最慢的ECU而不是所有ECU之和。
+ *
+ * 支持的服务：
+ *   0x10 DiagnosticSessionControl，非默认会话时空闲2秒自动发送0x3E 0x80(TesterPresent，不要求应答)
+ *   0x19 ReadDTCInformation(0x02 reportDTCByStatusMask)
+ *   0x14 ClearDiagnosticInformation
+ *   0x22 ReadDataByIdentifier，轮询列表中同一ECU到期的DID合并到一个请求中
+ * 收到0x78(responsePending)时把应答超时从P2延长到P2*。
+ * ECU对多DID请求回复0x13(长度错误)时，该ECU以后每个请求只读一个DID。
+ *
+ * 在数据消费任务中调用：onPdu()处理IsoTp输出的PDU，service()发送请求和检查超时。
+ */
+
+#define UDS_ECUS                8
+#define UDS_POLL_DIDS           32      // 轮询列表的大小
+#define UDS_MAX_BATCH           8       // 一个0x22请求最多读取的DID数
+#define UDS_MAX_REQUEST         64      // 单次请求的最大长度
+#define UDS_P2_MS               150     // 等待应答的超时
+#define UDS_P2_STAR_MS          5000    // 收到0x78后的超时
+#define UDS_TESTER_PRESENT_MS   2000    // 非默认会话下空闲多久发送TesterPresent
+
+// 服务ID
+static const uint8_t UDS_SESSION_CONTROL  = 0x10;
+static const uint8_t UDS_CLEAR_DTC        = 0x14;
+static const uint8_t UDS_READ_DTC         = 0x19;
+static const uint8_t UDS_READ_DID         = 0x22;
+static const uint8_t UDS_TESTER_PRESENT   = 0x3E;
+static const uint8_t UDS_NEGATIVE         = 0x7F;
+
+// 否定应答码
+static const uint8_t UDS_NRC_INCORRECT_LENGTH = 0x13;
+static const uint8_t UDS_NRC_PENDING          = 0x78;
+static const uint8_t UDS_NRC_TIMEOUT          = 0xFF;   // 不是标准的NRC，表示没有应答
+
+/**
+ * 请求完成(轮询的DID除外)
+ * @param data - 肯定应答的数据(包含应答SID)，否定应答或超时时为NULL
+ * @param nrc - 0表示肯定应答
+ */
+typedef void (*uds_response_t)(uint8_t ecu, uint8_t sid, const uint8_t * data, uint16_t len, uint8_t nrc);
+
+// 读到一个DID的值
+typedef void (*uds_did_t)(uint8_t ecu, uint16_t did, const uint8_t * data, uint16_t len);
+
+class UdsClient {
+private:
+  struct PollDid {
+    uint32_t nextMs;
+    uint16_t did;
+    uint16_t periodMs;
+    uint8_t ecu;
+    uint8_t len;          // 数据长度(不含DID)，用于拆分多DID应答
+    bool used;
+  };
+
+  struct Ecu {
+    uint32_t txId;
+    uint32_t rxId;
+    uint32_t deadline;    // 当前请求的应答超时时间
+    uint32_t sentUs;      // 当前请求的发送时间
+    uint32_t lastTxMs;
+    uint32_t requests;
+    uint32_t negatives;
+    uint32_t timeouts;
+    uint32_t pendings;    // 收到的0x78次数
+    uint32_t latencyUs;   // 最近一次请求的应答时间
+    int8_t link;
+    uint8_t session;
+    uint8_t sid;          // 等待应答的服务，0表示空闲
+    bool used;
+    bool ext;
+    bool singleDid;       // 不支持多DID请求
+    bool polling;         // 当前请求来自轮询列表
+    uint8_t batch[UDS_MAX_BATCH];   // 当前请求中的轮询项
+    uint8_t batchCount;
+    uint8_t request[UDS_MAX_REQUEST];   // 等待发送的用户请求
+    uint8_t requestLen;
+  };
+
+  IsoTp & mIsoTp;
+  Ecu mEcus[UDS_ECUS];
+  PollDid mPolls[UDS_POLL_DIDS];
+  uds_response_t mOnResponse;
+  uds_did_t mOnDid;
+
+  bool transmit(uint8_t index, const uint8_t * data, uint16_t len, uint32_t now) {
+    Ecu & ecu = mEcus[index];
+    if (!mIsoTp.send(ecu.link, data, len, now)) {
+      return false;
+    }
+    ecu.sid = data[0];
+    ecu.deadline = now + UDS_P2_MS;
+    ecu.sentUs = micros();
+    ecu.lastTxMs = now;
+    ecu.requests++;
+    return true;
+  }
+
+  // 把同一ECU到期的轮询DID合并成一个0x22请求
+  bool sendPoll(uint8_t index, uint32_t now) {
+    Ecu & ecu = mEcus[index];
+    uint8_t request[1 + 2 * UDS_MAX_BATCH];
+    uint8_t len = 1;
+    uint8_t count = 0;
+    uint8_t maxBatch = ecu.singleDid ? 1 : UDS_MAX_BATCH;
+    request[0] = UDS_READ_DID;
+    for (uint8_t i = 0; i < UDS_POLL_DIDS && count < maxBatch; i++) {
+      PollDid & poll = mPolls[i];
+      if (!poll.used || poll.ecu != index || (int32_t)(now - poll.nextMs) < 0) {
+        continue;
+      }
+      request[len++] = poll.did >> 8;
+      request[len++] = poll.did & 0xFF;
+      ecu.batch[count++] = i;
+    }
+    if (count == 0 || !transmit(index, request, len, now)) {
+      return false;
+    }
+    ecu.batchCount = count;
+    ecu.polling = true;
+    for (uint8_t i = 0; i < count; i++) {
+      PollDid & poll = mPolls[ecu.batch[i]];
+      poll.nextMs += poll.periodMs;
+      // 落后超过一个周期时从现在重新计时，不补发
+      if ((int32_t)(now - poll.nextMs) > 0) {
+        poll.nextMs = now + poll.periodMs;
+      }
+    }
+    return true;
+  }
+
+  // 拆分0x62应答：按请求中的DID顺序，每个DID后面是轮询列表中定义的长度
+  void parseDids(uint8_t index, const uint8_t * data, uint16_t len) {
+    uint16_t pos = 1;
+    while (pos + 2 <= len) {
+      uint16_t did = (data[pos] << 8) | data[pos + 1];
+      pos += 2;
+      uint16_t didLen = len - pos;
+      for (uint8_t i = 0; i < UDS_POLL_DIDS; i++) {
+        if (mPolls[i].used && mPolls[i].ecu == index && mPolls[i].did == did) {
+          didLen = mPolls[i].len;
+          break;
+        }
+      }
+      // 应答被截断
+      if (pos + didLen > len) {
+        return;
+      }
+      if (mOnDid) {
+        mOnDid(index, did, data + pos, didLen);
+      }
+      pos += didLen;
+    }
+  }
+
+  // 请求结束(应答、否定应答或超时)
+  void complete(uint8_t index, const uint8_t * data, uint16_t len, uint8_t nrc) {
+    Ecu & ecu = mEcus[index];
+    uint8_t sid = ecu.sid;
+    bool polling = ecu.polling;
+    ecu.sid = 0;
+    ecu.polling = false;
+    ecu.latencyUs = micros() - ecu.sentUs;
+
+    if (nrc == 0 && sid == UDS_SESSION_CONTROL && len >= 2) {
+      ecu.session = data[1];
+    }
+    if (nrc == 0 && sid == UDS_READ_DID) {
+      parseDids(index, data, len);
+    }
+    if (polling) {
+      if (nrc == UDS_NRC_INCORRECT_LENGTH && ecu.batchCount > 1) {
+        ecu.singleDid = true;
+      }
+    } else if (mOnResponse) {
+      mOnResponse(index, sid, nrc ? NULL : data, nrc ? 0 : len, nrc);
+    }
+  }
+
+public:
+  UdsClient(IsoTp & isotp) : mIsoTp(isotp) {
+    memset(mEcus, 0, sizeof(mEcus));
+    memset(mPolls, 0, sizeof(mPolls));
+    mOnResponse = NULL;
+    mOnDid = NULL;
+  }
+
+  void setCallbacks(uds_response_t onResponse, uds_did_t onDid) {
+    mOnResponse = onResponse;
+    mOnDid = onDid;
+  }
+
+  /**
+   * 增加一个ECU
+   * @return ECU序号，ECU或IsoTp链路用完时返回-1
+   */
+  int8_t addEcu(uint32_t txId, uint32_t rxId, bool ext) {
+    for (uint8_t i = 0; i < UDS_ECUS; i++) {
+      if (mEcus[i].used && mEcus[i].txId == txId && mEcus[i].rxId == rxId && mEcus[i].ext == ext) {
+        return i;
+      }
+    }
+    for (uint8_t i = 0; i < UDS_ECUS; i++) {
+      if (mEcus[i].used) {
+        continue;
+      }
+      int8_t link = mIsoTp.open(txId, rxId, ext);
+      if (link < 0) {
+        return -1;
+      }
+      memset(&mEcus[i], 0, sizeof(Ecu));
+      mEcus[i].txId = txId;
+      mEcus[i].rxId = rxId;
+      mEcus[i].ext = ext;
+      mEcus[i].link = link;
+      mEcus[i].session = 1;
+      mEcus[i].used = true;
+      return i;
+    }
+    return -1;
+  }
+
+  bool isEcu(int index) {
+    return index >= 0 && index < UDS_ECUS && mEcus[index].used;
+  }
+
+  bool isBusy(uint8_t index) {
+    return mEcus[index].sid != 0 || mEcus[index].requestLen != 0;
+  }
+
+  /**
+   * 提交一个请求，在ECU空闲时发送，优先于轮询
+   * @return ECU不存在或已经有等待发送的请求时返回false
+   */
+  bool request(uint8_t index, const uint8_t * data, uint8_t len) {
+    if (!isEcu(index) || len == 0 || len > UDS_MAX_REQUEST || mEcus[index].requestLen != 0) {
+      return false;
+    }
+    memcpy(mEcus[index].request, data, len);
+    mEcus[index].requestLen = len;
+    return true;
+  }
+
+  bool sessionControl(uint8_t index, uint8_t session) {
+    uint8_t data[] = {UDS_SESSION_CONTROL, session};
+    return request(index, data, sizeof(data));
+  }
+
+  // 0x19 0x02：按状态掩码读取故障码
+  bool readDtc(uint8_t index, uint8_t statusMask = 0xFF) {
+    uint8_t data[] = {UDS_READ_DTC, 0x02, statusMask};
+    return request(index, data, sizeof(data));
+  }
+
+  // 0x14：清除故障码，默认清除所有组
+  bool clearDtc(uint8_t index, uint32_t group = 0xFFFFFF) {
+    uint8_t data[] = {UDS_CLEAR_DTC, (uint8_t)(group >> 16), (uint8_t)(group >> 8), (uint8_t) group};
+    return request(index, data, sizeof(data));
+  }
+
+  // 0x22：一次读取多个DID
+  bool readDids(uint8_t index, const uint16_t * dids, uint8_t count) {
+    uint8_t data[1 + 2 * UDS_MAX_BATCH];
+    if (count == 0 || count > UDS_MAX_BATCH) {
+      return false;
+    }
+    data[0] = UDS_READ_DID;
+    for (uint8_t i = 0; i < count; i++) {
+      data[1 + 2 * i] = dids[i] >> 8;
+      data[2 + 2 * i] = dids[i] & 0xFF;
+    }
+    return request(index, data, 1 + 2 * count);
+  }
+
+  /**
+   * 增加一个轮询的DID
+   * @param len - DID数据的长度，多DID应答按这个长度拆分
+   * @return 列表已满时返回false
+   */
+  bool addPoll(uint8_t index, uint16_t did, uint8_t len, uint16_t periodMs) {
+    if (!isEcu(index) || periodMs == 0) {
+      return false;
+    }
+    for (uint8_t i = 0; i < UDS_POLL_DIDS; i++) {
+      if (!mPolls[i].used) {
+        mPolls[i].ecu = index;
+        mPolls[i].did = did;
+        mPolls[i].len = len;
+        mPolls[i].periodMs = periodMs;
+        mPolls[i].nextMs = millis();
+        mPolls[i].used = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void clearPolls() {
+    memset(mPolls, 0, sizeof(mPolls));
+  }
+
+  /**
+   * 处理IsoTp输出的PDU
+   * @return PDU是某个ECU的应答时返回true
+   */
+  bool onPdu(const IsoTpPdu & pdu, uint32_t now) {
+    if (pdu.link < 0 || pdu.len == 0) {
+      return false;
+    }
+    for (uint8_t i = 0; i < UDS_ECUS; i++) {
+      Ecu & ecu = mEcus[i];
+      if (!ecu.used || ecu.link != pdu.link) {
+        continue;
+      }
+      if (ecu.sid == 0) {
+        return true;
+      }
+      const uint8_t * data = pdu.data;
+      if (data[0] == UDS_NEGATIVE && pdu.len >= 3 && data[1] == ecu.sid) {
+        if (data[2] == UDS_NRC_PENDING) {
+          ecu.deadline = now + UDS_P2_STAR_MS;
+          ecu.pendings++;
+        } else {
+          ecu.negatives++;
+          complete(i, data, pdu.len, data[2]);
+        }
+      } else if (data[0] == (ecu.sid | 0x40)) {
+        complete(i, data, pdu.len, 0);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // 周期调用：检查超时，给空闲的ECU发送用户请求、轮询请求或TesterPresent
+  void service(uint32_t now) {
+    for (uint8_t i = 0; i < UDS_ECUS; i++) {
+      Ecu & ecu = mEcus[i];
+      if (!ecu.used) {
+        continue;
+      }
+      if (ecu.sid != 0) {
+        if ((int32_t)(now - ecu.deadline) >= 0) {
+          ecu.timeouts++;
+          complete(i, NULL, 0, UDS_NRC_TIMEOUT);
+        }
+        continue;
+      }
+      if (ecu.requestLen != 0) {
+        if (transmit(i, ecu.request, ecu.requestLen, now)) {
+          ecu.requestLen = 0;
+        }
+        continue;
+      }
+      if (sendPoll(i, now)) {
+        continue;
+      }
+      if (ecu.session != 1 && now - ecu.lastTxMs >= UDS_TESTER_PRESENT_MS) {
+        // suppressPosRspMsgIndicationBit，ECU不应答，不占用请求
+        uint8_t data[] = {UDS_TESTER_PRESENT, 0x80};
+        if (mIsoTp.send(ecu.link, data, sizeof(data), now)) {
+          ecu.lastTxMs = now;
+        }
+      }
+    }
+  }
+
+  // 输出每个ECU的统计
+  void print() {
+    for (uint8_t i = 0; i < UDS_ECUS; i++) {
+      const Ecu & ecu = mEcus[i];
+      if (!ecu.used) {
+        continue;
+      }
+      Serial.printf("ecu %u: %X->%X session %u, %u requests, %u negative, %u timeout, %u pending, last %u us%s\n",
+                    i, ecu.txId, ecu.rxId, ecu.session, ecu.requests, ecu.negatives, ecu.timeouts,
+                    ecu.pendings, ecu.latencyUs, ecu.singleDid ? ", single DID" : "");
+    }
+    for (uint8_t i = 0; i < UDS_POLL_DIDS; i++) {
+      if (mPolls[i].used) {
+        Serial.printf("poll ecu %u did %04X len %u every %u ms\n",
+                      mPolls[i].ecu, mPolls[i].did, mPolls[i].len, mPolls[i].periodMs);
+      }
+    }
+  }
+
+  /**
+   * 遍历0x59 0x02应答中的故障码，callback(uint32_t dtc, uint8_t status)
+   * 应答格式：0x59 0x02 availabilityMask [DTC高 DTC中 DTC低 状态]...
+   */
+  template <typename F>
+  static void forEachDtc(const uint8_t * data, uint16_t len, F callback) {
+    for (uint16_t pos = 3; pos + 4 <= len; pos += 4) {
+      uint32_t dtc = ((uint32_t) data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+      callback(dtc, data[pos + 3]);
+    }
+  }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+/**
+ * 主机测试用的Arduino最小替身：只提供驱动和可在主机上编译的模块用到的部分
+ *
+ * millis()/micros()由测试控制(mockAdvanceMicros)，GPIO写入转给mockPinWrite钩子，
+ * Serial写到标准输出，硬件定时器由mockAdvanceTimer推进，SPI总线的模拟在SPI.h中。
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define FALLING 0x02
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define NOT_AN_INTERRUPT -1
+
+using std::min;
+using std::max;
+
+inline uint32_t mockMicros = 0;
+inline void (*mockPinWrite)(uint8_t pin, uint8_t value) = NULL;
+
+// 推进模拟时钟，等待超时的循环每次读取时钟时前进1us，不会死循环
+inline void mockAdvanceMicros(uint32_t us) {
+  mockMicros += us;
+}
+
+inline unsigned long micros() {
+  return mockMicros++;
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline void delay(unsigned long ms) {
+  mockMicros += ms * 1000;
+}
+
+inline void delayMicroseconds(unsigned int us) {
+  mockMicros += us;
+}
+
+inline void pinMode(uint8_t, uint8_t) {}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  if (mockPinWrite != NULL) {
+    mockPinWrite(pin, value);
+  }
+}
+
+inline int digitalRead(uint8_t) {
+  return HIGH;
+}
+
+inline int digitalPinToInterrupt(uint8_t pin) {
+  return pin;
+}
+
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+inline void detachInterrupt(uint8_t) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#define IRAM_ATTR
+
+// 串口输出直接写到标准输出
+class MockSerial {
+public:
+  int printf(const char * format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n;
+  }
+
+  size_t print(const char * s) {
+    return fputs(s, stdout) >= 0 ? strlen(s) : 0;
+  }
+
+  size_t println(const char * s = "") {
+    return print(s) + print("\n");
+  }
+};
+
+inline MockSerial Serial;
+
+// 1MHz硬件定时器：计数由测试推进(mockAdvanceTimer)，到达报警值时调用中断函数
+typedef struct {
+  uint64_t count;
+  uint64_t alarm;
+  bool armed;
+  void (*isr)(void *);
+  void * arg;
+  uint32_t readUs;             // 每次timerRead后推进的时间，模拟忙等读定时器的耗时
+} hw_timer_t;
+
+inline hw_timer_t mockTimer = {};
+
+inline hw_timer_t * timerBegin(uint32_t) {
+  return &mockTimer;
+}
+
+inline void timerAttachInterruptArg(hw_timer_t * timer, void (*isr)(void *), void * arg) {
+  timer->isr = isr;
+  timer->arg = arg;
+}
+
+inline void timerWrite(hw_timer_t * timer, uint64_t value) {
+  timer->count = value;
+}
+
+inline void timerAlarm(hw_timer_t * timer, uint64_t value, bool, uint64_t) {
+  timer->alarm = value;
+  timer->armed = true;
+}
+
+// 推进定时器，跨过报警值时触发一次中断
+inline void mockAdvanceTimer(uint64_t us) {
+  uint64_t before = mockTimer.count;
+  mockTimer.count += us;
+  if (mockTimer.armed && before < mockTimer.alarm && mockTimer.count >= mockTimer.alarm) {
+    mockTimer.armed = false;
+    if (mockTimer.isr != NULL) {
+      mockTimer.isr(mockTimer.arg);
+    }
+  }
+}
+
+inline uint64_t timerRead(hw_timer_t * timer) {
+  uint64_t count = timer->count;
+  mockAdvanceTimer(timer->readUs);
+  return count;
+}
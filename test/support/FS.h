@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+/**
+ * 主机测试用的文件系统替身：文件保存在内存中，只提供采集日志、回放和DBC加载用到的接口
+ */
+
+#define FILE_READ  "r"
+#define FILE_WRITE "w"
+
+namespace fs {
+
+class File {
+private:
+  std::string * mData;
+  size_t mPos;
+
+public:
+  File(std::string * data = NULL) : mData(data), mPos(0) {}
+
+  operator bool() const {
+    return mData != NULL;
+  }
+
+  int read(uint8_t * buf, size_t size) {
+    if (mData == NULL || mPos >= mData->size()) {
+      return 0;
+    }
+    size_t n = min(size, mData->size() - mPos);
+    memcpy(buf, mData->data() + mPos, n);
+    mPos += n;
+    return n;
+  }
+
+  int available() {
+    return mData != NULL ? mData->size() - mPos : 0;
+  }
+
+  int read() {
+    if (mData == NULL || mPos >= mData->size()) {
+      return -1;
+    }
+    return (uint8_t)(*mData)[mPos++];
+  }
+
+  size_t readBytesUntil(char terminator, char * buf, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+      int c = read();
+      if (c < 0 || c == terminator) {
+        break;
+      }
+      buf[n++] = c;
+    }
+    return n;
+  }
+
+  bool seek(uint32_t pos) {
+    if (mData == NULL || pos > mData->size()) {
+      return false;
+    }
+    mPos = pos;
+    return true;
+  }
+
+  size_t write(const uint8_t * buf, size_t size) {
+    if (mData == NULL) {
+      return 0;
+    }
+    mData->append((const char *) buf, size);
+    return size;
+  }
+
+  size_t size() const {
+    return mData != NULL ? mData->size() : 0;
+  }
+
+  void flush() {}
+
+  void close() {
+    mData = NULL;
+  }
+};
+
+class FS {
+private:
+  std::map<std::string, std::string> mFiles;
+
+public:
+  File open(const char * path, const char * mode = FILE_READ) {
+    if (strcmp(mode, FILE_WRITE) == 0) {
+      mFiles[path].clear();
+    } else if (mFiles.find(path) == mFiles.end()) {
+      return File();
+    }
+    return File(&mFiles[path]);
+  }
+
+  bool exists(const char * path) {
+    return mFiles.find(path) != mFiles.end();
+  }
+
+  bool remove(const char * path) {
+    return mFiles.erase(path) > 0;
+  }
+};
+
+}  // namespace fs
+
+using fs::File;
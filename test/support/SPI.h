@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * 主机测试用的SPIClass替身：所有传输按字节交给mockSPITransfer钩子，
+ * 由测试中的器件模型回答，CS由驱动通过digitalWrite控制
+ */
+
+inline uint8_t (*mockSPITransfer)(uint8_t out) = NULL;
+
+class SPISettings {
+public:
+  uint32_t clock;
+  SPISettings() : clock(1000000) {}
+  SPISettings(uint32_t c, uint8_t, uint8_t) : clock(c) {}
+};
+
+class SPIClass {
+public:
+  uint32_t clock = 0;
+
+  void begin() {}
+  void end() {}
+  void usingInterrupt(int) {}
+  void beginTransaction(const SPISettings & settings) {
+    clock = settings.clock;
+  }
+  void endTransaction() {}
+
+  uint8_t transfer(uint8_t out) {
+    return mockSPITransfer != NULL ? mockSPITransfer(out) : 0;
+  }
+
+  uint16_t transfer16(uint16_t out) {
+    uint16_t in = transfer(out >> 8) << 8;
+    return in | transfer(out & 0xFF);
+  }
+
+  void transfer(void * buffer, size_t count) {
+    uint8_t * p = (uint8_t *) buffer;
+    for (size_t i = 0; i < count; i++) {
+      p[i] = transfer(p[i]);
+    }
+  }
+};
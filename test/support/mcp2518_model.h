@@ -0,0 +1,144 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+/**
+ * 主机测试用的MCP2518FD SPI模型：按字节解释READ/WRITE/RESET指令，统计SPI事务数和字节数
+ *
+ * 只模拟驱动初始化和接收路径需要的行为：
+ * RESET回到配置模式，写REQOP立即切换OPMOD，振荡器总是就绪，RAM按普通存储器读写。
+ * 接收FIFO(FIFO1)中有pending帧，每帧的报文对象在读FIFOUA指向的地址时按序号生成，
+ * 写UINC取走一帧。FIFO1使能了RXTSEN时对象带时间戳(frameTicks)，TBC寄存器返回tbc。不支持CRC指令。
+ */
+
+#define MCP2518_MODEL_CS        10
+#define MCP2518_MODEL_RX_FIFOUA 0x200     // 接收报文对象相对RAM起始的地址
+
+class Mcp2518Model {
+private:
+  uint8_t mMem[0x1000];
+  bool mSelected;
+  uint32_t mIndex;             // 本次CS有效期间的字节序号
+  uint8_t mCommand;
+  uint16_t mAddress;
+
+  static Mcp2518Model * sModel;
+
+  static void onPinWrite(uint8_t pin, uint8_t value) {
+    if (pin == MCP2518_MODEL_CS) {
+      sModel->select(value == LOW);
+    }
+  }
+
+  static uint8_t onTransfer(uint8_t out) {
+    return sModel->transfer(out);
+  }
+
+  void reset() {
+    memset(mMem, 0, sizeof(mMem));
+    mMem[0x002] = 4 << 5;      // OPMOD：配置模式
+  }
+
+  // 每条读指令开始时刷新状态寄存器和下一帧的报文对象
+  void refresh() {
+    mMem[0x01C] = pending > 0 ? 1 << 1 : 0;          // C1INT.RXIF
+    mMem[0x060] = pending > 0 ? 1 << 0 : 0;          // FIFOSTA1.TFNRFNIF
+    uint32_t ua = MCP2518_MODEL_RX_FIFOUA;
+    memcpy(mMem + 0x064, &ua, 4);                    // FIFOUA1
+    memcpy(mMem + 0x010, &tbc, 4);                   // TBC
+    mMem[0xE01] = 0x05;                              // OSC：PLLRDY、OSCRDY
+    uint8_t * object = mMem + 0x400 + ua;
+    uint32_t id = frameId(popped);
+    uint32_t flags = 8;                              // DLC 8，标准数据帧
+    memcpy(object, &id, 4);
+    memcpy(object + 4, &flags, 4);
+    uint8_t header = 8;
+    if (mMem[0x05C] & (1 << 5)) {                    // FIFOCON1.RXTSEN
+      uint32_t ticks = frameTicks(popped);
+      memcpy(object + 8, &ticks, 4);
+      header = 12;
+    }
+    for (uint8_t i = 0; i < 8; i++) {
+      object[header + i] = frameByte(popped, i);
+    }
+  }
+
+  void store(uint16_t address, uint8_t value) {
+    mMem[address] = value;
+    if (address == 0x003) {                          // C1CON.REQOP
+      mMem[0x002] = (mMem[0x002] & 0x1F) | ((value & 0x07) << 5);
+    } else if (address == 0x05D && (value & 1) != 0 && pending > 0) {   // FIFOCON1.UINC
+      pending--;
+      popped++;
+    }
+  }
+
+  uint8_t transfer(uint8_t out) {
+    bytes++;
+    uint8_t in = 0;
+    if (mIndex == 0) {
+      mCommand = out >> 4;
+      mAddress = (out & 0x0F) << 8;
+    } else if (mIndex == 1) {
+      mAddress |= out;
+      if (mCommand == 0 && mAddress == 0) {
+        reset();
+      } else if (mCommand == 0x3) {
+        refresh();
+      }
+    } else if (mCommand == 0x3) {
+      in = mMem[mAddress++ & 0xFFF];
+    } else if (mCommand == 0x2) {
+      store(mAddress++ & 0xFFF, out);
+    }
+    mIndex++;
+    return in;
+  }
+
+public:
+  uint32_t pending = 0;        // 接收FIFO中的帧数
+  uint32_t popped = 0;         // 已经被UINC取走的帧数
+  uint32_t tbc = 0;            // TBC寄存器的值
+  uint32_t transactions = 0;   // CS有效的次数
+  uint32_t bytes = 0;
+
+  Mcp2518Model() {
+    reset();
+    mSelected = false;
+    mIndex = 0;
+    mCommand = 0;
+    mAddress = 0;
+    sModel = this;
+    mockPinWrite = onPinWrite;
+    mockSPITransfer = onTransfer;
+  }
+
+  void select(bool selected) {
+    if (selected && !mSelected) {
+      transactions++;
+      mIndex = 0;
+    }
+    mSelected = selected;
+  }
+
+  void resetCounters() {
+    transactions = 0;
+    bytes = 0;
+  }
+
+  static uint32_t frameId(uint32_t n) {
+    return 0x100 + (n & 0x3FF);
+  }
+
+  // 第n帧SOF时的TBC，帧间隔100个计数
+  static uint32_t frameTicks(uint32_t n) {
+    return 1000 + n * 100;
+  }
+
+  static uint8_t frameByte(uint32_t n, uint8_t i) {
+    return (uint8_t) (n * 8 + i);
+  }
+};
+
+inline Mcp2518Model * Mcp2518Model::sModel = NULL;
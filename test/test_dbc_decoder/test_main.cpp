@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "dbc_decoder.h"
+
+/**
+ * DBC解码的主机测试：提取计划和逐位提取的结果一致，超长的SG_行不会丢掉后面的信号，
+ * 以及解码吞吐量的基准测试(要求单核每秒解码5000帧)
+ */
+
+#define BENCH_MESSAGES  200
+#define BENCH_SIGNALS   24         // 每个报文的信号数，一半Intel一半Motorola
+#define BENCH_FRAMES    200000
+
+static fs::FS memoryFS;
+
+static void writeFile(const char * path, const std::string & text) {
+  File file = memoryFS.open(path, FILE_WRITE);
+  file.write((const uint8_t *) text.data(), text.size());
+  file.close();
+}
+
+static uint32_t random32() {
+  static uint32_t state = 0x12345678;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// 参考实现：按DBC的位编号逐位取出原始值(Motorola从最高位开始，字节内向低位走)
+static int64_t extractBits(uint16_t startBit, uint8_t length, bool motorola, bool isSigned, const uint8_t * data) {
+  uint64_t raw = 0;
+  uint16_t bit = startBit;
+  for (uint8_t i = 0; i < length; i++) {
+    uint64_t value = (data[bit >> 3] >> (bit & 7)) & 1;
+    if (motorola) {
+      raw = (raw << 1) | value;
+      bit = ((bit & 7) == 0) ? bit + 15 : bit - 1;
+    } else {
+      raw |= value << i;
+      bit++;
+    }
+  }
+  if (isSigned && length < 64 && (raw & (1ULL << (length - 1)))) {
+    raw |= ~0ULL << length;
+  }
+  return (int64_t) raw;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// 64字节范围内随机位置、长度、字节序的信号，提取计划和逐位提取的结果相同
+static void test_plan_matches_bit_loop(void) {
+  uint8_t data[64 + 9];
+  for (uint32_t n = 0; n < 20000; n++) {
+    for (uint8_t i = 0; i < 64; i++) {
+      data[i] = random32();
+    }
+    memset(data + 64, 0, 9);
+    bool motorola = random32() & 1;
+    bool isSigned = random32() & 1;
+    uint8_t length = random32() % 64 + 1;
+    uint16_t startBit = random32() % 512;
+    DbcSignalPlan plan;
+    if (!DbcDecoder::compile(plan, startBit, length, motorola, isSigned)) {
+      continue;
+    }
+    TEST_ASSERT_TRUE(plan.minLen <= 64);
+    int64_t expected = extractBits(startBit, length, motorola, isSigned, data);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t) expected, (uint64_t) DbcDecoder::extract(plan, data));
+  }
+}
+
+// SG_行超过DBC_MAX_LINE时只截断接收节点列表，同一报文后面的信号仍然加载
+static void test_long_signal_line(void) {
+  std::string receivers;
+  while (receivers.size() < DBC_MAX_LINE * 2) {
+    receivers += "Receiver_" + std::to_string(receivers.size()) + ",";
+  }
+  receivers += "Last";
+  std::string text =
+    "VERSION \"\"\n"
+    "\n"
+    "BO_ 1234 Engine: 8 ECU\n"
+    " SG_ Rpm : 16|16@1+ (0.25,0) [0|8000] \"rpm\" " + receivers + "\r\n"
+    " SG_ Temp : 31|8@0- (1,-40) [-40|215] \"degC\" Dash\r\n"
+    "\n"
+    "BO_ 2147484000 Body: 8 ECU\n"
+    " SG_ Door : 0|1@1+ (1,0) [0|1] \"\" " + receivers + "\n";
+  writeFile("/long.dbc", text);
+
+  DbcDecoder dbc;
+  TEST_ASSERT_TRUE(dbc.load(memoryFS, "/long.dbc"));
+  TEST_ASSERT_EQUAL_UINT32(2, dbc.messageCount());
+  TEST_ASSERT_EQUAL_UINT32(3, dbc.signalCount());
+  TEST_ASSERT_EQUAL_UINT32(0, dbc.skippedSignals());
+  TEST_ASSERT_EQUAL_UINT32(2, dbc.longLines());
+
+  CANFDMessage msg;
+  msg.id = 1234;
+  msg.ext = false;
+  msg.len = 8;
+  memset(msg.data, 0, sizeof(msg.data));
+  msg.data[3] = 0x7D;             // Rpm原始值0x7D00 = 32000，Temp原始值0x7D
+  float values[2] = {0, 0};
+  uint32_t count = 0;
+  TEST_ASSERT_NOT_NULL(dbc.decode(msg, [&](const DbcSignalPlan &, float value) {
+    values[count++ % 2] = value;
+  }));
+  TEST_ASSERT_EQUAL_UINT32(2, count);
+  TEST_ASSERT_TRUE(values[0] == 8000);
+  TEST_ASSERT_TRUE(values[1] == 0x7D - 40);
+
+  msg.id = 2147484000u & 0x1FFFFFFF;
+  msg.ext = true;
+  msg.data[0] = 1;
+  count = 0;
+  TEST_ASSERT_NOT_NULL(dbc.decode(msg, [&](const DbcSignalPlan &, float value) {
+    values[0] = value;
+    count++;
+  }));
+  TEST_ASSERT_EQUAL_UINT32(1, count);
+  TEST_ASSERT_TRUE(values[0] == 1);
+}
+
+/**
+ * 基准测试：BENCH_MESSAGES个64字节的CAN FD报文，每个BENCH_SIGNALS个信号，
+ * 解码BENCH_FRAMES个随机帧，输出每帧的耗时和每秒帧数
+ */
+static void test_decode_benchmark(void) {
+  std::string text = "VERSION \"\"\n\n";
+  for (uint32_t m = 0; m < BENCH_MESSAGES; m++) {
+    text += "BO_ " + std::to_string(0x100 + m) + " Msg" + std::to_string(m) + ": 64 ECU\n";
+    for (uint32_t s = 0; s < BENCH_SIGNALS; s++) {
+      uint32_t length = 1 + (m * 7 + s * 13) % 20;
+      bool motorola = s % 2;
+      // 每个信号占用20位的区域；Intel的起始位是最低位，Motorola的起始位是最高位
+      uint32_t startBit = motorola ? (s * 20 / 8) * 8 + 7 - s * 20 % 8 : s * 20;
+      text += " SG_ Sig" + std::to_string(s) + " : " + std::to_string(startBit) + "|" + std::to_string(length)
+            + (motorola ? "@0" : "@1") + (s % 3 ? "+" : "-") + " (0.5,-10) [0|0] \"u\" ECU\n";
+    }
+    text += "\n";
+  }
+  writeFile("/bench.dbc", text);
+
+  DbcDecoder dbc;
+  TEST_ASSERT_TRUE(dbc.load(memoryFS, "/bench.dbc"));
+  TEST_ASSERT_EQUAL_UINT32(BENCH_MESSAGES, dbc.messageCount());
+  TEST_ASSERT_EQUAL_UINT32(BENCH_MESSAGES * BENCH_SIGNALS, dbc.signalCount());
+
+  static CANFDMessage frames[1024];
+  for (uint32_t i = 0; i < 1024; i++) {
+    frames[i].id = 0x100 + random32() % BENCH_MESSAGES;
+    frames[i].ext = false;
+    frames[i].len = 64;
+    for (uint8_t b = 0; b < 64; b++) {
+      frames[i].data[b] = random32();
+    }
+  }
+
+  uint32_t decoded = 0;
+  float sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++) {
+    dbc.decode(frames[n & 1023], [&](const DbcSignalPlan &, float value) {
+      sum += value;
+      decoded++;
+    });
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double framesPerSecond = BENCH_FRAMES / seconds;
+  printf("dbc benchmark: %u frames, %u signals, %.0f ns/frame, %.0f frames/s (checksum %g)\n",
+         BENCH_FRAMES, decoded, seconds * 1e9 / BENCH_FRAMES, framesPerSecond, sum);
+  TEST_ASSERT_EQUAL_UINT32(BENCH_FRAMES * BENCH_SIGNALS, decoded);
+  TEST_ASSERT_TRUE(framesPerSecond > 5000);
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_plan_matches_bit_loop);
+  RUN_TEST(test_long_signal_line);
+  RUN_TEST(test_decode_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+#include <ACAN2517FD.h>
+#include "mcp2518_model.h"
+
+/**
+ * MCP2518接收路径每帧的SPI开销，用主机上的MCP2518模型统计事务数(CS有效次数)和字节数
+ *
+ * 总线上的时间和每帧的CPU周期都由这两个数决定：事务数决定CS和传输建立的固定开销，字节数决定传输时间。
+ * 设备上的每帧周期数由"can"命令的cycles/frame给出(receiveCycleCount/receivedFrameCount)。
+ *
+ * 改进前的驱动(逐帧receive轮询，每帧单独读INT、FIFOSTA和FIFOUA，读整个74字节报文对象)在同一模型上
+ * 接收64个8字节经典帧的结果是每帧5.0个事务、91字节(17 MHz时约43us总线时间)；
+ * 现在是每帧3.2个事务、32字节(约15us)。下面的上限就是改进前的基线，接收路径不能退回去。
+ */
+
+#define BASELINE_TRANSACTIONS_PER_FRAME 5
+#define BASELINE_BYTES_PER_FRAME        91
+#define FRAME_COUNT                     64
+#define BURST                           8
+
+static SPIClass spi;
+
+static void begin(ACAN2517FD & can, bool timeStamp = false) {
+  ACAN2517FDSettings settings(ACAN2517FDSettings::OSC_40MHz, 500 * 1000, DataBitRateFactor::x1);
+  settings.mRequestedMode = ACAN2517FDSettings::Normal20B;
+  settings.mControllerReceiveFIFOPayload = ACAN2517FDSettings::PAYLOAD_8;
+  settings.mControllerReceiveFIFOTimeStamp = timeStamp;
+  TEST_ASSERT_EQUAL_UINT32(0, can.begin(settings, NULL));
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// 接收一批经典帧：顺序和内容正确，每帧的事务数和字节数低于改进前的基线
+static void test_receive_burst_cost(void) {
+  Mcp2518Model model;
+  ACAN2517FD can(MCP2518_MODEL_CS, spi, 255);
+  begin(can);
+  model.pending = FRAME_COUNT;
+  model.resetCounters();
+  CANFDMessage frames[BURST];
+  uint32_t received = 0;
+  for (int i = 0; i < 100 && received < FRAME_COUNT; i++) {
+    size_t count = can.receiveBurst(frames, BURST);
+    for (size_t k = 0; k < count; k++, received++) {
+      TEST_ASSERT_EQUAL_UINT32(Mcp2518Model::frameId(received), frames[k].id);
+      TEST_ASSERT_EQUAL_UINT8(8, frames[k].len);
+      TEST_ASSERT_EQUAL_UINT8(Mcp2518Model::frameByte(received, 7), frames[k].data[7]);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, received);
+  TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, can.receivedFrameCount());
+
+  double transactions = (double) model.transactions / received;
+  double bytes = (double) model.bytes / received;
+  printf("receive: %.2f transactions/frame, %.1f bytes/frame (baseline %d, %d)\n", transactions, bytes,
+         BASELINE_TRANSACTIONS_PER_FRAME, BASELINE_BYTES_PER_FRAME);
+  TEST_ASSERT_TRUE(transactions < BASELINE_TRANSACTIONS_PER_FRAME);
+  TEST_ASSERT_TRUE(bytes < BASELINE_BYTES_PER_FRAME);
+}
+
+// 没有帧时一次轮询只读INT寄存器
+static void test_empty_poll_cost(void) {
+  Mcp2518Model model;
+  ACAN2517FD can(MCP2518_MODEL_CS, spi, 255);
+  begin(can);
+  model.resetCounters();
+  CANFDMessage frames[BURST];
+  TEST_ASSERT_EQUAL_UINT32(0, can.receiveBurst(frames, BURST));
+  TEST_ASSERT_EQUAL_UINT32(1, model.transactions);
+}
+
+// 控制器时间戳：一批中每帧的micros()保持SOF之间的间隔，最后一帧和读TBC时刻的距离与TBC的差相同
+static void test_receive_time_stamps(void) {
+  Mcp2518Model model;
+  ACAN2517FD can(MCP2518_MODEL_CS, spi, 255);
+  begin(can, true);
+  model.pending = BURST;
+  model.tbc = Mcp2518Model::frameTicks(BURST - 1) + 250;
+  mockMicros = 0xFFFFFF00;     // micros()在这一批中回绕
+  CANFDMessage frames[BURST];
+  uint32_t timestamps[BURST];
+  TEST_ASSERT_EQUAL_UINT32(BURST, can.receiveBurst(frames, BURST, timestamps));
+  for (uint32_t k = 0; k < BURST; k++) {
+    TEST_ASSERT_EQUAL_UINT32(Mcp2518Model::frameId(k), frames[k].id);
+    TEST_ASSERT_EQUAL_UINT8(Mcp2518Model::frameByte(k, 0), frames[k].data[0]);
+    if (k > 0) {
+      TEST_ASSERT_EQUAL_UINT32(100, timestamps[k] - timestamps[k - 1]);
+    }
+  }
+  // TBC在最后一帧之后250us读取，读TBC和micros()之间模拟时钟只前进几us
+  TEST_ASSERT_UINT32_WITHIN(10, 250, mockMicros - timestamps[BURST - 1]);
+}
+
+// 超过接收FIFO数据长度的帧按该长度保存：取出时不会带上调用者缓冲区中上一帧的数据
+static void test_buffer_truncates_long_frames(void) {
+  ACANFDBuffer buffer;
+  buffer.initWithSize(4, 12);  // 12字节的接收FIFO使用16字节的缓冲区
+  CANFDMessage frame;
+  frame.len = 64;
+  for (uint8_t i = 0; i < 64; i++) {
+    frame.data[i] = i;
+  }
+  TEST_ASSERT_TRUE(buffer.append(frame));
+  frame.len = 8;
+  TEST_ASSERT_TRUE(buffer.append(frame));
+  TEST_ASSERT_EQUAL_UINT32(1, buffer.truncatedCount());
+
+  CANFDMessage out;
+  memset(out.data, 0xAA, sizeof(out.data));
+  uint32_t timeStamp;
+  TEST_ASSERT_TRUE(buffer.remove(out, timeStamp));
+  TEST_ASSERT_EQUAL_UINT8(12, out.len);
+  TEST_ASSERT_EQUAL_UINT8(11, out.data[11]);
+  TEST_ASSERT_TRUE(buffer.remove(out, timeStamp));
+  TEST_ASSERT_EQUAL_UINT8(8, out.len);
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_receive_burst_cost);
+  RUN_TEST(test_empty_poll_cost);
+  RUN_TEST(test_receive_time_stamps);
+  RUN_TEST(test_buffer_truncates_long_frames);
+  return UNITY_END();
+}
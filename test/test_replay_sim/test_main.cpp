@@ -0,0 +1,173 @@
+#include <unity.h>
+#include <deque>
+#include <vector>
+#include "capture_log.h"
+#include "can_replay.h"
+
+/**
+ * CAN回放的主机模拟：用CaptureLog写一个采集日志，CanReplay从内存文件系统读出，
+ * 交给模拟的控制器发送。控制器的发送FIFO只有几个对象，按总线上每帧的时间逐个发出，
+ * 发送FIFO满时回放只能等待下一次循环重试。
+ *
+ * 采集循环每次调用一次poll()，一次循环的耗时一般为LOOP_US，每7次有一次LOOP_US + BURST_US(接收一批帧)，
+ * 可以再加上偶尔的SLOW_US长循环(重新初始化、繁忙总线上的长接收突发)；
+ * 数据消费任务每SERVICE_LOOPS次循环补充一次队列。poll()忙等时每读一次定时器推进1us。
+ *
+ * 检查所有帧都按日志中的顺序到达总线，sent等于控制器接收的帧数；
+ * 原速(日志平均约3400帧/秒，高于2000帧/秒的要求)、循环不超过CAN_REPLAY_SPIN_US + CAN_REPLAY_LATE_US时
+ * 误差都不超过50us；
+ * 有长循环时晚发的帧计入late()，误差不超过长循环减去CAN_REPLAY_SPIN_US。
+ */
+
+#define FRAME_COUNT     3000
+#define LOOP_US         40
+#define BURST_US        50         // 每7次循环有一次接收突发
+#define SLOW_US         400
+#define SLOW_LOOPS      500        // 每500次循环有一次长循环
+#define SERVICE_LOOPS   25
+#define FIFO_DEPTH      4          // FD模式下的发送FIFO对象数
+#define FRAME_BUS_US    130        // 500 kbit/s上一个8字节经典帧的时间(含填充位)
+
+static fs::FS memoryFS;
+
+// 模拟的MCP2518：只接受能写入发送FIFO的帧，FIFO中的帧按总线时间逐个发出
+class MockController {
+public:
+  std::deque<CANFDMessage> fifo;
+  std::vector<uint32_t> wire;      // 总线上出现的帧的序号(data[0..3])
+  uint64_t busyUntil = 0;
+  uint32_t accepted = 0;
+  bool driverBuffer = false;       // 回放不能把帧留在驱动的软件缓冲区
+
+  uint8_t transmitFIFOPayload() const {
+    return 64;
+  }
+
+  size_t trySendBurst(const CANFDMessage * frames, size_t count, bool driverBufferFallback) {
+    driverBuffer |= driverBufferFallback;
+    advance(mockTimer.count);          // poll()忙等期间总线也在发送
+    size_t n = 0;
+    while (n < count && fifo.size() < FIFO_DEPTH) {
+      fifo.push_back(frames[n++]);
+    }
+    accepted += n;
+    return n;
+  }
+
+  void advance(uint64_t now) {
+    while (!fifo.empty() && busyUntil <= now) {
+      uint32_t sequence;
+      memcpy(&sequence, fifo.front().data, 4);
+      wire.push_back(sequence);
+      fifo.pop_front();
+      busyUntil = max(busyUntil, now) + FRAME_BUS_US;
+    }
+  }
+};
+
+// 日志：平均约300us一帧(约3400帧/秒)，有4帧的突发和长间隔，记录时间在中间回绕
+static void writeLog(const char * path) {
+  CaptureLog log(memoryFS);
+  TEST_ASSERT_TRUE(log.start(path));
+  uint32_t timestamp = 0xFFFFFFFF - 300000;
+  for (uint32_t n = 0; n < FRAME_COUNT; n++) {
+    if (n % 200 == 0) {
+      timestamp += 5000;
+    } else if (n % 10 >= 4) {
+      timestamp += 300 + (n * 7919) % 300;
+    }
+    CANFDMessage msg;
+    msg.id = 0x100 + (n & 0xFF);
+    msg.len = 8;
+    memcpy(msg.data, &n, 4);
+    TEST_ASSERT_TRUE(log.writeCan(msg, timestamp));
+  }
+  log.stop();
+}
+
+static void run(uint32_t speed, bool slowLoops, MockController & can, CanReplay & replay) {
+  static can_replay_entry_t queue[CAN_REPLAY_QUEUE_SIZE];
+  mockTimer = {};
+  replay.begin(queue);
+  TEST_ASSERT_TRUE(replay.start("replay.bin", speed));
+  mockTimer.readUs = 1;
+  for (uint32_t loop = 0; replay.isRunning() && loop < 10000000; loop++) {
+    uint32_t loopUs = LOOP_US;
+    if (slowLoops && loop % SLOW_LOOPS == SLOW_LOOPS - 1) {
+      loopUs = SLOW_US;
+    } else if (loop % 7 == 6) {
+      loopUs += BURST_US;
+    }
+    mockAdvanceTimer(loopUs);
+    can.advance(timerRead(&mockTimer));
+    replay.poll(can);
+    if (loop % SERVICE_LOOPS == 0) {
+      replay.service();
+    }
+  }
+  TEST_ASSERT_FALSE(replay.isRunning());
+  mockTimer.readUs = 0;
+  for (uint32_t i = 0; i < 100 && !can.fifo.empty(); i++) {
+    mockAdvanceTimer(FRAME_BUS_US);
+    can.advance(timerRead(&mockTimer));
+  }
+  replay.print();
+}
+
+static void checkOrder(MockController & can, CanReplay & replay) {
+  TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, can.wire.size());
+  for (uint32_t n = 0; n < FRAME_COUNT; n++) {
+    TEST_ASSERT_EQUAL_UINT32(n, can.wire[n]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(can.accepted, replay.sent());
+  TEST_ASSERT_FALSE(can.driverBuffer);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// 原速，循环都不超过CAN_REPLAY_SPIN_US + CAN_REPLAY_LATE_US：没有超过50us的帧
+static void test_replay_1x(void) {
+  TEST_ASSERT_TRUE(LOOP_US + BURST_US <= CAN_REPLAY_SPIN_US + CAN_REPLAY_LATE_US);
+  writeLog("/replay.bin");
+  MockController can;
+  CanReplay replay(memoryFS);
+  run(1000, false, can, replay);
+  checkOrder(can, replay);
+  TEST_ASSERT_EQUAL_UINT32(0, replay.late());
+  TEST_ASSERT_TRUE(replay.maxError() <= CAN_REPLAY_LATE_US);
+}
+
+// 原速，偶尔有长循环：晚发的帧如实计入late()，误差不超过长循环减去忙等的提前量
+static void test_replay_1x_slow_loops(void) {
+  writeLog("/replay.bin");
+  MockController can;
+  CanReplay replay(memoryFS);
+  run(1000, true, can, replay);
+  checkOrder(can, replay);
+  printf("slow loops: %u of %u frames over %u us, max %u us\n", replay.late(), replay.sent(),
+         CAN_REPLAY_LATE_US, replay.maxError());
+  TEST_ASSERT_TRUE(replay.late() > 0);
+  TEST_ASSERT_TRUE(replay.late() < FRAME_COUNT / 20);
+  // 加上发送前后读定时器的2us
+  TEST_ASSERT_TRUE(replay.maxError() <= SLOW_US - CAN_REPLAY_SPIN_US + 2);
+}
+
+// 20倍速：总线跟不上，发送FIFO经常是满的，回放重试但不丢帧、不乱序
+static void test_replay_20x(void) {
+  writeLog("/replay.bin");
+  MockController can;
+  CanReplay replay(memoryFS);
+  run(20000, false, can, replay);
+  checkOrder(can, replay);
+  TEST_ASSERT_TRUE(replay.retries() > 0);
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_1x);
+  RUN_TEST(test_replay_1x_slow_loops);
+  RUN_TEST(test_replay_20x);
+  return UNITY_END();
+}
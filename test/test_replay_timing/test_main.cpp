@@ -0,0 +1,130 @@
+#include <unity.h>
+#include "replay_timing.h"
+
+/**
+ * CAN回放调度计时的主机测试：记录时间到计划发送时刻的换算(跨micros()回绕、倍速、长日志)，
+ * 以及按采集循环周期模拟调度时的误差统计
+ */
+
+#define LOOP_US     37           // 模拟的采集循环周期
+#define BURST       8            // 和CAN_REPLAY_BURST相同
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// 原速回放保持帧间隔，记录时间在日志中间回绕
+static void test_due_keeps_gaps_across_wrap(void) {
+  ReplayClock clock;
+  clock.reset(1000);
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US, clock.due(0xFFFFFF00));
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + 0x100 + 100, clock.due(100));
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + 0x100 + 350, clock.due(350));
+  // 同一时刻的突发帧计划在同一时刻发送
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + 0x100 + 350, clock.due(350));
+}
+
+// 倍速按速度缩放距第一帧的时间，不累积每帧的舍入误差
+static void test_due_speed(void) {
+  ReplayClock clock;
+  clock.reset(2000);
+  clock.due(1000);
+  for (uint32_t n = 1; n <= 1000; n++) {
+    TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + n * 333 / 2, clock.due(1000 + n * 333));
+  }
+  clock.reset(500);
+  clock.due(0);
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + 2000, clock.due(1000));
+  TEST_ASSERT_EQUAL_UINT32(500, clock.speed());
+}
+
+// 超过71分钟(32位micros()回绕一次以上)的日志，计划时刻继续单调增加
+static void test_due_long_log(void) {
+  ReplayClock clock;
+  clock.reset(1000);
+  uint32_t timestamp = 0x80000000;
+  uint64_t due = clock.due(timestamp);
+  for (uint32_t n = 1; n <= 10000; n++) {
+    timestamp += 1000000;
+    due = clock.due(timestamp);
+  }
+  TEST_ASSERT_EQUAL_UINT64(CAN_REPLAY_START_US + 10000ULL * 1000000, due);
+}
+
+// 误差按区间上限分桶，早于计划时刻的发送误差为0
+static void test_error_histogram(void) {
+  ReplayErrors errors;
+  errors.record(1000, 1000);     // 0
+  errors.record(1000, 1009);     // <10
+  errors.record(1000, 1010);     // <25
+  errors.record(1000, 1049);     // <50
+  errors.record(1000, 1051);     // <100，超过CAN_REPLAY_LATE_US
+  errors.record(1000, 1999);     // <1000
+  errors.record(1000, 3000);     // >=1000
+  errors.record(1000, 900);      // 0
+  TEST_ASSERT_EQUAL_UINT32(8, errors.count());
+  TEST_ASSERT_EQUAL_UINT32(3, errors.histogram(0));
+  TEST_ASSERT_EQUAL_UINT32(1, errors.histogram(1));
+  TEST_ASSERT_EQUAL_UINT32(1, errors.histogram(2));
+  TEST_ASSERT_EQUAL_UINT32(1, errors.histogram(3));
+  TEST_ASSERT_EQUAL_UINT32(1, errors.histogram(4));
+  TEST_ASSERT_EQUAL_UINT32(1, errors.histogram(5));
+  TEST_ASSERT_EQUAL_UINT32(3, errors.late());
+  TEST_ASSERT_EQUAL_UINT32(2000, errors.maxError());
+  TEST_ASSERT_EQUAL_UINT32((9 + 10 + 49 + 51 + 999 + 2000) / 8, errors.meanError());
+}
+
+/**
+ * 按采集循环周期模拟调度：每个周期发送所有已经到期的帧(每次最多BURST帧)，
+ * 日志中有均匀的帧、突发和长间隔，误差不超过一个循环周期，所有帧都按顺序发送
+ */
+static void test_scheduler_simulation(void) {
+  static uint64_t due[2000];
+  ReplayClock clock;
+  clock.reset(1000);
+  uint32_t timestamp = 0xFFF00000;
+  for (uint32_t n = 0; n < 2000; n++) {
+    if (n % 100 == 0) {
+      timestamp += 20000;                  // 长间隔
+    } else if (n % 10 < 4) {
+      timestamp += 0;                      // 4帧突发
+    } else {
+      timestamp += 250 + (n * 7919) % 500;
+    }
+    due[n] = clock.due(timestamp);
+    TEST_ASSERT_TRUE(n == 0 || due[n] >= due[n - 1]);
+  }
+
+  ReplayErrors errors;
+  uint32_t tail = 0;
+  for (uint64_t now = 0; tail < 2000; now += LOOP_US) {
+    uint32_t count = 0;
+    while (count < BURST && tail + count < 2000 && due[tail + count] <= now) {
+      count++;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      errors.record(due[tail + i], now);
+    }
+    tail += count;
+  }
+  printf("replay simulation: %u frames, mean %u us, max %u us\n", errors.count(), errors.meanError(),
+         errors.maxError());
+  TEST_ASSERT_EQUAL_UINT32(2000, errors.count());
+  TEST_ASSERT_TRUE(errors.maxError() < LOOP_US);
+  TEST_ASSERT_EQUAL_UINT32(0, errors.late());
+  uint32_t sum = 0;
+  for (uint8_t b = 0; b < CAN_REPLAY_HISTOGRAM; b++) {
+    sum += errors.histogram(b);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2000, sum);
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_due_keeps_gaps_across_wrap);
+  RUN_TEST(test_due_speed);
+  RUN_TEST(test_due_long_log);
+  RUN_TEST(test_error_histogram);
+  RUN_TEST(test_scheduler_simulation);
+  return UNITY_END();
+}